@@ -33,6 +33,15 @@
 #include "ReservedMemory.h"
 #include "SaveStateSaving.h"
 #include "SaveStateLoading.h"
+#include "SaveStateRam.h"
+#include "SaveStateWorkers.h"
+#include "SaveStatePageStore.h"
+#include "SaveStateLazy.h"
+#include "SaveStateDirty.h"
+#include "SaveStateSize.h"
+#include "CheckpointMetrics.h"
+#include "SaveStateCodec.h"
+#include "SaveStateStream.h"
 
 #include "TimeHolder.h"
 #include "logging.h"
@@ -61,6 +70,7 @@
 #include <stdint.h>
 #include <sys/statvfs.h>
 #include <cerrno>
+#include <inttypes.h> // PRIu64
 #ifdef __unix__
 #include <X11/Xlibint.h>
 #include <X11/Xlib-xcb.h>
@@ -103,6 +113,10 @@ static int ss_index = -1;
 static int parent_ss_index = -1;
 static int base_ss_index = -1;
 
+/* Some pages of the last loaded state could not be loaded. This is set after
+ * the memory was restored. */
+static bool restore_failed = false;
+
 /* Savestate ucontext (must be stored outside the alt stack) */
 static ucontext_t ss_ucontext;
 #if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
@@ -115,10 +129,11 @@ static _xstate ss_fpregset;
 
 static void readAllAreas();
 static int reallocateArea(Area *saved_area, Area *current_area);
-static void readAnArea(SaveStateLoading &saved_area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state);
+static void readAnArea(SaveStateLoading &saved_area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool lazy_allowed);
 static void readASavefile(SaveStateLoading &saved_state);
 
 static void writeAllAreas(bool base);
+static size_t writeAllAreasInto(SaveStateStream &pmstream, SaveStateStream &pstream, int spmfd, int index, bool base);
 static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool base);
 static size_t writeSaveFiles(SaveStateSaving &state);
 
@@ -168,29 +183,20 @@ static void resetParent()
 
 int Checkpoint::checkCheckpoint()
 {
-    /* TODO: Find another way to check for space, because mapped memory is
-     * way bigger than final savestate size. */
-    return SaveStateManager::ESTATE_OK;
-
-    /* Get an estimation of the savestate space */
-    uint64_t savestate_size = 0;
-
-#ifdef __unix__
-    ProcSelfMaps memMapLayout;
-#elif defined(__APPLE__) && defined(__MACH__)
-    MachVmMaps memMapLayout;
-#endif
+    /* Only pages written since the parent savestate are stored, unless the
+     * base savestate must be saved first */
+    bool dirty_only = false;
+    if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+        struct stat sb;
+        dirty_only = SaveStateRam::hasSlot(base_ss_index) || (stat(basepagemappath, &sb) == 0);
+    }
 
-    /* Read the first current area */
-    Area area;
-    bool not_eof = memMapLayout.getNextArea(&area);
+    /* States in RAM are moved to disk by the arena itself when needed */
+    if (SaveStateRam::isEnabled())
+        return SaveStateManager::ESTATE_OK;
 
-    while (not_eof) {
-        if (!area.skip) {
-            savestate_size += area.size;
-        }
-        not_eof = memMapLayout.getNextArea(&area);
-    }
+    /* Get an estimation of the savestate space */
+    uint64_t savestate_size = SaveStateSize::estimate(ss_index, dirty_only);
 
     /* Get the savestate directory */
     std::string savestate_str = pagemappath;
@@ -199,12 +205,26 @@ int Checkpoint::checkCheckpoint()
         savestate_str.resize(sep);
 
     struct statvfs devData;
-    int ret;
-    if ((ret = statvfs(savestate_str.c_str(), &devData)) >= 0) {
-        uint64_t available_size = static_cast<uint64_t>(devData.f_bavail) * devData.f_bsize;
-        if (savestate_size > available_size) {
-            return SaveStateManager::ESTATE_NOMEM;
-        }
+    if (statvfs(savestate_str.c_str(), &devData) < 0)
+        return SaveStateManager::ESTATE_OK;
+
+    uint64_t available_size = static_cast<uint64_t>(devData.f_bavail) * devData.f_bsize;
+
+    /* Non-incremental savestates remove the previous files of the slot before
+     * writing, instead of renaming temporary files at the end */
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
+        struct stat sb;
+        if (stat(pagemappath, &sb) == 0)
+            available_size += sb.st_blocks * 512;
+        if (stat(pagespath, &sb) == 0)
+            available_size += sb.st_blocks * 512;
+    }
+
+    SaveStateSize::setAvailable(available_size);
+
+    if (savestate_size > available_size) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "State %d needs about %" PRIu64 " bytes but only %" PRIu64 " are available", ss_index, savestate_size, available_size);
+        return SaveStateManager::ESTATE_NOMEM;
     }
 
     return SaveStateManager::ESTATE_OK;
@@ -212,6 +232,9 @@ int Checkpoint::checkCheckpoint()
 
 int Checkpoint::checkRestore()
 {
+    if (SaveStateRam::hasSlot(ss_index))
+        return SaveStateManager::ESTATE_OK;
+
     /* Check that the savestate files exist */
     struct stat sb;
     if (stat(pagemappath, &sb) == -1) {
@@ -225,11 +248,26 @@ int Checkpoint::checkRestore()
     if (pmfd == -1)
         return SaveStateManager::ESTATE_NOSTATE;
 
-    /* Read the savestate header */
-    StateHeader sh;
-    Utils::readAll(pmfd, &sh, sizeof(sh));
+    /* Read the beginning of the savestate header. Legacy savestates without
+     * magic number only used LZ4. */
+    int header[4] = {};
+    Utils::readAll(pmfd, header, sizeof(header));
     close(pmfd);
 
+    if (header[0] != StateHeader::MAGIC)
+        return SaveStateManager::ESTATE_OK;
+
+    if (header[1] > StateHeader::VERSION) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Savestate has version %d, which is newer than the supported version %d", header[1], StateHeader::VERSION);
+        return SaveStateManager::ESTATE_UNKNOWN;
+    }
+
+    int codec = header[3];
+    if (!SaveStateCodec::isSupported(codec)) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Savestate was compressed with codec %d, which is not supported by this build", codec);
+        return SaveStateManager::ESTATE_UNKNOWN;
+    }
+
     return SaveStateManager::ESTATE_OK;
 }
 
@@ -249,6 +287,10 @@ void Checkpoint::handler(int signum, siginfo_t *info, void *ucontext)
     }
 #endif
 
+    /* Memory must be fully loaded from the previous savestate before saving or
+     * loading, and the previous savestate may be overwritten */
+    SaveStateLazy::finish();
+
     if (SaveStateManager::isLoading()) {
 #ifdef __unix__
         /* Before reading from the savestate, we must keep some values from
@@ -324,7 +366,7 @@ void Checkpoint::handler(int signum, siginfo_t *info, void *ucontext)
         /* Check that base savestate exists, otherwise save it */
         if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
             struct stat sb;
-            if (stat(basepagemappath, &sb) == -1) {
+            if (!SaveStateRam::hasSlot(base_ss_index) && (stat(basepagemappath, &sb) == -1)) {
                 resetParent();
                 writeAllAreas(true);
             }
@@ -351,7 +393,7 @@ void Checkpoint::getStateHeader(StateHeader* sh)
 {
     /* Thanks to checkRestore() being called before this, savestate is garanteed 
      * to be present */
-    SaveStateLoading saved_state(pagemappath, pagespath);
+    SaveStateLoading saved_state(ss_index, pagemappath, pagespath);
     saved_state.readHeader(sh);
 }
 
@@ -363,13 +405,13 @@ static void readAllAreas()
      * file descriptors will be above a certain high value. */
     FileDescriptorManip::reserveUntilState();
     
-    SaveStateLoading saved_state(pagemappath, pagespath);
+    SaveStateLoading saved_state(ss_index, pagemappath, pagespath);
 
     int spmfd = open("/proc/self/pagemap", O_RDONLY);
     MYASSERT(spmfd != -1);
 
     int crfd = -1;
-    if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+    if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !SaveStateDirty::isEnabled()) {
         crfd = open("/proc/self/clear_refs", O_WRONLY);
         MYASSERT(crfd != -1);
     }
@@ -391,8 +433,19 @@ static void readAllAreas()
 #endif
 
     /* Load base and parent savestates */
-    SaveStateLoading parent_state(parentpagemappath, parentpagespath);
-    SaveStateLoading base_state(basepagemappath, basepagespath);
+    SaveStateLoading parent_state(parent_ss_index, parentpagemappath, parentpagespath);
+    SaveStateLoading base_state(base_ss_index, basepagemappath, basepagespath);
+
+    /* Pages are read from both the loading and base savestates, so they each
+     * get half of the worker buffers */
+    saved_state.enableParallelLoad(0, SaveStateWorkers::BUFFER_COUNT / 2);
+    base_state.enableParallelLoad(SaveStateWorkers::BUFFER_COUNT / 2, SaveStateWorkers::BUFFER_COUNT / 2);
+
+    /* Open the store of pages shared by savestates */
+    SaveStatePageStore::open(pagemappath);
+
+    /* Pages of the loading savestate may be loaded when first accessed */
+    saved_state.enableLazyLoad();
 
     /* Now that we have opened all files we need, and *before* doing the actual
      * state loading, we can clear our file descriptor reserve. If doing this
@@ -404,6 +457,7 @@ static void readAllAreas()
     bool not_eof = memMapLayout.getNextArea(&current_area);
 
     /* Reallocate areas to match the savestate areas. Nothing is written yet */
+    TimeHolder remap_time = TimeHolder::now();
     while (saved_area.isStandard() || not_eof) {
 
         /* Check for matching areas */
@@ -422,6 +476,7 @@ static void readAllAreas()
             saved_area = saved_state.nextArea();
         }
     }
+    CheckpointMetrics::addTime(SaveStateMetrics::PHASE_REMAP, remap_time);
     
     /* Now that the memory layout matches the savestate, we load savestate into memory */
     saved_state.restart();
@@ -431,32 +486,71 @@ static void readAllAreas()
     * same SaveStateLoading object to readAnArea because two SaveStateLoading objects
     * handling the same file descriptor will mess up the file offset. */
     bool same_state = (ss_index == parent_ss_index);
+
+    /* End of the previous area if it is a file mapping */
+    void* file_end = nullptr;
     while (saved_area.isStandard()) {
-        readAnArea(saved_state, spmfd, same_state?saved_state:parent_state, base_state);
+        /* Anonymous memory right after a file mapping is the .bss of a
+         * library, which may hold the state of the lazy loader (libTAS) or
+         * of functions it calls (libc), so it is never loaded lazily */
+        bool lazy_allowed = (saved_area.addr != file_end);
+        file_end = (saved_area.flags & Area::AREA_FILE) ? saved_area.endAddr : nullptr;
+
+        readAnArea(saved_state, spmfd, same_state?saved_state:parent_state, base_state, lazy_allowed);
         saved_area = saved_state.nextArea();
     }
+
+    /* From now on, the checkpoint code may access lazily loaded memory */
+    SaveStateLazy::commit();
     
     /* Before restoring savefiles, we open and close file descriptors to be in 
      * sync with when the savestate was made. */
     FileHandleList::syncFileDescriptors();
     
     /* The remaining areas are savefiles */
+    TimeHolder savefiles_time = TimeHolder::now();
     while (saved_area) {
         readASavefile(saved_state);
         saved_area = saved_state.nextArea();
     }
+    CheckpointMetrics::addTime(SaveStateMetrics::PHASE_SAVEFILES, savefiles_time);
 
     if (crfd != -1) {
         /* Clear soft-dirty bits */
         Utils::writeAll(crfd, "4\n", 2);
         close(crfd);
     }
+    else if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+        /* Track memory writes from now */
+        SaveStateDirty::reset();
+    }
 
+    SaveStatePageStore::close();
     close(spmfd);
+
+    restore_failed = saved_state.hasFailed() || parent_state.hasFailed() || base_state.hasFailed();
+    if (restore_failed)
+        LOG(LL_ERROR, LCF_CHECKPOINT, "State %d was not fully loaded, game memory may be corrupted", ss_index);
+}
+
+bool Checkpoint::hasRestoreFailed()
+{
+    return restore_failed;
 }
 
 static int reallocateArea(Area *saved_area, Area *current_area)
 {
+    /* Never deallocate the memory holding savestates or the savestate workers,
+     * even if it was created after the loading savestate */
+    if ((current_area->addr != nullptr) &&
+        (SaveStateRam::isArena(current_area->addr, current_area->size) ||
+         SaveStateWorkers::isReserved(current_area->addr, current_area->size) ||
+         SaveStatePageStore::isReserved(current_area->addr, current_area->size) ||
+         SaveStateLazy::isReserved(current_area->addr, current_area->size))) {
+        if ((!saved_area->isStandard()) || (saved_area->addr >= current_area->endAddr))
+            return 1;
+    }
+
     /* Do Areas start on the same address? */
     if ((saved_area->isStandard()) && (current_area->addr != nullptr) &&
         (saved_area->addr == current_area->addr)) {
@@ -628,7 +722,7 @@ static int reallocateArea(Area *saved_area, Area *current_area)
     return 0;
 }
 
-static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state)
+static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool lazy_allowed)
 {
     const Area& saved_area = saved_state.getArea();
 
@@ -640,6 +734,7 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
         return;
 
     saved_area.print("Restore");
+    CheckpointMetrics::beginArea(saved_area);
 
     /* Because adding write permission increases the commit charge, it can fail
      * on very large uncommitted memory (Celeste64 -> 274GB memory segment).
@@ -658,6 +753,9 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     /* Chunk of pagemap values */
     uint64_t pagemaps[512];
 
+    /* Pages written since the last checkpoint, when not using soft-dirty bits */
+    SaveStateDirty::Scanner written_pages(spmfd, saved_area.addr, saved_area.endAddr);
+
     /* Current index in the pagemaps array */
     int pagemap_i = 512;
 
@@ -666,6 +764,11 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     int pagecount_full = 0;
     int pagecount_base = 0;
     int pagecount_skip = 0;
+    int pagecount_lazy = 0;
+
+    /* Only private anonymous memory can be loaded lazily */
+    bool lazy_area = lazy_allowed && (saved_area.flags & Area::AREA_ANON) && (saved_area.flags & Area::AREA_PRIV) &&
+        ((saved_area.prot & (PROT_READ|PROT_WRITE)) == (PROT_READ|PROT_WRITE));
 
     /* Original file descriptor. Do not open the file yet, because we may not 
      * need to open it at all. */
@@ -713,16 +816,18 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
 
         /* We read pagemap flags in chunks to avoid too many read syscalls. */
         if (pagemap_i >= 512) {
+            CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_PAGEMAP);
             size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
             Utils::readAll(spmfd, pagemaps, remaining_pages*8);
             pagemap_i = 0;
         }
 
         char flag = saved_area.uncommitted ? Area::NO_PAGE : saved_state.getNextPageFlag();
+        CheckpointMetrics::addPage(flag);
 
         /* Gather the flag for the page map */
         uint64_t page = pagemaps[pagemap_i++];
-        bool soft_dirty = page & (0x1ull << 55);
+        bool soft_dirty = SaveStateDirty::isEnabled() ? written_pages.isWritten(curAddr) : (page & (0x1ull << 55));
         bool page_guard_region = page & (0x1ull << 58);
         bool page_file = page & (0x1ull << 61);
         bool page_present = page & (0x1ull << 63);
@@ -919,6 +1024,9 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
                 }
             }
         }
+        else if (lazy_area && saved_state.queueLazyPageLoad(curAddr)) {
+            pagecount_lazy++;
+        }
         else {
             pagecount_full++;
             saved_state.queuePageLoad(curAddr);
@@ -927,6 +1035,12 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     base_state.finishLoad();
     saved_state.finishLoad();
 
+    /* Register the area for lazy loading, now that other pages are written */
+    if (pagecount_lazy > 0) {
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "    Pagecount lazy: %d", pagecount_lazy);
+        SaveStateLazy::addArea(saved_area.addr, saved_area.size);
+    }
+
     if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
         LOG(LL_DEBUG, LCF_CHECKPOINT, "    Pagecount full: %d, zero/file: %d, base: %d, skipped: %d", pagecount_full, pagecount_zero_or_file, pagecount_base, pagecount_skip);
     }
@@ -955,6 +1069,8 @@ static void readASavefile(SaveStateLoading &saved_state)
 
     if (!(saved_area.flags & Area::AREA_SAVEFILE))
         return;
+
+    CheckpointMetrics::beginArea(saved_area);
     
     int ret = ftruncate(saved_area.fd, saved_area.size);
     
@@ -1005,6 +1121,7 @@ static void readASavefile(SaveStateLoading &saved_state)
         size_t page_len = (mapped_addr_end - mapped_addr_begin) > 4096 ? 4096 : (mapped_addr_end - mapped_addr_begin);
 
         char flag = saved_state.getNextPageFlag();
+        CheckpointMetrics::addPage(flag);
 
         if (flag == Area::FILE_PAGE) {
             /* Copy the original file into this file */
@@ -1047,10 +1164,52 @@ static void writeAllAreas(bool base)
     TimeHolder old_time = TimeHolder::now();
     TimeHolder new_time, delta_time;
 
-    int pmfd, pfd;
+    int index = base ? base_ss_index : ss_index;
+    const char* statepagemappath = base ? basepagemappath : pagemappath;
+    const char* statepagespath = base ? basepagespath : pagespath;
+
+    SaveStateStream pmstream, pstream;
 
     size_t savestate_size = 0;
 
+    int spmfd = open("/proc/self/pagemap", O_RDONLY);
+    MYASSERT(spmfd != -1);
+
+    int crfd = -1;
+    if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !SaveStateDirty::isEnabled()) {
+        crfd = open("/proc/self/clear_refs", O_WRONLY);
+        MYASSERT(crfd != -1);
+    }
+
+    /* Open the store of pages shared by savestates, which is also used to read
+     * pages of the parent and base savestates */
+    SaveStatePageStore::open(statepagemappath);
+
+    /* Try first to store the savestate in RAM. The state is written into a free
+     * memory window, so it does not overwrite the parent state. */
+    bool in_ram = SaveStateRam::beginSave(index, pmstream, pstream);
+
+    if (in_ram) {
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint %d in memory", index);
+
+        savestate_size = writeAllAreasInto(pmstream, pstream, spmfd, index, base);
+
+        if (pmstream.hasOverflowed() || pstream.hasOverflowed()) {
+            LOG(LL_WARN, LCF_CHECKPOINT, "State %d is too big to be stored in memory, saving it on disk", index);
+            SaveStateRam::abortSave();
+            in_ram = false;
+        }
+        else {
+            int pinned = (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) ? base_ss_index : -1;
+            SaveStateRam::commitSave(index, pinned, pmstream, pstream, statepagemappath, statepagespath);
+
+            /* The previous savestate of this slot may have used the page store */
+            SaveStatePageStore::releaseSlot(index);
+        }
+        pmstream.close();
+        pstream.close();
+    }
+
     /* Because we may overwrite our parent state, we must save on a temp file
      * and rename it at the end. Again, we must not allocate any memory, so
      * we store the strings on the stack.
@@ -1058,51 +1217,116 @@ static void writeAllAreas(bool base)
     char temppagemappath[1024];
     char temppagespath[1024];
 
-    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
-        LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", pagemappath, pagespath);
+    if (!in_ram) {
+        int pmfd, pfd;
 
-        unlink(pagemappath);
-        pmfd = creat(pagemappath, 0644);
+        if (!(Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", pagemappath, pagespath);
 
-        unlink(pagespath);
-        pfd = creat(pagespath, 0644);
-    }
-    else if (base) {
-        LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s", basepagespath);
+            unlink(pagemappath);
+            pmfd = creat(pagemappath, 0644);
 
-        pmfd = creat(basepagemappath, 0644);
-        pfd = creat(basepagespath, 0644);
-    }
-    else {
-        strcpy(temppagemappath, pagemappath);
-        strcpy(temppagespath, pagespath);
+            unlink(pagespath);
+            pfd = creat(pagespath, 0644);
+        }
+        else if (base) {
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s", basepagespath);
 
-        strncat(temppagemappath, ".temp", 1023 - strlen(temppagemappath));
-        strncat(temppagespath, ".temp", 1023 - strlen(temppagespath));
+            pmfd = creat(basepagemappath, 0644);
+            pfd = creat(basepagespath, 0644);
+        }
+        else {
+            strcpy(temppagemappath, pagemappath);
+            strcpy(temppagespath, pagespath);
 
-        LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", temppagemappath, temppagespath);
+            strncat(temppagemappath, ".temp", 1023 - strlen(temppagemappath));
+            strncat(temppagespath, ".temp", 1023 - strlen(temppagespath));
 
-        unlink(temppagemappath);
-        pmfd = creat(temppagemappath, 0644);
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", temppagemappath, temppagespath);
 
-        unlink(temppagespath);
-        pfd = creat(temppagespath, 0644);
-    }
+            unlink(temppagemappath);
+            pmfd = creat(temppagemappath, 0644);
 
-    MYASSERT(pmfd != -1)
-    MYASSERT(pfd != -1)
+            unlink(temppagespath);
+            pfd = creat(temppagespath, 0644);
+        }
 
-    int spmfd = open("/proc/self/pagemap", O_RDONLY);
-    MYASSERT(spmfd != -1);
+        MYASSERT(pmfd != -1)
+        MYASSERT(pfd != -1)
+
+        pmstream.openFd(pmfd);
+        pstream.openFd(pfd);
+
+        savestate_size = writeAllAreasInto(pmstream, pstream, spmfd, index, base);
+
+        /* Closing the savestate files */
+        pmstream.close();
+        pstream.close();
+
+        /* Rename the savestate files */
+        if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
+            rename(temppagemappath, pagemappath);
+            rename(temppagespath, pagespath);
+        }
+
+        /* The pages of the previous savestate of this slot can be released */
+        SaveStatePageStore::commitSlot(index);
+    }
+
+    SaveStatePageStore::close();
 
-    int crfd = -1;
     if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
-        crfd = open("/proc/self/clear_refs", O_WRONLY);
-        MYASSERT(crfd != -1);
+        if (crfd != -1) {
+            /* Clear soft-dirty bits */
+            Utils::writeAll(crfd, "4\n", 2);
+        }
+        else {
+            /* Track memory writes from now */
+            SaveStateDirty::reset();
+        }
+    }
+
+    if (crfd != -1) {
+        close(crfd);
+    }
+
+    close(spmfd);
+
+    new_time = TimeHolder::now();
+    delta_time = new_time - old_time;
+    /* Compare with the estimation. Base savestates are counted with the
+     * savestate that follows them */
+    SaveStateSize::addSaved(savestate_size, !base);
+    if (!base)
+        CheckpointMetrics::setSize(savestate_size);
+
+    LOG(LL_INFO, LCF_CHECKPOINT, "Saved state %d of size %zu in %f seconds", base?0:ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+
+    if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK) {
+        /* Store that we are the child, so that destructors may act differently */
+        ThreadManager::setChildFork();
+
+        /* Return the savestate index as status code */
+        _exit(base?0:ss_index);
     }
+}
+
+/* Write the whole savestate into the pagemap and pages streams. Returns the
+ * size of the savestate in bytes */
+static size_t writeAllAreasInto(SaveStateStream &pmstream, SaveStateStream &pstream, int spmfd, int index, bool base)
+{
+    size_t savestate_size = 0;
+
+    SaveStateSaving state(pmstream, pstream, spmfd, index);
 
     /* Saving the savestate header */
     StateHeader sh;
+    sh.magic = StateHeader::MAGIC;
+    sh.version = StateHeader::VERSION;
+    sh.flags = 0;
+    if (state.hasIndependentBlocks())
+        sh.flags |= StateHeader::INDEPENDENT_BLOCKS;
+    sh.codec = state.getCodec();
     int n=0;
     for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
         if (thread->state == ThreadInfo::ST_SUSPENDED) {
@@ -1116,13 +1340,12 @@ static void writeAllAreas(bool base)
         }
     }
     sh.thread_count = n;
-    Utils::writeAll(pmfd, &sh, sizeof(sh));
+    pmstream.write(&sh, sizeof(sh));
     savestate_size += sizeof(sh);
 
     /* Load the parent savestate if any. */
-    SaveStateSaving state(pmfd, pfd, spmfd);
-    SaveStateLoading parent_state(parentpagemappath, parentpagespath);
-    SaveStateLoading base_state(basepagemappath, basepagespath);
+    SaveStateLoading parent_state(parent_ss_index, parentpagemappath, parentpagespath);
+    SaveStateLoading base_state(base_ss_index, basepagemappath, basepagespath);
 
     /* Read the memory mapping */
 #ifdef __unix__
@@ -1154,46 +1377,18 @@ static void writeAllAreas(bool base)
         not_eof = memMapLayout.getNextArea(&area);
     }
 
-    savestate_size += writeSaveFiles(state);
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_SAVEFILES);
+        savestate_size += writeSaveFiles(state);
+    }
 
     /* Add the last null (eof) area */
     area.addr = nullptr; // End of data
     area.size = 0; // End of data
-    Utils::writeAll(pmfd, &area, sizeof(area));
+    pmstream.write(&area, sizeof(area));
     savestate_size += sizeof(area);
 
-    if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
-        /* Clear soft-dirty bits */
-        Utils::writeAll(crfd, "4\n", 2);
-    }
-
-    if (crfd != 1) {
-        close(crfd);
-    }
-
-    close(spmfd);
-
-    /* Closing the savestate files */
-    close(pmfd);
-    close(pfd);
-
-    /* Rename the savestate files */
-    if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
-        rename(temppagemappath, pagemappath);
-        rename(temppagespath, pagespath);
-    }
-
-    new_time = TimeHolder::now();
-    delta_time = new_time - old_time;
-    LOG(LL_INFO, LCF_CHECKPOINT, "Saved state %d of size %zu in %f seconds", base?0:ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
-
-    if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK) {
-        /* Store that we are the child, so that destructors may act differently */
-        ThreadManager::setChildFork();
-
-        /* Return the savestate index as status code */
-        _exit(base?0:ss_index);
-    }
+    return savestate_size;
 }
 
 /* Write a memory area into the savestate. Returns the size of the area in bytes */
@@ -1220,6 +1415,9 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
     /* Chunk of pagemap values */
     uint64_t pagemaps[512];
 
+    /* Pages written since the last checkpoint, when not using soft-dirty bits */
+    SaveStateDirty::Scanner written_pages(spmfd, area.addr, area.endAddr);
+
     /* Current index in the pagemaps array */
     int pagemap_i = 512;
 
@@ -1272,6 +1470,7 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
 
         /* We read pagemap flags in chunks to avoid too many read syscalls. */
         if (pagemap_i >= 512) {
+            CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_PAGEMAP);
             size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
             Utils::readAll(spmfd, pagemaps, remaining_pages*8);
             pagemap_i = 0;
@@ -1279,7 +1478,7 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
 
         /* Gather the flag for the current pagemap. */
         uint64_t page = pagemaps[pagemap_i++];
-        bool soft_dirty = page & (0x1ull << 55);
+        bool soft_dirty = SaveStateDirty::isEnabled() ? written_pages.isWritten(curAddr) : (page & (0x1ull << 55));
         bool page_guard_region = page & (0x1ull << 58);
         bool page_file = page & (0x1ull << 61);
         bool page_present = page & (0x1ull << 63);
@@ -1386,7 +1585,8 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
             /* Copy the value of the parent savestate if any */
             if (parent_state) {
                 char parent_flag = parent_state.getPageFlag(curAddr);
-                if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) || (parent_flag == Area::COMPRESSED_PAGE)) {
+                if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) ||
+                    (parent_flag == Area::COMPRESSED_PAGE) || (parent_flag == Area::STORED_PAGE)) {
                     /* Parent does not have the page or parent stores the memory page,
                      * saving the full page. */
 
@@ -1412,7 +1612,7 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
                     if (Global::shared_config.logging_level >= LL_DEBUG) {
                         char base_flag = base_state.getPageFlag(curAddr);
                         
-                        if ((base_flag != Area::FULL_PAGE) && (base_flag != Area::COMPRESSED_PAGE)) {
+                        if ((base_flag != Area::FULL_PAGE) && (base_flag != Area::COMPRESSED_PAGE) && (base_flag != Area::STORED_PAGE)) {
                             LOG(LL_WARN, LCF_CHECKPOINT, "     No base page for %p, this should not happen!", curAddr);
                         }
 
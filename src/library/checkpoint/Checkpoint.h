@@ -42,6 +42,9 @@ namespace Checkpoint
     void getStateHeader(StateHeader* sh);
     int checkCheckpoint();
     int checkRestore();
+
+    /* Returns if some pages of the last loaded state could not be loaded */
+    bool hasRestoreFailed();
     void handler(int signum, siginfo_t *info, void *ucontext);
 }
 }
@@ -0,0 +1,151 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CheckpointMetrics.h"
+#include "ReservedMemory.h"
+#include "MemArea.h"
+
+#include "../shared/sockethelpers.h"
+
+#include <cstring>
+#include <cstddef> // offsetof
+
+namespace libtas {
+
+static CheckpointMetrics::Storage* getStorage()
+{
+    return static_cast<CheckpointMetrics::Storage*>(ReservedMemory::getAddr(ReservedMemory::METRICS_ADDR));
+}
+
+void CheckpointMetrics::begin(int slot, bool loading)
+{
+    Storage* storage = getStorage();
+    memset(&storage->metrics, 0, offsetof(SaveStateMetrics, areas));
+    storage->metrics.slot = slot;
+    storage->metrics.loading = loading;
+    storage->area_i = -1;
+    storage->start_time = TimeHolder::now();
+    storage->recording = true;
+}
+
+void CheckpointMetrics::end()
+{
+    Storage* storage = getStorage();
+    if (!storage->recording)
+        return;
+
+    addTime(SaveStateMetrics::PHASE_TOTAL, storage->start_time);
+    storage->recording = false;
+}
+
+void CheckpointMetrics::addTime(int phase, const TimeHolder& start)
+{
+    Storage* storage = getStorage();
+    if (!storage->recording)
+        return;
+
+    TimeHolder delta = TimeHolder::now() - start;
+    storage->metrics.phase_ns[phase] += delta.tv_sec * 1000000000ull + delta.tv_nsec;
+}
+
+CheckpointMetrics::Timer::Timer(int p) : phase(p), start(TimeHolder::now()) {}
+
+CheckpointMetrics::Timer::~Timer()
+{
+    addTime(phase, start);
+}
+
+void CheckpointMetrics::beginArea(const Area& area)
+{
+    Storage* storage = getStorage();
+    if (!storage->recording)
+        return;
+
+    SaveStateMetrics& metrics = storage->metrics;
+
+    /* Only areas with pages are recorded */
+    if (area.skip || area.uncommitted || (metrics.area_count >= SaveStateMetrics::AREA_COUNT)) {
+        storage->area_i = -1;
+        return;
+    }
+    storage->area_i = metrics.area_count++;
+
+    SaveStateMetrics::AreaMetrics& area_metrics = metrics.areas[storage->area_i];
+    area_metrics.addr = reinterpret_cast<uintptr_t>(area.addr);
+    area_metrics.size = area.size;
+    strncpy(area_metrics.name, area.name, SaveStateMetrics::AREA_NAME_SIZE - 1);
+    area_metrics.name[SaveStateMetrics::AREA_NAME_SIZE - 1] = '\0';
+    area_metrics.padding = 0;
+    memset(area_metrics.pages, 0, sizeof(area_metrics.pages));
+}
+
+void CheckpointMetrics::addPage(char flag)
+{
+    Storage* storage = getStorage();
+    if (!storage->recording)
+        return;
+
+    int type;
+    switch (flag) {
+        case Area::FULL_PAGE:
+            type = SaveStateMetrics::PAGE_FULL;
+            break;
+        case Area::COMPRESSED_PAGE:
+            type = SaveStateMetrics::PAGE_COMPRESSED;
+            break;
+        case Area::STORED_PAGE:
+            type = SaveStateMetrics::PAGE_STORED;
+            break;
+        case Area::ZERO_PAGE:
+            type = SaveStateMetrics::PAGE_ZERO;
+            break;
+        case Area::FILE_PAGE:
+            type = SaveStateMetrics::PAGE_FILE;
+            break;
+        case Area::BASE_PAGE:
+            type = SaveStateMetrics::PAGE_BASE;
+            break;
+        default:
+            type = SaveStateMetrics::PAGE_NONE;
+            break;
+    }
+
+    storage->metrics.pages[type]++;
+
+    if (storage->area_i >= 0)
+        storage->metrics.areas[storage->area_i].pages[type]++;
+}
+
+void CheckpointMetrics::setSize(uint64_t size)
+{
+    Storage* storage = getStorage();
+    if (!storage->recording)
+        return;
+
+    storage->metrics.size = size;
+}
+
+void CheckpointMetrics::send()
+{
+    SaveStateMetrics& metrics = getStorage()->metrics;
+    sendData(&metrics, offsetof(SaveStateMetrics, areas));
+    sendData(metrics.areas, metrics.area_count * sizeof(SaveStateMetrics::AreaMetrics));
+}
+
+}
@@ -0,0 +1,84 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_CHECKPOINTMETRICS_H
+#define LIBTAS_CHECKPOINTMETRICS_H
+
+#include "TimeHolder.h"
+#include "../shared/SaveStateMetrics.h"
+
+#include <cstdint>
+
+namespace libtas {
+
+struct Area;
+
+/* Collection of timings and page counts of a savestate saving or loading.
+ * Metrics are stored inside the reserved memory, so that they are kept when
+ * loading a savestate. They are only collected by the checkpoint thread,
+ * between begin() and end(). */
+namespace CheckpointMetrics {
+
+    /* Storage of the metrics inside the reserved memory */
+    struct Storage {
+        SaveStateMetrics metrics;
+        TimeHolder start_time;
+        bool recording;
+
+        /* Index of the current area in the metrics, or -1 if the area is not
+         * recorded */
+        int area_i;
+    };
+
+    /* Reset the metrics and start collecting them */
+    void begin(int slot, bool loading);
+
+    /* Stop collecting metrics and compute the total duration */
+    void end();
+
+    /* Add the time elapsed since `start` to a phase */
+    void addTime(int phase, const TimeHolder& start);
+
+    /* Measure the time spent in a phase inside a scope */
+    class Timer
+    {
+    public:
+        Timer(int phase);
+        ~Timer();
+
+    private:
+        int phase;
+        TimeHolder start;
+    };
+
+    /* Start counting the pages of a memory area */
+    void beginArea(const Area& area);
+
+    /* Count a page with its savestate flag */
+    void addPage(char flag);
+
+    /* Set the size of the savestate in bytes */
+    void setSize(uint64_t size);
+
+    /* Send the metrics to the program */
+    void send();
+}
+}
+
+#endif
@@ -21,6 +21,11 @@
 
 #include "MemArea.h"
 #include "ReservedMemory.h"
+#include "SaveStateRam.h"
+#include "SaveStateWorkers.h"
+#include "SaveStatePageStore.h"
+#include "SaveStateLazy.h"
+#include "../shared/sockethelpers.h"
 
 #include "fileio/FileHandleList.h"
 #include "logging.h"
@@ -103,6 +108,32 @@ bool Area::isSkipped() const
         return true;
     }
 
+    /* Don't save the savestates stored in RAM */
+    if (SaveStateRam::isArena(addr, size)) {
+        return true;
+    }
+
+    /* Don't save the stacks and buffers of savestate workers */
+    if (SaveStateWorkers::isReserved(addr, size)) {
+        return true;
+    }
+
+    /* Don't save the index of the savestate page store */
+    if (SaveStatePageStore::isReserved(addr, size)) {
+        return true;
+    }
+
+    /* Don't save the lazy loading thread and tables */
+    if (SaveStateLazy::isReserved(addr, size)) {
+        return true;
+    }
+
+    /* Don't save the buffers and shared memory used to communicate with
+     * the program */
+    if (isSocketMemory(addr, size)) {
+        return true;
+    }
+
     /* Don't save area that cannot be promoted to read/write */
     if ((max_prot & (PROT_WRITE|PROT_READ)) != (PROT_WRITE|PROT_READ)) {
         return true;
@@ -53,6 +53,7 @@ struct Area {
         COMPRESSED_PAGE, /* Full page but compressed */
         FILE_PAGE, /* Page is identical to the original mapped file */
         GUARD_PAGE, /* A page causing a fatal signal on access, without a VMA backing it */
+        STORED_PAGE, /* Page is stored in the page store shared by all savestates */
     };
 
     void* addr;
@@ -25,6 +25,7 @@
 #include "Utils.h"
 #include "GlobalState.h"
 #include "MemArea.h"
+#include "CheckpointMetrics.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -35,6 +36,8 @@ namespace libtas {
 
 ProcSelfMaps::ProcSelfMaps() : off(0)
 {
+    CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_MAPS);
+
     /* We need to copy /proc/self/maps, because it can be modified while parsing it */
     int fd;
     NATIVECALL(fd = open("/proc/self/maps", O_RDONLY));
@@ -102,6 +105,8 @@ uintptr_t ProcSelfMaps::readHex()
 
 bool ProcSelfMaps::getNextArea(Area *area)
 {
+    CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_MAPS);
+
     ssize_t ret = pread(tmp_fd, line, Area::FILENAMESIZE, off);
     if (ret < 1) {
         area->addr = nullptr;
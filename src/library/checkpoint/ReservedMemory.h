@@ -23,6 +23,8 @@
 #define LIBTAS_RESERVEDMEMORY_H
 
 #include "StateHeader.h"
+#include "CheckpointMetrics.h"
+#include "SaveStateSize.h"
 
 #include <cstdint> // intptr_t
 #include <cstddef> // size_t
@@ -36,13 +38,17 @@ namespace ReservedMemory {
         STACK_SIZE = 5 * ONE_MB,
         SS_SLOTS_SIZE = 11*sizeof(bool),
         SH_SIZE = sizeof(StateHeader),
+        METRICS_SIZE = sizeof(CheckpointMetrics::Storage),
+        SIZE_ESTIMATE_SIZE = sizeof(SaveStateSize::Storage),
     };
     enum Addresses {
         COMPRESSED_ADDR = 0,
         STACK_ADDR = COMPRESSED_ADDR + COMPRESSED_SIZE,
         SS_SLOTS_ADDR = STACK_ADDR + STACK_SIZE,
         SH_ADDR = SS_SLOTS_ADDR + SS_SLOTS_SIZE,
-        RESTORE_TOTAL_SIZE = SH_ADDR + SH_SIZE,
+        METRICS_ADDR = ((SH_ADDR + SH_SIZE + 63) / 64) * 64,
+        SIZE_ESTIMATE_ADDR = ((METRICS_ADDR + METRICS_SIZE + 63) / 64) * 64,
+        RESTORE_TOTAL_SIZE = SIZE_ESTIMATE_ADDR + SIZE_ESTIMATE_SIZE,
     };
 
     void init();
@@ -0,0 +1,150 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "SaveStateCodec.h"
+#include "SaveStateWorkers.h"
+
+#include "logging.h"
+#include "global.h"
+#include "../external/lz4.h"
+
+/* The 32-bit library may be built without zstd */
+#ifdef LIBTAS_LIB32_NO_ZSTD
+#undef LIBTAS_HAS_ZSTD
+#endif
+
+#ifdef LIBTAS_HAS_ZSTD
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#endif
+
+namespace libtas {
+
+#ifdef LIBTAS_HAS_ZSTD
+/* The workspace is split between the compression context and the
+ * decompression context */
+static const size_t ZSTD_CCTX_SIZE = 3 * (SaveStateWorkers::WORKSPACE_SIZE / 4);
+static const size_t ZSTD_DCTX_SIZE = SaveStateWorkers::WORKSPACE_SIZE / 4;
+
+static_assert(ZSTD_COMPRESSBOUND(4096) <= SaveStateCodec::PAGE_BOUND, "Compressed page bound is too small");
+#endif
+static_assert(LZ4_COMPRESSBOUND(4096) <= SaveStateCodec::PAGE_BOUND, "Compressed page bound is too small");
+
+bool SaveStateCodec::isSupported(int codec)
+{
+    switch (codec) {
+        case SharedConfig::SS_CODEC_LZ4:
+            return true;
+#ifdef LIBTAS_HAS_ZSTD
+        case SharedConfig::SS_CODEC_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+SaveStateCodec::Compressor SaveStateCodec::Compressor::forSlot(int slot, char* workspace)
+{
+    if ((slot >= 0) && (Global::shared_config.savestate_alt_codec_slots & (1 << slot)))
+        return Compressor(Global::shared_config.savestate_alt_codec, Global::shared_config.savestate_alt_codec_level, workspace);
+
+    return Compressor(Global::shared_config.savestate_codec, Global::shared_config.savestate_codec_level, workspace);
+}
+
+SaveStateCodec::Compressor::Compressor(int c, int l, char* workspace) : codec(c), level(l), context(nullptr)
+{
+#ifdef LIBTAS_HAS_ZSTD
+    if ((codec == SharedConfig::SS_CODEC_ZSTD) && workspace) {
+        if (level > ZSTD_maxCLevel())
+            level = ZSTD_maxCLevel();
+
+        /* Lower the level until the context fits inside the workspace. Pages
+         * are small, so this should never happen in practice. */
+        while ((level > 1) && (ZSTD_estimateCCtxSize_usingCParams(ZSTD_getCParams(level, 4096, 0)) > ZSTD_CCTX_SIZE))
+            level--;
+
+        context = ZSTD_initStaticCCtx(workspace, ZSTD_CCTX_SIZE);
+    }
+#else
+    (void) workspace;
+#endif
+
+    if ((codec != SharedConfig::SS_CODEC_LZ4) && !context) {
+        /* A compressor is built for each savestate, so only warn once for
+         * each codec (e.g. zstd is never available on 32-bit games, which
+         * don't have the workspace) */
+        static int warned_codec = SharedConfig::SS_CODEC_LZ4;
+        if (codec != warned_codec) {
+            LOG(LL_WARN, LCF_CHECKPOINT, "Savestate codec %d is not available, using LZ4", codec);
+            warned_codec = codec;
+        }
+        codec = SharedConfig::SS_CODEC_LZ4;
+        level = 1;
+    }
+
+    if ((codec == SharedConfig::SS_CODEC_LZ4) && (level < 1))
+        level = 1;
+}
+
+int SaveStateCodec::Compressor::compressPage(const char* src, char* dst, int capacity)
+{
+#ifdef LIBTAS_HAS_ZSTD
+    if (codec == SharedConfig::SS_CODEC_ZSTD) {
+        size_t size = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(context), dst, capacity, src, 4096, level);
+        if (ZSTD_isError(size))
+            return 0;
+        return static_cast<int>(size);
+    }
+#endif
+
+    return LZ4_compress_fast(src, dst, 4096, capacity, level);
+}
+
+SaveStateCodec::Decompressor::Decompressor() : codec(SharedConfig::SS_CODEC_LZ4), context(nullptr) {}
+
+SaveStateCodec::Decompressor::Decompressor(int c, char* workspace) : codec(c), context(nullptr)
+{
+#ifdef LIBTAS_HAS_ZSTD
+    if ((codec == SharedConfig::SS_CODEC_ZSTD) && workspace) {
+        context = ZSTD_initStaticDCtx(workspace + ZSTD_CCTX_SIZE, ZSTD_DCTX_SIZE);
+    }
+#else
+    (void) workspace;
+#endif
+}
+
+bool SaveStateCodec::Decompressor::decompressPage(const char* src, int length, char* dst)
+{
+    switch (codec) {
+        case SharedConfig::SS_CODEC_LZ4:
+            return LZ4_decompress_safe(src, dst, length, 4096) == 4096;
+#ifdef LIBTAS_HAS_ZSTD
+        case SharedConfig::SS_CODEC_ZSTD:
+            if (!context)
+                return false;
+            return ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(context), dst, 4096, src, length) == 4096;
+#endif
+        default:
+            return false;
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATECODEC_H
+#define LIBTAS_SAVESTATECODEC_H
+
+namespace libtas {
+
+/* Compression of individual memory pages with one of the codecs of
+ * `SharedConfig::SaveStateCodec`. Codec contexts are stored inside a workspace
+ * of `SaveStateWorkers::WORKSPACE_SIZE` bytes given by the caller, so that no
+ * memory is allocated during checkpoints. */
+namespace SaveStateCodec {
+
+    enum {
+        /* Maximum size of a compressed page for all codecs */
+        PAGE_BOUND = 4096 + 128,
+    };
+
+    /* Returns if libTAS was built with the codec */
+    bool isSupported(int codec);
+
+    class Compressor
+    {
+    public:
+        /* Use `codec` at `level`, or LZ4 if the codec is not supported. */
+        Compressor(int codec, int level, char* workspace);
+
+        /* Use the codec and level configured for the savestate `slot` */
+        static Compressor forSlot(int slot, char* workspace);
+
+        /* Codec and level that are actually used */
+        int getCodec() const {return codec;}
+        int getLevel() const {return level;}
+
+        /* Compress a page independently of other pages. Returns the
+         * compressed size, or 0 if the page could not be compressed. */
+        int compressPage(const char* src, char* dst, int capacity);
+
+    private:
+        int codec;
+        int level;
+        void* context;
+    };
+
+    class Decompressor
+    {
+    public:
+        /* Default to LZ4 */
+        Decompressor();
+        Decompressor(int codec, char* workspace);
+
+        /* Decompress a page that was compressed independently. Returns false
+         * on error. */
+        bool decompressPage(const char* src, int length, char* dst);
+
+    private:
+        int codec;
+        void* context;
+    };
+}
+}
+
+#endif
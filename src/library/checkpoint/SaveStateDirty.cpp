@@ -0,0 +1,222 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateDirty.h"
+#include "MemArea.h"
+#ifdef __unix__
+#include "ProcSelfMaps.h"
+#endif
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#endif
+
+/* Definitions from recent kernel headers */
+#ifdef __linux__
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1<<13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1<<15)
+#endif
+#ifndef PAGEMAP_SCAN
+struct pm_scan_arg {
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#define PAGE_IS_WRITTEN (1 << 1)
+#endif
+#endif
+
+namespace libtas {
+
+static int uffd = -1;
+
+void SaveStateDirty::init()
+{
+#if defined(__linux__) && defined(__NR_userfaultfd)
+    if (uffd != -1)
+        return;
+
+    if (Global::shared_config.savestate_dirty_tracking != SharedConfig::DIRTY_UFFD_WP)
+        return;
+
+    /* Write faults are resolved by the kernel, so we don't need to read any
+     * event, and user-mode only is enough */
+    NATIVECALL(uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+    if (uffd == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create userfaultfd object, using soft-dirty bits to track memory writes");
+        return;
+    }
+
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    int ret;
+    NATIVECALL(ret = ioctl(uffd, UFFDIO_API, &api));
+    if (ret == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Asynchronous write-protect is not supported (requires Linux 6.7), using soft-dirty bits to track memory writes");
+        NATIVECALL(close(uffd));
+        uffd = -1;
+        return;
+    }
+
+    /* Check that PAGEMAP_SCAN is supported with a scan of our own variable */
+    int spmfd;
+    NATIVECALL(spmfd = open("/proc/self/pagemap", O_RDONLY));
+    if (spmfd != -1) {
+        uintptr_t page = reinterpret_cast<uintptr_t>(&uffd) & ~static_cast<uintptr_t>(4095);
+        struct pm_scan_arg arg = {};
+        arg.size = sizeof(arg);
+        arg.start = page;
+        arg.end = page + 4096;
+        arg.category_mask = PAGE_IS_WRITTEN;
+        arg.return_mask = PAGE_IS_WRITTEN;
+        NATIVECALL(ret = ioctl(spmfd, PAGEMAP_SCAN, &arg));
+        NATIVECALL(close(spmfd));
+    }
+
+    if ((spmfd == -1) || (ret == -1)) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "PAGEMAP_SCAN is not supported (requires Linux 6.7), using soft-dirty bits to track memory writes");
+        NATIVECALL(close(uffd));
+        uffd = -1;
+        return;
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Memory writes are tracked using userfaultfd");
+#endif
+}
+
+bool SaveStateDirty::isEnabled()
+{
+    return uffd != -1;
+}
+
+void SaveStateDirty::reset()
+{
+#if defined(__linux__) && defined(__NR_userfaultfd)
+    if (uffd == -1)
+        return;
+
+    ProcSelfMaps memMapLayout;
+    Area area;
+    while (memMapLayout.getNextArea(&area)) {
+        if (area.skip || !(area.prot & PROT_WRITE) || !(area.flags & Area::AREA_PRIV))
+            continue;
+
+        /* Registering an area that is already registered only updates its
+         * mode. Areas that cannot be registered (e.g. file mappings on some
+         * kernels) report all their present pages as written. */
+        struct uffdio_register reg;
+        reg.range.start = reinterpret_cast<uintptr_t>(area.addr);
+        reg.range.len = area.size;
+        reg.mode = UFFDIO_REGISTER_MODE_WP;
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0)
+            continue;
+
+        struct uffdio_writeprotect wp;
+        wp.range.start = reinterpret_cast<uintptr_t>(area.addr);
+        wp.range.len = area.size;
+        wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+        if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) != 0) {
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Could not write-protect area %p", area.addr);
+        }
+    }
+#endif
+}
+
+SaveStateDirty::Scanner::Scanner(int spmfd, void* start, void* e)
+{
+    fd = spmfd;
+    end = static_cast<char*>(e);
+    region_count = 0;
+    region_i = 0;
+    walk_end = static_cast<char*>(start);
+}
+
+void SaveStateDirty::Scanner::fetch(char* addr)
+{
+    region_count = 0;
+    region_i = 0;
+    walk_end = end;
+
+#ifdef __linux__
+    struct pm_scan_arg arg = {};
+    arg.size = sizeof(arg);
+    arg.start = reinterpret_cast<uintptr_t>(addr);
+    arg.end = reinterpret_cast<uintptr_t>(end);
+    arg.vec = reinterpret_cast<uintptr_t>(regions);
+    arg.vec_len = REGION_COUNT;
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN;
+
+    int ret = ioctl(fd, PAGEMAP_SCAN, &arg);
+    if (ret < 0) {
+        /* Consider the whole remaining area as written */
+        regions[0].start = arg.start;
+        regions[0].end = arg.end;
+        region_count = 1;
+        return;
+    }
+
+    region_count = ret;
+    walk_end = reinterpret_cast<char*>(arg.walk_end);
+#endif
+}
+
+bool SaveStateDirty::Scanner::isWritten(char* addr)
+{
+    while (true) {
+        while ((region_i < region_count) && (reinterpret_cast<uintptr_t>(addr) >= regions[region_i].end))
+            region_i++;
+
+        if (region_i < region_count)
+            return reinterpret_cast<uintptr_t>(addr) >= regions[region_i].start;
+
+        /* All gathered ranges are before the address. Pages before the end of
+         * the walk were not written. */
+        if ((addr < walk_end) || (walk_end >= end))
+            return false;
+
+        fetch(addr);
+    }
+}
+
+}
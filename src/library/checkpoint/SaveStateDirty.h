@@ -0,0 +1,82 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEDIRTY_H
+#define LIBTAS_SAVESTATEDIRTY_H
+
+#include <cstdint>
+
+namespace libtas {
+
+/* Tracking of memory pages written since the last checkpoint, used by
+ * incremental savestates instead of the soft-dirty bit. Writable private areas
+ * are registered to userfaultfd in asynchronous write-protect mode, so that
+ * the kernel resolves write faults by itself, and written pages are gathered
+ * with the PAGEMAP_SCAN ioctl (Linux 6.7 or later). */
+namespace SaveStateDirty {
+
+    /* Create the userfaultfd object if this tracking is selected */
+    void init();
+
+    /* Returns if written pages are tracked with userfaultfd instead of the
+     * soft-dirty bit */
+    bool isEnabled();
+
+    /* Write-protect all writable private areas, so that following writes are
+     * tracked. This replaces clearing soft-dirty bits. */
+    void reset();
+
+    /* Iterate over the written pages of a memory area, using the file
+     * descriptor of /proc/self/pagemap */
+    class Scanner
+    {
+    public:
+        Scanner(int spmfd, void* start, void* end);
+
+        /* Returns if the page at `addr` was written since the last reset.
+         * Addresses must be increasing. */
+        bool isWritten(char* addr);
+
+    private:
+        /* Gather the next written ranges, starting at `addr` */
+        void fetch(char* addr);
+
+        enum {
+            REGION_COUNT = 256,
+        };
+
+        /* Same layout as the kernel `struct page_region` */
+        struct Region {
+            uint64_t start;
+            uint64_t end;
+            uint64_t categories;
+        };
+
+        Region regions[REGION_COUNT];
+        int region_count;
+        int region_i;
+
+        int fd;
+        char* walk_end;
+        char* end;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,547 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateLazy.h"
+#include "SaveStateDirty.h"
+#include "SaveStateStream.h"
+#include "SaveStateCodec.h"
+#include "SaveStateWorkers.h"
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/userfaultfd.h>
+#endif
+
+namespace libtas {
+
+namespace {
+
+enum {
+    MAX_PAGES = 1 << 22,
+    MAX_AREAS = 1 << 14,
+    THREAD_STACK_SIZE = 1024 * 1024,
+    /* Number of pages loaded in the background between two checks for
+     * page faults */
+    PREFETCH_BATCH = 64,
+};
+
+enum LazyState {
+    ST_IDLE, /* No page is waiting to be loaded */
+    ST_FILLING, /* A savestate is being loaded, and pages are gathered */
+    ST_ACTIVE, /* Pages are loaded by the thread */
+};
+
+struct LazyPage {
+    char* addr;
+    off_t offset;
+    int length;
+    bool loaded;
+};
+
+struct LazyArea {
+    void* addr;
+    size_t size;
+};
+
+struct LazyHeader {
+    std::atomic<int> state;
+    SaveStateStream source;
+    int codec;
+    int page_count;
+    int area_count;
+    /* First page of the area being filled */
+    int area_first_page;
+    /* Next page to be loaded in the background */
+    int prefetch_page;
+    /* Statistics of the last lazy load, because the thread cannot log */
+    int fault_count;
+    int error_count;
+    bool reported;
+};
+
+}
+
+static char* segment_addr = nullptr;
+static size_t segment_size = 0;
+static LazyHeader* header = nullptr;
+static LazyPage* pages = nullptr;
+static LazyArea* areas = nullptr;
+static char* page_buffer = nullptr;
+static char* compressed_buffer = nullptr;
+static char* workspace = nullptr;
+static int uffd = -1;
+static pid_t thread_pid = 0;
+
+static size_t roundPage(size_t size)
+{
+    return ((size + 4095) / 4096) * 4096;
+}
+
+#ifdef __linux__
+/* Returns if the range holds one of the variables above, which the loading
+ * thread reads */
+static bool overlapsLoader(void* addr, size_t size)
+{
+    const void* statics[] = {&segment_addr, &segment_size, &header, &pages, &areas,
+        &page_buffer, &compressed_buffer, &workspace, &uffd, &thread_pid};
+
+    char* begin = static_cast<char*>(addr);
+    char* end = begin + size;
+    for (const void* s : statics) {
+        const char* c = static_cast<const char*>(s);
+        if ((c >= begin) && (c < end))
+            return true;
+    }
+    return (segment_addr < end) && (begin < (segment_addr + segment_size));
+}
+
+static void futexWait(std::atomic<int>* word, int value)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+static void futexWake(std::atomic<int>* word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/* Read the content of a page into `dst`. Returns false on error */
+static bool readPage(const LazyPage& page, char* dst, SaveStateCodec::Decompressor& decompressor)
+{
+    if (page.length == 4096)
+        return header->source.readAt(dst, 4096, page.offset) == 4096;
+
+    if (header->source.readAt(compressed_buffer, page.length, page.offset) != static_cast<size_t>(page.length))
+        return false;
+
+    return decompressor.decompressPage(compressed_buffer, page.length, dst);
+}
+
+static void wakeRange(char* addr)
+{
+    struct uffdio_range range;
+    range.start = reinterpret_cast<uintptr_t>(addr);
+    range.len = 4096;
+    NATIVECALL(ioctl(uffd, UFFDIO_WAKE, &range));
+}
+
+static void copyPage(LazyPage& page, SaveStateCodec::Decompressor& decompressor)
+{
+    if (page.loaded)
+        return;
+    page.loaded = true;
+
+    struct uffdio_copy copy;
+    copy.dst = reinterpret_cast<uintptr_t>(page.addr);
+    copy.src = reinterpret_cast<uintptr_t>(page_buffer);
+    copy.len = 4096;
+    copy.mode = 0;
+    copy.copy = 0;
+
+    if (!readPage(page, page_buffer, decompressor)) {
+        /* The page content is lost, but the faulting thread must not stay
+         * blocked forever */
+        header->error_count++;
+        memset(page_buffer, 0, 4096);
+    }
+
+    while (true) {
+        int ret;
+        NATIVECALL(ret = ioctl(uffd, UFFDIO_COPY, &copy));
+        if (ret == 0)
+            return;
+        if (errno == EAGAIN)
+            continue;
+        /* The page was already populated */
+        if (errno == EEXIST)
+            wakeRange(page.addr);
+        return;
+    }
+}
+
+/* Find the page at `addr`, or returns -1. Pages are sorted by address */
+static int findPage(char* addr)
+{
+    int low = 0;
+    int high = header->page_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (pages[mid].addr == addr)
+            return mid;
+        if (pages[mid].addr < addr)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return -1;
+}
+
+static void handleFault(char* addr, SaveStateCodec::Decompressor& decompressor)
+{
+    int p = findPage(addr);
+    if (p >= 0) {
+        copyPage(pages[p], decompressor);
+        return;
+    }
+
+    /* The page was not part of the savestate, it is only a page of a
+     * registered area that was never accessed */
+    struct uffdio_zeropage zero;
+    zero.range.start = reinterpret_cast<uintptr_t>(addr);
+    zero.range.len = 4096;
+    zero.mode = 0;
+    int ret;
+    NATIVECALL(ret = ioctl(uffd, UFFDIO_ZEROPAGE, &zero));
+    if ((ret == -1) && (errno == EEXIST))
+        wakeRange(addr);
+}
+
+/* Unregister all areas, which also wakes up any thread that may still be
+ * waiting on them, and release the tables */
+static void stopLoading()
+{
+    for (int a = 0; a < header->area_count; a++) {
+        struct uffdio_range range;
+        range.start = reinterpret_cast<uintptr_t>(areas[a].addr);
+        range.len = areas[a].size;
+        NATIVECALL(ioctl(uffd, UFFDIO_UNREGISTER, &range));
+    }
+
+    if (header->page_count > 0)
+        madvise(pages, roundPage(header->page_count * sizeof(LazyPage)), MADV_DONTNEED);
+
+    header->source.close();
+    header->page_count = 0;
+    header->area_count = 0;
+    header->state.store(ST_IDLE);
+    futexWake(&header->state, INT_MAX);
+}
+
+/* The thread must never access memory of the game, which may be registered,
+ * so it only calls syscalls and codec functions, and it does not log. */
+static void* lazyLoop(void*)
+{
+    while (true) {
+        int state = header->state.load();
+        if (state != ST_ACTIVE) {
+            futexWait(&header->state, state);
+            continue;
+        }
+
+        SaveStateCodec::Decompressor decompressor(header->codec, workspace);
+
+        while (header->prefetch_page < header->page_count) {
+            /* Serve the pages that are accessed first */
+            struct uffd_msg msgs[16];
+            ssize_t ret;
+            NATIVECALL(ret = read(uffd, msgs, sizeof(msgs)));
+            for (int m = 0; m < (ret / static_cast<ssize_t>(sizeof(struct uffd_msg))); m++) {
+                if (msgs[m].event != UFFD_EVENT_PAGEFAULT)
+                    continue;
+                char* addr = reinterpret_cast<char*>(msgs[m].arg.pagefault.address & ~static_cast<uint64_t>(4095));
+                handleFault(addr, decompressor);
+                header->fault_count++;
+            }
+
+            /* Then load pages in the background */
+            for (int n = 0; (n < PREFETCH_BATCH) && (header->prefetch_page < header->page_count); n++)
+                copyPage(pages[header->prefetch_page++], decompressor);
+        }
+
+        stopLoading();
+    }
+    return nullptr;
+}
+#endif
+
+void SaveStateLazy::init()
+{
+#if defined(__linux__) && defined(__NR_userfaultfd)
+    if (segment_addr)
+        return;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_LAZY))
+        return;
+
+    /* Pages must also be loaded when accessed by the kernel (e.g. inside a
+     * read() call), so we cannot use the user-mode only mode, which may
+     * require privileges */
+    NATIVECALL(uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+    if (uffd == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create userfaultfd object, savestates will not be loaded lazily (check vm.unprivileged_userfaultfd)");
+        return;
+    }
+
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = 0;
+    int ret;
+    NATIVECALL(ret = ioctl(uffd, UFFDIO_API, &api));
+    if (ret == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not initialize userfaultfd, savestates will not be loaded lazily");
+        NATIVECALL(close(uffd));
+        uffd = -1;
+        return;
+    }
+
+    /* Segment layout: the header, the thread stack, the page buffers, the
+     * codec workspace and the tables, with a guard page at each end */
+    size_t header_size = roundPage(sizeof(LazyHeader));
+    size_t buffers_size = 4096 + roundPage(SaveStateCodec::PAGE_BOUND);
+    size_t areas_size = roundPage(static_cast<size_t>(MAX_AREAS) * sizeof(LazyArea));
+    size_t pages_size = roundPage(static_cast<size_t>(MAX_PAGES) * sizeof(LazyPage));
+    segment_size = header_size + THREAD_STACK_SIZE + buffers_size +
+        SaveStateWorkers::WORKSPACE_SIZE + areas_size + pages_size;
+
+    void* addr;
+    NATIVECALL(addr = mmap(nullptr, segment_size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+    if (addr == MAP_FAILED) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve memory for lazy savestate loading");
+        segment_size = 0;
+        return;
+    }
+    segment_addr = static_cast<char*>(addr) + 4096;
+    MYASSERT(mprotect(segment_addr, segment_size, PROT_READ | PROT_WRITE) == 0)
+
+    header = new (segment_addr) LazyHeader();
+    header->state.store(ST_IDLE);
+
+    char* stack = segment_addr + header_size;
+    page_buffer = stack + THREAD_STACK_SIZE;
+    compressed_buffer = page_buffer + 4096;
+    workspace = page_buffer + buffers_size;
+    areas = reinterpret_cast<LazyArea*>(workspace + SaveStateWorkers::WORKSPACE_SIZE);
+    pages = reinterpret_cast<LazyPage*>(reinterpret_cast<char*>(areas) + areas_size);
+
+    /* Like savestate workers, the thread must never handle signals */
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    NATIVECALL(ret = pthread_create(&thread, &attr, lazyLoop, nullptr));
+    pthread_attr_destroy(&attr);
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &old_signals, nullptr));
+
+    if (ret != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create the lazy savestate loading thread");
+        header = nullptr;
+        return;
+    }
+
+    NATIVECALL(thread_pid = getpid());
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Savestates will be loaded lazily");
+#endif
+}
+
+bool SaveStateLazy::isEnabled()
+{
+    if (!header)
+        return false;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_LAZY))
+        return false;
+
+    /* Areas cannot be registered to both userfaultfd objects */
+    if (SaveStateDirty::isEnabled())
+        return false;
+
+    /* The thread does not exist in a forked process */
+    pid_t pid;
+    NATIVECALL(pid = getpid());
+    return pid == thread_pid;
+}
+
+bool SaveStateLazy::isReserved(void* addr, size_t size)
+{
+    return segment_addr && (addr == segment_addr) && (size == segment_size);
+}
+
+bool SaveStateLazy::begin(const SaveStateStream& source, int codec)
+{
+    if (!isEnabled())
+        return false;
+
+    MYASSERT(header->state.load() == ST_IDLE)
+
+    header->source.openCopy(source);
+    header->codec = codec;
+    header->page_count = 0;
+    header->area_count = 0;
+    header->area_first_page = 0;
+    header->prefetch_page = 0;
+    header->fault_count = 0;
+    header->error_count = 0;
+    header->reported = true;
+    header->state.store(ST_FILLING);
+    return true;
+}
+
+#ifdef __linux__
+/* Load the pages of the current area from page `first`, and remove them */
+static void loadNow(int first, SaveStateCodec::Decompressor& decompressor)
+{
+    for (int p = first; p < header->page_count; p++) {
+        if (pages[p].loaded)
+            continue;
+        if (!readPage(pages[p], pages[p].addr, decompressor))
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read page %p from savestate", pages[p].addr);
+    }
+    header->page_count = first;
+    header->area_first_page = first;
+}
+#endif
+
+bool SaveStateLazy::addPage(char* addr, off_t offset, int length)
+{
+    if (!header || (header->state.load() != ST_FILLING))
+        return false;
+
+    if ((header->page_count >= MAX_PAGES) || (header->area_count >= MAX_AREAS))
+        return false;
+
+    LazyPage& page = pages[header->page_count++];
+    page.addr = addr;
+    page.offset = offset;
+    page.length = length;
+    page.loaded = false;
+    return true;
+}
+
+void SaveStateLazy::addArea(void* addr, size_t size)
+{
+#ifdef __linux__
+    if (!header || (header->state.load() != ST_FILLING))
+        return;
+
+    int first = header->area_first_page;
+    header->area_first_page = header->page_count;
+    if (first == header->page_count)
+        return;
+
+    SaveStateCodec::Decompressor decompressor(header->codec, workspace);
+
+    /* The loader would discard its own state, or wait on itself */
+    if (overlapsLoader(addr, size)) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "    Area %p holds the lazy loader state, loading it now", addr);
+        loadNow(first, decompressor);
+        return;
+    }
+
+    /* Discard pages by contiguous runs, so that they are missing */
+    int run_start = first;
+    for (int p = first + 1; p <= header->page_count; p++) {
+        if ((p == header->page_count) || (pages[p].addr != pages[p-1].addr + 4096)) {
+            if (madvise(pages[run_start].addr, (p - run_start) * 4096, MADV_DONTNEED) != 0) {
+                /* Pages cannot be discarded (e.g. locked memory), so we
+                 * load them now */
+                for (int r = run_start; r < p; r++) {
+                    readPage(pages[r], pages[r].addr, decompressor);
+                    pages[r].loaded = true;
+                }
+            }
+            run_start = p;
+        }
+    }
+
+    /* Register the whole area, so that it is not split */
+    struct uffdio_register reg;
+    reg.range.start = reinterpret_cast<uintptr_t>(addr);
+    reg.range.len = size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    int ret;
+    NATIVECALL(ret = ioctl(uffd, UFFDIO_REGISTER, &reg));
+
+    if (ret == 0) {
+        areas[header->area_count++] = {addr, size};
+        return;
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "    Could not register area %p for lazy loading, loading it now", addr);
+    loadNow(first, decompressor);
+#endif
+}
+
+void SaveStateLazy::commit()
+{
+#ifdef __linux__
+    if (!header || (header->state.load() != ST_FILLING))
+        return;
+
+    if (header->page_count == 0) {
+        stopLoading();
+        return;
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "%d pages will be loaded lazily", header->page_count);
+
+    header->reported = false;
+    header->state.store(ST_ACTIVE);
+    futexWake(&header->state, INT_MAX);
+#endif
+}
+
+void SaveStateLazy::finish()
+{
+#ifdef __linux__
+    if (!header)
+        return;
+
+    /* Pages may not have been committed if the loading was interrupted */
+    if (header->state.load() == ST_FILLING)
+        commit();
+
+    int state;
+    while ((state = header->state.load()) != ST_IDLE)
+        futexWait(&header->state, state);
+
+    if (!header->reported) {
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Lazy loading finished, %d pages were loaded on access", header->fault_count);
+        if (header->error_count > 0)
+            LOG(LL_ERROR, LCF_CHECKPOINT, "%d pages could not be read from the savestate", header->error_count);
+        header->reported = true;
+    }
+#endif
+}
+
+}
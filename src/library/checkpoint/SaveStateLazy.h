@@ -0,0 +1,71 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATELAZY_H
+#define LIBTAS_SAVESTATELAZY_H
+
+#include <cstddef> // size_t
+#include <sys/types.h> // off_t
+
+namespace libtas {
+
+class SaveStateStream;
+
+/* Lazy loading of savestate pages using userfaultfd. Instead of writing the
+ * pages when loading a state, they are discarded and their area is registered
+ * to userfaultfd, so that a page is only loaded by a dedicated thread when it
+ * is first accessed. The same thread loads the remaining pages in the
+ * background, and all pages are loaded before the next checkpoint. The thread
+ * and its tables are stored inside a reserved memory segment that is excluded
+ * from savestates. */
+namespace SaveStateLazy {
+
+    /* Create the userfaultfd object, reserve the memory segment and spawn
+     * the loading thread */
+    void init();
+
+    /* Returns if savestates can be loaded lazily */
+    bool isEnabled();
+
+    /* Returns if the memory segment holds the loading thread and tables */
+    bool isReserved(void* addr, size_t size);
+
+    /* Start a lazy load of pages from the savestate `pages` stream, which are
+     * compressed with `codec`. Returns false if lazy loading is not possible */
+    bool begin(const SaveStateStream& pages, int codec);
+
+    /* Load the page at `addr` on first access, from `length` bytes at `offset`
+     * in the savestate stream, which is compressed if `length` is not 4096.
+     * Returns false if the page must be loaded now. */
+    bool addPage(char* addr, off_t offset, int length);
+
+    /* Discard the pages of the area that were added, and register the area so
+     * that pages are loaded on access. Must be called after all the other
+     * pages of the area were written. */
+    void addArea(void* addr, size_t size);
+
+    /* Start loading pages on access and in the background */
+    void commit();
+
+    /* Wait for all pages to be loaded */
+    void finish();
+}
+}
+
+#endif
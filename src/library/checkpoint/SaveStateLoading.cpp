@@ -20,6 +20,10 @@
 */
 
 #include "SaveStateLoading.h"
+#include "SaveStateRam.h"
+#include "SaveStatePageStore.h"
+#include "SaveStateLazy.h"
+#include "CheckpointMetrics.h"
 #include "StateHeader.h"
 
 #include "Utils.h"
@@ -39,37 +43,124 @@
 
 namespace libtas {
 
-SaveStateLoading::SaveStateLoading(const char* pagemappath, const char* pagespath)
+SaveStateLoading::SaveStateLoading(int index, const char* pagemappath, const char* pagespath)
 {
     queued_size = 0;
+    header_flags = 0;
+    header_codec = SharedConfig::SS_CODEC_LZ4;
+    header_size = sizeof(StateHeader);
+    failed = false;
+    parallel = false;
+    lazy = false;
+    job_count = 0;
+    job_head = 0;
+    job_tail = 0;
+    job_filling = false;
+
+    if (!SaveStateRam::openSlot(index, pmstream, pstream)) {
+        if (pagemappath[0] == '\0') {
+            return;
+        }
 
-    if (pagemappath[0] == '\0') {
-        pmfd = -1;
-        return;
-    }
+        int pmfd, pfd;
+        NATIVECALL(pmfd = open(pagemappath, O_RDONLY));
+        MYASSERT(pmfd != -1)
+        if (pmfd == -1)
+            return;
 
-    NATIVECALL(pmfd = open(pagemappath, O_RDONLY));
-    MYASSERT(pmfd != -1)
+        NATIVECALL(pfd = open(pagespath, O_RDONLY));
+        MYASSERT(pfd != -1)
 
-    NATIVECALL(pfd = open(pagespath, O_RDONLY));
-    MYASSERT(pfd != -1)
+        pmstream.openFd(pmfd);
+        pstream.openFd(pfd);
+    }
 
     memset(&lz4s, 0, sizeof(LZ4_streamDecode_t));
+
+    /* Flags and codec are at the beginning of the header. Legacy savestates
+     * don't have them, and their pages are decoded as a stream, which also
+     * works for pages that were compressed independently. */
+    int magic = 0;
+    pmstream.read(&magic, sizeof(int));
+    if (magic == StateHeader::MAGIC) {
+        int version;
+        pmstream.read(&version, sizeof(int));
+        pmstream.read(&header_flags, sizeof(int));
+        pmstream.read(&header_codec, sizeof(int));
+    }
+    else {
+        header_size = sizeof(LegacyStateHeader);
+    }
+    decompressor = SaveStateCodec::Decompressor(header_codec, SaveStateWorkers::getWorkspace(SaveStateWorkers::CALLER));
+
     restart();
 }
 
-SaveStateLoading::~SaveStateLoading()
+void SaveStateLoading::enableParallelLoad(int first, int count)
 {
-    if (pmfd > 0) {
-        NATIVECALL(close(pmfd));
-        NATIVECALL(close(pfd));
+    if (!pmstream || !(header_flags & StateHeader::INDEPENDENT_BLOCKS))
+        return;
+
+    /* Keep two jobs per worker, so that workers are busy while we read the
+     * compressed data of the next job */
+    job_count = 2 * SaveStateWorkers::count();
+    if (job_count > count)
+        job_count = count;
+    if (job_count > MAX_JOBS)
+        job_count = MAX_JOBS;
+    if (job_count == 0)
+        return;
+
+    for (int j = 0; j < job_count; j++) {
+        jobs[j].run = decompressJob;
+        jobs[j].buffer = SaveStateWorkers::getBuffer(first + j);
+        jobs[j].codec = header_codec;
     }
+    parallel = true;
+}
+
+bool SaveStateLoading::enableLazyLoad()
+{
+    if (!pmstream)
+        return false;
+
+    lazy = SaveStateLazy::begin(pstream, header_codec);
+    return lazy;
+}
+
+bool SaveStateLoading::queueLazyPageLoad(char* addr)
+{
+    if (!lazy)
+        return false;
+
+    if (current_flag == Area::FULL_PAGE)
+        return SaveStateLazy::addPage(addr, next_pfd_offset - 4096, 4096);
+
+    /* Compressed pages can only be decompressed out of order if they are
+     * independent */
+    if ((current_flag == Area::COMPRESSED_PAGE) && (header_flags & StateHeader::INDEPENDENT_BLOCKS))
+        return SaveStateLazy::addPage(addr, next_pfd_offset - compressed_length, compressed_length);
+
+    return false;
 }
 
 void SaveStateLoading::readHeader(StateHeader* sh)
 {
-    lseek(pmfd, 0, SEEK_SET);
-    Utils::readAll(pmfd, sh, sizeof(StateHeader));
+    if (header_size == sizeof(StateHeader)) {
+        pmstream.seek(0, SEEK_SET);
+        pmstream.read(sh, sizeof(StateHeader));
+    }
+    else {
+        /* The thread list has the same layout in both headers */
+        sh->magic = StateHeader::MAGIC;
+        sh->version = StateHeader::VERSION;
+        sh->flags = header_flags;
+        sh->codec = header_codec;
+        pmstream.seek(0, SEEK_SET);
+        pmstream.read(&sh->thread_count, sizeof(int));
+        pmstream.seek(offsetof(LegacyStateHeader, pthread_ids), SEEK_SET);
+        pmstream.read(sh->pthread_ids, sizeof(LegacyStateHeader) - offsetof(LegacyStateHeader, pthread_ids));
+    }
 
     restart();
 }
@@ -77,7 +168,7 @@ void SaveStateLoading::readHeader(StateHeader* sh)
 void SaveStateLoading::restart()
 {
     /* Seek after the savestate header */
-    lseek(pmfd, sizeof(StateHeader), SEEK_SET);
+    pmstream.seek(header_size, SEEK_SET);
     flags_remaining = 0;
 
     /* Read the first area */
@@ -91,7 +182,7 @@ char SaveStateLoading::nextFlag()
 
     	int size = (flags_remaining > 4096 ? 4096 : flags_remaining);
 
-    	Utils::readAll(pmfd, flags, size);
+    	pmstream.read(flags, size);
     	flags_remaining -= size;
 
     	flag_i = 0;
@@ -104,8 +195,8 @@ char SaveStateLoading::nextFlag()
 Area& SaveStateLoading::nextArea()
 {
     if (flags_remaining > 0)
-        lseek(pmfd, flags_remaining, SEEK_CUR);
-    Utils::readAll(pmfd, &area, sizeof(area));
+        pmstream.seek(flags_remaining, SEEK_CUR);
+    pmstream.read(&area, sizeof(area));
     next_pfd_offset = area.page_offset;
     current_addr = static_cast<char*>(area.addr);
     flag_i = 4096;
@@ -164,10 +255,15 @@ char SaveStateLoading::getPageFlag(char* addr)
             next_pfd_offset += 4096;
         }
         else if (flag == Area::COMPRESSED_PAGE) {
-            lseek(pfd, next_pfd_offset, SEEK_SET);
-            Utils::readAll(pfd, &compressed_length, sizeof(int));
+            pstream.seek(next_pfd_offset, SEEK_SET);
+            pstream.read(&compressed_length, sizeof(int));
             next_pfd_offset += sizeof(int) + compressed_length;
         }
+        else if (flag == Area::STORED_PAGE) {
+            pstream.seek(next_pfd_offset, SEEK_SET);
+            pstream.read(&stored_id, sizeof(uint32_t));
+            next_pfd_offset += sizeof(uint32_t);
+        }
         current_addr += 4096;
     } while (current_addr <= addr);
 
@@ -183,19 +279,34 @@ char SaveStateLoading::getNextPageFlag()
         next_pfd_offset += 4096;
     }
     else if (flag == Area::COMPRESSED_PAGE) {
-        lseek(pfd, next_pfd_offset, SEEK_SET);
-        Utils::readAll(pfd, &compressed_length, sizeof(int));
+        pstream.seek(next_pfd_offset, SEEK_SET);
+        pstream.read(&compressed_length, sizeof(int));
         next_pfd_offset += sizeof(int) + compressed_length;
     }
+    else if (flag == Area::STORED_PAGE) {
+        pstream.seek(next_pfd_offset, SEEK_SET);
+        pstream.read(&stored_id, sizeof(uint32_t));
+        next_pfd_offset += sizeof(uint32_t);
+    }
     current_addr += 4096;
     return flag;
 }
 
 void SaveStateLoading::finishLoad()
 {
+    /* All pages must be written before the area protection is restored */
+    if (parallel) {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_DECOMPRESS);
+        submitJob();
+        while (job_head != job_tail)
+            waitJob();
+    }
+
     if (queued_size > 0) {
-        lseek(pfd, queued_offset, SEEK_SET);
-        Utils::readAll(pfd, queued_addr, queued_size);
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+        pstream.seek(queued_offset, SEEK_SET);
+        if (pstream.read(queued_addr, queued_size) != static_cast<size_t>(queued_size))
+            failPage(queued_addr, "short read");
         queued_size = 0;
     }
 }
@@ -211,8 +322,10 @@ void SaveStateLoading::queuePageLoad(char* addr)
                 queued_size += 4096;
                 return;
         	} else {
-                lseek(pfd, queued_offset, SEEK_SET);
-                Utils::readAll(pfd, queued_addr, queued_size);
+                CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+                pstream.seek(queued_offset, SEEK_SET);
+                if (pstream.read(queued_addr, queued_size) != static_cast<size_t>(queued_size))
+                    failPage(queued_addr, "short read");
         	}
         }
         queued_offset = (next_pfd_offset - 4096);
@@ -220,31 +333,150 @@ void SaveStateLoading::queuePageLoad(char* addr)
         queued_size = 4096;
     }
     else if (current_flag == Area::COMPRESSED_PAGE) {
-        char compressed[LZ4_COMPRESSBOUND(4096)];
-        Utils::readAll(pfd, compressed, compressed_length);
+        if (parallel) {
+            queueParallelPageLoad(addr);
+            return;
+        }
+
+        char compressed[SaveStateCodec::PAGE_BOUND];
+        if ((compressed_length <= 0) || (compressed_length > static_cast<int>(sizeof(compressed)))) {
+            failPage(addr, "invalid compressed size");
+            return;
+        }
+
+        {
+            CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+            if (pstream.read(compressed, compressed_length) != static_cast<size_t>(compressed_length)) {
+                failPage(addr, "short read");
+                return;
+            }
+        }
         
-        if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_DECOMPRESS);
+        bool decompressed;
+        if (header_flags & StateHeader::INDEPENDENT_BLOCKS) {
             /* For incremental savestates, block compression is independant */
-            LZ4_decompress_safe(compressed, addr, compressed_length, 4096);
+            decompressed = decompressor.decompressPage(compressed, compressed_length, addr);
         }
         else {
-            LZ4_decompress_safe_continue(&lz4s, compressed, addr, compressed_length, 4096);
+            decompressed = (LZ4_decompress_safe_continue(&lz4s, compressed, addr, compressed_length, 4096) == 4096);
         }
+        if (!decompressed)
+            failPage(addr, "decompression error");
+    }
+    else if (current_flag == Area::STORED_PAGE) {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_DECOMPRESS);
+        if (!SaveStatePageStore::loadPage(stored_id, addr))
+            failPage(addr, "stored page error");
     }
 }
 
+void SaveStateLoading::queueParallelPageLoad(char* addr)
+{
+    if ((compressed_length <= 0) || (compressed_length > SaveStateCodec::PAGE_BOUND)) {
+        failPage(addr, "invalid compressed size");
+        return;
+    }
+
+    /* Submit the current job if the compressed page does not fit */
+    if (job_filling && ((jobs[job_tail % job_count].buffer_size + compressed_length) > SaveStateWorkers::BUFFER_SIZE))
+        submitJob();
+
+    if (!job_filling) {
+        /* Wait for the oldest job if all jobs are in use */
+        if ((job_tail - job_head) >= job_count) {
+            CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_DECOMPRESS);
+            waitJob();
+        }
+
+        DecompressJob& job = jobs[job_tail % job_count];
+        job.page_count = 0;
+        job.buffer_size = 0;
+        job.failed_pages = 0;
+        job_filling = true;
+    }
+
+    DecompressJob& job = jobs[job_tail % job_count];
+    DecompressJob::Page& page = job.pages[job.page_count++];
+    page.addr = addr;
+    page.offset = job.buffer_size;
+    page.length = compressed_length;
+
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+        if (pstream.read(job.buffer + job.buffer_size, compressed_length) != static_cast<size_t>(compressed_length)) {
+            job.page_count--;
+            failPage(addr, "short read");
+            return;
+        }
+    }
+    job.buffer_size += compressed_length;
+
+    if (job.page_count == JOB_PAGES)
+        submitJob();
+}
+
+void SaveStateLoading::submitJob()
+{
+    if (!job_filling)
+        return;
+
+    SaveStateWorkers::submit(&jobs[job_tail % job_count]);
+    job_tail++;
+    job_filling = false;
+}
+
+void SaveStateLoading::decompressJob(SaveStateWorkers::Task* task, int worker)
+{
+    DecompressJob* job = static_cast<DecompressJob*>(task);
+
+    SaveStateCodec::Decompressor job_decompressor(job->codec, SaveStateWorkers::getWorkspace(worker));
+
+    for (int p = 0; p < job->page_count; p++) {
+        const DecompressJob::Page& page = job->pages[p];
+        if (!job_decompressor.decompressPage(job->buffer + page.offset, page.length, page.addr))
+            job->failed_pages++;
+    }
+}
+
+void SaveStateLoading::waitJob()
+{
+    DecompressJob& job = jobs[job_head % job_count];
+    SaveStateWorkers::wait(&job);
+    job_head++;
+
+    if (job.failed_pages > 0) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not decompress %d pages between %p and %p", job.failed_pages, job.pages[0].addr, job.pages[job.page_count-1].addr);
+        failed = true;
+    }
+}
+
+void SaveStateLoading::failPage(char* addr, const char* reason)
+{
+    LOG(LL_ERROR, LCF_CHECKPOINT, "Could not load page at %p: %s", addr, reason);
+    failed = true;
+}
+
 bool SaveStateLoading::debugIsMatchingPage(char* addr)
 {
     char current_page[4096];
     
     if (current_flag == Area::FULL_PAGE) {
-        lseek(pfd, next_pfd_offset - 4096, SEEK_SET);
-        Utils::readAll(pfd, current_page, 4096);
+        pstream.seek(next_pfd_offset - 4096, SEEK_SET);
+        pstream.read(current_page, 4096);
     }
     else if (current_flag == Area::COMPRESSED_PAGE) {
-        char compressed[LZ4_COMPRESSBOUND(4096)];
-        Utils::readAll(pfd, compressed, compressed_length);
-        LZ4_decompress_safe(compressed, current_page, compressed_length, 4096);
+        char compressed[SaveStateCodec::PAGE_BOUND];
+        if ((compressed_length <= 0) || (compressed_length > static_cast<int>(sizeof(compressed))))
+            return false;
+        if (pstream.read(compressed, compressed_length) != static_cast<size_t>(compressed_length))
+            return false;
+        if (!decompressor.decompressPage(compressed, compressed_length, current_page))
+            return false;
+    }
+    else if (current_flag == Area::STORED_PAGE) {
+        if (!SaveStatePageStore::loadPage(stored_id, current_page))
+            return false;
     }
     
     return 0 == memcmp(addr, current_page, 4096);
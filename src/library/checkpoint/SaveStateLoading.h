@@ -23,6 +23,9 @@
 #define LIBTAS_SAVESTATELOADING_H
 
 #include "MemArea.h"
+#include "SaveStateStream.h"
+#include "SaveStateWorkers.h"
+#include "SaveStateCodec.h"
 #include "../external/lz4.h"
 
 namespace libtas {
@@ -32,8 +35,9 @@ struct StateHeader;
 class SaveStateLoading
 {
     public:
-        SaveStateLoading(const char* pagemappath, const char* pagespath);
-        ~SaveStateLoading();
+        /* Open the savestate of index `index`, either from RAM if it is
+         * stored there, or from the savestate files */
+        SaveStateLoading(int index, const char* pagemappath, const char* pagespath);
 
     // Also resets back to first area
     void readHeader(StateHeader* sh);
@@ -51,31 +55,114 @@ class SaveStateLoading
     void queuePageLoad(char* addr);
     void finishLoad();
 
+    /* Decompress pages on the savestate workers, using `count` of their
+     * buffers starting at `first`, if the savestate supports it. */
+    void enableParallelLoad(int first, int count);
+
+    /* Load pages lazily when they are accessed, if possible */
+    bool enableLazyLoad();
+
+    /* Defer the loading of the current page until it is accessed. Returns
+     * false if the page must be loaded with queuePageLoad() */
+    bool queueLazyPageLoad(char* addr);
+
     bool debugIsMatchingPage(char* addr);
 
+    /* Returns if some pages could not be read or decompressed */
+    bool hasFailed() const {return failed;}
+
     explicit operator bool() const {
-        return (pmfd != -1);
+        return static_cast<bool>(pmstream);
     }
 
     private:
     char nextFlag();
 
+    /* Add the compressed page to the job being filled, and submit it to the
+     * workers when full */
+    void queueParallelPageLoad(char* addr);
+
+    /* Submit the job being filled to the workers */
+    void submitJob();
+
+    enum {
+        JOB_PAGES = 256,
+        MAX_JOBS = SaveStateWorkers::BUFFER_COUNT / 2,
+    };
+
+    /* Compressed pages to be decompressed by a worker into their target
+     * address. Compressed data is read by the checkpoint thread into the
+     * job buffer, so that the streams are only accessed by one thread. */
+    struct DecompressJob : SaveStateWorkers::Task {
+        struct Page {
+            char* addr;
+            int offset;
+            int length;
+        };
+
+        Page pages[JOB_PAGES];
+        int page_count;
+
+        /* Compression codec */
+        int codec;
+
+        char* buffer;
+        int buffer_size;
+
+        /* Number of pages that could not be decompressed */
+        int failed_pages;
+    };
+
+    /* Wait for the oldest job and check its pages */
+    void waitJob();
+
+    /* Log a page that could not be loaded, and mark the loading as failed */
+    void failPage(char* addr, const char* reason);
+
+    static void decompressJob(SaveStateWorkers::Task* task, int worker);
+
+    /* Header flags and compression codec of the savestate, and size of its
+     * header, which is different for legacy savestates */
+    int header_flags;
+    int header_codec;
+    size_t header_size;
+
+    /* Some pages could not be loaded */
+    bool failed;
+
+    SaveStateCodec::Decompressor decompressor;
+
     char flags[4096];
     char current_flag;
     int flag_i;
     int flags_remaining;
 
-    int pmfd, pfd;
+    SaveStateStream pmstream, pstream;
 
     Area area;
     char* current_addr;
     off_t next_pfd_offset;
 
     int compressed_length;
+    uint32_t stored_id;
     char* queued_addr;
     off_t queued_offset;
     int queued_size;
     LZ4_streamDecode_t lz4s;
+
+    /* Are compressed pages decompressed by the savestate workers */
+    bool parallel;
+
+    /* Are pages loaded lazily */
+    bool lazy;
+
+    /* Ring of decompression jobs. Jobs in [job_head, job_tail) were submitted,
+     * and job_tail is being filled if job_filling is true. */
+    DecompressJob jobs[MAX_JOBS];
+    int job_count;
+    int job_head;
+    int job_tail;
+    bool job_filling;
 };
 }
 
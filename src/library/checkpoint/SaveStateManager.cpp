@@ -25,6 +25,7 @@
 #include "Checkpoint.h"
 #include "AltStack.h"
 #include "ReservedMemory.h"
+#include "CheckpointMetrics.h"
 #include "ThreadInfo.h"
 #include "clone_wrapper.h"
 
@@ -218,6 +219,8 @@ int SaveStateManager::checkpoint(int slot)
 
     ThreadSync::acquireLocks();
 
+    CheckpointMetrics::begin(slot, false);
+
     restoreInProgress = false;
 
     /* We must close the connection to the sound device. This must be done
@@ -232,6 +235,7 @@ int SaveStateManager::checkpoint(int slot)
     /* Perform a series of checks before attempting to checkpoint */
     int ret = Checkpoint::checkCheckpoint();
     if (ret < 0) {
+        CheckpointMetrics::end();
         ThreadSync::releaseLocks();
         return ret;
     }
@@ -281,7 +285,10 @@ int SaveStateManager::checkpoint(int slot)
     ThreadManager::updateStackInfo();
 
     /* Sending a suspend signal to all threads */
-    suspendThreads();
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_SUSPEND);
+        suspendThreads();
+    }
 
 #ifdef __linux__
     /* Disable the signal that refills the fake urandom pipe. Must be done
@@ -340,7 +347,10 @@ int SaveStateManager::checkpoint(int slot)
         createNewThreads();
     }
 
-    resumeThreads();
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_RESUME);
+        resumeThreads();
+    }
 
 #ifdef __unix__
     /* After restore, we need to sync xcb connections to avoid potential deadlocks */
@@ -365,6 +375,9 @@ int SaveStateManager::checkpoint(int slot)
 
     ThreadSync::releaseLocks();
 
+    /* Collected from the state loading too, which returns here */
+    CheckpointMetrics::end();
+
     /* Mark the savestate as dirty in case of fork savestate */
     if (!restoreInProgress)
         stateStatus(slot, true);
@@ -383,6 +396,8 @@ int SaveStateManager::restore(int slot)
     MYASSERT(current_thread->state == ThreadInfo::ST_CKPNTHREAD)
     ThreadSync::acquireLocks();
 
+    CheckpointMetrics::begin(slot, true);
+
     /* We must close the connection to the sound device. This must be done
      * BEFORE suspending threads.
      */
@@ -395,6 +410,7 @@ int SaveStateManager::restore(int slot)
     /* Perform a series of checks before attempting to restore */
     int ret = Checkpoint::checkRestore();
     if (ret < 0) {
+        CheckpointMetrics::end();
         ThreadSync::releaseLocks();
         return ret;
     }
@@ -423,7 +439,10 @@ int SaveStateManager::restore(int slot)
     /* Stop threads that will not be present after state loading */
     terminateThreads();
     
-    suspendThreads();
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_SUSPEND);
+        suspendThreads();
+    }
 
     /* Save thread list in reserved memory */
     saveThreadList();
@@ -477,6 +496,8 @@ int SaveStateManager::restore(int slot)
 
      ThreadSync::releaseLocks();
 
+     CheckpointMetrics::end();
+
      return ESTATE_UNKNOWN;
 }
 
@@ -904,6 +925,7 @@ void SaveStateManager::printError(int err)
         "Savestate does not exist",
         "Loading not allowed because new threads were created",
         "State still saving",
+        "State was loaded with corrupted memory",
         0 };
 
     if (err < 0) {
@@ -43,6 +43,7 @@ enum Error {
     ESTATE_NOSTATE = -3, // No state in slot
     ESTATE_NOTSAMETHREADS = -4, // Thread list has changed
     ESTATE_NOTCOMPLETE = -5, // State still being saved
+    ESTATE_CORRUPTED = -6, // State was loaded with pages that could not be read
 };
 
 
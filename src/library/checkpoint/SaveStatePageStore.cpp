@@ -0,0 +1,500 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStatePageStore.h"
+#include "SaveStateWorkers.h"
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+
+#define XXH_INLINE_ALL
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_NO_STDLIB
+#define XXH_NO_STREAM
+#include "../external/xxhash.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <linux/prctl.h>
+#include <linux/falloc.h>
+#endif
+
+namespace libtas {
+
+namespace {
+
+enum {
+    MAX_ENTRIES = 1 << 24,
+    MIN_INDEX_SIZE = 1 << 16,
+    MAX_INDEX_SIZE = 2 * MAX_ENTRIES,
+    /* Stored pages are rounded up to a multiple of the class size, so that the
+     * space of a released page can be reused by a page of the same class */
+    CLASS_SIZE = 512,
+    CLASS_COUNT = 4096 / CLASS_SIZE,
+};
+
+/* Values of the index table, other values are entry identifiers plus one */
+static const uint32_t INDEX_EMPTY = 0;
+static const uint32_t INDEX_REMOVED = 0xffffffff;
+
+struct StoreEntry {
+    XXH128_hash_t hash;
+    off_t offset;
+    /* Size of the stored page, which is not compressed if it is 4096 */
+    uint16_t length;
+    uint8_t codec;
+    uint8_t size_class;
+    /* Bitmask of slots referencing the page */
+    uint16_t slots;
+    /* Bitmask of the slot being saved, if it references the page */
+    uint16_t pending;
+    /* Next released entry of the same class */
+    uint32_t next_free;
+    bool used;
+};
+
+struct StoreHeader {
+    int fd;
+    char path[1024];
+    uint32_t entry_count;
+    uint32_t live_count;
+    uint32_t free_heads[CLASS_COUNT];
+    off_t file_end;
+    /* Size of the index table, and number of non-empty values */
+    uint32_t index_size;
+    uint32_t index_used;
+};
+
+}
+
+static char* segment_addr = nullptr;
+static size_t segment_size = 0;
+static StoreHeader* header = nullptr;
+static StoreEntry* entries = nullptr;
+static uint32_t* index_table = nullptr;
+
+static size_t roundPage(size_t size)
+{
+    return ((size + 4095) / 4096) * 4096;
+}
+
+void SaveStatePageStore::init()
+{
+#ifdef __linux__
+    if (segment_addr)
+        return;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_DEDUP))
+        return;
+
+    if (sizeof(void*) < 8) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Savestate page deduplication is only supported on 64-bit games");
+        return;
+    }
+
+    /* The virtual memory is only reserved, physical pages are allocated when
+     * entries are created */
+    size_t header_size = roundPage(sizeof(StoreHeader));
+    size_t entries_size = roundPage(static_cast<size_t>(MAX_ENTRIES) * sizeof(StoreEntry));
+    size_t index_size = roundPage(static_cast<size_t>(MAX_INDEX_SIZE) * sizeof(uint32_t));
+    size_t size = header_size + entries_size + index_size;
+
+    void* addr;
+    NATIVECALL(addr = mmap(nullptr, size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+    if (addr == MAP_FAILED) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve %zu bytes for the savestate page store", size);
+        return;
+    }
+
+    char* a = static_cast<char*>(addr) + 4096;
+    if (mprotect(a, size, PROT_READ | PROT_WRITE) != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve %zu bytes for the savestate page store", size);
+        munmap(addr, size + (2 * 4096));
+        return;
+    }
+
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, a, size, "libTAS savestate pages");
+
+    segment_addr = a;
+    segment_size = size;
+
+    header = reinterpret_cast<StoreHeader*>(segment_addr);
+    entries = reinterpret_cast<StoreEntry*>(segment_addr + header_size);
+    index_table = reinterpret_cast<uint32_t*>(segment_addr + header_size + entries_size);
+
+    header->fd = -1;
+    header->path[0] = '\0';
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Reserved %zu bytes at %p for the savestate page store", segment_size, segment_addr);
+#endif
+}
+
+bool SaveStatePageStore::isEnabled()
+{
+    /* Forked savestates are saved by the child process, which cannot update
+     * the index of the parent */
+    if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK)
+        return false;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_DEDUP))
+        return false;
+
+    return segment_addr != nullptr;
+}
+
+bool SaveStatePageStore::isReserved(void* addr, size_t size)
+{
+    return segment_addr && (addr == segment_addr) && (size == segment_size);
+}
+
+static void resetStore()
+{
+    /* Give the memory back to the system, without changing the mapping */
+    if (header->entry_count > 0)
+        madvise(entries, roundPage(header->entry_count * sizeof(StoreEntry)), MADV_DONTNEED);
+    madvise(index_table, roundPage(static_cast<size_t>(MAX_INDEX_SIZE) * sizeof(uint32_t)), MADV_DONTNEED);
+
+    header->entry_count = 0;
+    header->live_count = 0;
+    for (int c = 0; c < CLASS_COUNT; c++)
+        header->free_heads[c] = SaveStatePageStore::NO_ENTRY;
+    header->file_end = 0;
+    header->index_size = MIN_INDEX_SIZE;
+    header->index_used = 0;
+}
+
+bool SaveStatePageStore::open(const char* pagemappath)
+{
+    if (!isEnabled())
+        return false;
+
+    if (header->fd != -1)
+        return true;
+
+    /* The store is named after the game, which is the savestate path without
+     * the `.stateN.pm` suffix */
+    char path[1024];
+    strncpy(path, pagemappath, 1000);
+    path[1000] = '\0';
+    char* suffix = strrchr(path, '/');
+    suffix = strstr(suffix ? suffix : path, ".state");
+    if (!suffix)
+        return false;
+    strcpy(suffix, ".pagestore");
+
+    /* Any previous store file belongs to another session, because the index
+     * is not saved */
+    int flags = O_RDWR | O_CREAT;
+    if (strcmp(path, header->path) != 0) {
+        flags |= O_TRUNC;
+        resetStore();
+        strcpy(header->path, path);
+    }
+
+    NATIVECALL(header->fd = ::open(path, flags, 0644));
+    if (header->fd == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not open the savestate page store %s", path);
+        header->path[0] = '\0';
+        return false;
+    }
+
+    return true;
+}
+
+void SaveStatePageStore::close()
+{
+    if (!header || (header->fd == -1))
+        return;
+
+    NATIVECALL(::close(header->fd));
+    header->fd = -1;
+}
+
+static bool sameHash(const XXH128_hash_t& a, const XXH128_hash_t& b)
+{
+    return (a.low64 == b.low64) && (a.high64 == b.high64);
+}
+
+/* Look for the hash in the index. Returns the position of the value of the
+ * entry if found, or else the position where the entry must be inserted */
+static uint32_t findIndex(const XXH128_hash_t& hash, bool* found)
+{
+    uint32_t mask = header->index_size - 1;
+    uint32_t pos = static_cast<uint32_t>(hash.low64) & mask;
+    uint32_t insert_pos = INDEX_REMOVED;
+
+    while (true) {
+        uint32_t value = index_table[pos];
+        if (value == INDEX_EMPTY) {
+            *found = false;
+            return (insert_pos != INDEX_REMOVED) ? insert_pos : pos;
+        }
+        if (value == INDEX_REMOVED) {
+            if (insert_pos == INDEX_REMOVED)
+                insert_pos = pos;
+        }
+        else if (sameHash(entries[value - 1].hash, hash)) {
+            *found = true;
+            return pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+static void rebuildIndex(uint32_t size)
+{
+    memset(index_table, 0, header->index_size * sizeof(uint32_t));
+    header->index_size = size;
+    header->index_used = 0;
+
+    for (uint32_t id = 0; id < header->entry_count; id++) {
+        if (!entries[id].used)
+            continue;
+
+        bool found;
+        uint32_t pos = findIndex(entries[id].hash, &found);
+        index_table[pos] = id + 1;
+        header->index_used++;
+    }
+}
+
+static void insertIndex(uint32_t id)
+{
+    /* Keep the table at most half full, counting removed values */
+    if (2 * (header->index_used + 1) > header->index_size) {
+        uint32_t size = header->index_size;
+        if ((4 * (header->live_count + 1) > size) && (size < MAX_INDEX_SIZE))
+            size *= 2;
+        rebuildIndex(size);
+    }
+
+    bool found;
+    uint32_t pos = findIndex(entries[id].hash, &found);
+    if (index_table[pos] == INDEX_EMPTY)
+        header->index_used++;
+    index_table[pos] = id + 1;
+}
+
+static int writeRecord(const char* data, int length, off_t offset)
+{
+    while (length > 0) {
+        ssize_t ret;
+        NATIVECALL(ret = pwrite(header->fd, data, length, offset));
+        if ((ret == -1) && (errno == EINTR))
+            continue;
+        if (ret <= 0)
+            return -1;
+        data += ret;
+        length -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static int readRecord(char* data, int length, off_t offset)
+{
+    while (length > 0) {
+        ssize_t ret;
+        NATIVECALL(ret = pread(header->fd, data, length, offset));
+        if ((ret == -1) && (errno == EINTR))
+            continue;
+        if (ret <= 0)
+            return -1;
+        data += ret;
+        length -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/* Get an unused entry whose record can hold a page of class `c` */
+static uint32_t allocEntry(int c)
+{
+    uint32_t id = header->free_heads[c];
+    if (id != SaveStatePageStore::NO_ENTRY) {
+        header->free_heads[c] = entries[id].next_free;
+        return id;
+    }
+
+    off_t record_size = (c + 1) * CLASS_SIZE;
+
+    if (header->entry_count < MAX_ENTRIES) {
+        id = header->entry_count++;
+        entries[id].offset = header->file_end;
+        entries[id].size_class = c;
+        header->file_end += record_size;
+        return id;
+    }
+
+    /* All entries were created, so take a released entry of another class
+     * and move its record to the end of the file */
+    for (int k = 0; k < CLASS_COUNT; k++) {
+        id = header->free_heads[k];
+        if (id == SaveStatePageStore::NO_ENTRY)
+            continue;
+
+        header->free_heads[k] = entries[id].next_free;
+#ifdef __linux__
+        fallocate(header->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            entries[id].offset, (entries[id].size_class + 1) * CLASS_SIZE);
+#endif
+        entries[id].offset = header->file_end;
+        entries[id].size_class = c;
+        header->file_end += record_size;
+        return id;
+    }
+
+    return SaveStatePageStore::NO_ENTRY;
+}
+
+static void releaseEntry(uint32_t id)
+{
+    StoreEntry& entry = entries[id];
+
+    bool found;
+    uint32_t pos = findIndex(entry.hash, &found);
+    if (found)
+        index_table[pos] = INDEX_REMOVED;
+
+    entry.used = false;
+    entry.next_free = header->free_heads[entry.size_class];
+    header->free_heads[entry.size_class] = id;
+    header->live_count--;
+}
+
+uint32_t SaveStatePageStore::storePage(const char* addr, int slot, SaveStateCodec::Compressor& compressor)
+{
+    if (!header || (header->fd == -1) || (slot < 0) || (slot >= 16))
+        return NO_ENTRY;
+
+    XXH128_hash_t hash = XXH3_128bits(addr, 4096);
+
+    bool found;
+    uint32_t pos = findIndex(hash, &found);
+    if (found) {
+        uint32_t id = index_table[pos] - 1;
+        entries[id].pending = 1 << slot;
+        return id;
+    }
+
+    /* Compress the page, or store it raw if it cannot be compressed enough
+     * to save space */
+    char compressed[SaveStateCodec::PAGE_BOUND];
+    const char* data = addr;
+    int length = 4096;
+    int codec = compressor.getCodec();
+    if (Global::shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
+        int compressed_size = compressor.compressPage(addr, compressed, SaveStateCodec::PAGE_BOUND);
+        if ((compressed_size > 0) && (compressed_size < 4096 - CLASS_SIZE)) {
+            data = compressed;
+            length = compressed_size;
+        }
+    }
+
+    int c = (length - 1) / CLASS_SIZE;
+    uint32_t id = allocEntry(c);
+    if (id == NO_ENTRY)
+        return NO_ENTRY;
+
+    StoreEntry& entry = entries[id];
+    if (writeRecord(data, length, entry.offset) != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not write to the savestate page store");
+        entry.next_free = header->free_heads[c];
+        header->free_heads[c] = id;
+        return NO_ENTRY;
+    }
+
+    entry.hash = hash;
+    entry.length = length;
+    entry.codec = codec;
+    entry.slots = 0;
+    entry.pending = 1 << slot;
+    entry.used = true;
+    header->live_count++;
+
+    insertIndex(id);
+    return id;
+}
+
+bool SaveStatePageStore::loadPage(uint32_t id, char* addr)
+{
+    if (!header || (header->fd == -1) || (id >= header->entry_count) || !entries[id].used) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Stored page %u is not available", id);
+        return false;
+    }
+
+    const StoreEntry& entry = entries[id];
+    if (entry.length == 4096)
+        return readRecord(addr, 4096, entry.offset) == 0;
+
+    char compressed[SaveStateCodec::PAGE_BOUND];
+    if (readRecord(compressed, entry.length, entry.offset) != 0)
+        return false;
+
+    SaveStateCodec::Decompressor decompressor(entry.codec, SaveStateWorkers::getWorkspace(SaveStateWorkers::CALLER));
+    return decompressor.decompressPage(compressed, entry.length, addr);
+}
+
+static void updateSlots(int slot)
+{
+    uint16_t bit = 1 << slot;
+
+    for (uint32_t id = 0; id < header->entry_count; id++) {
+        StoreEntry& entry = entries[id];
+        if (!entry.used)
+            continue;
+
+        if (entry.pending)
+            entry.slots |= bit;
+        else
+            entry.slots &= ~bit;
+        entry.pending = 0;
+
+        if (entry.slots == 0)
+            releaseEntry(id);
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Savestate page store holds %u pages", header->live_count);
+}
+
+void SaveStatePageStore::commitSlot(int slot)
+{
+    if (!header || (slot < 0) || (slot >= 16))
+        return;
+
+    updateSlots(slot);
+}
+
+void SaveStatePageStore::releaseSlot(int slot)
+{
+    if (!header || (slot < 0) || (slot >= 16))
+        return;
+
+    /* Nothing is pending, so all references of the slot are removed */
+    updateSlots(slot);
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEPAGESTORE_H
+#define LIBTAS_SAVESTATEPAGESTORE_H
+
+#include "SaveStateCodec.h"
+
+#include <cstddef> // size_t
+#include <cstdint>
+
+namespace libtas {
+
+/* Content-addressed store of memory pages shared by all savestate slots.
+ * Pages are identified by their XXH3 hash, and each distinct page is stored
+ * once in a single store file next to the savestates. Savestates only keep
+ * the identifier of the page, and each stored page keeps the set of slots
+ * that reference it, so that it is released when no slot uses it anymore.
+ * The index is kept inside a reserved memory segment that is excluded from
+ * savestates, so it survives state loading. */
+namespace SaveStatePageStore {
+
+    /* Identifier returned when a page could not be stored */
+    static const uint32_t NO_ENTRY = 0xffffffff;
+
+    /* Reserve the memory segment of the index */
+    void init();
+
+    /* Returns if savestates must store their pages in the store */
+    bool isEnabled();
+
+    /* Returns if the memory segment holds the index */
+    bool isReserved(void* addr, size_t size);
+
+    /* Open the store file associated with the savestate at `pagemappath`.
+     * The store is reset when it is first opened in the session. */
+    bool open(const char* pagemappath);
+
+    /* Close the store file */
+    void close();
+
+    /* Store a page referenced by the savestate being saved in `slot`, and
+     * returns its identifier, or NO_ENTRY if the page could not be stored. */
+    uint32_t storePage(const char* addr, int slot, SaveStateCodec::Compressor& compressor);
+
+    /* Read the stored page `id` into `addr`. Returns false on error */
+    bool loadPage(uint32_t id, char* addr);
+
+    /* Make the pages stored during the last save of `slot` the new set of
+     * pages referenced by the slot, and release the pages that are not
+     * referenced by any slot anymore. */
+    void commitSlot(int slot);
+
+    /* Release all pages referenced by `slot`, because the slot is not stored
+     * using the store anymore */
+    void releaseSlot(int slot);
+}
+}
+
+#endif
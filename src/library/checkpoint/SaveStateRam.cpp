@@ -0,0 +1,441 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateRam.h"
+#include "SaveStateStream.h"
+#include "SaveStateCodec.h"
+#include "StateHeader.h"
+#include "MemArea.h"
+#ifdef __unix__
+#include "ProcSelfMaps.h"
+#elif defined(__APPLE__) && defined(__MACH__)
+#include "MachVmMaps.h"
+#endif
+
+#include "Utils.h"
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#define ONE_MB 1024 * 1024
+
+#ifndef PR_SET_VMA
+#define PR_SET_VMA 0x53564d41
+#endif
+#ifndef PR_SET_VMA_ANON_NAME
+#define PR_SET_VMA_ANON_NAME 0
+#endif
+
+namespace libtas {
+
+namespace {
+
+/* Part of the arena holding the pagemap or the pages of a state. Only the
+ * beginning of the part is readable and writable, the rest is only reserved. */
+struct RamRegion {
+    char* addr;
+    size_t committed;
+};
+
+struct RamWindow {
+    RamRegion pm;
+    RamRegion p;
+    size_t pm_size;
+    size_t p_size;
+};
+
+struct RamSlot {
+    int window; // -1 if not stored in RAM
+    uint64_t last_use;
+    char pagemappath[1024];
+    char pagespath[1024];
+};
+
+/* Header stored at the beginning of the arena, so that it is not modified
+ * when loading a state */
+struct RamHeader {
+    size_t budget;
+    size_t part_size; // size reserved for each region
+    uint64_t use_counter;
+    int saving_window;
+    RamWindow windows[SaveStateRam::WINDOW_COUNT];
+    RamSlot slots[SaveStateRam::SLOT_COUNT];
+};
+
+}
+
+/* Whole arena, without the guard pages around it */
+static char* arena_addr = nullptr;
+static size_t arena_size = 0;
+static RamHeader* header = nullptr;
+
+static size_t roundToPage(size_t size)
+{
+    return ((size + 4095) / 4096) * 4096;
+}
+
+/* Give back the end of the region to the system, keeping `size` bytes */
+static void trimRegion(RamRegion& r, size_t size)
+{
+    size = roundToPage(size);
+    if (size >= r.committed)
+        return;
+
+    madvise(r.addr + size, r.committed - size, MADV_DONTNEED);
+    mprotect(r.addr + size, r.committed - size, PROT_NONE);
+    r.committed = size;
+}
+
+/* Make the beginning of the region writable, up to `size` bytes or the
+ * reserved size */
+static bool commitRegion(RamRegion& r, size_t size)
+{
+    size = roundToPage(size);
+    if (size > header->part_size)
+        size = header->part_size;
+
+    if (size <= r.committed) {
+        trimRegion(r, size);
+        return true;
+    }
+
+    if (mprotect(r.addr + r.committed, size - r.committed, PROT_READ | PROT_WRITE) != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not allocate %zu bytes to store savestates in RAM", size);
+        return false;
+    }
+    r.committed = size;
+    return true;
+}
+
+/* Upper bound of the savestate size of the current memory, without the
+ * savefiles. States that are still bigger are saved on disk. */
+static void stateBound(size_t& pm_bound, size_t& p_bound)
+{
+    pm_bound = sizeof(StateHeader) + sizeof(Area);
+    p_bound = 0;
+
+#ifdef __unix__
+    ProcSelfMaps memMapLayout;
+#elif defined(__APPLE__) && defined(__MACH__)
+    MachVmMaps memMapLayout;
+#endif
+
+    Area area;
+    while (memMapLayout.getNextArea(&area)) {
+        pm_bound += sizeof(Area);
+        if (area.skip)
+            continue;
+
+        /* One flag per page, and pages may be slightly bigger when compressed */
+        size_t nb_pages = area.size / 4096;
+        pm_bound += nb_pages;
+        p_bound += nb_pages * (SaveStateCodec::PAGE_BOUND + sizeof(int));
+    }
+}
+
+static void releaseWindow(int w)
+{
+    /* Give the memory back to the system */
+    trimRegion(header->windows[w].pm, 0);
+    trimRegion(header->windows[w].p, 0);
+    header->windows[w].pm_size = 0;
+    header->windows[w].p_size = 0;
+}
+
+static void spillSlot(int slot)
+{
+    RamSlot& s = header->slots[slot];
+    int w = s.window;
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Move state %d from memory to %s", slot, s.pagespath);
+
+    int pmfd, pfd;
+    unlink(s.pagemappath);
+    NATIVECALL(pmfd = creat(s.pagemappath, 0644));
+    unlink(s.pagespath);
+    NATIVECALL(pfd = creat(s.pagespath, 0644));
+
+    if ((pmfd == -1) || (pfd == -1)) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not move state %d to disk, it is dropped", slot);
+        unlink(s.pagemappath);
+        unlink(s.pagespath);
+    }
+    else {
+        Utils::writeAll(pmfd, header->windows[w].pm.addr, header->windows[w].pm_size);
+        Utils::writeAll(pfd, header->windows[w].p.addr, header->windows[w].p_size);
+    }
+
+    if (pmfd != -1)
+        NATIVECALL(close(pmfd));
+    if (pfd != -1)
+        NATIVECALL(close(pfd));
+}
+
+static void evictSlots(int current, int pinned)
+{
+    while (SaveStateRam::usedSize() > header->budget) {
+        /* Look for the least recently used slot */
+        int lru = -1;
+        for (int i = 0; i < SaveStateRam::SLOT_COUNT; i++) {
+            if ((i == current) || (i == pinned) || (header->slots[i].window < 0))
+                continue;
+            if ((lru == -1) || (header->slots[i].last_use < header->slots[lru].last_use))
+                lru = i;
+        }
+
+        if (lru == -1)
+            return;
+
+        if (Global::shared_config.savestate_settings & SharedConfig::SS_RAM_SPILL) {
+            spillSlot(lru);
+        }
+        else {
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Drop state %d from memory", lru);
+        }
+
+        releaseWindow(header->slots[lru].window);
+        header->slots[lru].window = -1;
+    }
+}
+
+void SaveStateRam::init()
+{
+    if (header)
+        return;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_RAM))
+        return;
+
+    if (sizeof(void*) < 8) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Savestates in RAM are only supported on 64-bit games");
+        return;
+    }
+
+    size_t budget = static_cast<size_t>(Global::shared_config.savestate_ram_size) * ONE_MB;
+    if (budget == 0)
+        return;
+
+    /* The whole arena is reserved once, so that it is always at the same
+     * place and never overlaps memory of the game that was saved in a state.
+     * Each window can hold a pagemap and pages up to the budget. Memory is
+     * only made writable when saving a state, with the size needed by the
+     * current memory, and then trimmed to the size of the state. */
+    size_t header_size = roundToPage(sizeof(RamHeader));
+    size_t part_size = roundToPage(budget);
+    size_t size = header_size + 2 * WINDOW_COUNT * part_size;
+
+    void* addr;
+    NATIVECALL(addr = mmap(nullptr, size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+    if (addr == MAP_FAILED) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve %zu bytes to store savestates in RAM", size);
+        return;
+    }
+
+    char* a = static_cast<char*>(addr) + 4096;
+    if (mprotect(a, header_size, PROT_READ | PROT_WRITE) != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve %zu bytes to store savestates in RAM", size);
+        munmap(addr, size + (2 * 4096));
+        return;
+    }
+
+#ifdef __linux__
+    /* Name the mapping, so that it is easily identified (e.g. by ram search).
+     * This is only supported by recent kernels. */
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, a, size, "libTAS savestates");
+#endif
+
+    arena_addr = a;
+    arena_size = size;
+
+    header = reinterpret_cast<RamHeader*>(arena_addr);
+    header->budget = budget;
+    header->part_size = part_size;
+    header->use_counter = 0;
+    header->saving_window = -1;
+    for (int w = 0; w < WINDOW_COUNT; w++) {
+        char* window_addr = arena_addr + header_size + 2 * w * part_size;
+        header->windows[w].pm = {window_addr, 0};
+        header->windows[w].p = {window_addr + part_size, 0};
+        header->windows[w].pm_size = 0;
+        header->windows[w].p_size = 0;
+    }
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        header->slots[i].window = -1;
+        header->slots[i].last_use = 0;
+        header->slots[i].pagemappath[0] = '\0';
+        header->slots[i].pagespath[0] = '\0';
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Reserved memory at %p to store savestates in RAM", arena_addr);
+}
+
+bool SaveStateRam::isEnabled()
+{
+    /* Forked savestates are saved in the memory of the child process */
+    if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK)
+        return false;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_RAM))
+        return false;
+
+    init();
+    return header != nullptr;
+}
+
+bool SaveStateRam::isArena(void* addr, size_t size)
+{
+    if (!arena_addr)
+        return false;
+
+    /* Also match the guard pages */
+    char* a = static_cast<char*>(addr);
+    return (a >= (arena_addr - 4096)) && ((a + size) <= (arena_addr + arena_size + 4096));
+}
+
+bool SaveStateRam::beginSave(int slot, SaveStateStream& pm, SaveStateStream& p)
+{
+    if ((slot < 0) || (slot >= SLOT_COUNT))
+        return false;
+
+    if (!isEnabled())
+        return false;
+
+    /* Find a window that is not used by any slot. There is always one because
+     * there is one more window than slots. */
+    for (int w = 0; w < WINDOW_COUNT; w++) {
+        bool used = false;
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            if (header->slots[i].window == w) {
+                used = true;
+                break;
+            }
+        }
+        if (used)
+            continue;
+
+        /* Allocate the window now, so that it is not larger than the state.
+         * States that do not fit in the window are saved on disk. */
+        RamWindow& window = header->windows[w];
+        releaseWindow(w);
+
+        size_t pm_bound, p_bound;
+        stateBound(pm_bound, p_bound);
+        if (!commitRegion(window.pm, pm_bound) || !commitRegion(window.p, p_bound)) {
+            releaseWindow(w);
+            return false;
+        }
+
+        header->saving_window = w;
+        pm.openRam(window.pm.addr, window.pm.committed, 0);
+        p.openRam(window.p.addr, window.p.committed, 0);
+        return true;
+    }
+
+    return false;
+}
+
+void SaveStateRam::commitSave(int slot, int pinned, SaveStateStream& pm, SaveStateStream& p, const char* pagemappath, const char* pagespath)
+{
+    int w = header->saving_window;
+    MYASSERT(w != -1)
+    header->saving_window = -1;
+
+    RamSlot& s = header->slots[slot];
+    if (s.window >= 0)
+        releaseWindow(s.window);
+
+    s.window = w;
+    s.last_use = ++header->use_counter;
+    header->windows[w].pm_size = pm.size();
+    header->windows[w].p_size = p.size();
+    trimRegion(header->windows[w].pm, pm.size());
+    trimRegion(header->windows[w].p, p.size());
+
+    strncpy(s.pagemappath, pagemappath, 1023);
+    s.pagemappath[1023] = '\0';
+    strncpy(s.pagespath, pagespath, 1023);
+    s.pagespath[1023] = '\0';
+
+    /* Remove any previous savestate file of this slot, so that it cannot be
+     * mixed up with the one in memory */
+    unlink(s.pagemappath);
+    unlink(s.pagespath);
+
+    evictSlots(slot, pinned);
+}
+
+void SaveStateRam::abortSave()
+{
+    if (header && (header->saving_window != -1)) {
+        /* The window content was partially written, release it */
+        releaseWindow(header->saving_window);
+        header->saving_window = -1;
+    }
+}
+
+bool SaveStateRam::hasSlot(int slot)
+{
+    if (!header || (slot < 0) || (slot >= SLOT_COUNT))
+        return false;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_RAM))
+        return false;
+
+    return header->slots[slot].window >= 0;
+}
+
+bool SaveStateRam::openSlot(int slot, SaveStateStream& pm, SaveStateStream& p)
+{
+    if (!hasSlot(slot))
+        return false;
+
+    RamSlot& s = header->slots[slot];
+    s.last_use = ++header->use_counter;
+
+    int w = s.window;
+    pm.openRam(header->windows[w].pm.addr, header->windows[w].pm.committed, header->windows[w].pm_size);
+    p.openRam(header->windows[w].p.addr, header->windows[w].p.committed, header->windows[w].p_size);
+    return true;
+}
+
+size_t SaveStateRam::usedSize()
+{
+    if (!header)
+        return 0;
+
+    size_t size = 0;
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        int w = header->slots[i].window;
+        if (w >= 0)
+            size += header->windows[w].pm_size + header->windows[w].p_size;
+    }
+    return size;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATERAM_H
+#define LIBTAS_SAVESTATERAM_H
+
+#include <cstddef> // size_t
+
+namespace libtas {
+
+class SaveStateStream;
+
+/* Storage of savestates inside memory instead of files. The arena is a single
+ * range reserved once, so that it is present in all savestates and excluded
+ * from checkpointing. It is made of a header and of windows that each hold
+ * one savestate (pagemap and pages). Memory of a window is only allocated when
+ * saving, with the size needed by the current memory, and trimmed to the size
+ * of the state. It then replaces the previous window of the slot, so the
+ * previous state can still be read while saving (incremental savestates).
+ * When the total size goes above the configured budget, the least recently
+ * used states are either moved to their savestate files, or dropped. */
+namespace SaveStateRam {
+
+    enum {
+        SLOT_COUNT = 11,
+        WINDOW_COUNT = SLOT_COUNT + 1,
+    };
+
+    /* Reserve the arena if savestates in RAM are enabled */
+    void init();
+
+    /* Returns if savestates must be stored in RAM */
+    bool isEnabled();
+
+    /* Returns if the memory segment is inside our arena */
+    bool isArena(void* addr, size_t size);
+
+    /* Open streams on a free window to save the state of `slot` */
+    bool beginSave(int slot, SaveStateStream& pm, SaveStateStream& p);
+
+    /* Attach the saved window to the slot and evict other slots if needed.
+     * Paths are used if the state must be moved to disk later. Slot `pinned`
+     * is never evicted. */
+    void commitSave(int slot, int pinned, SaveStateStream& pm, SaveStateStream& p, const char* pagemappath, const char* pagespath);
+
+    /* Release the window if saving failed */
+    void abortSave();
+
+    /* Returns if the state of `slot` is stored in RAM */
+    bool hasSlot(int slot);
+
+    /* Open streams to read the state of `slot`. Returns false if not in RAM */
+    bool openSlot(int slot, SaveStateStream& pm, SaveStateStream& p);
+
+    /* Total size of the states stored in RAM */
+    size_t usedSize();
+}
+}
+
+#endif
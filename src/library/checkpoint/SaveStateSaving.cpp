@@ -20,6 +20,9 @@
 */
 
 #include "SaveStateSaving.h"
+#include "SaveStateStream.h"
+#include "SaveStatePageStore.h"
+#include "CheckpointMetrics.h"
 #include "ReservedMemory.h"
 
 #include "Utils.h"
@@ -38,10 +41,12 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <cstring>
 
 namespace libtas {
 
-SaveStateSaving::SaveStateSaving(int pagemapfd, int pagesfd, int selfpagemapfd)
+SaveStateSaving::SaveStateSaving(SaveStateStream& pagemapstream, SaveStateStream& pagesstream, int selfpagemapfd, int index)
+    : compressor(SaveStateCodec::Compressor::forSlot(index, SaveStateWorkers::getWorkspace(SaveStateWorkers::CALLER)))
 {
     ss_pagemap_i = 0;
     queued_size = 0;
@@ -51,17 +56,42 @@ SaveStateSaving::SaveStateSaving(int pagemapfd, int pagesfd, int selfpagemapfd)
     queued_compressed_size = 0;
     queued_target_addr = nullptr;
 
-    pmfd = pagemapfd;
-    pfd = pagesfd;
+    pmstream = &pagemapstream;
+    pstream = &pagesstream;
     spmfd = selfpagemapfd;
 
     LZ4_initStream(&lz4s, sizeof(lz4s));
+
+    /* Savestates stored in RAM keep their own copy of pages */
+    dedup = SaveStatePageStore::isEnabled() && !pagesstream.isRam();
+    slot = index;
+
+    /* Use the savestate workers to compress pages if available. We keep two
+     * jobs per worker, so that workers are busy while we write the compressed
+     * data of the oldest job. */
+    int worker_count = SaveStateWorkers::count();
+    parallel = (Global::shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) && (worker_count > 0) && !dedup;
+    job_count = 2 * worker_count;
+    if (job_count > SaveStateWorkers::BUFFER_COUNT)
+        job_count = SaveStateWorkers::BUFFER_COUNT;
+    job_head = 0;
+    job_tail = 0;
+    job_filling = false;
+
+    if (parallel) {
+        for (int j = 0; j < job_count; j++) {
+            jobs[j].run = compressJob;
+            jobs[j].compressed_addr = SaveStateWorkers::getBuffer(j);
+            jobs[j].codec = compressor.getCodec();
+            jobs[j].level = compressor.getLevel();
+        }
+    }
 }
 
 void SaveStateSaving::processArea(Area* area)
 {
     /* Save the position of the first area page in the pages file */
-    area->page_offset = lseek(pfd, 0, SEEK_CUR);
+    area->page_offset = pstream->seek(0, SEEK_CUR);
     MYASSERT(area->page_offset != -1)
 
     /* Write the area struct */
@@ -80,7 +110,9 @@ void SaveStateSaving::processArea(Area* area)
     //         area->hash = XXH3_64bits(area->addr, area->size);
     // }
 
-    Utils::writeAll(pmfd, area, sizeof(*area));
+    CheckpointMetrics::beginArea(*area);
+
+    pmstream->write(area, sizeof(*area));
     
     LZ4_resetStream_fast(&lz4s);
 }
@@ -89,17 +121,46 @@ void SaveStateSaving::savePageFlag(char flag)
 {
     /* We write a chunk of savestate pagemaps if it is full */
     if (ss_pagemap_i >= PAGEMAP_CHUNK) {
-        Utils::writeAll(pmfd, ss_pagemaps, PAGEMAP_CHUNK);
-        ss_pagemap_i = 0;
+        flushPageFlags();
     }
 
     ss_pagemaps[ss_pagemap_i++] = flag;
+    CheckpointMetrics::addPage(flag);
 }
 
 size_t SaveStateSaving::queuePageSave(char* addr)
 {
     size_t returned_size = 0;
     
+    if (parallel) {
+        /* Pages are always stored compressed, so we can write the page flag now */
+        savePageFlag(Area::COMPRESSED_PAGE);
+        return queueParallelPageSave(addr);
+    }
+
+    if (dedup) {
+        uint32_t id;
+        {
+            CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_COMPRESS);
+            id = SaveStatePageStore::storePage(addr, slot, compressor);
+        }
+        if (id != SaveStatePageStore::NO_ENTRY) {
+            /* Flush the uncompressed buffer if any, and store the page
+             * identifier with the compressed data */
+            returned_size = flushSave();
+
+            savePageFlag(Area::STORED_PAGE);
+            memcpy(queued_compressed_base_addr + queued_compressed_size, &id, sizeof(uint32_t));
+            queued_compressed_size += sizeof(uint32_t);
+            queued_target_addr = addr + 4096;
+
+            if ((queued_compressed_max_size - queued_compressed_size) < static_cast<int>(SaveStateCodec::PAGE_BOUND + sizeof(int))) {
+                returned_size += flushCompressedSave();
+            }
+            return returned_size;
+        }
+    }
+
     if (Global::shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
         /* Try to compress the memory page */
         if ((queued_compressed_size > 0) && (addr != queued_target_addr)) {
@@ -109,14 +170,18 @@ size_t SaveStateSaving::queuePageSave(char* addr)
             
         /* Append the compressed data to the current stream */
         int compressed_size;
-        if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+        char* compressed_addr = queued_compressed_base_addr + queued_compressed_size + sizeof(int);
+        int compressed_capacity = queued_compressed_max_size - (queued_compressed_size + sizeof(int));
+        TimeHolder compress_time = TimeHolder::now();
+        if (hasIndependentBlocks()) {
             /* For incremental savestates, not all blocks may be decompressed, so
              * we must compress each block independantly */
-            compressed_size = LZ4_compress_fast(addr, queued_compressed_base_addr + queued_compressed_size + sizeof(int), 4096, queued_compressed_max_size - (queued_compressed_size + sizeof(int)), 1);
+            compressed_size = compressor.compressPage(addr, compressed_addr, compressed_capacity);
         }
         else {
-            compressed_size = LZ4_compress_fast_continue(&lz4s, addr, queued_compressed_base_addr + queued_compressed_size + sizeof(int), 4096, queued_compressed_max_size - (queued_compressed_size + sizeof(int)), 1);
+            compressed_size = LZ4_compress_fast_continue(&lz4s, addr, compressed_addr, 4096, compressed_capacity, compressor.getLevel());
         }
+        CheckpointMetrics::addTime(SaveStateMetrics::PHASE_COMPRESS, compress_time);
         if (compressed_size) {
             /* Flush the uncompressed buffer if any */
             returned_size = flushSave();
@@ -127,7 +192,7 @@ size_t SaveStateSaving::queuePageSave(char* addr)
             queued_target_addr = addr + 4096;
 
             /* Check for remaining size */
-            if ((queued_compressed_max_size - queued_compressed_size) < LZ4_COMPRESSBOUND(4096)) {
+            if ((queued_compressed_max_size - queued_compressed_size) < static_cast<int>(SaveStateCodec::PAGE_BOUND + sizeof(int))) {
                 returned_size += flushCompressedSave();
             }
             return returned_size;
@@ -139,6 +204,9 @@ size_t SaveStateSaving::queuePageSave(char* addr)
         }
     }
 
+    /* Flush the identifiers of stored pages if any */
+    returned_size += flushCompressedSave();
+
     /* Save regular memory page */
     savePageFlag(Area::FULL_PAGE);
     
@@ -160,7 +228,8 @@ size_t SaveStateSaving::queuePageSave(char* addr)
 size_t SaveStateSaving::flushSave()
 {
     if (queued_size > 0) {
-        Utils::writeAll(pfd, queued_addr, queued_size);
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+        pstream->write(queued_addr, queued_size);
         int returned_size = queued_size;
         queued_size = 0;
         return returned_size;
@@ -171,7 +240,8 @@ size_t SaveStateSaving::flushSave()
 size_t SaveStateSaving::flushCompressedSave()
 {
     if (queued_compressed_size > 0) {
-        Utils::writeAll(pfd, queued_compressed_base_addr, queued_compressed_size);
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+        pstream->write(queued_compressed_base_addr, queued_compressed_size);
         int returned_size = queued_compressed_size;
         queued_compressed_size = 0;
         return returned_size;        
@@ -179,17 +249,201 @@ size_t SaveStateSaving::flushCompressedSave()
     return 0;
 }
 
+bool SaveStateSaving::hasIndependentBlocks() const
+{
+    /* Only LZ4 can compress pages as a stream, and pages in between are
+     * skipped when using the page store */
+    return parallel || dedup || (compressor.getCodec() != SharedConfig::SS_CODEC_LZ4) ||
+        (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL);
+}
+
+int SaveStateSaving::getCodec() const
+{
+    return compressor.getCodec();
+}
+
+size_t SaveStateSaving::queueParallelPageSave(char* addr)
+{
+    size_t returned_size = 0;
+
+    if (!job_filling) {
+        /* Write the jobs that are already finished, and wait for the oldest
+         * one if all jobs are in use */
+        while ((job_head != job_tail) && (jobs[job_head % job_count].state.load() == SaveStateWorkers::Task::ST_DONE))
+            returned_size += writeJob(false);
+        if ((job_tail - job_head) >= job_count)
+            returned_size += writeJob(true);
+
+        CompressJob& job = jobs[job_tail % job_count];
+        job.run_count = 0;
+        job.page_count = 0;
+        job.flags_updated = false;
+        job_filling = true;
+    }
+
+    CompressJob& job = jobs[job_tail % job_count];
+
+    /* The page flag was just written, and may change if the page cannot be
+     * compressed */
+    job.flag_index[job.page_count] = ss_pagemap_i - 1;
+
+    /* Extend the last run if the page is contiguous */
+    if ((job.run_count > 0) &&
+        (addr == (job.runs[job.run_count-1].addr + 4096 * job.runs[job.run_count-1].count))) {
+        job.runs[job.run_count-1].count++;
+    }
+    else {
+        job.runs[job.run_count].addr = addr;
+        job.runs[job.run_count].count = 1;
+        job.run_count++;
+    }
+    job.page_count++;
+
+    if ((job.page_count == JOB_PAGES) || (job.run_count == JOB_RUNS))
+        submitJob();
+
+    return returned_size;
+}
+
+void SaveStateSaving::submitJob()
+{
+    if (!job_filling)
+        return;
+
+    SaveStateWorkers::submit(&jobs[job_tail % job_count]);
+    job_tail++;
+    job_filling = false;
+}
+
+size_t SaveStateSaving::writeJob(bool wait)
+{
+    CompressJob& job = jobs[job_head % job_count];
+    if (wait) {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_COMPRESS);
+        SaveStateWorkers::wait(&job);
+    }
+    else {
+        job.state.store(SaveStateWorkers::Task::ST_IDLE);
+    }
+
+    updateJobFlags(job);
+
+    {
+        CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_IO);
+        pstream->write(job.compressed_addr, job.compressed_size);
+    }
+    job_head++;
+    return job.compressed_size;
+}
+
+void SaveStateSaving::compressJob(SaveStateWorkers::Task* task, int worker)
+{
+    static_assert(JOB_PAGES * (SaveStateCodec::PAGE_BOUND + sizeof(int)) <= SaveStateWorkers::BUFFER_SIZE, "Compression jobs don't fit in worker buffers");
+
+    CompressJob* job = static_cast<CompressJob*>(task);
+    char* dst = job->compressed_addr;
+
+    SaveStateCodec::Compressor job_compressor(job->codec, job->level, SaveStateWorkers::getWorkspace(worker));
+
+    int page = 0;
+    for (int r = 0; r < job->run_count; r++) {
+        char* src = job->runs[r].addr;
+        for (int p = 0; p < job->runs[r].count; p++, src += 4096, page++) {
+            /* Blocks are compressed independently, which can also be read by
+             * the stream decoder of non-incremental savestates */
+            int compressed_size = job_compressor.compressPage(src, dst + sizeof(int), SaveStateCodec::PAGE_BOUND);
+            if (compressed_size) {
+                memcpy(dst, &compressed_size, sizeof(int));
+                dst += compressed_size + sizeof(int);
+                job->full_page[page] = false;
+            }
+            else {
+                /* Could not compress the memory page, store the regular page */
+                memcpy(dst, src, 4096);
+                dst += 4096;
+                job->full_page[page] = true;
+            }
+        }
+    }
+
+    job->compressed_size = dst - job->compressed_addr;
+}
+
+void SaveStateSaving::flushPageFlags()
+{
+    /* Flags of pages that are still compressed may change, so we keep the end
+     * of the chunk from the first of them */
+    int kept = ss_pagemap_i;
+    int last_job = job_filling ? (job_tail + 1) : job_tail;
+
+    if (parallel) {
+        for (int j = job_head; j < last_job; j++) {
+            CompressJob& job = jobs[j % job_count];
+            if (job.flags_updated || (job.page_count == 0))
+                continue;
+
+            if (job.flag_index[0] > 0) {
+                kept = job.flag_index[0];
+                break;
+            }
+
+            /* The whole chunk belongs to unfinished jobs, wait for the oldest */
+            if (j == job_tail)
+                submitJob();
+            {
+                CheckpointMetrics::Timer timer(SaveStateMetrics::PHASE_COMPRESS);
+                SaveStateWorkers::wait(&job);
+            }
+            updateJobFlags(job);
+        }
+    }
+
+    pmstream->write(ss_pagemaps, kept);
+    memmove(ss_pagemaps, ss_pagemaps + kept, ss_pagemap_i - kept);
+    ss_pagemap_i -= kept;
+
+    if (parallel) {
+        for (int j = job_head; j < last_job; j++) {
+            CompressJob& job = jobs[j % job_count];
+            if (job.flags_updated)
+                continue;
+            for (int p = 0; p < job.page_count; p++)
+                job.flag_index[p] -= kept;
+        }
+    }
+}
+
+void SaveStateSaving::updateJobFlags(CompressJob& job)
+{
+    if (job.flags_updated)
+        return;
+
+    for (int p = 0; p < job.page_count; p++) {
+        if (job.full_page[p])
+            ss_pagemaps[job.flag_index[p]] = Area::FULL_PAGE;
+    }
+    job.flags_updated = true;
+}
+
 size_t SaveStateSaving::finishSave()
 {
     size_t returned_size = 0;
     
+    /* Write all compression jobs, because the next area must know the
+     * position of its first page in the pages file. */
+    if (parallel) {
+        submitJob();
+        while (job_head != job_tail)
+            returned_size += writeJob(true);
+    }
+
     /* We don't care about the following order of the saves, because code
      * guarantees that at most one of those has non-zero queue size. */
     returned_size += flushSave();
     returned_size += flushCompressedSave();
     
     /* Writing the last savestate pagemap chunk */
-    Utils::writeAll(pmfd, ss_pagemaps, ss_pagemap_i);
+    pmstream->write(ss_pagemaps, ss_pagemap_i);
     ss_pagemap_i = 0;
     
     return returned_size;
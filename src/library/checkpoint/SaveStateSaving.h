@@ -23,16 +23,20 @@
 #define LIBTAS_SAVESTATESAVING_H
 
 #include "MemArea.h"
+#include "SaveStateWorkers.h"
+#include "SaveStateCodec.h"
 #include "../external/lz4.h"
 
 namespace libtas {
 
 struct StateHeader;
+class SaveStateStream;
 
 class SaveStateSaving
 {
 public:
-    SaveStateSaving(int pagemapfd, int pagesfd, int selfpagemapfd);
+    /* Save the state of `index`, which determines the compression codec */
+    SaveStateSaving(SaveStateStream& pagemapstream, SaveStateStream& pagesstream, int selfpagemapfd, int index);
 
     /* Import an area and fill some missing members */
     void processArea(Area* area);
@@ -46,6 +50,12 @@ public:
     /* Finish processing a memory area */
     size_t finishSave();
 
+    /* Returns if compressed pages can be decompressed independently */
+    bool hasIndependentBlocks() const;
+
+    /* Codec used to compress pages */
+    int getCodec() const;
+
 private:
 
     /* Flush the queue of noncompressed data, and returns the number of written bytes */
@@ -54,10 +64,59 @@ private:
     /* Flush the queue of compressed data, and returns the number of written bytes */
     size_t flushCompressedSave();
 
+    /* Add a page to the job being filled, and submit it to the workers when full */
+    size_t queueParallelPageSave(char* addr);
+
+    /* Submit the job being filled to the workers */
+    void submitJob();
+
+    /* Write the compressed data of the oldest submitted job, after waiting for
+     * it if `wait` is true. Returns the number of written bytes */
+    size_t writeJob(bool wait);
+
     enum {
-        PAGEMAP_CHUNK = 4096
+        PAGEMAP_CHUNK = 4096,
+        JOB_PAGES = 256,
+        JOB_RUNS = 64,
+    };
+
+    /* Contiguous pages to be compressed by a worker. Pages are compressed
+     * independently, and stored with the same layout as the serial saving. */
+    struct CompressJob : SaveStateWorkers::Task {
+        struct Run {
+            char* addr;
+            int count;
+        };
+
+        Run runs[JOB_RUNS];
+        int run_count;
+        int page_count;
+
+        /* Index of the flag of each page inside the chunk of page flags, and
+         * if the page was stored without compression because of an error */
+        int flag_index[JOB_PAGES];
+        bool full_page[JOB_PAGES];
+        bool flags_updated;
+
+        /* Compression codec and level */
+        int codec;
+        int level;
+
+        /* Buffer holding the compressed data, and its size */
+        char* compressed_addr;
+        size_t compressed_size;
     };
 
+    static void compressJob(SaveStateWorkers::Task* task, int worker);
+
+    /* Write the chunk of page flags, except the flags of pages that are still
+     * compressed by workers */
+    void flushPageFlags();
+
+    /* Change the flags of the pages of a finished job that could not be
+     * compressed */
+    void updateJobFlags(CompressJob& job);
+
     /* Chunk of savestate pagemap values */
     char ss_pagemaps[PAGEMAP_CHUNK];
 
@@ -66,8 +125,13 @@ private:
 
     LZ4_stream_t lz4s;
 
-    /* File descriptors */
-    int pmfd, pfd, spmfd;
+    SaveStateCodec::Compressor compressor;
+
+    /* Savestate files */
+    SaveStateStream *pmstream, *pstream;
+
+    /* File descriptor of /proc/self/pagemap */
+    int spmfd;
 
     /* Address and size of the memory segment that is queued to be saved */
     char* queued_addr;
@@ -81,6 +145,21 @@ private:
     /* Target address and size of the compressed memory segments that are queued to be saved */
     char* queued_target_addr;
     int queued_compressed_size;
+
+    /* Are pages compressed by the savestate workers */
+    bool parallel;
+
+    /* Are pages stored in the page store, and the slot of the savestate */
+    bool dedup;
+    int slot;
+
+    /* Ring of compression jobs. Jobs in [job_head, job_tail) were submitted,
+     * and job_tail is being filled if job_filling is true. */
+    CompressJob jobs[SaveStateWorkers::BUFFER_COUNT];
+    int job_count;
+    int job_head;
+    int job_tail;
+    bool job_filling;
 };
 }
 
@@ -0,0 +1,184 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateSize.h"
+#include "SaveStateDirty.h"
+#include "ReservedMemory.h"
+#include "MemArea.h"
+#ifdef __unix__
+#include "ProcSelfMaps.h"
+#elif defined(__APPLE__) && defined(__MACH__)
+#include "MachVmMaps.h"
+#endif
+
+#include "logging.h"
+#include "Utils.h"
+#include "global.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h> // PRIu64
+
+namespace libtas {
+
+static SaveStateSize::Storage* getStorage()
+{
+    return static_cast<SaveStateSize::Storage*>(ReservedMemory::getAddr(ReservedMemory::SIZE_ESTIMATE_ADDR));
+}
+
+/* Count the bytes of an area that would be stored, using the same page
+ * categories as when saving, except for zero pages that cannot be detected
+ * without reading memory. */
+static uint64_t estimateArea(Area &area, int spmfd, bool dirty_only)
+{
+    uint64_t size = sizeof(Area);
+
+    if (area.skip)
+        return size;
+
+    /* Uncommitted areas are only detected when saving, so it is done here.
+     * They don't have any page, so their pagemap is not read. */
+    bool uncommitted = area.isUncommitted(spmfd);
+    if (uncommitted && (Global::shared_config.savestate_settings & SharedConfig::SS_PRESENT))
+        return size;
+
+    /* One flag per page */
+    size_t nb_pages = area.size / 4096;
+    size += nb_pages;
+
+    if (uncommitted)
+        return size;
+
+    if (-1 == lseek(spmfd, static_cast<off_t>(reinterpret_cast<uintptr_t>(area.addr) / (4096/8)), SEEK_SET))
+        return size + area.size;
+
+    uint64_t pagemaps[512];
+    SaveStateDirty::Scanner written_pages(spmfd, area.addr, area.endAddr);
+
+    char* curAddr = static_cast<char*>(area.addr);
+    for (size_t page_i = 0; page_i < nb_pages; page_i += 512) {
+        size_t chunk_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
+        Utils::readAll(spmfd, pagemaps, chunk_pages*8);
+
+        for (size_t i = 0; i < chunk_pages; i++, curAddr += 4096) {
+            uint64_t page = pagemaps[i];
+            bool page_guard_region = page & (0x1ull << 58);
+            bool page_file = page & (0x1ull << 61);
+            bool page_present = page & (0x1ull << 63);
+
+            if (page_guard_region || !page_present)
+                continue;
+
+            if ((area.flags & Area::AREA_PRIV) && (area.flags & Area::AREA_FILE) && page_file)
+                continue;
+
+            if (dirty_only) {
+                bool soft_dirty = SaveStateDirty::isEnabled() ? written_pages.isWritten(curAddr) : (page & (0x1ull << 55));
+                if (!soft_dirty)
+                    continue;
+            }
+
+            size += 4096;
+        }
+    }
+
+    return size;
+}
+
+uint64_t SaveStateSize::estimate(int slot, bool dirty_only)
+{
+    Storage* storage = getStorage();
+    storage->raw_size = 0;
+    storage->current_slot = slot;
+
+    int spmfd = open("/proc/self/pagemap", O_RDONLY);
+    if (spmfd == -1)
+        return 0;
+
+#ifdef __unix__
+    ProcSelfMaps memMapLayout;
+#elif defined(__APPLE__) && defined(__MACH__)
+    MachVmMaps memMapLayout;
+#endif
+
+    Area area;
+    while (memMapLayout.getNextArea(&area)) {
+        storage->raw_size += estimateArea(area, spmfd, dirty_only);
+    }
+    close(spmfd);
+
+    float ratio = 0;
+    if ((slot >= 0) && (slot < SLOT_COUNT))
+        ratio = storage->slot_ratio[slot];
+    if (ratio == 0)
+        ratio = storage->last_ratio;
+    if (ratio == 0)
+        ratio = 1.0f;
+
+    storage->estimated_size = static_cast<uint64_t>(storage->raw_size * ratio);
+    storage->saved_size = 0;
+    storage->saved_size_known = false;
+    storage->available_size = 0;
+    storage->to_report = true;
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Estimated size of state %d: %" PRIu64 " bytes (%" PRIu64 " before compression)", slot, storage->estimated_size, storage->raw_size);
+
+    return storage->estimated_size;
+}
+
+void SaveStateSize::addSaved(uint64_t size, bool last)
+{
+    Storage* storage = getStorage();
+    storage->saved_size += size;
+
+    if (!last || (storage->raw_size == 0))
+        return;
+
+    storage->saved_size_known = true;
+
+    float ratio = static_cast<float>(storage->saved_size) / storage->raw_size;
+    if ((storage->current_slot >= 0) && (storage->current_slot < SLOT_COUNT))
+        storage->slot_ratio[storage->current_slot] = ratio;
+    storage->last_ratio = ratio;
+
+    /* Savestates without estimation (e.g. states in RAM) must not use the
+     * estimation of this checkpoint */
+    storage->raw_size = 0;
+}
+
+void SaveStateSize::setAvailable(uint64_t size)
+{
+    getStorage()->available_size = size;
+}
+
+bool SaveStateSize::getReport(int* slot, uint64_t* estimated, uint64_t* actual, uint64_t* available)
+{
+    Storage* storage = getStorage();
+    if (!storage->to_report)
+        return false;
+
+    *slot = storage->current_slot;
+    *estimated = storage->estimated_size;
+    *actual = storage->saved_size_known ? storage->saved_size : 0;
+    *available = storage->available_size;
+    storage->to_report = false;
+    return true;
+}
+
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATESIZE_H
+#define LIBTAS_SAVESTATESIZE_H
+
+#include <cstdint>
+
+namespace libtas {
+
+/* Estimation of the size of a savestate before performing it. Memory pages
+ * that would be stored are counted from /proc/self/pagemap only, without
+ * reading any page, and the result is scaled by the compression ratio of the
+ * previous savestates of the same slot. */
+namespace SaveStateSize {
+
+    enum {
+        SLOT_COUNT = 11,
+    };
+
+    /* Storage of the estimator inside the reserved memory, so that the
+     * compression ratios are kept when loading a state */
+    struct Storage {
+        /* Ratio between the size of the last savestate of each slot and its
+         * estimated size without compression, or 0 if unknown */
+        float slot_ratio[SLOT_COUNT];
+
+        /* Last measured ratio of any slot, used for slots without savestate */
+        float last_ratio;
+
+        /* Estimation without compression and slot of the current checkpoint */
+        uint64_t raw_size;
+        int current_slot;
+
+        /* Sizes to report to the program */
+        uint64_t estimated_size;
+        uint64_t saved_size;
+        uint64_t available_size;
+        bool saved_size_known;
+        bool to_report;
+    };
+
+    /* Estimate the size of the next savestate of `slot`. If `dirty_only` is
+     * true, only pages written since the last checkpoint are counted. This is
+     * then a lower bound, because pages that are not dirty but were stored as
+     * full pages in the parent savestate are copied again, and counting them
+     * would require reading the parent pagemap. */
+    uint64_t estimate(int slot, bool dirty_only);
+
+    /* Add the size of a savestate written during the checkpoint. If `last` is
+     * true, this was the last savestate of the checkpoint (base savestates are
+     * written before), and the compression ratio of the slot is updated. */
+    void addSaved(uint64_t size, bool last);
+
+    /* Set the available space to store the savestate, or 0 if unknown */
+    void setAvailable(uint64_t size);
+
+    /* Get the slot, estimated size, actual size (0 if unknown) and available
+     * space of the last savestate. Returns false if there is nothing new to
+     * report to the program. */
+    bool getReport(int* slot, uint64_t* estimated, uint64_t* actual, uint64_t* available);
+}
+}
+
+#endif
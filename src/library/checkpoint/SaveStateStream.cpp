@@ -0,0 +1,167 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateStream.h"
+
+#include "Utils.h"
+#include "logging.h"
+#include "GlobalState.h"
+
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+namespace libtas {
+
+SaveStateStream::~SaveStateStream()
+{
+    close();
+}
+
+void SaveStateStream::openFd(int f)
+{
+    close();
+    fd = f;
+}
+
+void SaveStateStream::openRam(char* a, size_t c, size_t s)
+{
+    close();
+    addr = a;
+    capacity = c;
+    length = s;
+    pos = 0;
+    overflowed = false;
+}
+
+void SaveStateStream::openCopy(const SaveStateStream& other)
+{
+    if (other.fd != -1) {
+        int f;
+        NATIVECALL(f = dup(other.fd));
+        openFd(f);
+    }
+    else {
+        openRam(other.addr, other.capacity, other.length);
+    }
+}
+
+void SaveStateStream::close()
+{
+    if (fd != -1) {
+        NATIVECALL(::close(fd));
+        fd = -1;
+    }
+    addr = nullptr;
+}
+
+void SaveStateStream::write(const void* buf, size_t count)
+{
+    if (fd != -1) {
+        Utils::writeAll(fd, buf, count);
+        return;
+    }
+
+    if (overflowed)
+        return;
+
+    if ((pos + count) > capacity) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Savestate does not fit inside the reserved memory of %zu bytes", capacity);
+        overflowed = true;
+        return;
+    }
+
+    memcpy(addr + pos, buf, count);
+    pos += count;
+    if (static_cast<size_t>(pos) > length)
+        length = pos;
+}
+
+size_t SaveStateStream::read(void* buf, size_t count)
+{
+    if (fd != -1) {
+        ssize_t ret = Utils::readAll(fd, buf, count);
+        return (ret < 0) ? 0 : ret;
+    }
+
+    if (static_cast<size_t>(pos) >= length)
+        return 0;
+
+    if ((pos + count) > length)
+        count = length - pos;
+
+    memcpy(buf, addr + pos, count);
+    pos += count;
+    return count;
+}
+
+size_t SaveStateStream::readAt(void* buf, size_t count, off_t offset) const
+{
+    if (fd != -1) {
+        size_t total = 0;
+        while (total < count) {
+            ssize_t ret;
+            NATIVECALL(ret = pread(fd, static_cast<char*>(buf) + total, count - total, offset + total));
+            if ((ret == -1) && (errno == EINTR))
+                continue;
+            if (ret <= 0)
+                break;
+            total += ret;
+        }
+        return total;
+    }
+
+    if ((offset < 0) || (static_cast<size_t>(offset) >= length))
+        return 0;
+
+    if ((offset + count) > length)
+        count = length - offset;
+
+    memcpy(buf, addr + offset, count);
+    return count;
+}
+
+off_t SaveStateStream::seek(off_t offset, int whence)
+{
+    if (fd != -1)
+        return lseek(fd, offset, whence);
+
+    off_t new_pos;
+    switch (whence) {
+        case SEEK_SET:
+            new_pos = offset;
+            break;
+        case SEEK_CUR:
+            new_pos = pos + offset;
+            break;
+        case SEEK_END:
+            new_pos = length + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (new_pos < 0)
+        return -1;
+
+    pos = new_pos;
+    return pos;
+}
+
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATESTREAM_H
+#define LIBTAS_SAVESTATESTREAM_H
+
+#include <cstddef> // size_t
+#include <sys/types.h> // off_t
+
+namespace libtas {
+
+/* File-like access to one savestate file (pagemap or pages). The content is
+ * either stored in a regular file, or directly inside a memory buffer when
+ * savestates are kept in RAM. This class never allocates memory, so it can be
+ * used from the checkpoint signal handler. */
+class SaveStateStream
+{
+public:
+    SaveStateStream() = default;
+    ~SaveStateStream();
+
+    SaveStateStream(const SaveStateStream&) = delete;
+    SaveStateStream& operator=(const SaveStateStream&) = delete;
+
+    /* Use a file descriptor, which will be closed by this object */
+    void openFd(int fd);
+
+    /* Use a memory buffer of `capacity` bytes, with `size` bytes of content */
+    void openRam(char* addr, size_t capacity, size_t size);
+
+    /* Access the same content as `other`, with a separate position. The
+     * file descriptor is duplicated, so it can be closed independently */
+    void openCopy(const SaveStateStream& other);
+
+    void close();
+
+    void write(const void* buf, size_t count);
+
+    /* Returns the number of read bytes */
+    size_t read(void* buf, size_t count);
+
+    off_t seek(off_t offset, int whence);
+
+    /* Read at `offset` without changing the position, so that it can be
+     * called from another thread. Returns the number of read bytes */
+    size_t readAt(void* buf, size_t count, off_t offset) const;
+
+    /* Size of the content, only valid for memory buffers */
+    size_t size() const {return length;}
+
+    /* Returns if a write did not fit inside the memory buffer */
+    bool hasOverflowed() const {return overflowed;}
+
+    bool isRam() const {return addr != nullptr;}
+
+    explicit operator bool() const {
+        return (fd != -1) || (addr != nullptr);
+    }
+
+private:
+    int fd = -1;
+
+    char* addr = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    off_t pos = 0;
+    bool overflowed = false;
+};
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateWorkers.h"
+
+#include "logging.h"
+#include "GlobalState.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+namespace libtas {
+
+namespace {
+
+enum {
+    QUEUE_SIZE = 64,
+    /* Worker stacks also hold the thread control block and static TLS */
+    WORKER_STACK_SIZE = 1024 * 1024,
+};
+
+/* Queue of tasks, stored at the beginning of the reserved segment so that it
+ * is not modified when loading a savestate. There is a single producer (the
+ * checkpoint thread) and multiple consumers (the workers). */
+struct WorkQueue {
+    std::atomic<int> head;
+    std::atomic<int> tail;
+    SaveStateWorkers::Task* tasks[QUEUE_SIZE];
+};
+
+}
+
+static char* segment_addr = nullptr;
+static size_t segment_size = 0;
+static WorkQueue* queue = nullptr;
+static int worker_count = 0;
+static pid_t worker_pid = 0;
+
+#ifdef __linux__
+static void futexWait(std::atomic<int>* word, int value)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+static void futexWake(std::atomic<int>* word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+#endif
+
+static char* stackAddr(int index)
+{
+    return segment_addr + 4096 + index * WORKER_STACK_SIZE;
+}
+
+char* SaveStateWorkers::getBuffer(int index)
+{
+    return stackAddr(MAX_WORKERS) + index * BUFFER_SIZE;
+}
+
+char* SaveStateWorkers::getWorkspace(int worker)
+{
+    if (!segment_addr)
+        return nullptr;
+    return getBuffer(BUFFER_COUNT) + static_cast<size_t>(worker) * WORKSPACE_SIZE;
+}
+
+static void* workerLoop(void* arg)
+{
+#ifdef __linux__
+    int worker = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+
+    while (true) {
+        int head = queue->head.load();
+        int tail = queue->tail.load();
+
+        if (head == tail) {
+            futexWait(&queue->tail, tail);
+            continue;
+        }
+
+        /* Read the task before taking it, because the slot may be reused by
+         * the producer as soon as the head is incremented. */
+        SaveStateWorkers::Task* task = queue->tasks[head % QUEUE_SIZE];
+        if (!queue->head.compare_exchange_weak(head, head + 1))
+            continue;
+
+        task->run(task, worker);
+
+        task->state.store(SaveStateWorkers::Task::ST_DONE);
+        futexWake(&task->state, INT_MAX);
+    }
+#endif
+    return nullptr;
+}
+
+void SaveStateWorkers::init()
+{
+#if defined(__linux__) && defined(__x86_64__)
+    if (segment_addr)
+        return;
+
+    /* Segment layout: a page holding the queue, the worker stacks, the buffers,
+     * the workspaces of the workers and of the checkpoint thread, and a guard
+     * page at each end. The whole segment is always reserved with the maximum
+     * number of workers so that its size never changes. */
+    segment_size = 4096 + static_cast<size_t>(MAX_WORKERS) * WORKER_STACK_SIZE +
+        static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE +
+        static_cast<size_t>(MAX_WORKERS + 1) * WORKSPACE_SIZE;
+    void* addr = mmap(nullptr, segment_size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not reserve memory for savestate workers");
+        segment_size = 0;
+        return;
+    }
+    segment_addr = static_cast<char*>(addr) + 4096;
+    MYASSERT(mprotect(segment_addr, segment_size, PROT_READ | PROT_WRITE) == 0)
+
+    queue = new (segment_addr) WorkQueue();
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Keep one core for the checkpoint thread */
+    int count = static_cast<int>(cpus) - 1;
+    if (count > MAX_WORKERS)
+        count = MAX_WORKERS;
+    if (count <= 0)
+        return;
+
+    /* Workers must never handle signals, especially the ones used to suspend
+     * threads, so we block all signals while creating them. */
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals));
+
+    for (int i = 0; i < count; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstack(&attr, stackAddr(i), WORKER_STACK_SIZE);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        pthread_t thread;
+        int ret;
+        NATIVECALL(ret = pthread_create(&thread, &attr, workerLoop, reinterpret_cast<void*>(static_cast<intptr_t>(i))));
+        pthread_attr_destroy(&attr);
+
+        if (ret != 0) {
+            LOG(LL_WARN, LCF_CHECKPOINT, "Could not create savestate worker %d", i);
+            break;
+        }
+        worker_count++;
+    }
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &old_signals, nullptr));
+
+    NATIVECALL(worker_pid = getpid());
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Created %d savestate workers", worker_count);
+#endif
+}
+
+int SaveStateWorkers::count()
+{
+    /* Workers don't exist in a forked process */
+    if (worker_count == 0)
+        return 0;
+
+    pid_t pid;
+    NATIVECALL(pid = getpid());
+    if (pid != worker_pid)
+        return 0;
+
+    return worker_count;
+}
+
+bool SaveStateWorkers::isReserved(void* addr, size_t size)
+{
+    return segment_addr && (addr == segment_addr) && (size == segment_size);
+}
+
+void SaveStateWorkers::submit(Task* task)
+{
+#ifdef __linux__
+    /* The queue can only be full if many tasks are submitted without waiting
+     * for them, so just wait for a worker to take one. */
+    while ((queue->tail.load() - queue->head.load()) >= QUEUE_SIZE)
+        sched_yield();
+
+    task->state.store(Task::ST_QUEUED);
+
+    int tail = queue->tail.load();
+    queue->tasks[tail % QUEUE_SIZE] = task;
+    queue->tail.store(tail + 1);
+    futexWake(&queue->tail, 1);
+#endif
+}
+
+void SaveStateWorkers::wait(Task* task)
+{
+#ifdef __linux__
+    int state;
+    while ((state = task->state.load()) == Task::ST_QUEUED)
+        futexWait(&task->state, state);
+    task->state.store(Task::ST_IDLE);
+#endif
+}
+
+}
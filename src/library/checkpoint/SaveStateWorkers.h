@@ -0,0 +1,86 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEWORKERS_H
+#define LIBTAS_SAVESTATEWORKERS_H
+
+#include <atomic>
+#include <cstddef> // size_t
+
+namespace libtas {
+
+/* Pool of worker threads used by the checkpoint code to process memory pages
+ * in parallel. Workers are spawned at startup, are not registered in the
+ * ThreadManager (so they are not suspended during checkpoints), and keep their
+ * stacks and buffers inside a reserved memory segment that is excluded from
+ * savestates. They only wait on futexes, so the checkpoint thread can submit
+ * tasks without allocating memory or calling any hooked function. */
+namespace SaveStateWorkers {
+
+    enum {
+        MAX_WORKERS = 8,
+        BUFFER_COUNT = 2 * MAX_WORKERS,
+        BUFFER_SIZE = 2 * 1024 * 1024,
+        /* Index of the workspace used by the checkpoint thread itself */
+        CALLER = MAX_WORKERS,
+        WORKSPACE_SIZE = 4 * 1024 * 1024,
+    };
+
+    /* Task to be executed by a worker. Tasks are owned by the caller, and
+     * must stay alive until `wait()` returns. */
+    struct Task {
+        enum State {
+            ST_IDLE,
+            ST_QUEUED,
+            ST_DONE,
+        };
+
+        /* Function executed by the worker of index `worker` */
+        void (*run)(Task* task, int worker);
+        std::atomic<int> state{ST_IDLE};
+    };
+
+    /* Reserve the memory segment and spawn the worker threads */
+    void init();
+
+    /* Number of workers available to the caller, or 0 if tasks must be
+     * processed by the caller (no workers or inside a forked process). */
+    int count();
+
+    /* Get one of the `BUFFER_COUNT` buffers of `BUFFER_SIZE` bytes, stored
+     * in the reserved segment */
+    char* getBuffer(int index);
+
+    /* Get the workspace of `WORKSPACE_SIZE` bytes owned by a worker, or by
+     * the checkpoint thread if `worker` is `CALLER`. Returns nullptr if the
+     * reserved segment could not be created. */
+    char* getWorkspace(int worker);
+
+    /* Returns if the memory segment holds the workers stacks and buffers */
+    bool isReserved(void* addr, size_t size);
+
+    /* Queue a task to be executed by a worker */
+    void submit(Task* task);
+
+    /* Wait for a submitted task to finish */
+    void wait(Task* task);
+}
+}
+
+#endif
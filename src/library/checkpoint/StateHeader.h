@@ -23,16 +23,44 @@
 #define LIBTAS_STATEHEADER_H
 
 #include <pthread.h>
+#include <cstddef> // offsetof
 
 #define STATEMAXTHREADS 1000
 
 namespace libtas {
 struct StateHeader {
+    enum {
+        MAGIC = 0x5354534c, // "LSTS"
+        VERSION = 1,
+    };
+
+    enum Flags {
+        /* Compressed pages can be decompressed independently */
+        INDEPENDENT_BLOCKS = 0x01,
+    };
+
+    int magic;
+    int version;
+    int flags;
+    int codec; // SharedConfig::SaveStateCodec used for compressed pages
     int thread_count;
     pthread_t pthread_ids[STATEMAXTHREADS];
     pid_t tids[STATEMAXTHREADS];
     int states[STATEMAXTHREADS];
 };
+
+/* Header of savestates made before the header had a magic number, which
+ * starts with the thread count. Pages were always compressed with LZ4. */
+struct LegacyStateHeader {
+    int thread_count;
+    pthread_t pthread_ids[STATEMAXTHREADS];
+    pid_t tids[STATEMAXTHREADS];
+    int states[STATEMAXTHREADS];
+};
+
+static_assert(sizeof(StateHeader) - offsetof(StateHeader, pthread_ids) ==
+    sizeof(LegacyStateHeader) - offsetof(LegacyStateHeader, pthread_ids),
+    "Thread lists of savestate headers must have the same layout");
 }
 
 #endif
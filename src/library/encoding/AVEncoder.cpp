@@ -29,6 +29,8 @@
 #include "../shared/messages.h"
 
 #include <cstdint>
+#include <cstring>
+#include <signal.h>
 #include <unistd.h> // usleep
 #include <sstream>
 #include <iomanip>
@@ -76,8 +78,12 @@ AVEncoder::AVEncoder() {
         ffmpeg_pipe = fdopen(pipefd[1], "w");
     }
 
+    queue_size = Global::shared_config.encode_queue_size;
+    queue_policy = Global::shared_config.encode_queue_policy;
+
     if (ScreenCapture::isInited()) {
         initMuxer();
+        startThread();
     }
 
     segment_number++;
@@ -95,9 +101,9 @@ void AVEncoder::initMuxer() {
     /* Initialize the muxer with either framerate or video framerate */
     AudioContext& audiocontext = AudioContext::get();
     if (Global::shared_config.video_framerate)
-        nutMuxer = new NutMuxer(width, height, Global::shared_config.video_framerate, 1, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, ffmpeg_pipe);
+        nutMuxer = new NutMuxer(width, height, Global::shared_config.video_framerate, 1, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, Global::shared_config.encode_skip_duplicates, ffmpeg_pipe);
     else
-        nutMuxer = new NutMuxer(width, height, Global::shared_config.initial_framerate_num, Global::shared_config.initial_framerate_den, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, ffmpeg_pipe);
+        nutMuxer = new NutMuxer(width, height, Global::shared_config.initial_framerate_num, Global::shared_config.initial_framerate_den, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, Global::shared_config.encode_skip_duplicates, ffmpeg_pipe);
 }
 
 void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
@@ -108,6 +114,7 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
     int ret_pid = waitpid(ffmpeg_pid, nullptr, WNOHANG);
     if (ret_pid == ffmpeg_pid) {
         LOG(LL_WARN, LCF_DUMP, "ffmpeg process exited, encoding stopped");
+        stopThread(false);
         NATIVECALL(fclose(ffmpeg_pipe));
         ffmpeg_pipe = nullptr;
         return;
@@ -130,8 +137,11 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
             int size = ScreenCapture::getSize();
             startup_audio_bytes.resize(size, 0); // reusing the audio samples vector
             for (int i=0; i<startup_video_frames; i++) {
-                nutMuxer->writeVideoFrame(startup_audio_bytes.data(), size);
+                nutMuxer->writeVideoFrame(startup_audio_bytes.data(), size, i > 0);
             }
+            std::vector<uint8_t>().swap(startup_audio_bytes);
+
+            startThread();
         }
         else {
             startup_video_frames++;
@@ -144,7 +154,8 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
     /*** Audio ***/
     LOG(LL_DEBUG, LCF_DUMP, "Encode an audio frame");
 
-    nutMuxer->writeAudioFrame(audiocontext.outSamples.data(), audiocontext.outBytes);
+    if (!thread_running)
+        nutMuxer->writeAudioFrame(audiocontext.outSamples.data(), audiocontext.outBytes);
 
     /*** Video ***/
 
@@ -162,13 +173,183 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
     /* Access to the screen pixels, or last screen pixels if not a draw frame */
     int size = ScreenCapture::getPixelsFromSurface(&pixels, draw);
 
+    if (thread_running) {
+        /* Pixels are only copied on draw frames, the encoder thread sends
+         * its copy of the last pixels otherwise */
+        bool new_pixels = draw || !pixels_queued;
+        queueFrame(audiocontext.outSamples.data(), audiocontext.outBytes, new_pixels ? pixels : nullptr, size, frames);
+        pixels_queued = true;
+        return;
+    }
+
     for (int f=0; f<frames; f++) {
         LOG(LL_DEBUG, LCF_DUMP, "Encode a video frame");
-        nutMuxer->writeVideoFrame(pixels, size);
+        nutMuxer->writeVideoFrame(pixels, size, (f > 0) || !draw);
+    }
+}
+
+void AVEncoder::startThread()
+{
+    if (thread_running || (queue_size <= 0) || !nutMuxer)
+        return;
+
+    stopping = false;
+    pixels_queued = false;
+
+    /* The encoder thread must never handle signals, especially the ones used
+     * to suspend threads. This also makes writing into a closed pipe return
+     * an error instead of raising SIGPIPE. */
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals));
+
+    int ret;
+    NATIVECALL(ret = pthread_create(&encoder_thread, nullptr, threadLoop, this));
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &old_signals, nullptr));
+
+    if (ret != 0) {
+        LOG(LL_WARN, LCF_DUMP, "Could not create the encoder thread, frames are encoded from the game thread");
+        return;
     }
+
+    thread_running = true;
+    LOG(LL_DEBUG, LCF_DUMP, "Started the encoder thread with a queue of %d frames", queue_size);
+}
+
+void AVEncoder::stopThread(bool send_queued)
+{
+    if (!thread_running)
+        return;
+
+    GlobalNative gn;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!send_queued) {
+            /* Give back the screen buffers of the dropped frames */
+            for (Job& job : jobs) {
+                if (job.video)
+                    free_video_buffers.push_back(job.video);
+            }
+            jobs.clear();
+        }
+        stopping = true;
+    }
+    queue_cond.notify_one();
+
+    pthread_join(encoder_thread, nullptr);
+    thread_running = false;
+}
+
+void AVEncoder::suspendThread()
+{
+    stopThread(true);
+}
+
+void AVEncoder::resumeThread()
+{
+    startThread();
+}
+
+void* AVEncoder::threadLoop(void* arg)
+{
+    /* Nothing from this thread must be hooked */
+    GlobalNative gn;
+
+    static_cast<AVEncoder*>(arg)->processJobs();
+    return nullptr;
+}
+
+void AVEncoder::processJobs()
+{
+    /* Last pixels that were sent, which are sent again by non-draw frames */
+    std::vector<uint8_t>* last_video = nullptr;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_cond.wait(lock, [this]{ return !jobs.empty() || stopping; });
+
+        /* Only stop when all frames are sent */
+        if (jobs.empty()) {
+            /* The next thread starts without previous pixels */
+            if (last_video)
+                free_video_buffers.push_back(last_video);
+            break;
+        }
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        space_cond.notify_one();
+
+        nutMuxer->writeAudioFrame(job.audio.data(), job.audio.size());
+
+        std::vector<uint8_t>* old_video = nullptr;
+        if (job.video) {
+            old_video = last_video;
+            last_video = job.video;
+        }
+
+        if (last_video) {
+            for (int f=0; f<job.video_count; f++)
+                nutMuxer->writeVideoFrame(last_video->data(), last_video->size(), (f > 0) || !job.video);
+        }
+
+        lock.lock();
+        if (old_video) {
+            free_video_buffers.push_back(old_video);
+            space_cond.notify_one();
+        }
+    }
+}
+
+void AVEncoder::queueFrame(const uint8_t* audio, int audio_size, const uint8_t* video, int video_size, int video_count)
+{
+    /* Waits on the queue must not be hooked */
+    GlobalNative gn;
+
+    Job job;
+    job.audio.assign(audio, audio + audio_size);
+    job.video = nullptr;
+    job.video_count = video_count;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+
+    /* When the queue is full, either wait for the encoder thread, or let the
+     * queue grow */
+    if ((queue_policy == SharedConfig::ENCODE_QUEUE_BLOCK) &&
+        (jobs.size() >= static_cast<size_t>(queue_size))) {
+        LOG(LL_DEBUG, LCF_DUMP, "Encoder queue is full, waiting for ffmpeg");
+        space_cond.wait(lock, [this]{ return jobs.size() < static_cast<size_t>(queue_size); });
+    }
+
+    if (video) {
+        if (free_video_buffers.empty()) {
+            video_buffers.emplace_back(new std::vector<uint8_t>());
+            job.video = video_buffers.back().get();
+        }
+        else {
+            job.video = free_video_buffers.back();
+            free_video_buffers.pop_back();
+        }
+
+        /* The buffer is not used by the encoder thread */
+        lock.unlock();
+        job.video->resize(video_size);
+        memcpy(job.video->data(), video, video_size);
+        lock.lock();
+    }
+
+    jobs.push_back(std::move(job));
+    lock.unlock();
+    queue_cond.notify_one();
 }
 
 AVEncoder::~AVEncoder() {
+    /* Send all remaining frames */
+    stopThread(true);
+
     if (nutMuxer) {
         nutMuxer->finish();
     }
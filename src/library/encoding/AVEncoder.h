@@ -23,8 +23,12 @@
 #include "TimeHolder.h"
 
 #include <vector>
+#include <deque>
 #include <memory> // std::unique_ptr
+#include <mutex>
+#include <condition_variable>
 #include <cstdint>
+#include <pthread.h>
 
 namespace libtas {
 
@@ -49,7 +53,15 @@ class AVEncoder {
          */
         void encodeOneFrame(bool draw, TimeHolder frametime);
 
-        /* Close all allocated objects and close the pipe at the end of an av dump
+        /* The encoder thread is not suspended during savestates, so it must
+         * be stopped before saving or loading a state, after sending all
+         * queued frames, and started again afterwards.
+         */
+        void suspendThread();
+        void resumeThread();
+
+        /* Close all allocated objects and close the pipe at the end of an av dump.
+         * Frames still in the queue are sent before.
          */
         ~AVEncoder();
 
@@ -75,6 +87,56 @@ class AVEncoder {
 
         /* remainder of the number of video frames to send */
         double frame_remainder = 0;
+
+        /* Audio and video of a frame, waiting to be sent by the encoder thread */
+        struct Job {
+            std::vector<uint8_t> audio;
+
+            /* Screen pixels, or nullptr to send the previous pixels again */
+            std::vector<uint8_t>* video;
+
+            /* Number of times the video frame is sent */
+            int video_count;
+        };
+
+        /* Start the encoder thread if enabled, once the muxer is initialized */
+        void startThread();
+
+        /* Stop the encoder thread, after sending all queued frames or not */
+        void stopThread(bool send_queued);
+
+        static void* threadLoop(void* arg);
+
+        /* Send queued frames to the muxer, executed by the encoder thread */
+        void processJobs();
+
+        /* Copy a frame into the queue, and wait for some space if needed */
+        void queueFrame(const uint8_t* audio, int audio_size, const uint8_t* video, int video_size, int video_count);
+
+        pthread_t encoder_thread;
+        bool thread_running = false;
+
+        /* Maximum number of queued frames and queue policy */
+        int queue_size = 0;
+        int queue_policy = 0;
+
+        std::mutex queue_mutex;
+
+        /* Signaled when a frame is queued or when the thread must stop */
+        std::condition_variable queue_cond;
+
+        /* Signaled when a frame was removed from the queue */
+        std::condition_variable space_cond;
+
+        std::deque<Job> jobs;
+        bool stopping = false;
+
+        /* Pool of screen buffers, and buffers that are not used */
+        std::vector<std::unique_ptr<std::vector<uint8_t>>> video_buffers;
+        std::vector<std::vector<uint8_t>*> free_video_buffers;
+
+        /* Were pixels already sent to the encoder thread */
+        bool pixels_queued = false;
 };
 
 extern std::unique_ptr<AVEncoder> avencoder;
@@ -0,0 +1,339 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ImageWriter.h"
+
+#include "logging.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+/* The 32-bit library may be built without zlib */
+#ifdef LIBTAS_LIB32_NO_ZLIB
+#undef LIBTAS_HAS_ZLIB
+#endif
+
+#ifdef LIBTAS_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace libtas {
+
+namespace {
+
+void appendBE32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+#ifndef LIBTAS_HAS_ZLIB
+uint32_t pngCrc(uint32_t crc, const uint8_t* data, size_t len)
+{
+    static const auto table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(const uint8_t* data, size_t len)
+{
+    uint32_t a = 1, b = 0;
+    while (len > 0) {
+        /* Largest number of bytes before the sums can overflow */
+        size_t n = (len < 5552) ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+#else
+uint32_t pngCrc(uint32_t crc, const uint8_t* data, size_t len)
+{
+    return crc32(crc, data, len);
+}
+#endif
+
+/* Append a png chunk, with its length, type and crc */
+void appendChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t len)
+{
+    appendBE32(out, len);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + len);
+    appendBE32(out, pngCrc(0, &out[start], len + 4));
+}
+
+int encodePng(std::vector<uint8_t>& out, const uint8_t* pixels, int width, int height, ImageWriter::PixelLayout layout)
+{
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.insert(out.end(), signature, signature + 8);
+
+    std::vector<uint8_t> ihdr;
+    appendBE32(ihdr, width);
+    appendBE32(ihdr, height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(2); // color type RGB
+    ihdr.push_back(0); // compression
+    ihdr.push_back(0); // filter
+    ihdr.push_back(0); // interlace
+    appendChunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+    /* Convert each row to RGB, prefixed by its filter type. With compression,
+     * use the Sub filter which makes flat areas compress much better. */
+    size_t row_size = 1 + 3 * static_cast<size_t>(width);
+    std::vector<uint8_t> raw(row_size * height);
+#ifdef LIBTAS_HAS_ZLIB
+    const uint8_t filter = 1;
+#else
+    const uint8_t filter = 0;
+#endif
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* src = pixels + 4 * static_cast<size_t>(width) * y;
+        uint8_t* dst = &raw[row_size * y];
+        *dst++ = filter;
+        uint8_t pr = 0, pg = 0, pb = 0;
+        for (int x = 0; x < width; x++, src += 4) {
+            uint8_t r = src[layout.r], g = src[layout.g], b = src[layout.b];
+            if (filter) {
+                *dst++ = r - pr;
+                *dst++ = g - pg;
+                *dst++ = b - pb;
+                pr = r; pg = g; pb = b;
+            }
+            else {
+                *dst++ = r;
+                *dst++ = g;
+                *dst++ = b;
+            }
+        }
+    }
+
+    std::vector<uint8_t> idat;
+
+#ifdef LIBTAS_HAS_ZLIB
+    /* Lowest compression level, screenshots must be fast to save */
+    uLongf idat_size = compressBound(raw.size());
+    idat.resize(idat_size);
+    if (compress2(idat.data(), &idat_size, raw.data(), raw.size(), 1) != Z_OK) {
+        LOG(LL_ERROR, LCF_DUMP, "Could not compress the image");
+        return -1;
+    }
+    idat.resize(idat_size);
+#else
+    /* Without zlib, store the data in uncompressed deflate blocks */
+    idat.reserve(raw.size() + 5 * (raw.size() / 65535 + 1) + 6);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    size_t pos = 0;
+    do {
+        size_t len = raw.size() - pos;
+        if (len > 65535)
+            len = 65535;
+        bool last = (pos + len) == raw.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(len & 0xff);
+        idat.push_back(len >> 8);
+        idat.push_back(~len & 0xff);
+        idat.push_back((~len >> 8) & 0xff);
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+    appendBE32(idat, adler32(raw.data(), raw.size()));
+#endif
+
+    appendChunk(out, "IDAT", idat.data(), idat.size());
+    appendChunk(out, "IEND", nullptr, 0);
+    return 0;
+}
+
+int encodeQoi(std::vector<uint8_t>& out, const uint8_t* pixels, int width, int height, ImageWriter::PixelLayout layout)
+{
+    size_t pixel_count = static_cast<size_t>(width) * height;
+    out.reserve(14 + 4 * pixel_count + 8);
+
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    appendBE32(out, width);
+    appendBE32(out, height);
+    out.push_back(3); // channels
+    out.push_back(0); // sRGB
+
+    struct Pixel {
+        uint8_t r, g, b;
+        bool operator==(const Pixel& other) const {
+            return (r == other.r) && (g == other.g) && (b == other.b);
+        }
+    };
+
+    /* Alpha is always 255, and only taken into account in the hash. Unused
+     * entries of the index are transparent black, which never matches. */
+    Pixel index[64];
+    bool index_used[64] = {};
+    Pixel prev = {0, 0, 0};
+    int run = 0;
+
+    for (size_t p = 0; p < pixel_count; p++) {
+        const uint8_t* src = pixels + 4 * p;
+        Pixel px = {src[layout.r], src[layout.g], src[layout.b]};
+
+        if (px == prev) {
+            run++;
+            if ((run == 62) || (p == (pixel_count - 1))) {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            out.push_back(0xc0 | (run - 1));
+            run = 0;
+        }
+
+        int hash = (px.r * 3 + px.g * 5 + px.b * 7 + 255 * 11) % 64;
+        if (index_used[hash] && (index[hash] == px)) {
+            out.push_back(hash);
+        }
+        else {
+            index[hash] = px;
+            index_used[hash] = true;
+
+            int8_t vr = px.r - prev.r;
+            int8_t vg = px.g - prev.g;
+            int8_t vb = px.b - prev.b;
+            int8_t vg_r = vr - vg;
+            int8_t vg_b = vb - vg;
+
+            if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2)) {
+                out.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+            }
+            else if ((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32) && (vg_b > -9) && (vg_b < 8)) {
+                out.push_back(0x80 | (vg + 32));
+                out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+            }
+            else {
+                out.push_back(0xfe);
+                out.push_back(px.r);
+                out.push_back(px.g);
+                out.push_back(px.b);
+            }
+        }
+        prev = px;
+    }
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return 0;
+}
+
+}
+
+ImageWriter::Format ImageWriter::formatFromPath(const std::string& path)
+{
+    size_t dot = path.find_last_of("./");
+    if ((dot == std::string::npos) || (path[dot] != '.'))
+        return FORMAT_NONE;
+
+    const char* ext = path.c_str() + dot + 1;
+    if (strcasecmp(ext, "png") == 0)
+        return FORMAT_PNG;
+    if (strcasecmp(ext, "qoi") == 0)
+        return FORMAT_QOI;
+    return FORMAT_NONE;
+}
+
+bool ImageWriter::layoutFromPixelFormat(const char* pixfmt, PixelLayout& layout)
+{
+    /* Only formats of four 8-bit components, named in memory order */
+    layout = {-1, -1, -1};
+    for (int i = 0; i < 4; i++) {
+        switch (pixfmt[i]) {
+            case 'R':
+                layout.r = i;
+                break;
+            case 'G':
+                layout.g = i;
+                break;
+            case 'B':
+                layout.b = i;
+                break;
+            case 'A':
+            case '\0':
+                break;
+            default:
+                return false;
+        }
+    }
+    return (layout.r >= 0) && (layout.g >= 0) && (layout.b >= 0);
+}
+
+int ImageWriter::write(const std::string& path, Format format, const uint8_t* pixels, int width, int height, PixelLayout layout)
+{
+    std::vector<uint8_t> out;
+    int ret = -1;
+    switch (format) {
+        case FORMAT_PNG:
+            ret = encodePng(out, pixels, width, height, layout);
+            break;
+        case FORMAT_QOI:
+            ret = encodeQoi(out, pixels, width, height, layout);
+            break;
+        default:
+            break;
+    }
+    if (ret < 0)
+        return -1;
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        LOG(LL_ERROR, LCF_DUMP, "Could not open screenshot file %s", path.c_str());
+        return -1;
+    }
+
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        LOG(LL_ERROR, LCF_DUMP, "Could not write screenshot file %s", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+}
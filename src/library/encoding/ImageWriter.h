@@ -0,0 +1,59 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_IMAGEWRITER_H_INCL
+#define LIBTAS_IMAGEWRITER_H_INCL
+
+#include <string>
+#include <cstdint>
+
+namespace libtas {
+
+/* Writers of image files, used to save screenshots without spawning an ffmpeg
+ * process. Images are always written as opaque RGB, because the alpha channel
+ * of the screen is not meaningful. */
+namespace ImageWriter {
+
+    enum Format {
+        FORMAT_NONE = 0, // Format not supported by the writers
+        FORMAT_PNG,
+        FORMAT_QOI,
+    };
+
+    /* Location of each color inside a 4-byte pixel */
+    struct PixelLayout {
+        int r;
+        int g;
+        int b;
+    };
+
+    /* Get the image format from the file extension */
+    Format formatFromPath(const std::string& path);
+
+    /* Get the pixel layout from the pixel format used by nut muxer.
+     * Returns false if the pixel format is not supported. */
+    bool layoutFromPixelFormat(const char* pixfmt, PixelLayout& layout);
+
+    /* Write an image of 4-byte pixels without padding between rows.
+     * Returns 0 or -1 on error. */
+    int write(const std::string& path, Format format, const uint8_t* pixels, int width, int height, PixelLayout layout);
+}
+}
+
+#endif
@@ -23,6 +23,9 @@
 
 #include "logging.h"
 
+#define XXH_INLINE_ALL
+#include "../external/xxhash.h"
+
 namespace libtas {
 
 void NutMuxer::writeVarU(uint64_t v, std::vector<uint8_t> &stream)
@@ -217,7 +220,7 @@ void NutMuxer::writeVideoHeader()
 	writeVarU(8, header_packet.data); // msb_pts_shift
 	writeVarU(1, header_packet.data); // max_pts_distance
 	writeVarU(0, header_packet.data); // decode_delay
-	writeVarU(1, header_packet.data); // stream_flags = FLAG_FIXED_FPS
+	writeVarU(skipduplicates ? 0 : 1, header_packet.data); // stream_flags = FLAG_FIXED_FPS, unless frames are skipped
 	writeBytes("", 0, header_packet.data); // codec_specific_data
 
 	// stream_class = video
@@ -261,7 +264,7 @@ void NutMuxer::writeAudioHeader()
 	header_packet.flush();
 }
 
-void NutMuxer::writeFrame(const uint8_t* payload, unsigned int payloadlen, uint64_t pts, uint64_t ptsnum, uint64_t ptsden, int ptsindex, FILE *underlying)
+void NutMuxer::writeFrame(const uint8_t* payload, unsigned int payloadlen, uint64_t pts, uint64_t /* ptsnum */, uint64_t /* ptsden */, int ptsindex, FILE *underlying)
 {
 	// create syncpoint
 	NutPacket sync(NutPacket::Syncpoint, underlying);
@@ -298,8 +301,36 @@ void NutMuxer::writeFrame(const uint8_t* payload, unsigned int payloadlen, uint6
 	}
 }
 
-void NutMuxer::writeVideoFrame(const uint8_t* video, unsigned int len)
+void NutMuxer::writeVideoFrame(const uint8_t* video, unsigned int len, bool duplicate)
 {
+	if (skipduplicates) {
+		// frames are compared by hash, unless the caller knows they are identical
+		bool same = videowritten && duplicate;
+		XXH128_hash_t hash = {0, 0};
+		if (!same) {
+			hash = XXH3_128bits(video, len);
+			same = videowritten && (len == lastvideolen) &&
+				(hash.low64 == lastvideohash[0]) && (hash.high64 == lastvideohash[1]);
+		}
+
+		if (same) {
+			LOG(LL_DEBUG, LCF_DUMP, "Skip duplicate nut video frame");
+
+			// keep the frame at the start of a run of duplicates, so that it can end the video
+			if (!videoskipped)
+				skippedvideo.assign(video, video + len);
+			videoskipped = true;
+			videopts++;
+			return;
+		}
+
+		videowritten = true;
+		videoskipped = false;
+		lastvideolen = len;
+		lastvideohash[0] = hash.low64;
+		lastvideohash[1] = hash.high64;
+	}
+
 	LOG(LL_DEBUG, LCF_DUMP, "Write nut video frame");
 	LOG(LL_DEBUG, LCF_DUMP, "Video pts is %f", (double)videopts * avparams.fpsden / avparams.fpsnum);
 
@@ -318,7 +349,7 @@ void NutMuxer::writeAudioFrame(const uint8_t* samples, unsigned int len)
 	audiopts += static_cast<uint64_t>(len) / static_cast<uint64_t>(avparams.samplesize);
 }
 
-NutMuxer::NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int samplesize, int channels, FILE *underlying)
+NutMuxer::NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int samplesize, int channels, bool skipdup, FILE *underlying)
 {
 	avparams.width = width;
 	avparams.height = height;
@@ -334,6 +365,11 @@ NutMuxer::NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pi
 	audiopts = 0;
 	videopts = 0;
 
+	skipduplicates = skipdup;
+	videowritten = false;
+	videoskipped = false;
+	lastvideolen = 0;
+
 	writeMainHeader();
 	writeVideoHeader();
 	writeAudioHeader();
@@ -344,6 +380,12 @@ NutMuxer::NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pi
 
 void NutMuxer::finish()
 {
+	// if the last frames were skipped, write the last one so that the video has the correct length
+	if (videoskipped) {
+		writeFrame(skippedvideo.data(), skippedvideo.size(), videopts - 1, static_cast<uint64_t>(avparams.fpsden), static_cast<uint64_t>(avparams.fpsnum), 0, output);
+		videoskipped = false;
+	}
+
 	LOG(LL_DEBUG, LCF_DUMP, "Write nut EOF frames");
 	// writeVideoFrame(nullptr, 0);
 	// writeAudioFrame(nullptr, 0);
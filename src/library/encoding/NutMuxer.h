@@ -95,6 +95,24 @@ public:
 	/// </summary>
 	uint64_t audiopts;
 
+	/// <summary>
+	/// are identical video frames skipped, leaving gaps in the video pts (variable framerate)?
+	/// </summary>
+	bool skipduplicates;
+
+	/// <summary>
+	/// was a video frame written, and its size and hash
+	/// </summary>
+	bool videowritten;
+	unsigned int lastvideolen;
+	uint64_t lastvideohash[2];
+
+	/// <summary>
+	/// was the last video frame skipped, and copy of the skipped frame, written again when finishing
+	/// </summary>
+	bool videoskipped;
+	std::vector<uint8_t> skippedvideo;
+
 	/// <summary>
 	/// has EOR been writen on this stream?
 	/// </summary>
@@ -121,11 +139,14 @@ public:
 
     void writeFrame(const uint8_t* payload, unsigned int payloadlen, uint64_t pts, uint64_t ptsnum, uint64_t ptsden, int ptsindex, FILE *underlying);
 
-    void writeVideoFrame(const uint8_t* video, unsigned int len);
+	/// <summary>
+	/// write a video frame. `duplicate` indicates that the frame is known to be identical to the previous one
+	/// </summary>
+    void writeVideoFrame(const uint8_t* video, unsigned int len, bool duplicate = false);
 
     void writeAudioFrame(const uint8_t* samples, unsigned int len);
 
-	NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int samplesize, int channels, FILE *underlying);
+	NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int samplesize, int channels, bool skipduplicates, FILE *underlying);
 
 	void finish();
 
@@ -19,6 +19,7 @@
 
 #include "Screenshot.h"
 #include "NutMuxer.h"
+#include "ImageWriter.h"
 
 #include "logging.h"
 #include "screencapture/ScreenCapture.h"
@@ -27,9 +28,48 @@
 
 #include <cstdint>
 #include <sstream>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
 
 namespace libtas {
 
+namespace {
+
+/* Screenshot being written by the writer thread */
+struct WriteJob {
+    std::string path;
+    ImageWriter::Format format;
+    ImageWriter::PixelLayout layout;
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+};
+
+WriteJob* pending_job = nullptr;
+pthread_t writer_thread;
+
+void* writeImage(void* arg)
+{
+    GlobalNative gn;
+
+    WriteJob* job = static_cast<WriteJob*>(arg);
+    ImageWriter::write(job->path, job->format, job->pixels.data(), job->width, job->height, job->layout);
+    return nullptr;
+}
+
+}
+
+void Screenshot::wait() {
+    if (!pending_job)
+        return;
+
+    GlobalNative gn;
+    pthread_join(writer_thread, nullptr);
+    delete pending_job;
+    pending_job = nullptr;
+}
+
 int Screenshot::save(const std::string& screenshotfile, bool draw) {
     
     if (!ScreenCapture::isInited()) {
@@ -37,6 +77,66 @@ int Screenshot::save(const std::string& screenshotfile, bool draw) {
         return ESCREENSHOT_NOSCREEN;
     }
 
+    /* Only one screenshot is written at a time */
+    wait();
+
+    int width, height;
+    ScreenCapture::getDimensions(width, height);
+
+    const char* pixfmt = ScreenCapture::getPixelFormat();
+
+    /* Write png and qoi files ourselves when the pixel format is supported,
+     * which is much faster than starting an ffmpeg process */
+    ImageWriter::Format format = ImageWriter::formatFromPath(screenshotfile);
+    ImageWriter::PixelLayout layout;
+    if ((format != ImageWriter::FORMAT_NONE) && ImageWriter::layoutFromPixelFormat(pixfmt, layout)) {
+        uint8_t* pixels = nullptr;
+        int size = ScreenCapture::getPixelsFromSurface(&pixels, draw);
+
+        if (size < (4 * width * height)) {
+            LOG(LL_ERROR, LCF_DUMP, "Screen pixels are smaller than expected");
+            return ESCREENSHOT_NOSCREEN;
+        }
+
+        /* Unless asked otherwise, the file is complete when returning */
+        if (!Global::shared_config.screenshot_async) {
+            int err;
+            NATIVECALL(err = ImageWriter::write(screenshotfile, format, pixels, width, height, layout));
+            return (err < 0) ? ESCREENSHOT_NOFILE : ESCREENSHOT_OK;
+        }
+
+        WriteJob* job = new WriteJob;
+        job->path = screenshotfile;
+        job->format = format;
+        job->layout = layout;
+        job->width = width;
+        job->height = height;
+
+        /* Pixels are copied so that the game can continue while the image
+         * is encoded. The writer thread must never handle signals. */
+        job->pixels.assign(pixels, pixels + 4 * width * height);
+
+        sigset_t all_signals, old_signals;
+        sigfillset(&all_signals);
+        NATIVECALL(pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals));
+
+        int ret;
+        NATIVECALL(ret = pthread_create(&writer_thread, nullptr, writeImage, job));
+
+        NATIVECALL(pthread_sigmask(SIG_SETMASK, &old_signals, nullptr));
+
+        if (ret == 0) {
+            pending_job = job;
+            return ESCREENSHOT_OK;
+        }
+
+        LOG(LL_WARN, LCF_DUMP, "Could not create the screenshot thread, writing from the game thread");
+        int err;
+        NATIVECALL(err = ImageWriter::write(job->path, job->format, job->pixels.data(), width, height, layout));
+        delete job;
+        return (err < 0) ? ESCREENSHOT_NOFILE : ESCREENSHOT_OK;
+    }
+
     std::ostringstream commandline;
     commandline << "ffmpeg -loglevel warning -hide_banner -y -guess_layout_max 0 -f nut -i - -frames:v 1 -update 1 \"";
     commandline << screenshotfile;
@@ -50,13 +150,8 @@ int Screenshot::save(const std::string& screenshotfile, bool draw) {
         return ESCREENSHOT_NOPIPE;
     }
     
-    int width, height;
-    ScreenCapture::getDimensions(width, height);
-
-    const char* pixfmt = ScreenCapture::getPixelFormat();
-
     /* Initialize the muxer. Audio parameters don't matter here for screenshot */
-    NutMuxer* nutMuxer = new NutMuxer(width, height, Global::shared_config.initial_framerate_num, Global::shared_config.initial_framerate_den, pixfmt, 44100, 1, 1, ffmpeg_pipe);
+    NutMuxer* nutMuxer = new NutMuxer(width, height, Global::shared_config.initial_framerate_num, Global::shared_config.initial_framerate_den, pixfmt, 44100, 1, 1, false, ffmpeg_pipe);
 
     /* Access to the screen pixels, or last screen pixels if not a draw frame */
     uint8_t* pixels = nullptr;
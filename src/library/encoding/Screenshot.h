@@ -30,12 +30,17 @@ namespace Screenshot {
         ESCREENSHOT_OK = 0,
         ESCREENSHOT_NOSCREEN = -1, // Screen Capture was not inited
         ESCREENSHOT_NOPIPE = -2, // Could not create a pipe to ffmpeg
+        ESCREENSHOT_NOFILE = -3, // Could not write the image file
     };
 
     /* Save the screenshot to file, `draw` indicates if the current frame is
-     * a draw frame. */
+     * a draw frame. Png and qoi files are written without ffmpeg, from a
+     * separate thread if enabled. */
     int save(const std::string& screenshotfile, bool draw);
 
+    /* Wait for the screenshot being written, if any */
+    void wait();
+
 };
 
 }
@@ -30,6 +30,8 @@
 #include "checkpoint/ThreadManager.h"
 #include "checkpoint/SaveStateManager.h"
 #include "checkpoint/Checkpoint.h"
+#include "checkpoint/SaveStateSize.h"
+#include "checkpoint/CheckpointMetrics.h"
 #include "checkpoint/ThreadSync.h"
 #include "screencapture/ScreenCapture.h"
 #include "WindowTitle.h"
@@ -738,8 +740,19 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
                     screen_redraw(draw, hud, preview_ai, true);
                 }
 
+                /* The screenshot and encoder threads are not suspended
+                 * during savestates */
+                Screenshot::wait();
+                if (avencoder)
+                    avencoder->suspendThread();
+
                 status = SaveStateManager::checkpoint(slot);
 
+                /* This is reached after saving or after loading the state.
+                 * In both cases, the encoder was stopped when saving. */
+                if (avencoder)
+                    avencoder->resumeThread();
+
                 if (status == 0) {
                     /* Current savestate is now the parent savestate */
                     Checkpoint::setCurrentToParent();
@@ -747,12 +760,31 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
 
                 SaveStateManager::printError(status);
 
+                /* Report the estimated and actual size of the savestate */
+                if (!SaveStateManager::isLoading()) {
+                    int size_slot;
+                    uint64_t estimated_size, actual_size, available_size;
+                    if (SaveStateSize::getReport(&size_slot, &estimated_size, &actual_size, &available_size)) {
+                        sendMessage(MSGB_SAVESTATE_SIZE);
+                        sendData(&size_slot, sizeof(int));
+                        sendData(&estimated_size, sizeof(uint64_t));
+                        sendData(&actual_size, sizeof(uint64_t));
+                        sendData(&available_size, sizeof(uint64_t));
+                    }
+                }
+
                 /* Don't forget that when we load a savestate, the game continues
                  * from here and not from SaveStateManager::restore() under.
                  */
                 if (SaveStateManager::isLoading()) {
+                    /* The game continues even if some memory could not be
+                     * loaded, because the previous memory was overwritten */
+                    if (Checkpoint::hasRestoreFailed())
+                        SaveStateManager::printError(SaveStateManager::ESTATE_CORRUPTED);
+
                     /* Tell the program that the loading succeeded */
                     sendMessage(MSGB_LOADING_SUCCEEDED);
+                    CheckpointMetrics::send();
 
                     /* After loading, the game and the program no longer store
                      * the same information, so they must communicate to be
@@ -775,6 +807,7 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
                 else if (status == 0) {
                     /* Tell the program that the saving succeeded */
                     sendMessage(MSGB_SAVING_SUCCEEDED);
+                    CheckpointMetrics::send();
 
                     /* Print the successful message, unless we are saving in a fork */
                     if (!(Global::shared_config.savestate_settings & SharedConfig::SS_FORK)) {
@@ -797,8 +830,16 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
                 // Force redraw because screen refresh won't happen during state loading
                 screen_redraw(draw, hud, preview_ai, true);
 
+                Screenshot::wait();
+                if (avencoder)
+                    avencoder->suspendThread();
+
                 status = SaveStateManager::restore(slot);
 
+                /* Only reached if restoring failed */
+                if (avencoder)
+                    avencoder->resumeThread();
+
                 SaveStateManager::printError(status);
 
                 /* If restoring failed, we return here. We still send the
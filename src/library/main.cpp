@@ -28,6 +28,7 @@
 #include "UnityHacks.h"
 #include "audio/AudioContext.h"
 #include "encoding/AVEncoder.h"
+#include "encoding/Screenshot.h"
 #include "steam/isteamuser/isteamuser.h" // SteamSetUserDataFolder
 #include "general/dlhook.h"
 #include "general/monowrappers.h"
@@ -36,6 +37,11 @@
 #include "checkpoint/ThreadManager.h"
 #include "checkpoint/SaveStateManager.h"
 #include "checkpoint/Checkpoint.h"
+#include "checkpoint/SaveStateRam.h"
+#include "checkpoint/SaveStateWorkers.h"
+#include "checkpoint/SaveStatePageStore.h"
+#include "checkpoint/SaveStateDirty.h"
+#include "checkpoint/SaveStateLazy.h"
 #include "sdl/sdldynapi.h"
 #include "../shared/sockethelpers.h"
 #include "../shared/messages.h"
@@ -193,6 +199,22 @@ void __attribute__((constructor)) init(void)
         message = receiveMessage();
     }
 
+    /* Reserve the memory for savestates in RAM now that we have the config, so
+     * that it is present in all savestates */
+    SaveStateRam::init();
+
+    /* Spawn the threads used to compress savestates */
+    SaveStateWorkers::init();
+
+    /* Reserve the index of pages shared by savestates */
+    SaveStatePageStore::init();
+
+    /* Track memory writes for incremental savestates */
+    SaveStateDirty::init();
+
+    /* Spawn the thread used to load savestates lazily */
+    SaveStateLazy::init();
+
     if (Global::shared_config.sigint_upon_launch) {
         raise(SIGINT);
     }
@@ -220,6 +242,7 @@ void __attribute__((destructor)) term(void)
             closeSocket();
         }
         LOG(LL_DEBUG, LCF_SOCKET, "Exiting.");
+        Screenshot::wait();
         ThreadManager::deallocateThreads();
     }
 }
@@ -94,6 +94,11 @@ void gl_load_procs(GLGetProcAddressProc proc)
     GET_GL_POINTER(BindVertexArray)
     GET_GL_POINTER(BindBuffer)
     GET_GL_POINTER(BufferData)
+    GET_GL_POINTER(MapBufferRange)
+    GET_GL_POINTER(UnmapBuffer)
+    GET_GL_POINTER(FenceSync)
+    GET_GL_POINTER(ClientWaitSync)
+    GET_GL_POINTER(DeleteSync)
     GET_GL_POINTER(VertexAttribPointer)
     GET_GL_POINTER(EnableVertexAttribArray)
     GET_GL_POINTER(CreateShader)
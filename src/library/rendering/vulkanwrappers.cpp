@@ -134,6 +134,8 @@ DEFINE_ORIG_POINTER(vkCreateSemaphore)
 DEFINE_ORIG_POINTER(vkDestroyRenderPass)
 DEFINE_ORIG_POINTER(vkDestroySemaphore)
 DEFINE_ORIG_POINTER(vkDestroyFence)
+DEFINE_ORIG_POINTER(vkWaitForFences)
+DEFINE_ORIG_POINTER(vkResetFences)
 DEFINE_ORIG_POINTER(vkDestroyCommandPool)
 DEFINE_ORIG_POINTER(vkDestroyImageView)
 DEFINE_ORIG_POINTER(vkDestroySampler)
@@ -210,6 +212,8 @@ static void* store_orig_and_return_my_symbol(const char* symbol, void* real_poin
     STORE_SYMBOL(vkDestroyRenderPass)
     STORE_SYMBOL(vkDestroySemaphore)
     STORE_SYMBOL(vkDestroyFence)
+    STORE_SYMBOL(vkWaitForFences)
+    STORE_SYMBOL(vkResetFences)
     STORE_SYMBOL(vkFreeCommandBuffers)
     STORE_SYMBOL(vkDestroyCommandPool)
     STORE_SYMBOL(vkDestroyImageView)
@@ -343,6 +347,8 @@ VkResult myvkCreateDevice(VkPhysicalDevice physicalDevice, const VkDeviceCreateI
         GETPROCADDR(vkDestroyRenderPass)
         GETPROCADDR(vkDestroySemaphore)
         GETPROCADDR(vkDestroyFence)
+        GETPROCADDR(vkWaitForFences)
+        GETPROCADDR(vkResetFences)
         GETPROCADDR(vkFreeCommandBuffers)
         GETPROCADDR(vkDestroyCommandPool)
         GETPROCADDR(vkDestroyImageView)
@@ -26,6 +26,7 @@
 #include "rendering/openglloader.h"
 
 #include <cstring> // memcpy
+#include <cstdio> // sscanf
 #define GL_GLEXT_PROTOTYPES
 #ifdef __unix__
 #include <GL/gl.h>
@@ -83,14 +84,66 @@ void ScreenCapture_GL::initScreenSurface()
         GL_CALL(GenTextures, (1, &screenTex));
     }
 
+    screenTexFormat = (default_fb_color_encoding == GL_SRGB) ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+
     GL_CALL(BindTexture, (GL_TEXTURE_2D, screenTex));
-    GL_CALL(TexImage2D, (GL_TEXTURE_2D, 0,
-        default_fb_color_encoding == GL_SRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8, 
+    GL_CALL(TexImage2D, (GL_TEXTURE_2D, 0, screenTexFormat, 
         width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL));
     GL_CALL(TexParameteri, (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
     GL_CALL(TexParameteri, (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
     GL_CALL(FramebufferTexture2D, (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screenTex, 0));
 
+    /* Asynchronous transfers require pixel buffers and fences, which are
+     * available from OpenGL 3.2 and OpenGL ES 3.0. Parse the version string,
+     * because querying GL_MAJOR_VERSION raises an error on older contexts. */
+    int major_version = 0, minor_version = 0;
+    LINK_GL_POINTER(GetString);
+    const char* version = reinterpret_cast<const char*>(glProcs.GetString(GL_VERSION));
+    if (version) {
+        /* OpenGL ES versions are prefixed by "OpenGL ES " */
+        while (*version && ((*version < '0') || (*version > '9')))
+            version++;
+        sscanf(version, "%d.%d", &major_version, &minor_version);
+    }
+
+    if (Global::game_info.opengl_profile == GameInfo::ES)
+        asyncReadback = (major_version >= 3);
+    else
+        asyncReadback = (major_version > 3) || ((major_version == 3) && (minor_version >= 2));
+
+    asyncReadback = asyncReadback && glProcs.MapBufferRange && glProcs.UnmapBuffer &&
+        glProcs.FenceSync && glProcs.ClientWaitSync && glProcs.DeleteSync;
+
+    if (asyncReadback) {
+        if (flipFBO == 0) {
+            GL_CALL(GenFramebuffers, (1, &flipFBO));
+        }
+        GL_CALL(BindFramebuffer, (GL_FRAMEBUFFER, flipFBO));
+
+        if (flipTex == 0) {
+            GL_CALL(GenTextures, (1, &flipTex));
+        }
+        GL_CALL(BindTexture, (GL_TEXTURE_2D, flipTex));
+        GL_CALL(TexImage2D, (GL_TEXTURE_2D, 0, screenTexFormat,
+            width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL));
+        GL_CALL(TexParameteri, (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(TexParameteri, (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(FramebufferTexture2D, (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, flipTex, 0));
+
+        GLint pixel_buffer;
+        glProcs.GetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_buffer);
+
+        if (readbackPBO[0] == 0) {
+            GL_CALL(GenBuffers, (READBACK_COUNT, readbackPBO));
+        }
+        for (int i = 0; i < READBACK_COUNT; i++) {
+            GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, readbackPBO[i]));
+            GL_CALL(BufferData, (GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ));
+        }
+
+        GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, pixel_buffer));
+    }
+
     GL_CALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, draw_buffer));
     GL_CALL(BindFramebuffer, (GL_READ_FRAMEBUFFER, read_buffer));
 
@@ -102,6 +155,24 @@ void ScreenCapture_GL::destroyScreenSurface()
     LINK_GL_POINTER(DeleteFramebuffers)
     LINK_GL_POINTER(DeleteRenderbuffers)
     LINK_GL_POINTER(DeleteTextures)
+    LINK_GL_POINTER(DeleteBuffers)
+    LINK_GL_POINTER(DeleteSync)
+
+    /* Delete pending transfers */
+    for (int i = 0; i < READBACK_COUNT; i++) {
+        if (readbackFence[i]) {
+            glProcs.DeleteSync(static_cast<GLsync>(readbackFence[i]));
+            readbackFence[i] = nullptr;
+        }
+    }
+    pendingReadback = -1;
+    readbackIndex = 0;
+
+    if (readbackPBO[0] != 0) {
+        glProcs.DeleteBuffers(READBACK_COUNT, readbackPBO);
+        for (int i = 0; i < READBACK_COUNT; i++)
+            readbackPBO[i] = 0;
+    }
 
     /* Delete openGL framebuffers */
     if (screenFBO != 0) {
@@ -116,6 +187,14 @@ void ScreenCapture_GL::destroyScreenSurface()
         glProcs.DeleteTextures(1, &screenTex);
         screenTex = 0;
     }
+    if (flipFBO != 0) {
+        glProcs.DeleteFramebuffers(1, &flipFBO);
+        flipFBO = 0;
+    }
+    if (flipTex != 0) {
+        glProcs.DeleteTextures(1, &flipTex);
+        flipTex = 0;
+    }
 }
 
 uint64_t ScreenCapture_GL::screenTexture()
@@ -152,6 +231,11 @@ int ScreenCapture_GL::copyScreenToSurface()
     GL_CALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, screenFBO));
     GL_CALL(BlitFramebuffer, (0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST));
 
+    /* When encoding, start the transfer of pixels now, so that they are
+     * ready when the frame is encoded */
+    if (asyncReadback && Global::shared_config.av_dumping)
+        startReadback();
+
     /* Restore the original draw/read framebuffers */
     GL_CALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, draw_buffer));
     GL_CALL(BindFramebuffer, (GL_READ_FRAMEBUFFER, read_buffer));
@@ -162,6 +246,91 @@ int ScreenCapture_GL::copyScreenToSurface()
     return size;
 }
 
+void ScreenCapture_GL::startReadback()
+{
+    /* Flip the image vertically during the blit, because OpenGL has a
+     * different reference point */
+    GL_CALL(BindFramebuffer, (GL_READ_FRAMEBUFFER, screenFBO));
+    GL_CALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, flipFBO));
+    GL_CALL(BlitFramebuffer, (0, 0, width, height, 0, height, width, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+
+    /* Copy the original pixel buffer and pack row length */
+    GLint pixel_buffer, pack_row;
+    glProcs.GetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_buffer);
+    glProcs.GetIntegerv(GL_PACK_ROW_LENGTH, &pack_row);
+
+    int index = readbackIndex;
+
+    GL_CALL(BindFramebuffer, (GL_READ_FRAMEBUFFER, flipFBO));
+    GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, readbackPBO[index]));
+
+    if (pack_row != 0)
+        glProcs.PixelStorei(GL_PACK_ROW_LENGTH, 0);
+
+    /* With a pixel buffer bound, this call returns without waiting for the
+     * transfer to finish */
+    GL_CALL(ReadPixels, (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+
+    if (pack_row != 0)
+        glProcs.PixelStorei(GL_PACK_ROW_LENGTH, pack_row);
+
+    GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, pixel_buffer));
+
+    /* The previous transfer in this buffer, if any, was never used */
+    if (readbackFence[index])
+        glProcs.DeleteSync(static_cast<GLsync>(readbackFence[index]));
+    readbackFence[index] = glProcs.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    if (!readbackFence[index]) {
+        LOG(LL_ERROR, LCF_WINDOW | LCF_OGL, "Could not create fence for pixel transfer");
+        pendingReadback = -1;
+        return;
+    }
+
+    pendingReadback = index;
+    readbackIndex = (index + 1) % READBACK_COUNT;
+}
+
+bool ScreenCapture_GL::finishReadback()
+{
+    if (pendingReadback < 0)
+        return false;
+
+    int index = pendingReadback;
+    pendingReadback = -1;
+
+    /* Wait for the transfer to finish. The flush bit makes sure that the
+     * fence is submitted to the GPU, otherwise it may never be signaled. */
+    GLsync fence = static_cast<GLsync>(readbackFence[index]);
+    GLenum status = glProcs.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glProcs.DeleteSync(fence);
+    readbackFence[index] = nullptr;
+
+    if ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED)) {
+        LOG(LL_WARN, LCF_WINDOW | LCF_OGL, "Pixel transfer did not complete (status %d)", status);
+        return false;
+    }
+
+    GLint pixel_buffer;
+    glProcs.GetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_buffer);
+
+    GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, readbackPBO[index]));
+
+    const void* data = glProcs.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data) {
+        /* Pixels are already flipped, so this is a single copy */
+        memcpy(winpixels.data(), data, size);
+        glProcs.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+        LOG(LL_ERROR, LCF_WINDOW | LCF_OGL, "Could not map pixel buffer");
+    }
+
+    GL_CALL(BindBuffer, (GL_PIXEL_PACK_BUFFER, pixel_buffer));
+
+    return data != nullptr;
+}
+
 int ScreenCapture_GL::getPixelsFromSurface(uint8_t **pixels, bool draw)
 {
     if (pixels) {
@@ -173,6 +342,11 @@ int ScreenCapture_GL::getPixelsFromSurface(uint8_t **pixels, bool draw)
 
     GlobalNative gn;
 
+    /* Use the transfer started when the screen was captured, and fallback
+     * to a synchronous read otherwise */
+    if (finishReadback())
+        return size;
+
     /* Copy the original read framebuffer */
     GLint read_buffer;
     glProcs.GetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_buffer);
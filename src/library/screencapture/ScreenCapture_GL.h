@@ -59,9 +59,45 @@ public:
     uint64_t screenTexture();
 
 private:    
+    /* Start transfering the screen surface into a pixel buffer object, so
+     * that the GPU copies pixels while the frame continues */
+    void startReadback();
+
+    /* Copy the pixels of the last started transfer into `winpixels`.
+     * Returns false if there is no transfer or if it failed. */
+    bool finishReadback();
+
     /* Single line of pixels to swap GL array that has different reference point */
     std::vector<uint8_t> gllinepixels;
 
+    /* Number of pixel buffers, so that a transfer can be started while a
+     * previous one is not finished (e.g. when the screen is recaptured with
+     * the OSD) */
+    static const int READBACK_COUNT = 2;
+
+    /* Pixel buffers receiving the asynchronous transfers */
+    uint32_t readbackPBO[READBACK_COUNT] = {};
+
+    /* Fences signaled when each transfer is complete (GLsync objects) */
+    void* readbackFence[READBACK_COUNT] = {};
+
+    /* Index of the next pixel buffer to use */
+    int readbackIndex = 0;
+
+    /* Index of the pixel buffer of the last transfer, or -1 */
+    int pendingReadback = -1;
+
+    /* Are pixel buffers and fences supported by the context */
+    bool asyncReadback = false;
+
+    /* Internal format of the screen texture */
+    int32_t screenTexFormat = 0;
+
+    /* OpenGL framebuffer and texture that receive the screen upside down,
+     * so that the GPU does the vertical flip before the transfer */
+    uint32_t flipFBO = 0;
+    uint32_t flipTex = 0;
+
     /* OpenGL framebuffer */
     uint32_t screenFBO = 0;
 
@@ -51,6 +51,10 @@ DECLARE_ORIG_POINTER(vkCreateSampler)
 DECLARE_ORIG_POINTER(vkDestroyImageView)
 DECLARE_ORIG_POINTER(vkDestroySampler)
 DECLARE_ORIG_POINTER(vkCmdClearColorImage)
+DECLARE_ORIG_POINTER(vkCreateFence)
+DECLARE_ORIG_POINTER(vkDestroyFence)
+DECLARE_ORIG_POINTER(vkWaitForFences)
+DECLARE_ORIG_POINTER(vkResetFences)
 
 int ScreenCapture_Vulkan::init()
 {
@@ -132,14 +136,43 @@ void ScreenCapture_Vulkan::initScreenSurface()
     VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocInfo.allocationSize = memRequirements.size;
-    // Memory must be host visible to copy from
-    allocInfo.memoryTypeIndex = vk::getMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    // Memory must be host visible to copy from. Prefer cached memory, which
+    // is much faster to read from the CPU.
+    VkMemoryPropertyFlags cachedFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    allocInfo.memoryTypeIndex = vk::getMemoryTypeIndex(memRequirements.memoryTypeBits, cachedFlags);
+    if (!((memRequirements.memoryTypeBits >> allocInfo.memoryTypeIndex) & 1) ||
+        ((vk::context.deviceMemoryProperties.memoryTypes[allocInfo.memoryTypeIndex].propertyFlags & cachedFlags) != cachedFlags))
+        allocInfo.memoryTypeIndex = vk::getMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
     if ((res = orig::vkAllocateMemory(vk::context.device, &allocInfo, vk::context.allocator, &vkScreenImageMemory)) != VK_SUCCESS) {
         LOG(LL_ERROR, LCF_VULKAN, "vkAllocateMemory failed with error %d", res);
     }
 
     orig::vkBindImageMemory(vk::context.device, vkScreenImage, vkScreenImageMemory, 0);
+
+    /* Map image memory once, and get its layout */
+    if ((res = orig::vkMapMemory(vk::context.device, vkScreenImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&vkScreenImageData)) != VK_SUCCESS) {
+        LOG(LL_ERROR, LCF_VULKAN, "vkMapMemory failed with error %d", res);
+        vkScreenImageData = nullptr;
+    }
+
+    VkImageSubresource subResource { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+    orig::vkGetImageSubresourceLayout(vk::context.device, vkScreenImage, &subResource, &vkScreenImageLayout);
+
+    directPixels = vkScreenImageData && (vkScreenImageLayout.rowPitch == static_cast<VkDeviceSize>(pitch)) &&
+        (vkScreenImageLayout.size >= static_cast<VkDeviceSize>(size));
+
+    /* Create the fence of screen copies */
+    {
+        VkFenceCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        res = orig::vkCreateFence(vk::context.device, &info, vk::context.allocator, &vkScreenFence);
+        if (res != VK_SUCCESS) {
+            LOG(LL_ERROR, LCF_VULKAN, "vkCreateFence failed with error %d", res);
+            vkScreenFence = VK_NULL_HANDLE;
+        }
+        vkScreenFencePending = false;
+    }
     
     /* From Dear ImGui Display example page 
      * <https://github.com/ocornut/imgui/wiki/Image-Loading-and-Displaying-Examples#example-for-vulkan-users> */
@@ -188,6 +221,13 @@ void ScreenCapture_Vulkan::initScreenSurface()
 
 void ScreenCapture_Vulkan::destroyScreenSurface()
 {
+    /* The image must not be used by a pending copy */
+    waitScreenCopy();
+    if (vkScreenFence != VK_NULL_HANDLE) {
+        orig::vkDestroyFence(vk::context.device, vkScreenFence, vk::context.allocator);
+        vkScreenFence = VK_NULL_HANDLE;
+    }
+
     /* Delete the Vulkan image and all associated objects */
     if (vkScreenDescriptorSet != VK_NULL_HANDLE) {
         ImGui_ImplVulkan_RemoveTexture(vkScreenDescriptorSet);
@@ -201,6 +241,11 @@ void ScreenCapture_Vulkan::destroyScreenSurface()
         orig::vkDestroyImageView(vk::context.device, vkScreenImageView, nullptr);
         vkScreenImageView = VK_NULL_HANDLE;
     }    
+    if (vkScreenImageData) {
+        orig::vkUnmapMemory(vk::context.device, vkScreenImageMemory);
+        vkScreenImageData = nullptr;
+    }
+    directPixels = false;
     if (vkScreenImageMemory != VK_NULL_HANDLE) {
         orig::vkFreeMemory(vk::context.device, vkScreenImageMemory, nullptr);
         vkScreenImageMemory = VK_NULL_HANDLE;
@@ -263,6 +308,13 @@ int ScreenCapture_Vulkan::copyScreenToSurface()
     VkCommandBuffer cmdBuffer = vk::context.frames[vk::context.frameIndex].screenCommandBuffer;
     VkImage backbuffer = vk::context.frames[vk::context.frameIndex].backbuffer;
 
+    /* The fence can only be reset when not in use by a previous copy, which
+     * is already completed at this point (e.g. when recapturing the screen
+     * with the OSD). */
+    waitScreenCopy();
+    if (vkScreenFence != VK_NULL_HANDLE)
+        orig::vkResetFences(vk::context.device, 1, &vkScreenFence);
+
     VkCommandBufferBeginInfo cmdBufInfo{};
     cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -389,19 +441,38 @@ int ScreenCapture_Vulkan::copyScreenToSurface()
 
     // LOG(LL_DEBUG, LCF_VULKAN, "    vkQueueSubmit wait on %llx and signal %llx and semindex %d", submitInfo.pWaitSemaphores[0], submitInfo.pSignalSemaphores[0], vk::context.semaphoreIndex);
 
-    if ((res = orig::vkQueueSubmit(vk::context.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE)) != VK_SUCCESS) {
+    /* Pixels are not read here, but when encoding at the end of the frame,
+     * so that the copy runs while the frame continues */
+    if ((res = orig::vkQueueSubmit(vk::context.graphicsQueue, 1, &submitInfo, vkScreenFence)) != VK_SUCCESS) {
         LOG(LL_ERROR, LCF_VULKAN, "vkEndCommandBuffer failed with error %d", res);
     }
+    else {
+        vkScreenFencePending = (vkScreenFence != VK_NULL_HANDLE);
+    }
 
     vk::context.currentSemaphore = submitInfo.pSignalSemaphores[0];
     
     return size;
 }
 
+void ScreenCapture_Vulkan::waitScreenCopy()
+{
+    if (!vkScreenFencePending)
+        return;
+
+    VkResult res;
+    if ((res = orig::vkWaitForFences(vk::context.device, 1, &vkScreenFence, VK_TRUE, 1000000000)) != VK_SUCCESS) {
+        LOG(LL_ERROR, LCF_VULKAN, "vkWaitForFences failed with error %d", res);
+    }
+    vkScreenFencePending = false;
+}
+
 int ScreenCapture_Vulkan::getPixelsFromSurface(uint8_t **pixels, bool draw)
 {
+    /* When rows are not padded, the encoder reads pixels directly from the
+     * mapped image, which keeps the last captured screen */
     if (pixels) {
-        *pixels = winpixels.data();
+        *pixels = directPixels ? (vkScreenImageData + vkScreenImageLayout.offset) : winpixels.data();
     }
 
     if (!draw)
@@ -409,35 +480,26 @@ int ScreenCapture_Vulkan::getPixelsFromSurface(uint8_t **pixels, bool draw)
 
     GlobalNative gn;
 
-    VkResult res;
+    /* Wait for the copy of the screen */
+    waitScreenCopy();
 
-    /* Get layout of the image (including row pitch) */
-	VkImageSubresource subResource { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-	VkSubresourceLayout subResourceLayout;
-	orig::vkGetImageSubresourceLayout(vk::context.device, vkScreenImage, &subResource, &subResourceLayout);
+    if (directPixels || !vkScreenImageData)
+        return size;
 
-	/* Map image memory so we can start copying from it */
-	const char* data;
-    if ((res = orig::vkMapMemory(vk::context.device, vkScreenImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data)) != VK_SUCCESS) {
-        LOG(LL_ERROR, LCF_VULKAN, "vkEndCommandBuffer failed with error %d", res);
-    }
-    
     /* Copy image pixels respecting the image layout. */
-    data += subResourceLayout.offset;
+    const uint8_t* data = vkScreenImageData + vkScreenImageLayout.offset;
     VkDeviceSize s = 0;
     int h = 0;
-    while ((s < subResourceLayout.size) && (h < height)) {
+    while ((s < vkScreenImageLayout.size) && (h < height)) {
         memcpy(&winpixels[h*width*pixelSize], data, width*pixelSize);
-        data += subResourceLayout.rowPitch;
-        s += subResourceLayout.rowPitch;
+        data += vkScreenImageLayout.rowPitch;
+        s += vkScreenImageLayout.rowPitch;
         h++;
     }
 
     if (h != height)
         LOG(LL_ERROR, LCF_VULKAN, "Mismatch between Vulkan internal image height (%d) and registered height (%d)", h, height);
     
-    orig::vkUnmapMemory(vk::context.device, vkScreenImageMemory);
-    
     return size;
 }
 
@@ -68,6 +68,25 @@ private:
     VkSampler vkScreenSampler = VK_NULL_HANDLE;
     VkDescriptorSet vkScreenDescriptorSet = VK_NULL_HANDLE;
     VkDeviceMemory vkScreenImageMemory = VK_NULL_HANDLE;
+
+    /* Screen image memory, mapped for the lifetime of the image */
+    uint8_t* vkScreenImageData = nullptr;
+
+    /* Layout of the screen image in memory (including row pitch) */
+    VkSubresourceLayout vkScreenImageLayout{};
+
+    /* Fence signaled when the copy of the screen is complete */
+    VkFence vkScreenFence = VK_NULL_HANDLE;
+
+    /* Was a copy submitted with the fence that we did not wait for */
+    bool vkScreenFencePending = false;
+
+    /* Wait for the last copy of the screen to complete */
+    void waitScreenCopy();
+
+    /* Return pixels directly from the mapped image memory instead of copying
+     * them, when rows are stored without padding */
+    bool directPixels = false;
 }; 
 }
 
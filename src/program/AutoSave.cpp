@@ -50,7 +50,10 @@ void AutoSave::update(Context* context, MovieFile& movie)
 		std::string moviename = fileFromPath(context->config.moviefile);
 
 		/* Remove the extension if any */
-		if (moviename.compare(moviename.size() - 4, 4, ".ltm") == 0) {
+		if (MovieFile::isBinaryPath(moviename)) {
+			moviename.resize(moviename.size() - strlen(MovieFile::BINARY_EXTENSION));
+		}
+		else if (moviename.compare(moviename.size() - 4, 4, ".ltm") == 0) {
 			moviename.resize(moviename.size() - 4);
 		}
 
@@ -72,6 +72,8 @@ void Config::save(const std::string& gamepath) {
     general_settings.setValue("debugger", debugger);
     general_settings.setValue("strace_events", strace_events.c_str());
     general_settings.setValue("allow_downloads", allow_downloads);
+    general_settings.setValue("shared_memory_socket", shared_memory_socket);
+    general_settings.setValue("ramsearch_memory_budget", ramsearch_memory_budget);
 
     general_settings.setValue("datadir", datadir.c_str());
     general_settings.setValue("steamuserdir", steamuserdir.c_str());
@@ -162,6 +164,8 @@ void Config::save(const std::string& gamepath) {
     settings.setValue("screen_height", sc.screen_height);
     settings.setValue("osd", sc.osd);
     settings.setValue("osd_encode", sc.osd_encode);
+    settings.setValue("encode_skip_duplicates", sc.encode_skip_duplicates);
+    settings.setValue("screenshot_async", sc.screenshot_async);
     settings.setValue("prevent_savefiles", sc.prevent_savefiles);
     settings.setValue("audio_bitdepth", sc.audio_bitdepth);
     settings.setValue("audio_channels", sc.audio_channels);
@@ -174,6 +178,8 @@ void Config::save(const std::string& gamepath) {
     settings.setValue("video_framerate", sc.video_framerate);
     settings.setValue("audio_codec", sc.audio_codec);
     settings.setValue("audio_bitrate", sc.audio_bitrate);
+    settings.setValue("encode_queue_size", sc.encode_queue_size);
+    settings.setValue("encode_queue_policy", sc.encode_queue_policy);
     settings.setValue("locale", sc.locale);
     settings.setValue("virtual_steam", sc.virtual_steam);
     settings.setValue("openal_soft", sc.openal_soft);
@@ -193,6 +199,13 @@ void Config::save(const std::string& gamepath) {
     settings.endArray();
 
     settings.setValue("savestate_settings", sc.savestate_settings);
+    settings.setValue("savestate_ram_size", sc.savestate_ram_size);
+    settings.setValue("savestate_codec", sc.savestate_codec);
+    settings.setValue("savestate_codec_level", sc.savestate_codec_level);
+    settings.setValue("savestate_alt_codec", sc.savestate_alt_codec);
+    settings.setValue("savestate_alt_codec_level", sc.savestate_alt_codec_level);
+    settings.setValue("savestate_alt_codec_slots", sc.savestate_alt_codec_slots);
+    settings.setValue("savestate_dirty_tracking", sc.savestate_dirty_tracking);
 
     settings.endGroup();
 }
@@ -232,6 +245,8 @@ void Config::load(const std::string& gamepath) {
 #endif
     strace_events = general_settings.value("strace_events").toString().toStdString();
     allow_downloads = general_settings.value("allow_downloads", allow_downloads).toInt();
+    shared_memory_socket = general_settings.value("shared_memory_socket", shared_memory_socket).toBool();
+    ramsearch_memory_budget = general_settings.value("ramsearch_memory_budget", ramsearch_memory_budget).toInt();
 
     ffmpegoptions = general_settings.value("ffmpegoptions", ffmpegoptions.c_str()).toString().toStdString();
 
@@ -367,6 +382,8 @@ void Config::load(const std::string& gamepath) {
     sc.screen_height = settings.value("screen_height", sc.screen_height).toInt();
     sc.osd = settings.value("osd", sc.osd).toBool();
     sc.osd_encode = settings.value("osd_encode", sc.osd_encode).toBool();
+    sc.encode_skip_duplicates = settings.value("encode_skip_duplicates", sc.encode_skip_duplicates).toBool();
+    sc.screenshot_async = settings.value("screenshot_async", sc.screenshot_async).toBool();
     sc.prevent_savefiles = settings.value("prevent_savefiles", sc.prevent_savefiles).toBool();
     sc.audio_bitdepth = settings.value("audio_bitdepth", sc.audio_bitdepth).toInt();
     sc.audio_channels = settings.value("audio_channels", sc.audio_channels).toInt();
@@ -388,7 +405,16 @@ void Config::load(const std::string& gamepath) {
     sc.video_framerate = settings.value("video_framerate", sc.video_framerate).toInt();
     sc.audio_codec = settings.value("audio_codec", sc.audio_codec).toInt();
     sc.audio_bitrate = settings.value("audio_bitrate", sc.audio_bitrate).toInt();
+    sc.encode_queue_size = settings.value("encode_queue_size", sc.encode_queue_size).toInt();
+    sc.encode_queue_policy = settings.value("encode_queue_policy", sc.encode_queue_policy).toInt();
     sc.savestate_settings = settings.value("savestate_settings", sc.savestate_settings).toInt();
+    sc.savestate_ram_size = settings.value("savestate_ram_size", sc.savestate_ram_size).toInt();
+    sc.savestate_codec = settings.value("savestate_codec", sc.savestate_codec).toInt();
+    sc.savestate_codec_level = settings.value("savestate_codec_level", sc.savestate_codec_level).toInt();
+    sc.savestate_alt_codec = settings.value("savestate_alt_codec", sc.savestate_alt_codec).toInt();
+    sc.savestate_alt_codec_level = settings.value("savestate_alt_codec_level", sc.savestate_alt_codec_level).toInt();
+    sc.savestate_alt_codec_slots = settings.value("savestate_alt_codec_slots", sc.savestate_alt_codec_slots).toInt();
+    sc.savestate_dirty_tracking = settings.value("savestate_dirty_tracking", sc.savestate_dirty_tracking).toInt();
     sc.opengl_soft = settings.value("opengl_soft", sc.opengl_soft).toBool();
     sc.opengl_performance = settings.value("opengl_performance", sc.opengl_performance).toBool();
 
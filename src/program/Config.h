@@ -93,6 +93,10 @@ public:
     /* Directory holding files storing ram search results */
     std::string ramsearchdir;
 
+    /* Maximum size of ram search results kept in memory (in MB). Results
+     * above are stored in files inside ramsearchdir. */
+    int ramsearch_memory_budget = 1024;
+
     /* Directory holding extra i386 libs required by some games */
     std::string extralib32dir;
 
@@ -183,6 +187,9 @@ public:
      * (-1 for unset) */
     int allow_downloads = -1;
 
+    /* Exchange data with the game through shared memory instead of the socket */
+    bool shared_memory_socket = false;
+
 private:
     QString iniPath(const std::string& gamepath) const;
 
@@ -23,6 +23,7 @@
 #include "Config.h"
 #include "ConcurrentQueue.h"
 #include "KeyMapping.h"
+#include "../shared/SaveStateMetrics.h"
 
 #ifdef __unix__
 #include <xcb/xcb.h>
@@ -134,6 +135,16 @@ struct Context {
     /* fps values */
     float fps, lfps = -1;
 
+    /* Slot, estimated and actual size of the last savestate, and space
+     * available to store it. Sizes are 0 if unknown. */
+    int savestate_size_slot = -1;
+    uint64_t savestate_size_estimate = 0;
+    uint64_t savestate_size = 0;
+    uint64_t savestate_space = 0;
+
+    /* Timings and page counts of the last savestate saving or loading */
+    SaveStateMetrics savestate_metrics = {};
+
     /* Interactive mode */
     bool interactive = true;
     
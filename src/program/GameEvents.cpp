@@ -148,6 +148,7 @@ bool GameEvents::processEvent(GameEvents::EventType type, const HotKey &hk)
             /* Checking that saving succeeded */
             if (message == MSGB_SAVING_SUCCEEDED) {
                 emit savestatePerformed(statei, context->framecount);
+                emit savestateMetricsChanged(context->savestate_metrics);
             }
 
             return false;
@@ -271,6 +272,7 @@ bool GameEvents::processEvent(GameEvents::EventType type, const HotKey &hk)
 
             if (message == MSGB_LOADING_SUCCEEDED) {
                 emit savestatePerformed(statei, 0);
+                emit savestateMetricsChanged(context->savestate_metrics);
             }
 
             return false;
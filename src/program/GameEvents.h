@@ -21,6 +21,7 @@
 #define LIBTAS_GAMEEVENTS_H_INCLUDED
 
 #include "KeyMapping.h"
+#include "../shared/SaveStateMetrics.h"
 
 #include <QtCore/QObject>
 #include <stdint.h>
@@ -90,6 +91,9 @@ signals:
 
     /* register a savestate */
     void savestatePerformed(int slot, unsigned long long frame);
+
+    /* metrics of the last savestate saving or loading */
+    void savestateMetricsChanged(SaveStateMetrics metrics);
 };
 
 #endif
@@ -299,7 +299,7 @@ void GameLoop::init()
 void GameLoop::initProcessMessages()
 {
     /* Connect to the socket between the program and the game */
-    bool inited = initSocketProgram(fork_pid);
+    bool inited = initSocketProgram(fork_pid, context->config.shared_memory_socket);
     if (!inited) {
         loopExit();
         return;
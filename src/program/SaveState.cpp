@@ -26,6 +26,7 @@
 
 #include <iostream>
 #include <unistd.h> // access()
+#include <cstddef> // offsetof
 
 void SaveState::init(Context* context, int i)
 {
@@ -56,7 +57,13 @@ void SaveState::buildPaths(Context* context)
     if (movie_path.empty()) {
         movie_path = context->config.savestatedir + '/';
         movie_path += context->gamename;
-        movie_path += ".movie" + std::to_string(id) + ".ltm";
+        movie_path += ".movie" + std::to_string(id) + MovieFile::BINARY_EXTENSION;
+    }
+
+    if (legacy_movie_path.empty()) {
+        legacy_movie_path = context->config.savestatedir + '/';
+        legacy_movie_path += context->gamename;
+        legacy_movie_path += ".movie" + std::to_string(id) + ".ltm";
     }
 }
 
@@ -82,8 +89,17 @@ void SaveState::buildMessages()
     loaded_state_msg += " loaded";
 }
 
+/* Receive the metrics that follow a successful saving or loading */
+static void receiveMetrics(SaveStateMetrics& metrics)
+{
+    receiveData(&metrics, offsetof(SaveStateMetrics, areas));
+    receiveData(metrics.areas, metrics.area_count * sizeof(SaveStateMetrics::AreaMetrics));
+}
+
 const std::string& SaveState::getMoviePath() const
 {
+    if ((access(movie_path.c_str(), F_OK) != 0) && (access(legacy_movie_path.c_str(), F_OK) == 0))
+        return legacy_movie_path;
     return movie_path;
 }
 
@@ -104,9 +120,19 @@ int SaveState::save(Context* context, const MovieFile& m)
 
     /* Checking that saving succeeded */
     int message = receiveMessage();
+
+    /* Get the size of the savestate */
+    if (message == MSGB_SAVESTATE_SIZE) {
+        receiveData(&context->savestate_size_slot, sizeof(int));
+        receiveData(&context->savestate_size_estimate, sizeof(uint64_t));
+        receiveData(&context->savestate_size, sizeof(uint64_t));
+        receiveData(&context->savestate_space, sizeof(uint64_t));
+        message = receiveMessage();
+    }
     
     /* Set framecount */
     if (message == MSGB_SAVING_SUCCEEDED) {
+        receiveMetrics(context->savestate_metrics);
         framecount = context->framecount;
     }
     
@@ -117,19 +143,23 @@ int SaveState::load(Context* context, const MovieFile& m, bool branch, bool inpu
 {
     /* Check that the savestate exists (check for both savestate files and 
      * framecount, because there can be leftover savestate files from
-     * forked savestate of previous execution). */
-    if ((access(pagemap_path.c_str(), F_OK) != 0) || (access(pages_path.c_str(), F_OK) != 0) ||
-        (framecount == 0)) {
+     * forked savestate of previous execution). Savestates stored in RAM may
+     * not have any file, the game will check for the state presence. */
+    bool missing_files = (access(pagemap_path.c_str(), F_OK) != 0) || (access(pages_path.c_str(), F_OK) != 0);
+    if (context->config.sc.savestate_settings & SharedConfig::SS_RAM)
+        missing_files = false;
+
+    if (missing_files || (framecount == 0)) {
         /* If there is no savestate but a movie file, offer to load
          * the movie and fast-forward to the savestate movie frame.
          */
 
         if ((context->config.sc.recording != SharedConfig::NO_RECORDING) &&
-            (access(movie_path.c_str(), F_OK) == 0)) {
+            (access(getMoviePath().c_str(), F_OK) == 0)) {
 
             /* Load the savestate movie from disk */
             MovieFile savedmovie(context);
-            int ret = savedmovie.loadSavestateMovie(movie_path);
+            int ret = savedmovie.loadSavestateMovie(getMoviePath());
 
             /* Checking if our movie is a prefix of the savestate movie */
             if ((ret == 0) && savedmovie.inputs->isEqual(m.inputs, 0, context->framecount)) {
@@ -207,6 +237,8 @@ int SaveState::postLoad(Context* context, MovieFile& m, bool branch, bool inputE
      */
     bool didLoad = message == MSGB_LOADING_SUCCEEDED;
     if (didLoad) {
+        receiveMetrics(context->savestate_metrics);
+
         /* The copy of SharedConfig that the game stores may not
          * be the same as this one due to memory loading, so we
          * send it.
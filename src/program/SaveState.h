@@ -60,7 +60,8 @@ public:
 
     void init(Context* context, int i);
 
-    /* Return the savestate movie path */
+    /* Return the savestate movie path, or the path of a savestate movie saved
+     * in the text format by an older version if there is only that one */
     const std::string& getMoviePath() const;
 
     /* Save state. Return the received message */
@@ -88,6 +89,9 @@ private:
     /* Savestate movie path */
     std::string movie_path;
 
+    /* Savestate movie path of older versions */
+    std::string legacy_movie_path;
+
     /* Build all savestate paths */
     void buildPaths(Context* context);
 
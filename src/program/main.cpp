@@ -418,7 +418,7 @@ int main(int argc, char **argv)
         context.config.dumping = true;
     }
     
-    MemScanner::init(context.config.ramsearchdir);
+    MemScanner::init(context.config.ramsearchdir, static_cast<uint64_t>(context.config.ramsearch_memory_budget) * 1024 * 1024);
 
     /* Store current content of LD_PRELOAD/DYLD_INSERT_LIBRARIES */
 
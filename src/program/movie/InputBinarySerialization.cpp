@@ -0,0 +1,422 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InputBinarySerialization.h"
+
+#include "../shared/inputs/AllInputs.h"
+#include "../shared/inputs/ControllerInputs.h"
+#include "../shared/inputs/MiscInputs.h"
+#include "../shared/inputs/MouseInputs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Number of records that are encoded and compared at once when writing */
+#define WRITE_CHUNK_FRAMES 4096
+
+namespace {
+
+const char MAGIC[4] = {'L', 'T', 'I', 'N'};
+const uint32_t VERSION = 1;
+
+/* Flags of the inputs header, for inputs that are present in records */
+enum {
+    HAS_POINTER = 0x01,
+    HAS_MISC = 0x02,
+};
+
+/* Flags of the first byte of each record, for inputs that are present in
+ * the frame */
+enum {
+    FRAME_POINTER = 0x01,
+    FRAME_MISC = 0x02,
+    FRAME_EVENTS = 0x04,
+    FRAME_CONTROLLER = 0x10, // shifted by the controller index
+};
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t frame_count;
+    uint32_t record_size;
+    uint32_t key_count; // number of keys stored in each record
+    uint32_t joy_count; // number of controllers stored in each record
+    uint32_t flags;
+    uint64_t event_frame_count; // number of frames containing events
+    uint64_t event_index_offset;
+    uint64_t end_offset; // size of the whole inputs
+};
+
+/* Records are stored after the header */
+const size_t RECORDS_OFFSET = 64;
+static_assert(sizeof(Header) <= RECORDS_OFFSET, "Inputs header is too large");
+
+struct EventIndex {
+    uint64_t frame;
+    uint64_t offset;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+const size_t POINTER_SIZE = 5*sizeof(uint32_t);
+const size_t CONTROLLER_SIZE = ControllerInputs::MAXAXES*sizeof(int16_t) + sizeof(uint16_t);
+const size_t MISC_SIZE = 5*sizeof(uint32_t);
+const size_t EVENT_SIZE = 3*sizeof(uint32_t);
+
+/* Compute the smallest record layout that can store all inputs */
+void buildLayout(const std::vector<AllInputs>& input_list, Header& header)
+{
+    header.key_count = 0;
+    header.joy_count = 0;
+    header.flags = 0;
+    header.event_frame_count = 0;
+
+    for (const AllInputs& ai : input_list) {
+        if (!ai.events.empty()) {
+            /* The state of these frames is rebuilt from the events */
+            header.event_frame_count++;
+            continue;
+        }
+
+        uint32_t k = 0;
+        while ((k < AllInputs::MAXKEYS) && ai.keyboard[k])
+            k++;
+        header.key_count = std::max(header.key_count, k);
+
+        if (ai.pointer)
+            header.flags |= HAS_POINTER;
+        if (ai.misc)
+            header.flags |= HAS_MISC;
+        for (int j = header.joy_count; j < AllInputs::MAXJOYS; j++)
+            if (ai.controllers[j])
+                header.joy_count = j + 1;
+    }
+
+    header.record_size = 1 + header.key_count*sizeof(uint32_t) + header.joy_count*CONTROLLER_SIZE;
+    if (header.flags & HAS_POINTER)
+        header.record_size += POINTER_SIZE;
+    if (header.flags & HAS_MISC)
+        header.record_size += MISC_SIZE;
+}
+
+template<typename T>
+inline uint8_t* put(uint8_t* p, T value)
+{
+    memcpy(p, &value, sizeof(T));
+    return p + sizeof(T);
+}
+
+template<typename T>
+inline const uint8_t* get(const uint8_t* p, T& value)
+{
+    memcpy(&value, p, sizeof(T));
+    return p + sizeof(T);
+}
+
+void encodeRecord(const Header& header, const AllInputs& ai, uint8_t* record)
+{
+    memset(record, 0, header.record_size);
+
+    if (!ai.events.empty()) {
+        record[0] = FRAME_EVENTS;
+        return;
+    }
+
+    uint8_t presence = 0;
+    uint8_t* p = record + 1;
+
+    for (uint32_t k = 0; k < header.key_count; k++)
+        p = put<uint32_t>(p, ai.keyboard[k]);
+
+    if (header.flags & HAS_POINTER) {
+        if (ai.pointer) {
+            presence |= FRAME_POINTER;
+            put<int32_t>(p, ai.pointer->x);
+            put<int32_t>(p + 4, ai.pointer->y);
+            put<int32_t>(p + 8, ai.pointer->wheel);
+            put<uint32_t>(p + 12, ai.pointer->mode);
+            put<uint32_t>(p + 16, ai.pointer->mask);
+        }
+        p += POINTER_SIZE;
+    }
+
+    for (uint32_t j = 0; j < header.joy_count; j++) {
+        if (ai.controllers[j]) {
+            presence |= FRAME_CONTROLLER << j;
+            uint8_t* q = p;
+            for (int axis = 0; axis < ControllerInputs::MAXAXES; axis++)
+                q = put<int16_t>(q, ai.controllers[j]->axes[axis]);
+            put<uint16_t>(q, ai.controllers[j]->buttons);
+        }
+        p += CONTROLLER_SIZE;
+    }
+
+    if ((header.flags & HAS_MISC) && ai.misc) {
+        presence |= FRAME_MISC;
+        put<uint32_t>(p, ai.misc->flags);
+        put<uint32_t>(p + 4, ai.misc->framerate_num);
+        put<uint32_t>(p + 8, ai.misc->framerate_den);
+        put<uint32_t>(p + 12, ai.misc->realtime_sec);
+        put<uint32_t>(p + 16, ai.misc->realtime_nsec);
+    }
+
+    record[0] = presence;
+}
+
+void decodeRecord(const Header& header, const uint8_t* record, AllInputs& ai)
+{
+    uint8_t presence = record[0];
+    const uint8_t* p = record + 1;
+
+    for (uint32_t k = 0; k < header.key_count; k++)
+        p = get<uint32_t>(p, ai.keyboard[k]);
+
+    if (header.flags & HAS_POINTER) {
+        if (presence & FRAME_POINTER) {
+            if (!ai.pointer)
+                ai.pointer.reset(new MouseInputs{});
+            get<int32_t>(p, ai.pointer->x);
+            get<int32_t>(p + 4, ai.pointer->y);
+            get<int32_t>(p + 8, ai.pointer->wheel);
+            get<uint32_t>(p + 12, ai.pointer->mode);
+            get<uint32_t>(p + 16, ai.pointer->mask);
+        }
+        p += POINTER_SIZE;
+    }
+
+    for (uint32_t j = 0; j < header.joy_count; j++) {
+        if (presence & (FRAME_CONTROLLER << j)) {
+            if (!ai.controllers[j])
+                ai.controllers[j].reset(new ControllerInputs{});
+            const uint8_t* q = p;
+            for (int axis = 0; axis < ControllerInputs::MAXAXES; axis++)
+                q = get<int16_t>(q, ai.controllers[j]->axes[axis]);
+            get<uint16_t>(q, ai.controllers[j]->buttons);
+        }
+        p += CONTROLLER_SIZE;
+    }
+
+    if ((header.flags & HAS_MISC) && (presence & FRAME_MISC)) {
+        if (!ai.misc)
+            ai.misc.reset(new MiscInputs{});
+        get<uint32_t>(p, ai.misc->flags);
+        get<uint32_t>(p + 4, ai.misc->framerate_num);
+        get<uint32_t>(p + 8, ai.misc->framerate_den);
+        get<uint32_t>(p + 12, ai.misc->realtime_sec);
+        get<uint32_t>(p + 16, ai.misc->realtime_nsec);
+    }
+}
+
+bool writeAll(int fd, const void* buf, size_t size, off_t offset)
+{
+    const char* ptr = static_cast<const char*>(buf);
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, ptr, size, offset);
+        if (ret <= 0)
+            return false;
+        ptr += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+/* Check that the header describes inputs that fit inside `size` bytes */
+bool checkHeader(const Header& header, size_t size)
+{
+    if ((memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) || (header.version != VERSION))
+        return false;
+    if ((header.end_offset > size) || (header.key_count > AllInputs::MAXKEYS) || (header.joy_count > AllInputs::MAXJOYS))
+        return false;
+    if ((header.record_size == 0) || (header.frame_count > ((header.end_offset - RECORDS_OFFSET) / header.record_size)))
+        return false;
+    if ((header.event_index_offset > header.end_offset) || (header.event_index_offset % alignof(EventIndex)) ||
+        (header.event_frame_count > ((header.end_offset - header.event_index_offset) / sizeof(EventIndex))))
+        return false;
+    return true;
+}
+
+}
+
+off_t InputBinarySerialization::writeInputs(int fd, off_t offset, const std::vector<AllInputs>& input_list)
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.frame_count = input_list.size();
+    buildLayout(input_list, header);
+
+    /* Check if existing inputs share the same layout, so that records can be
+     * compared and only overwritten when they changed */
+    Header old_header;
+    uint64_t old_frame_count = 0;
+    if ((pread(fd, &old_header, sizeof(old_header), offset) == sizeof(old_header)) &&
+        (memcmp(old_header.magic, MAGIC, sizeof(MAGIC)) == 0) &&
+        (old_header.version == VERSION) &&
+        (old_header.record_size == header.record_size) &&
+        (old_header.key_count == header.key_count) &&
+        (old_header.joy_count == header.joy_count) &&
+        (old_header.flags == header.flags))
+        old_frame_count = old_header.frame_count;
+
+    /* Write records */
+    std::vector<uint8_t> chunk(WRITE_CHUNK_FRAMES * header.record_size);
+    std::vector<uint8_t> old_chunk;
+    for (uint64_t f = 0; f < input_list.size(); f += WRITE_CHUNK_FRAMES) {
+        uint64_t count = std::min<uint64_t>(WRITE_CHUNK_FRAMES, input_list.size() - f);
+        for (uint64_t i = 0; i < count; i++)
+            encodeRecord(header, input_list[f+i], chunk.data() + i*header.record_size);
+
+        size_t size = count * header.record_size;
+        off_t chunk_offset = offset + RECORDS_OFFSET + f*header.record_size;
+
+        if ((f + count) <= old_frame_count) {
+            old_chunk.resize(size);
+            if ((pread(fd, old_chunk.data(), size, chunk_offset) == static_cast<ssize_t>(size)) &&
+                (memcmp(old_chunk.data(), chunk.data(), size) == 0))
+                continue;
+        }
+
+        if (!writeAll(fd, chunk.data(), size, chunk_offset))
+            return -1;
+    }
+
+    /* Write events followed by their index */
+    off_t events_offset = RECORDS_OFFSET + input_list.size()*header.record_size;
+    std::vector<uint8_t> events;
+    std::vector<EventIndex> event_index;
+    event_index.reserve(header.event_frame_count);
+    for (uint64_t f = 0; f < input_list.size(); f++) {
+        const AllInputs& ai = input_list[f];
+        if (ai.events.empty())
+            continue;
+
+        EventIndex ei;
+        ei.frame = f;
+        ei.offset = events_offset + events.size();
+        ei.count = ai.events.size();
+        ei.reserved = 0;
+        event_index.push_back(ei);
+
+        for (const InputEvent& ie : ai.events) {
+            uint8_t e[EVENT_SIZE];
+            put<int32_t>(e, ie.type);
+            put<uint32_t>(e + 4, ie.which);
+            put<int32_t>(e + 8, ie.value);
+            events.insert(events.end(), e, e + EVENT_SIZE);
+        }
+    }
+
+    /* Align the index for readers of the mapped inputs. Records may have any
+     * size, so the events don't start on an aligned offset. */
+    header.event_index_offset = (events_offset + events.size() + 7) & ~static_cast<uint64_t>(7);
+    events.resize(header.event_index_offset - events_offset);
+    header.end_offset = header.event_index_offset + event_index.size()*sizeof(EventIndex);
+
+    if (!writeAll(fd, events.data(), events.size(), offset + events_offset))
+        return -1;
+    if (!writeAll(fd, event_index.data(), event_index.size()*sizeof(EventIndex), offset + header.event_index_offset))
+        return -1;
+
+    /* Write the header last */
+    uint8_t header_buf[RECORDS_OFFSET] = {};
+    memcpy(header_buf, &header, sizeof(header));
+    if (!writeAll(fd, header_buf, RECORDS_OFFSET, offset))
+        return -1;
+
+    return offset + header.end_offset;
+}
+
+int InputBinarySerialization::readFrame(const uint8_t* data, size_t size, uint64_t pos, AllInputs& inputs)
+{
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if (pos >= header.frame_count)
+        return -1;
+
+    inputs.clear();
+
+    /* Records have a fixed size, so that any frame can be accessed directly */
+    const uint8_t* record = data + RECORDS_OFFSET + pos*header.record_size;
+    if (!(record[0] & FRAME_EVENTS)) {
+        decodeRecord(header, record, inputs);
+        return 0;
+    }
+
+    /* Look for the events of this frame */
+    const EventIndex* index_begin = reinterpret_cast<const EventIndex*>(data + header.event_index_offset);
+    const EventIndex* index_end = index_begin + header.event_frame_count;
+    const EventIndex* ei = std::lower_bound(index_begin, index_end, pos,
+        [](const EventIndex& e, uint64_t f) {return e.frame < f;});
+    if ((ei == index_end) || (ei->frame != pos) || (ei->offset + ei->count*EVENT_SIZE > size))
+        return -1;
+
+    const uint8_t* e = data + ei->offset;
+    for (uint32_t i = 0; i < ei->count; i++, e += EVENT_SIZE) {
+        InputEvent ie;
+        get<int32_t>(e, ie.type);
+        get<uint32_t>(e + 4, ie.which);
+        get<int32_t>(e + 8, ie.value);
+        inputs.events.push_back(ie);
+    }
+
+    /* Fill the remaining state to the state at the end of event processing,
+     * like the text format */
+    inputs.processEvents();
+    return 0;
+}
+
+int InputBinarySerialization::readInputs(const std::string& file, off_t offset, std::vector<AllInputs>& input_list)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    Header header;
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    if ((file_size < offset) || (pread(fd, &header, sizeof(header), offset) != sizeof(header)) ||
+        !checkHeader(header, file_size - offset)) {
+        ::close(fd);
+        return -1;
+    }
+
+    void* data = mmap(nullptr, header.end_offset, PROT_READ, MAP_PRIVATE, fd, offset);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    int ret = 0;
+
+    input_list.resize(header.frame_count);
+    for (uint64_t f = 0; f < header.frame_count; f++) {
+        if (readFrame(bytes, header.end_offset, f, input_list[f]) < 0) {
+            input_list.resize(f);
+            ret = -1;
+            break;
+        }
+    }
+
+    munmap(data, header.end_offset);
+    return ret;
+}
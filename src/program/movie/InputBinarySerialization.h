@@ -0,0 +1,53 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_INPUTBINARYSERIALIZATION_H_INCLUDED
+#define LIBTAS_INPUTBINARYSERIALIZATION_H_INCLUDED
+
+#include "../shared/inputs/AllInputs.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Binary format of the movie inputs. Each frame is stored as a record of
+ * fixed size, whose layout only contains the inputs used by the movie, so that
+ * any frame can be read or overwritten in place. Events, which have a
+ * variable size, are stored after the records with an index of the frames
+ * that contain them. */
+namespace InputBinarySerialization {
+
+/* Write a list of inputs into a file at the specified offset. If the file
+ * already contains inputs with the same record layout at this offset, only
+ * the records that changed are written. Returns the offset of the end of the
+ * inputs, or -1 on error. */
+off_t writeInputs(int fd, off_t offset, const std::vector<AllInputs>& input_list);
+
+/* Read a list of inputs from a file at the specified offset, which must be
+ * page-aligned so that inputs can be mapped. Returns 0 or -1 on error. */
+int readInputs(const std::string& file, off_t offset, std::vector<AllInputs>& input_list);
+
+/* Read a single frame from mapped inputs. Returns 0 or -1 if the frame does
+ * not exist. */
+int readFrame(const uint8_t* data, size_t size, uint64_t pos, AllInputs& inputs);
+
+};
+
+#endif
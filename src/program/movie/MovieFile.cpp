@@ -24,10 +24,38 @@
 
 #include <sstream>
 #include <iostream>
+#include <fstream>
+#include <cstring>
 #include <fcntl.h> // O_RDONLY, O_WRONLY, O_CREAT
 #include <errno.h>
 #include <unistd.h>
 
+/* Binary moviefiles start with a header listing the files of the movie. The
+ * inputs come first at a page-aligned offset, so that they can be mapped and
+ * updated in place when saving over the same moviefile, followed by the
+ * other files. */
+static const char BINARY_MAGIC[8] = {'L', 'I', 'B', 'T', 'A', 'S', 'M', 'V'};
+static const uint32_t BINARY_VERSION = 1;
+static const off_t BINARY_INPUTS_OFFSET = 4096;
+
+struct BinaryMovieHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    struct {
+        char name[48];
+        uint64_t offset;
+        uint64_t size;
+    } files[8];
+};
+
+static_assert(sizeof(BinaryMovieHeader) <= BINARY_INPUTS_OFFSET, "Binary moviefile header is too large");
+
+/* Files of the movie other than inputs, stored in binary moviefiles */
+static const char* const BINARY_MOVIE_FILES[] = {"config.ini", "editor.ini", "annotations.txt"};
+
+const char* MovieFile::BINARY_EXTENSION = ".ltmb";
+
 MovieFile::MovieFile(Context* c) : context(c)
 {
     header = new MovieFileHeader(c);
@@ -58,6 +86,12 @@ const char* MovieFile::errorString(int error_code) {
     }
 }
 
+bool MovieFile::isBinaryPath(const std::string& moviefile)
+{
+    size_t len = strlen(BINARY_EXTENSION);
+    return (moviefile.size() >= len) && (moviefile.compare(moviefile.size() - len, len, BINARY_EXTENSION) == 0);
+}
+
 void MovieFile::clear()
 {
     header->clear();
@@ -86,6 +120,16 @@ int MovieFile::extractMovie(const std::string& moviefile)
     unlink(inputfile.c_str());
     unlink(annotationsfile.c_str());
 
+    /* Binary moviefiles are recognized by their content, whatever their
+     * extension */
+    binary_inputs_offset = -1;
+    char magic[sizeof(BINARY_MAGIC)] = {};
+    std::ifstream ifs(moviefile, std::ios::binary);
+    ifs.read(magic, sizeof(magic));
+    ifs.close();
+    if (memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0)
+        return extractBinaryMovie(moviefile);
+
     /* Build the tar command */
     std::ostringstream oss;
     /* Piping gzip -> tar to avoid gzip warnings on old movie files */
@@ -110,6 +154,73 @@ int MovieFile::extractMovie(const std::string& moviefile)
     return 0;
 }
 
+int MovieFile::extractBinaryMovie(const std::string& moviefile)
+{
+    int fd = open(moviefile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return EBADARCHIVE;
+
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    BinaryMovieHeader header;
+    if ((pread(fd, &header, sizeof(header), 0) != sizeof(header)) ||
+        (header.version != BINARY_VERSION) ||
+        (header.file_count > (sizeof(header.files) / sizeof(header.files[0])))) {
+        ::close(fd);
+        errno = EINVAL;
+        return EBADARCHIVE;
+    }
+
+    bool has_config = false;
+    for (uint32_t f = 0; f < header.file_count; f++) {
+        std::string name(header.files[f].name, strnlen(header.files[f].name, sizeof(header.files[f].name)));
+
+        if ((header.files[f].offset > static_cast<uint64_t>(file_size)) ||
+            (header.files[f].size > (file_size - header.files[f].offset))) {
+            ::close(fd);
+            errno = EINVAL;
+            return EBADARCHIVE;
+        }
+
+        /* Inputs are read directly from the moviefile */
+        if (name == "inputs") {
+            binary_inputs_offset = header.files[f].offset;
+            continue;
+        }
+
+        /* Only extract known files */
+        bool known = false;
+        for (const char* file : BINARY_MOVIE_FILES)
+            known |= (name == file);
+        if (!known)
+            continue;
+
+        std::string content(header.files[f].size, '\0');
+        if (pread(fd, &content[0], content.size(), header.files[f].offset) != static_cast<ssize_t>(content.size())) {
+            ::close(fd);
+            errno = EIO;
+            return EBADARCHIVE;
+        }
+
+        std::ofstream ofs(context->config.tempmoviedir + "/" + name, std::ios::binary | std::ios::trunc);
+        ofs.write(content.data(), content.size());
+        if (!ofs) {
+            ::close(fd);
+            return EBADARCHIVE;
+        }
+
+        has_config |= (name == "config.ini");
+    }
+
+    ::close(fd);
+
+    if (!has_config)
+        return ENOCONFIG;
+    if (binary_inputs_offset < 0)
+        return ENOINPUTS;
+
+    return 0;
+}
+
 int MovieFile::extractMovie()
 {
     return extractMovie(context->config.moviefile);
@@ -130,7 +241,9 @@ int MovieFile::loadMovie(const std::string& moviefile)
      * Then it resets the input editor view */
     editor->load();
     header->load();
-    inputs->load();
+    ret = loadInputs(moviefile);
+    if (ret < 0)
+        return ret;
     annotations->load();
 
     /* Copy framerate values to inputs */
@@ -158,7 +271,9 @@ int MovieFile::loadSavestateMovie(const std::string& moviefile)
     if (ret < 0)
         return ret;
 
-    inputs->load();
+    ret = loadInputs(moviefile);
+    if (ret < 0)
+        return ret;
     editor->load();
     header->loadSavestate();
     inputs->length_sec = header->length_sec;
@@ -167,13 +282,29 @@ int MovieFile::loadSavestateMovie(const std::string& moviefile)
     return 0;
 }
 
+int MovieFile::loadInputs(const std::string& moviefile)
+{
+    if (binary_inputs_offset < 0) {
+        inputs->load();
+        return 0;
+    }
+
+    if (inputs->loadBinary(moviefile, binary_inputs_offset) < 0)
+        return ENOINPUTS;
+
+    return 0;
+}
+
 int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
 {
     /* Skip empty moviefiles, if user tested the annotations without specifying a movie */
     if (moviefile.empty())
         return ENOMOVIE;
 
-    inputs->save();
+    bool binary = isBinaryPath(moviefile);
+
+    if (!binary)
+        inputs->save();
     header->variable_framerate = inputs->variable_framerate;
     header->length_sec = inputs->length_sec;
     header->length_nsec = inputs->length_nsec;
@@ -181,6 +312,9 @@ int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
     annotations->save();
     editor->save();
 
+    if (binary)
+        return saveBinaryMovie(moviefile);
+
     /* Build the tar command */
     std::ostringstream oss;
     oss << "tar -czUf \"";
@@ -199,6 +333,60 @@ int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
     return 0;
 }
 
+int MovieFile::saveBinaryMovie(const std::string& moviefile)
+{
+    /* Don't truncate the file, so that unchanged inputs are not written
+     * again */
+    int fd = open(moviefile.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return EBADARCHIVE;
+
+    BinaryMovieHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version = BINARY_VERSION;
+
+    off_t offset = inputs->saveBinary(fd, BINARY_INPUTS_OFFSET);
+    if (offset < 0) {
+        ::close(fd);
+        return EBADARCHIVE;
+    }
+
+    strcpy(header.files[0].name, "inputs");
+    header.files[0].offset = BINARY_INPUTS_OFFSET;
+    header.files[0].size = offset - BINARY_INPUTS_OFFSET;
+    header.file_count = 1;
+
+    for (const char* file : BINARY_MOVIE_FILES) {
+        std::ifstream ifs(context->config.tempmoviedir + "/" + file, std::ios::binary);
+        if (!ifs)
+            continue;
+        std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+        if (pwrite(fd, content.data(), content.size(), offset) != static_cast<ssize_t>(content.size())) {
+            ::close(fd);
+            return EBADARCHIVE;
+        }
+
+        strncpy(header.files[header.file_count].name, file, sizeof(header.files[0].name) - 1);
+        header.files[header.file_count].offset = offset;
+        header.files[header.file_count].size = content.size();
+        header.file_count++;
+        offset += content.size();
+    }
+
+    /* Write the header last, and remove the remaining of a previous longer
+     * moviefile */
+    if ((pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) ||
+        (ftruncate(fd, offset) != 0)) {
+        ::close(fd);
+        return EBADARCHIVE;
+    }
+
+    ::close(fd);
+    return 0;
+}
+
 int MovieFile::saveMovie(const std::string& moviefile)
 {
     return saveMovie(moviefile, inputs->nbFrames());
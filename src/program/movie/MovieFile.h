@@ -28,6 +28,7 @@
 
 #include <string>
 #include <stdint.h>
+#include <sys/types.h>
 
 class AllInputs;
 struct Context;
@@ -52,6 +53,13 @@ public:
     /* Error string associated with an error code */
     static const char* errorString(int error_code);
 
+    /* Extension of moviefiles saved in the binary format instead of a
+     * compressed archive */
+    static const char* BINARY_EXTENSION;
+
+    /* Check if a moviefile path uses the binary format extension */
+    static bool isBinaryPath(const std::string& moviefile);
+
     /* Prepare a movie file from the context */
     MovieFile(Context* c);
 
@@ -99,6 +107,20 @@ public:
 private:
     Context* context;    
 
+    /* Offset of the inputs inside the extracted moviefile if it uses the
+     * binary format, or -1 */
+    off_t binary_inputs_offset = -1;
+
+    /* Extract the files of a binary moviefile, except the inputs which are
+     * read directly from the moviefile */
+    int extractBinaryMovie(const std::string& moviefile);
+
+    /* Write the moviefile in the binary format */
+    int saveBinaryMovie(const std::string& moviefile);
+
+    /* Load the inputs from the last extracted moviefile */
+    int loadInputs(const std::string& moviefile);
+
 };
 
 #endif
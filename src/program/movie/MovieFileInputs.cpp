@@ -20,6 +20,7 @@
 #include "MovieFileInputs.h"
 #include "MovieFileChangeLog.h"
 #include "InputSerialization.h"
+#include "InputBinarySerialization.h"
 #include "IMovieAction.h"
 #include "MovieActionEditFrames.h"
 #include "MovieActionInsertFrames.h"
@@ -109,6 +110,29 @@ void MovieFileInputs::save()
     input_stream.close();
 }
 
+int MovieFileInputs::loadBinary(const std::string& moviefile, off_t offset)
+{
+    emit inputsToBeReset();
+
+    modifiedSinceLastSave = false;
+    modifiedSinceLastAutoSave = false;
+    modifiedSinceLastStateLoad = false;
+
+    /* Clear structures */
+    input_list.clear();
+
+    int ret = InputBinarySerialization::readInputs(moviefile, offset, input_list);
+
+    movie_changelog->clear();
+    emit inputsReset();
+    return ret;
+}
+
+off_t MovieFileInputs::saveBinary(int fd, off_t offset)
+{
+    return InputBinarySerialization::writeInputs(fd, offset, input_list);
+}
+
 uint64_t MovieFileInputs::nbFrames()
 {
     return input_list.size();
@@ -30,6 +30,7 @@
 #include <set>
 #include <mutex>
 #include <stdint.h>
+#include <sys/types.h>
 
 struct Context;
 class MovieFileChangeLog;
@@ -78,6 +79,14 @@ public:
     /* Write the inputs into a file and compress to the whole moviefile */
     void save();
 
+    /* Import the inputs from a binary moviefile, at the specified offset.
+     * Returns 0 if no error, or a negative value if an error occured */
+    int loadBinary(const std::string& moviefile, off_t offset);
+
+    /* Write the inputs into a binary moviefile at the specified offset.
+     * Returns the offset of the end of the inputs, or -1 on error */
+    off_t saveBinary(int fd, off_t offset);
+
     /* Get the number of frames of the current movie */
     uint64_t nbFrames();
 
@@ -24,44 +24,53 @@
 #include <cstdio>
 #include <inttypes.h>
 #include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 /* Cast once the compared values to the appropriate type */
 static MemValueType compare_value;
 static MemValueType different_value;
 
-typedef bool (*compare_t)(const MemValueType*);
+/* Compare a value with another one, which is either the stored constant value
+ * or the old value, so that scan threads never write the stored value */
+typedef bool (*compare_t)(const MemValueType*, const MemValueType*);
 static compare_t compare_method;
 
+typedef void (*scan_t)(const uint8_t*, const uint8_t*, int, int, uint64_t*);
+static scan_t scan_values_method;
+static scan_t scan_previous_method;
+
 static int value_type;
 
 #define DEFINE_CHECK_TYPED(T) \
-static bool check_equal_##T(const MemValueType* value) \
+static bool check_equal_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T == compare_value.v_##T;\
+    return value->v_##T == other->v_##T;\
 }\
-static bool check_notequal_##T(const MemValueType* value) \
+static bool check_notequal_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T != compare_value.v_##T;\
+    return value->v_##T != other->v_##T;\
 }\
-static bool check_less_##T(const MemValueType* value) \
+static bool check_less_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T < compare_value.v_##T;\
+    return value->v_##T < other->v_##T;\
 }\
-static bool check_greater_##T(const MemValueType* value) \
+static bool check_greater_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T > compare_value.v_##T;\
+    return value->v_##T > other->v_##T;\
 }\
-static bool check_lessequal_##T(const MemValueType* value) \
+static bool check_lessequal_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T <= compare_value.v_##T;\
+    return value->v_##T <= other->v_##T;\
 }\
-static bool check_greaterequal_##T(const MemValueType* value) \
+static bool check_greaterequal_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return value->v_##T>= compare_value.v_##T;\
+    return value->v_##T>= other->v_##T;\
 }\
-static bool check_different_##T(const MemValueType* value) \
+static bool check_different_##T(const MemValueType* value, const MemValueType* other) \
 {\
-    return (value->v_##T - compare_value.v_##T) == different_value.v_##T;\
+    return static_cast<decltype(value->v_##T)>(value->v_##T - other->v_##T) == different_value.v_##T;\
 }\
 
 DEFINE_CHECK_TYPED(int8_t)
@@ -75,39 +84,187 @@ DEFINE_CHECK_TYPED(uint64_t)
 DEFINE_CHECK_TYPED(float)
 DEFINE_CHECK_TYPED(double)
 
+
+/* Apply the comparison operator on two values or two vectors of values. On
+ * vectors, each lane of the result is all ones if the comparison is true. */
+#define APPLY_OPERATOR(OP, a, b, d) \
+    ((OP == CompareOperator::Equal) ? ((a) == (b)) : \
+     (OP == CompareOperator::NotEqual) ? ((a) != (b)) : \
+     (OP == CompareOperator::Less) ? ((a) < (b)) : \
+     (OP == CompareOperator::Greater) ? ((a) > (b)) : \
+     (OP == CompareOperator::LessEqual) ? ((a) <= (b)) : \
+     (OP == CompareOperator::GreaterEqual) ? ((a) >= (b)) : \
+     (static_cast<decltype(a)>((a) - (b)) == (d)))
+
+/* Compare values one by one, used for unaligned search and for the end of
+ * vectorized search */
+template<typename T, CompareOperator OP, bool PREV>
+static void scan_scalar(const uint8_t* values, const uint8_t* old_values, int beg, int count, int stride, uint64_t* mask)
+{
+    T cv, dv;
+    memcpy(&cv, &compare_value, sizeof(T));
+    memcpy(&dv, &different_value, sizeof(T));
+
+    for (int i = beg; i < count; i++) {
+        T a, b = cv;
+        memcpy(&a, values + i*stride, sizeof(T));
+        if (PREV)
+            memcpy(&b, old_values + i*stride, sizeof(T));
+        if (APPLY_OPERATOR(OP, a, b, dv))
+            mask[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+#ifdef __x86_64__
+
+/* Gather one bit per lane of a comparison result of lanes of size S */
+static inline uint32_t compress_even_bits(uint32_t bits)
+{
+    bits &= 0x55555555;
+    bits = (bits | (bits >> 1)) & 0x33333333;
+    bits = (bits | (bits >> 2)) & 0x0F0F0F0F;
+    bits = (bits | (bits >> 4)) & 0x00FF00FF;
+    bits = (bits | (bits >> 8)) & 0x0000FFFF;
+    return bits;
+}
+
+template<int S>
+static inline uint32_t movemask_sse2(__m128i m)
+{
+    if (S == 1) return _mm_movemask_epi8(m);
+    if (S == 2) return compress_even_bits(_mm_movemask_epi8(m));
+    if (S == 4) return _mm_movemask_ps(_mm_castsi128_ps(m));
+    return _mm_movemask_pd(_mm_castsi128_pd(m));
+}
+
+template<int S>
+__attribute__((target("avx2"))) static inline uint32_t movemask_avx2(__m256i m)
+{
+    if (S == 1) return _mm256_movemask_epi8(m);
+    if (S == 2) return compress_even_bits(_mm256_movemask_epi8(m));
+    if (S == 4) return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+    return _mm256_movemask_pd(_mm256_castsi256_pd(m));
+}
+
+/* Compare contiguous values by vectors of W bytes. Each vector holds a
+ * divisor of 64 values, so its bits never cross a mask word. */
+#define DEFINE_SCAN_VECTOR(NAME, ATTRIBUTE, W, VECTOR, MOVEMASK) \
+template<typename T, CompareOperator OP, bool PREV> \
+ATTRIBUTE static void NAME(const uint8_t* values, const uint8_t* old_values, int count, uint64_t* mask) \
+{ \
+    typedef T V __attribute__((vector_size(W))); \
+    const int N = W / sizeof(T); \
+\
+    T cv, dv; \
+    memcpy(&cv, &compare_value, sizeof(T)); \
+    memcpy(&dv, &different_value, sizeof(T)); \
+    const V vcv = V{} + cv; \
+    const V vdv = V{} + dv; \
+\
+    int i = 0; \
+    for (; i <= count - N; i += N) { \
+        V a, b = vcv; \
+        memcpy(&a, values + i*sizeof(T), W); \
+        if (PREV) \
+            memcpy(&b, old_values + i*sizeof(T), W); \
+        auto m = APPLY_OPERATOR(OP, a, b, vdv); \
+        uint64_t bits = MOVEMASK<sizeof(T)>(reinterpret_cast<VECTOR>(m)); \
+        mask[i >> 6] |= bits << (i & 63); \
+    } \
+\
+    scan_scalar<T, OP, PREV>(values, old_values, i, count, sizeof(T), mask); \
+}
+
+DEFINE_SCAN_VECTOR(scan_sse2, , 16, __m128i, movemask_sse2)
+DEFINE_SCAN_VECTOR(scan_avx2, __attribute__((target("avx2"))), 32, __m256i, movemask_avx2)
+
+#endif
+
+template<typename T, CompareOperator OP, bool PREV>
+static void scan_values(const uint8_t* values, const uint8_t* old_values, int count, int stride, uint64_t* mask)
+{
+    memset(mask, 0, ((count + 63) / 64) * sizeof(uint64_t));
+
+#ifdef __x86_64__
+    if (stride == sizeof(T)) {
+        static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+
+        if (isAVX2Supported)
+            scan_avx2<T, OP, PREV>(values, old_values, count, mask);
+        else
+            scan_sse2<T, OP, PREV>(values, old_values, count, mask);
+        return;
+    }
+#endif
+
+    scan_scalar<T, OP, PREV>(values, old_values, 0, count, stride, mask);
+}
+
+/* Types without a kernel use the comparison methods value by value */
+static void scan_values_generic(const uint8_t* values, const uint8_t*, int count, int stride, uint64_t* mask)
+{
+    memset(mask, 0, ((count + 63) / 64) * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        if (compare_method(reinterpret_cast<const MemValueType*>(values + i*stride), &compare_value))
+            mask[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+static void scan_previous_generic(const uint8_t* values, const uint8_t* old_values, int count, int stride, uint64_t* mask)
+{
+    memset(mask, 0, ((count + 63) / 64) * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        if (compare_method(reinterpret_cast<const MemValueType*>(values + i*stride),
+                           reinterpret_cast<const MemValueType*>(old_values + i*stride)))
+            mask[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+#define DEFINE_SCAN_METHOD_TYPED(T, OP) \
+    scan_values_method = &scan_values<T, OP, false>;\
+    scan_previous_method = &scan_values<T, OP, true>;\
+
 #define DEFINE_COMPARE_METHOD_TYPED(T) \
 switch(compare_operator) {\
     case CompareOperator::Equal:\
         compare_method = &check_equal_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::Equal)\
         break;\
     case CompareOperator::NotEqual:\
         compare_method = &check_notequal_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::NotEqual)\
         break;\
     case CompareOperator::Less:\
         compare_method = &check_less_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::Less)\
         break;\
     case CompareOperator::Greater:\
         compare_method = &check_greater_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::Greater)\
         break;\
     case CompareOperator::LessEqual:\
         compare_method = &check_lessequal_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::LessEqual)\
         break;\
     case CompareOperator::GreaterEqual:\
         compare_method = &check_greaterequal_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::GreaterEqual)\
         break;\
     case CompareOperator::Different:\
         compare_method = &check_different_##T;\
+        DEFINE_SCAN_METHOD_TYPED(T, CompareOperator::Different)\
         break;\
 }\
 
-static bool check_equal_array(const MemValueType* value)
+static bool check_equal_array(const MemValueType* value, const MemValueType* other)
 {
-    return 0 == memcmp(value->v_array, compare_value.v_array, compare_value.v_array[RAM_ARRAY_MAX_SIZE]);
+    /* The array size is only stored in the searched value */
+    return 0 == memcmp(value->v_array, other->v_array, compare_value.v_array[RAM_ARRAY_MAX_SIZE]);
 }
 
-static bool check_equal_string(const MemValueType* value)
+static bool check_equal_string(const MemValueType* value, const MemValueType* other)
 {
-    return 0 == strncmp(value->v_cstr, compare_value.v_cstr, RAM_ARRAY_MAX_SIZE);
+    return 0 == strncmp(value->v_cstr, other->v_cstr, RAM_ARRAY_MAX_SIZE);
 }
 
 void CompareOperations::init(int vt, CompareOperator compare_operator, MemValueType compare_v, MemValueType different_v)
@@ -150,9 +307,13 @@ void CompareOperations::init(int vt, CompareOperator compare_operator, MemValueT
             break;
         case RamArray:
             compare_method = check_equal_array;
+            scan_values_method = scan_values_generic;
+            scan_previous_method = scan_previous_generic;
             break;
         case RamCString:
             compare_method = check_equal_string;
+            scan_values_method = scan_values_generic;
+            scan_previous_method = scan_previous_generic;
             break;
     }
 }
@@ -164,11 +325,23 @@ void CompareOperations::init(CompareOperator compare_operator, MemValueType comp
 
 bool CompareOperations::check_value(const void* value)
 {
-    return compare_method(static_cast<const MemValueType*>(value));
+    return compare_method(static_cast<const MemValueType*>(value), &compare_value);
 }
 
 bool CompareOperations::check_previous(const void* value, const void* old_value)
 {
-    compare_value = *static_cast<const MemValueType*>(old_value);
-    return compare_method(static_cast<const MemValueType*>(value));
+    /* Don't modify the compare value, this is called from multiple threads */
+    uint64_t mask;
+    scan_previous_method(static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(old_value), 1, 0, &mask);
+    return mask & 1;
+}
+
+void CompareOperations::check_values(const uint8_t* values, int count, int stride, uint64_t* mask)
+{
+    scan_values_method(values, nullptr, count, stride, mask);
+}
+
+void CompareOperations::check_previous_values(const uint8_t* values, const uint8_t* old_values, int count, int stride, uint64_t* mask)
+{
+    scan_previous_method(values, old_values, count, stride, mask);
 }
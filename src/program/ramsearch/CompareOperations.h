@@ -48,6 +48,17 @@ namespace CompareOperations {
 
     /* Compute the comparaison between the content of value and the old value */
     bool check_previous(const void* value, const void* old_value);
+
+    /* Compare `count` values, located every `stride` bytes from `values`, to
+     * the stored constant value. Bit i of the mask is set if value i matches,
+     * so the mask must hold (count+63)/64 words. Uses SIMD instructions when
+     * values are contiguous. Memory after the last value must be readable up
+     * to the value size. */
+    void check_values(const uint8_t* values, int count, int stride, uint64_t* mask);
+
+    /* Same as check_values(), but each value is compared with the old value
+     * at the same offset from `old_values` */
+    void check_previous_values(const uint8_t* values, const uint8_t* old_values, int count, int stride, uint64_t* mask);
 }
 
 #endif
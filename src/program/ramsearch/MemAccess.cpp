@@ -21,8 +21,11 @@
 
 #include <stdint.h>
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
 #ifdef __unix__
 #include <sys/uio.h>
+#include <limits.h>
 #elif defined(__APPLE__) && defined(__MACH__)
 #include <mach/vm_map.h>
 #include <mach/mach_traps.h>
@@ -92,6 +95,48 @@ size_t MemAccess::read(void* local_addr, void* remote_addr, size_t size)
 #endif
 }
 
+void MemAccess::readBatch(std::vector<ReadRequest>& requests)
+{
+    for (ReadRequest& request : requests)
+        request.result = 0;
+
+    if (!game_pid)
+        return;
+
+#ifdef __unix__
+    struct iovec local[IOV_MAX], remote[IOV_MAX];
+
+    size_t i = 0;
+    while (i < requests.size()) {
+        size_t count = std::min<size_t>(IOV_MAX, requests.size() - i);
+        for (size_t j = 0; j < count; j++) {
+            local[j].iov_base = requests[i+j].local_addr;
+            local[j].iov_len = requests[i+j].size;
+            remote[j].iov_base = requests[i+j].remote_addr;
+            remote[j].iov_len = requests[i+j].size;
+        }
+
+        ssize_t ret = process_vm_readv(game_pid, local, count, remote, count, 0);
+        if ((ret < 0) && (errno == ESRCH))
+            return;
+
+        /* The system call stops at the first request that could not be fully
+         * read, so we continue with the request after it */
+        size_t j = 0;
+        for (; (j < count) && (ret > 0); j++) {
+            requests[i+j].result = std::min<size_t>(ret, requests[i+j].size);
+            ret -= requests[i+j].result;
+            if (requests[i+j].result < requests[i+j].size)
+                break;
+        }
+        i += (j < count) ? (j + 1) : count;
+    }
+#elif defined(__APPLE__) && defined(__MACH__)
+    for (ReadRequest& request : requests)
+        request.result = read(request.local_addr, request.remote_addr, request.size);
+#endif
+}
+
 uintptr_t MemAccess::readAddr(void* remote_addr, bool* valid)
 {
     if (game_addr_size == 4) {
@@ -22,6 +22,7 @@
 
 #include <stddef.h>
 #include <sys/types.h>
+#include <vector>
 
 /* Functions to read/write into game memroy */
 namespace MemAccess {
@@ -37,6 +38,18 @@ namespace MemAccess {
     size_t read(void* local_addr, void* remote_addr, size_t size);
     size_t readAddr(void* local_addr, bool* valid);
 
+    /* One read of a batch */
+    struct ReadRequest {
+        void* local_addr;
+        void* remote_addr;
+        size_t size;
+        size_t result; // number of bytes that were read
+    };
+
+    /* Perform all reads with as few system calls as possible. A request that
+     * cannot be read does not prevent the following ones from being read. */
+    void readBatch(std::vector<ReadRequest>& requests);
+
     size_t write(void* local_addr, void* remote_addr, size_t size);    
 }
 
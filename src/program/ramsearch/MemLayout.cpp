@@ -33,19 +33,26 @@ MemLayout::MemLayout(pid_t p)
     pid = p;
 }
 
-MemLayout::~MemLayout()
+MemLayout::MemLayout(const std::string& m)
 {
-    if (mapsfile.is_open())
-        mapsfile.close();
+    pid = 0;
+    maps = m;
 }
 
+MemLayout::~MemLayout() {}
+
 void MemLayout::readLayout()
 {
+    if (pid == 0) {
+        mapsfile.reset(new std::istringstream(maps));
+        return;
+    }
+
     /* Compose the filename for the /proc memory map, and open it. */
     std::ostringstream oss;
     oss << "/proc/" << pid << "/maps";
-    mapsfile.open(oss.str());
-    if (!mapsfile) {
+    mapsfile.reset(new std::ifstream(oss.str()));
+    if (!*mapsfile) {
         std::cerr << "Could not open " << oss.str() << std::endl;
         return;
     }
@@ -59,7 +66,7 @@ uint64_t MemLayout::totalSize(int types, int flags)
     MemSection::reset();
 
     int total_size = 0;
-    while (std::getline(mapsfile, line)) {
+    while (std::getline(*mapsfile, line)) {
         MemSection section;
         section.readMap(line);
 
@@ -71,26 +78,25 @@ uint64_t MemLayout::totalSize(int types, int flags)
         }
     }
     
-    if (mapsfile.is_open())
-        mapsfile.close();
+    mapsfile.reset();
         
     return total_size;
 }
 
 bool MemLayout::nextSection(int types, int flags, MemSection &section)
 {
-    if (!mapsfile.is_open()) {
+    if (!mapsfile) {
         readLayout();
         MemSection::reset();
     }
 
-    if (!mapsfile) {
+    if (!*mapsfile) {
         section.addr = 0;
         return false;
     }
     
     std::string line;
-    while (std::getline(mapsfile, line)) {
+    while (std::getline(*mapsfile, line)) {
         section.readMap(line);
         
         if (!section.followFlags(flags))
@@ -24,6 +24,7 @@
 
 #include <string>
 #include <fstream>
+#include <memory>
 #include <cstdint>
 
 /* Handle the layout of game memory */
@@ -32,6 +33,10 @@ class MemLayout {
 
         MemLayout();
         MemLayout(pid_t pid);
+
+        /* Layout read from a string in the /proc/pid/maps format, such as
+         * the layout of a savestate */
+        MemLayout(const std::string& maps);
         ~MemLayout();
         
         /* Compute the total size of memory regions, within the selected `types`
@@ -44,7 +49,8 @@ class MemLayout {
         void readLayout();
 
         pid_t pid;
-        std::ifstream mapsfile;
+        std::string maps;
+        std::unique_ptr<std::istream> mapsfile;
 };
 
 #endif
@@ -0,0 +1,298 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemScanResults.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+
+/* Maximum number of results inside a block */
+#define BLOCK_RESULTS 4096
+
+std::string MemScanResults::spill_path;
+uint64_t MemScanResults::memory_budget = UINT64_MAX;
+std::atomic<uint64_t> MemScanResults::memory_usage(0);
+
+void MemScanResults::init(std::string path, uint64_t budget)
+{
+    spill_path = path;
+    memory_budget = budget;
+}
+
+MemScanResults::SpillFile::~SpillFile()
+{
+    close(fd);
+}
+
+MemScanResults::MemScanResults(int vs, int align) : value_size(vs), alignment(align) {}
+
+MemScanResults& MemScanResults::operator=(MemScanResults&& other)
+{
+    clear();
+    value_size = other.value_size;
+    alignment = other.alignment;
+    total_size = other.total_size;
+    blocks = std::move(other.blocks);
+    pending_addresses = std::move(other.pending_addresses);
+    pending_values = std::move(other.pending_values);
+    file = std::move(other.file);
+
+    other.blocks.clear();
+    other.pending_addresses.clear();
+    other.pending_values.clear();
+    other.total_size = 0;
+    return *this;
+}
+
+MemScanResults::~MemScanResults()
+{
+    clear();
+}
+
+void MemScanResults::add(uintptr_t addr, const uint8_t* value)
+{
+    pending_addresses.push_back(addr);
+    pending_values.insert(pending_values.end(), value, value + value_size);
+    total_size += value_size;
+
+    if (pending_addresses.size() == BLOCK_RESULTS)
+        flush();
+}
+
+void MemScanResults::add_region(uintptr_t addr, const uint8_t* memory, uint64_t size)
+{
+    flush();
+
+    Block block;
+    block.first = addr;
+    block.count = size;
+    block.encoding = ENCODING_REGION;
+    block.values.assign(memory, memory + size);
+    total_size += size;
+
+    store(block);
+}
+
+void MemScanResults::flush()
+{
+    if (pending_addresses.empty())
+        return;
+
+    Block block;
+    block.first = pending_addresses.front();
+    block.count = pending_addresses.size();
+    block.encoding = ENCODING_DELTA;
+
+    /* Encode the differences between consecutive addresses, using 7 bits per
+     * byte, and check if all addresses are aligned with the first one */
+    bool aligned = true;
+    for (size_t i = 1; i < pending_addresses.size(); i++) {
+        uintptr_t delta = pending_addresses[i] - pending_addresses[i-1];
+        if (delta % alignment)
+            aligned = false;
+        while (delta >= 0x80) {
+            block.addresses.push_back((delta & 0x7f) | 0x80);
+            delta >>= 7;
+        }
+        block.addresses.push_back(delta);
+    }
+
+    /* Use a bitmap instead if it is smaller, which happens when more than one
+     * aligned value out of 8 is a result */
+    if (aligned) {
+        size_t bitmap_size = ((pending_addresses.back() - block.first) / alignment) / 8 + 1;
+        if (bitmap_size < block.addresses.size()) {
+            block.encoding = ENCODING_BITMAP;
+            block.addresses.assign(bitmap_size, 0);
+            for (uintptr_t addr : pending_addresses) {
+                uintptr_t i = (addr - block.first) / alignment;
+                block.addresses[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+
+    block.values.swap(pending_values);
+    pending_addresses.clear();
+    pending_values.clear();
+
+    store(block);
+}
+
+void MemScanResults::store(Block& block)
+{
+    block.addresses_size = block.addresses.size();
+    block.values_size = block.values.size();
+    uint64_t block_size = block.addresses_size + block.values_size;
+
+    if ((memory_usage + block_size) <= memory_budget) {
+        memory_usage += block_size;
+        blocks.push_back(std::move(block));
+        return;
+    }
+
+    /* Write the block in our temporary file, which is removed right away so
+     * that it is deleted when closed */
+    if (!file) {
+        std::string path = spill_path + "/results-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) {
+            std::cerr << "Could not create file " << path << ", keeping results in memory" << std::endl;
+            memory_usage += block_size;
+            blocks.push_back(std::move(block));
+            return;
+        }
+        unlink(path.c_str());
+
+        file = std::make_shared<SpillFile>();
+        file->fd = fd;
+        file->size = 0;
+    }
+
+    if ((pwrite(file->fd, block.addresses.data(), block.addresses_size, file->size) != static_cast<ssize_t>(block.addresses_size)) ||
+        (pwrite(file->fd, block.values.data(), block.values_size, file->size + block.addresses_size) != static_cast<ssize_t>(block.values_size))) {
+        std::cerr << "Could not write results to file, keeping them in memory" << std::endl;
+        memory_usage += block_size;
+        blocks.push_back(std::move(block));
+        return;
+    }
+
+    block.file = file;
+    block.offset = file->size;
+    file->size += block_size;
+
+    std::vector<uint8_t>().swap(block.addresses);
+    std::vector<uint8_t>().swap(block.values);
+    blocks.push_back(std::move(block));
+}
+
+void MemScanResults::append(MemScanResults&& other)
+{
+    flush();
+    other.flush();
+
+    total_size += other.total_size;
+    blocks.insert(blocks.end(), std::make_move_iterator(other.blocks.begin()), std::make_move_iterator(other.blocks.end()));
+
+    other.blocks.clear();
+    other.total_size = 0;
+}
+
+void MemScanResults::clear()
+{
+    for (const Block& block : blocks) {
+        if (!block.file)
+            memory_usage -= block.addresses_size + block.values_size;
+    }
+
+    blocks.clear();
+    pending_addresses.clear();
+    pending_values.clear();
+    file.reset();
+    total_size = 0;
+}
+
+bool MemScanResults::load(const Block& block, std::vector<uint8_t>& buffer, const uint8_t*& addresses, const uint8_t*& values) const
+{
+    if (!block.file) {
+        addresses = block.addresses.data();
+        values = block.values.data();
+        return true;
+    }
+
+    size_t block_size = block.addresses_size + block.values_size;
+    buffer.resize(block_size);
+    if (pread(block.file->fd, buffer.data(), block_size, block.offset) != static_cast<ssize_t>(block_size)) {
+        std::cerr << "Could not read results from file" << std::endl;
+        return false;
+    }
+
+    addresses = buffer.data();
+    values = buffer.data() + block.addresses_size;
+    return true;
+}
+
+bool MemScanResults::read_block(size_t b, std::vector<uintptr_t>& addresses, std::vector<uint8_t>& values) const
+{
+    const Block& block = blocks[b];
+
+    std::vector<uint8_t> buffer;
+    const uint8_t* encoded_addresses;
+    const uint8_t* encoded_values;
+    if (!load(block, buffer, encoded_addresses, encoded_values))
+        return false;
+
+    values.assign(encoded_values, encoded_values + block.values_size);
+    addresses.clear();
+    addresses.reserve(block.count);
+
+    if (block.encoding == ENCODING_BITMAP) {
+        for (size_t i = 0; i < block.addresses_size; i++) {
+            for (uint8_t bits = encoded_addresses[i]; bits; bits &= bits - 1)
+                addresses.push_back(block.first + (i * 8 + __builtin_ctz(bits)) * alignment);
+        }
+    }
+    else {
+        uintptr_t addr = block.first;
+        addresses.push_back(addr);
+        size_t i = 0;
+        while (i < block.addresses_size) {
+            uintptr_t delta = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                byte = encoded_addresses[i++];
+                delta |= static_cast<uintptr_t>(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            addr += delta;
+            addresses.push_back(addr);
+        }
+    }
+
+    return addresses.size() == block.count;
+}
+
+void MemScanResults::read_region(uintptr_t addr, uint8_t* memory, uint64_t size) const
+{
+    memset(memory, 0, size);
+
+    /* Find the last block that starts before the address */
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), addr,
+        [](uintptr_t a, const Block& block) {return a < block.first;});
+    if (it != blocks.begin())
+        --it;
+
+    for (; (it != blocks.end()) && (it->first < (addr + size)); ++it) {
+        uintptr_t beg = std::max(addr, it->first);
+        uintptr_t end = std::min(addr + size, it->first + it->count);
+        if (beg >= end)
+            continue;
+
+        if (it->file) {
+            if (pread(it->file->fd, memory + (beg - addr), end - beg, it->offset + (beg - it->first)) < 0)
+                std::cerr << "Could not read results from file" << std::endl;
+        }
+        else {
+            memcpy(memory + (beg - addr), it->values.data() + (beg - it->first), end - beg);
+        }
+    }
+}
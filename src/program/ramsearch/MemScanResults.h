@@ -0,0 +1,136 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MEMSCANRESULTS_H_INCLUDED
+#define LIBTAS_MEMSCANRESULTS_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Store the results of a memory scan in memory, by blocks of consecutive
+ * results. Addresses of a block are encoded as deltas, or as a bitmap when
+ * results are dense. Scans with unknown values store whole memory regions
+ * instead. When all results exceed the memory budget, blocks are moved to a
+ * temporary file. */
+class MemScanResults {
+    public:
+        /* Initialize the directory of temporary files and the memory budget
+         * (in bytes) shared by all results */
+        static void init(std::string path, uint64_t budget);
+
+        MemScanResults() = default;
+        MemScanResults(int value_size, int alignment);
+        MemScanResults(MemScanResults&& other) = default;
+        MemScanResults& operator=(MemScanResults&& other);
+        ~MemScanResults();
+
+        /* Add a result. Addresses must be increasing */
+        void add(uintptr_t addr, const uint8_t* value);
+
+        /* Add a memory region. Addresses must be increasing */
+        void add_region(uintptr_t addr, const uint8_t* memory, uint64_t size);
+
+        /* Encode the results that were not stored yet */
+        void flush();
+
+        /* Move all results of another object at the end of this one */
+        void append(MemScanResults&& other);
+
+        /* Remove all results */
+        void clear();
+
+        /* Returns the number of results */
+        uint64_t count() const {return total_size / value_size;}
+
+        /* Returns the size of all values or regions (in bytes) */
+        uint64_t size() const {return total_size;}
+
+        /* Returns the number of blocks */
+        size_t block_count() const {return blocks.size();}
+
+        /* Returns the number of results inside a block */
+        uint64_t block_size(size_t b) const {return blocks[b].count;}
+
+        /* Decode the addresses and values of a block. Can be called from
+         * multiple threads at once. */
+        bool read_block(size_t b, std::vector<uintptr_t>& addresses, std::vector<uint8_t>& values) const;
+
+        /* Copy the stored memory between `addr` and `addr+size`. Memory that
+         * was not stored is filled with zeros. Can be called from multiple
+         * threads at once. */
+        void read_region(uintptr_t addr, uint8_t* memory, uint64_t size) const;
+
+    private:
+        enum Encoding {
+            ENCODING_DELTA,
+            ENCODING_BITMAP,
+            ENCODING_REGION,
+        };
+
+        /* Temporary file holding the blocks above the memory budget */
+        struct SpillFile {
+            int fd;
+            off_t size;
+            ~SpillFile();
+        };
+
+        struct Block {
+            uintptr_t first; // first address
+            uint64_t count; // number of results, or region size
+            Encoding encoding;
+
+            std::vector<uint8_t> addresses; // encoded addresses
+            std::vector<uint8_t> values;
+
+            /* Location of the block when stored in a file */
+            std::shared_ptr<SpillFile> file;
+            off_t offset;
+            size_t addresses_size;
+            size_t values_size;
+        };
+
+        /* Store a block, inside the temporary file when above budget */
+        void store(Block& block);
+
+        /* Get the encoded addresses and values of a block, reading them
+         * into `buffer` if the block was stored in a file */
+        bool load(const Block& block, std::vector<uint8_t>& buffer, const uint8_t*& addresses, const uint8_t*& values) const;
+
+        int value_size = 1;
+        int alignment = 1;
+        uint64_t total_size = 0;
+
+        std::vector<Block> blocks;
+
+        /* Results that are not encoded yet */
+        std::vector<uintptr_t> pending_addresses;
+        std::vector<uint8_t> pending_values;
+
+        std::shared_ptr<SpillFile> file;
+
+        static std::string spill_path;
+        static uint64_t memory_budget;
+        static std::atomic<uint64_t> memory_usage;
+};
+
+#endif
@@ -23,26 +23,44 @@
 #include "MemScannerThread.h"
 #include "MemValue.h"
 
-#include <sstream>
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
 #include <thread>
 
 std::string MemScanner::memscan_path;
-std::string MemScanner::addresses_path;
-std::string MemScanner::values_path;
 
-void MemScanner::init(std::string path)
+void MemScanner::init(std::string path, uint64_t memory_budget)
 {
     memscan_path = path;
-    
-    std::ostringstream ossov;
-    ossov << memscan_path << "/memory.bin";
-    values_path = ossov.str();
+    MemScanResults::init(path, memory_budget);
+}
+
+void MemScanner::set_snapshot(std::shared_ptr<SaveStateSnapshot> s)
+{
+    snapshot = s;
+}
+
+size_t MemScanner::read(void* local_addr, uintptr_t remote_addr, size_t size) const
+{
+    if (snapshot)
+        return snapshot->read(local_addr, remote_addr, size);
+
+    return MemAccess::read(local_addr, reinterpret_cast<void*>(remote_addr), size);
+}
+
+void MemScanner::read_batch(std::vector<MemAccess::ReadRequest>& requests) const
+{
+    if (snapshot) {
+        for (MemAccess::ReadRequest& request : requests) {
+            size_t ret = snapshot->read(request.local_addr, reinterpret_cast<uintptr_t>(request.remote_addr), request.size);
+            request.result = (ret == static_cast<size_t>(-1)) ? 0 : ret;
+        }
+        return;
+    }
 
-    std::ostringstream ossoa;
-    ossoa << memscan_path << "/addresses.bin";
-    addresses_path = ossoa.str();
+    MemAccess::readBatch(requests);
 }
 
 int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t begin_address, uintptr_t end_address)
@@ -72,13 +90,13 @@ int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, C
     begin_address &= (~page_mask);
     end_address = (end_address + page_mask) & (~page_mask);
 
-    /* Read the whole memory layout */
-    std::unique_ptr<MemLayout> memlayout (new MemLayout());
+    /* Read the whole memory layout, of the game or of the savestate */
+    std::unique_ptr<MemLayout> memlayout (snapshot ? new MemLayout(snapshot->maps()) : new MemLayout());
 
     memsections.clear();
     
     MemSection section;
-    total_size = 0;
+    memsections_size = 0;
     while (memlayout->nextSection(MemSection::MemAll, mem_flags, section)) {
         /* Filter for begin/end address here */
         if (section.addr >= end_address)
@@ -91,10 +109,16 @@ int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, C
         section.size = section.endaddr - section.addr;
             
         memsections.push_back(section);
-        total_size += section.size;
+        memsections_size += section.size;
     }
         
-    if (total_size == 0) return MemScannerThread::ENOERROR;
+    if (memsections_size == 0) {
+        results.clear();
+        addresses.clear();
+        old_values.clear();
+        current_values.clear();
+        return MemScannerThread::ENOERROR;
+    }
 
     return scan(true, ct, co, cv, dv);
 }
@@ -110,77 +134,66 @@ int MemScanner::scan(bool first, CompareType ct, CompareOperator co, MemValueTyp
 
     CompareOperations::init(value_type, compare_operator, compare_value, different_value);
 
-    /* Split the work between threads */
+    /* Split the work into tasks, which are either a range of memory inside a
+     * single section, or a range of blocks of the previous results. Tasks
+     * are small enough so that threads that finish early take the remaining
+     * ones, instead of waiting for a thread with a large section. */
     std::vector<MemScannerThread> memscanners;
-    std::vector<std::thread> memscan_threads;
-    uint64_t block_size = (total_size / THREAD_COUNT) & 0xfffffffffffff000;
-
-    size_t beg_region = 0;
-    size_t end_region = 0;
-    uintptr_t beg_address = 0;
-    uintptr_t end_address = 0;
-    size_t cur_region_offset = 0;
-
-    int thread_count = THREAD_COUNT;
-    if (block_size == 0)
-        thread_count = 1;
-    
-    for (int t = 0; t < thread_count-1; t++) {
-        uint64_t cur_block_size = memsections[beg_region].size - cur_region_offset;    
-        while ((cur_block_size < block_size) && (end_region < memsections.size())) {
-            end_region++;
-            cur_block_size += memsections[end_region].size;
-        }
-        
-        cur_region_offset = memsections[end_region].size - (cur_block_size - block_size);
-        end_address = memsections[end_region].addr + cur_region_offset;
-        
-        /* Sanitize beg and end addresses */
-        if (beg_address < memsections[beg_region].addr)
-            beg_address = memsections[beg_region].addr;
-        if (end_address > memsections[end_region].endaddr)
-            end_address = memsections[end_region].endaddr;
-
-        /* Configure the scanner thread */
-        memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, t*block_size, block_size);
-        
-        /* Set the beg variables for the next thread */
-        if (cur_block_size == block_size) {
-            /* Nothing left in this section, skip to the beginning of the next section */
-            beg_region = end_region + 1;
-            beg_address = memsections[beg_region].addr;
-        }
-        else {
-            beg_region = end_region;
-            beg_address = end_address;
+    if (first || last_scan_was_region) {
+        for (size_t r = 0; r < memsections.size(); r++) {
+            const MemSection& ms = memsections[r];
+            for (uintptr_t addr = ms.addr; addr < ms.endaddr; addr += TASK_MEMORY_SIZE)
+                memscanners.emplace_back(*this, r, r, addr, std::min<uintptr_t>(addr + TASK_MEMORY_SIZE, ms.endaddr), 0, 0);
         }
     }
-    
-    /* Last scanner thread gets the remaining memory */
-    end_region = memsections.size() - 1;
-    end_address = memsections.back().endaddr;
-    memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, (thread_count-1)*block_size, total_size-((thread_count-1)*block_size));
-    
-    /* Start all threads */
+    else {
+        for (size_t b = 0; b < results.block_count(); b += TASK_BLOCK_COUNT)
+            memscanners.emplace_back(*this, 0, 0, 0, 0, b, std::min(b + TASK_BLOCK_COUNT, results.block_count()));
+    }
+
+    void (MemScannerThread::*scan_method)();
+    if (first) {
+        if (compare_type == CompareType::Previous)
+            scan_method = &MemScannerThread::first_region_scan;
+        else
+            scan_method = &MemScannerThread::first_address_scan;
+    }
+    else {
+        if (last_scan_was_region)
+            scan_method = &MemScannerThread::next_scan_from_region;
+        else
+            scan_method = &MemScannerThread::next_scan_from_address;
+    }
+
+    /* Start one thread per core, each taking the next task until none are
+     * left */
+    int thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 4;
+    if (static_cast<size_t>(thread_count) > memscanners.size())
+        thread_count = memscanners.size();
+
+    std::atomic<size_t> next_task(0);
+    std::vector<std::thread> memscan_threads;
     for (int t = 0; t < thread_count; t++) {
-        if (first) {
-            if (compare_type == CompareType::Previous)
-                memscan_threads.emplace_back(&MemScannerThread::first_region_scan, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::first_address_scan, &memscanners[t]);            
-        }
-        else {
-            if (last_scan_was_region)
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_region, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_address, &memscanners[t]);
-        }
+        memscan_threads.emplace_back([&]() {
+            size_t task;
+            while ((task = next_task++) < memscanners.size()) {
+                MemScannerThread& mst = memscanners[task];
+                if (is_stopped) {
+                    mst.error = MemScannerThread::ESTOPPED;
+                    mst.finished = true;
+                    continue;
+                }
+                (mst.*scan_method)();
+            }
+        });
     }
 
     /* Update progress bar */
     /* We would normally just join all threads, but we need to update the scan
      * state periodically to update the progress bar. So we check if all
-     * scan threads have finished. */
+     * scan tasks have finished. */
     bool scan_finished = false;
     uint64_t total_processed_size = 0;
     while (!scan_finished) { 
@@ -191,120 +204,62 @@ int MemScanner::scan(bool first, CompareType ct, CompareOperator co, MemValueTyp
             scan_finished &= ms.finished;
         }
         emit signalProgress(total_processed_size);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!scan_finished)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
     last_scan_was_region = (first && (compare_type == CompareType::Previous));
 
-    /* Wait for the thread to finish, and read error codes. */
-    total_size = 0;
-    total_processed_size = 0;
-    int error = 0;
-    for (int t = 0; t < thread_count; t++) {
-        memscan_threads[t].join();
-
-        /* If the scanner thread encounter an error, don't read the file */
-        if (memscanners[t].error < 0) {
-            error = memscanners[t].error;
-            continue;
-        }
+    /* Wait for the threads to finish, and read error codes. */
+    for (auto& thread : memscan_threads)
+        thread.join();
 
-        /* Compute total size and processed size (for display) */
-        total_size += memscanners[t].new_memory_size;
-        total_processed_size += memscanners[t].processed_memory_size;
+    int error = 0;
+    for (const auto& mst : memscanners) {
+        if (mst.error < 0)
+            error = mst.error;
     }
 
-    /* If user requested a stop or an error occured, skip the file merging
-     * and report as if we didn't find any result */
+    /* If user requested a stop or an error occured, report as if we didn't
+     * find any result */
     if (is_stopped && (error < 0)) {
+        results.clear();
         addresses.clear();
         old_values.clear();
-        total_size = 0;
+        current_values.clear();
         return error;
     }
 
-    /* Wait for each thread to finish and merge all individual files created
-     * by each thread into a single file, and inside vectors to be displayed. */
-    /* TODO: this can take a bit of time, do this in another thread if we don't
-     * need to display values (above threshold).
-     * Prevent a new search until the file merge is completed */
-    std::ofstream ovfs(values_path, std::ofstream::binary);
-    std::ofstream oafs;
-    if (!last_scan_was_region) {
-        oafs.open(addresses_path, std::ofstream::binary);
-    }
-
-    /* Reset progress bar to show progression of file merging */
-    emit signalProgress(0);
-    uint64_t cur_size = 0;
-
-    for (int t = 0; t < thread_count; t++) {
-        const MemScannerThread& mst = memscanners[t];
-        
-        /* For some reason, trying to append an empty file messes up the stream */
-        if (memscanners[t].new_memory_size == 0)
+    /* Gather the results of all tasks in address order, skipping the ones
+     * that encountered an error. This only moves blocks of results. */
+    MemScanResults new_results(value_type_size, alignment);
+    for (auto& mst : memscanners) {
+        if (mst.error < 0)
             continue;
-            
-        /* Append memscan_thread file to unique file */
-        if (!last_scan_was_region) {
-            std::ifstream iafs(mst.addresses_path, std::ios_base::binary);
-            oafs << iafs.rdbuf();
-            uint64_t recorded_size = memscanners[t].new_memory_size * sizeof(uintptr_t) / value_type_size;
-            if (iafs.tellg() != (std::streamoff) recorded_size) {
-                std::cerr << "Mismatch size between recorded (" << recorded_size << ") and file (" <<  iafs.tellg() << ") sizes" << std::endl;
-                error = MemScannerThread::EOUTPUT;
-                break;
-            }
-            if (!oafs) {
-                error = MemScannerThread::EOUTPUT;
-                break;
-            }
-        }
-        std::ifstream ivfs(mst.values_path, std::ios_base::binary);
-        ovfs << ivfs.rdbuf();
-        if (ivfs.tellg() != (std::streamoff) memscanners[t].new_memory_size) {
-            std::cerr << "Mismatch size between recorded (" << memscanners[t].new_memory_size << ") and file (" <<  ivfs.tellg() << ") sizes" << std::endl;
-            error = MemScannerThread::EOUTPUT;
-            break;
-        }
-        if (!ovfs) {
-            error = MemScannerThread::EOUTPUT;
-            break;
-        }
-        
-        if (is_stopped) {
-            error = MemScannerThread::ESTOPPED;
-            break;
-        }
-
-        /* Some math to reuse progress bar that has the old size for total */
-        cur_size += memscanners[t].new_memory_size;
-        emit signalProgress(cur_size*total_processed_size/total_size);
-    }
-    
-    if (error < 0) {
-        addresses.clear();
-        old_values.clear();
-        total_size = 0;
-        return error;
+        new_results.append(std::move(mst.results));
     }
-
-    /* If the total size is below threshold, load all data (except if region data) */
-    if (last_scan_was_region) return MemScannerThread::ENOERROR;
+    results = std::move(new_results);
 
     addresses.clear();
     old_values.clear();
-    
-    if (total_size < (DISPLAY_THRESHOLD*value_type_size)) {
-        /* Close the streams before reading the files */
-        oafs.close();
-        ovfs.close();
-        
-        std::ifstream iafs(addresses_path, std::ios::in | std::ios::binary);
-        addresses = std::vector<char>(std::istreambuf_iterator<char>(iafs), std::istreambuf_iterator<char>());
+    current_values.clear();
+
+    /* If the number of results is below threshold, decode all of them
+     * (except if region data) */
+    if (last_scan_was_region) return MemScannerThread::ENOERROR;
 
-        std::ifstream ivfs(values_path, std::ios::in | std::ios::binary);
-        old_values = std::vector<char>(std::istreambuf_iterator<char>(ivfs), std::istreambuf_iterator<char>());
+    if (results.count() < DISPLAY_THRESHOLD) {
+        std::vector<uintptr_t> block_addresses;
+        std::vector<uint8_t> block_values;
+        for (size_t b = 0; b < results.block_count(); b++) {
+            if (!results.read_block(b, block_addresses, block_values)) {
+                addresses.clear();
+                old_values.clear();
+                return MemScannerThread::EINPUT;
+            }
+            addresses.insert(addresses.end(), block_addresses.begin(), block_addresses.end());
+            old_values.insert(old_values.end(), block_values.begin(), block_values.end());
+        }
     }
     
     return MemScannerThread::ENOERROR;
@@ -312,17 +267,17 @@ int MemScanner::scan(bool first, CompareType ct, CompareOperator co, MemValueTyp
 
 uint64_t MemScanner::scan_size() const
 {
-    return total_size;
+    return results.size();
 }
 
 uint64_t MemScanner::scan_count() const
 {
-    return total_size / value_type_size;
+    return results.count();
 }
 
 uint64_t MemScanner::display_scan_count() const
 {
-    return addresses.size() / sizeof(uintptr_t);
+    return addresses.size();
 }
 
 uintptr_t MemScanner::get_address(int index) const
@@ -330,7 +285,7 @@ uintptr_t MemScanner::get_address(int index) const
     if (addresses.empty())
         return 0;
         
-    return *reinterpret_cast<const uintptr_t*>(&addresses[index*sizeof(uintptr_t)]);
+    return addresses[index];
 }
 
 const MemValueType* MemScanner::get_previous_value(int index) const
@@ -345,19 +300,42 @@ const MemValueType* MemScanner::get_previous_value(int index) const
 
 MemValueType MemScanner::get_current_value(int index) const
 {
+    if (static_cast<size_t>(index) < current_values.size())
+        return current_values[index];
+
     uintptr_t addr = get_address(index);
     MemValueType value;
-    int readValues = MemAccess::read(&value, reinterpret_cast<void*>(addr), value_type_size);
+    int readValues = read(&value, addr, value_type_size);
     if (readValues != value_type_size)
         value.v_uint64_t = 0;
 
     return value;
 }
 
+void MemScanner::update_current_values()
+{
+    current_values.resize(addresses.size());
+
+    std::vector<MemAccess::ReadRequest> requests(addresses.size());
+    for (size_t i = 0; i < addresses.size(); i++) {
+        requests[i].local_addr = &current_values[i];
+        requests[i].remote_addr = reinterpret_cast<void*>(addresses[i]);
+        requests[i].size = value_type_size;
+    }
+    read_batch(requests);
+
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (requests[i].result != static_cast<size_t>(value_type_size))
+            current_values[i].v_uint64_t = 0;
+    }
+}
+
 void MemScanner::clear()
 {
-    total_size = 0;
+    results.clear();
+    memsections_size = 0;
     addresses.clear();
     old_values.clear();
+    current_values.clear();
     memsections.clear();
 }
@@ -22,10 +22,14 @@
 
 #include "CompareOperations.h"
 #include "MemSection.h"
+#include "MemScanResults.h"
+#include "SaveStateSnapshot.h"
+#include "MemAccess.h"
 
 #include <QtCore/QObject>
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 /* Store a section of the game memory */
@@ -33,8 +37,21 @@ class MemScanner : public QObject {
     Q_OBJECT
     
     public:
-        /* Initialize the memory scanner with the memory scan path */
-        static void init(std::string path);
+        /* Initialize the memory scanner with the memory scan path, and the
+         * maximum size of results kept in memory (in bytes) */
+        static void init(std::string path, uint64_t memory_budget);
+
+        /* Search inside a savestate instead of the game memory for the next
+         * scans, or inside the game memory if null */
+        void set_snapshot(std::shared_ptr<SaveStateSnapshot> snapshot);
+
+        /* Read memory of the game or of the savestate being searched, with
+         * the same behaviour as MemAccess::read() */
+        size_t read(void* local_addr, uintptr_t remote_addr, size_t size) const;
+
+        /* Perform many reads of the game or of the savestate being searched,
+         * with the same behaviour as MemAccess::readBatch() */
+        void read_batch(std::vector<MemAccess::ReadRequest>& requests) const;
 
         /* First memory scan. Returns 0 if no error, or error code */
         int first_scan(int mem_flags, int type, int align, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t begin_address, uintptr_t end_address);
@@ -61,18 +78,21 @@ class MemScanner : public QObject {
         /* Get the current value of the scan result with index */
         MemValueType get_current_value(int index) const;
 
+        /* Read the current values of all results shown to the user at once,
+         * which are then returned by get_current_value() */
+        void update_current_values();
+
         /* Clear all results */
         void clear();
 
         /* Array of all memory sections parsed from /proc/self/maps */
         std::vector<MemSection> memsections;
         
-        const int THREAD_COUNT = 4;
+        const uint64_t TASK_MEMORY_SIZE = 16*1024*1024; // memory size scanned by each task
+        const size_t TASK_BLOCK_COUNT = 16; // number of result blocks scanned by each task
         const uint64_t DISPLAY_THRESHOLD = 10000; // don't display results when above threshold
         
         static std::string memscan_path; // directory containing all scan files
-        static std::string addresses_path; // output file containing all scan addresses
-        static std::string values_path; // output file containing all scan values
         
         int value_type;
         int value_type_size;
@@ -83,12 +103,17 @@ class MemScanner : public QObject {
         int alignment;
         bool is_stopped = false;
         
+        MemScanResults results; // results of the last scan
+
     private:
         bool last_scan_was_region = true;
-        uint64_t total_size = 0; // total size of the last scan (in bytes)
+        uint64_t memsections_size = 0; // total size of memory sections (in bytes)
+
+        std::shared_ptr<SaveStateSnapshot> snapshot; // savestate being searched
 
-        std::vector<char> addresses; // scan addresses shown to the user
-        std::vector<char> old_values; // scan previous values shown to the user
+        std::vector<uintptr_t> addresses; // scan addresses shown to the user
+        std::vector<uint8_t> old_values; // scan previous values shown to the user
+        std::vector<MemValueType> current_values; // scan current values shown to the user
 
     signals:
         /* Update the scan progress bar */
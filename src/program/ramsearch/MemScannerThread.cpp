@@ -22,53 +22,29 @@
 #include "MemScannerThread.h"
 #include "MemAccess.h"
 #include "CompareOperations.h"
+#include "MemValue.h"
 
+#include <algorithm>
 #include <cstring>
-#include <sstream>
-#include <fstream>
 #include <iostream>
 #include <vector>
-#include <thread>
 
 #define MEMORY_CHUNK_SIZE 1024*1024
-#define OUTPUT_CHUNK_SIZE 4096
 #define MAX_TYPE_SIZE 8
 
-MemScannerThread::MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem) : memscanner(ms), beg_region(br), end_region(er), beg_address(ba), end_address(ea), memory_offset(mo), memory_size(mem), error(ENOERROR)
+MemScannerThread::MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, size_t bb, size_t eb) : memscanner(ms), beg_region(br), end_region(er), beg_address(ba), end_address(ea), beg_block(bb), end_block(eb), results(ms.value_type_size, ms.alignment), error(ENOERROR)
 {
+    processed_memory_size = 0;
     finished = false;
 }
 
-MemScannerThread::~MemScannerThread()
-{
-    if (!addresses_path.empty())
-        std::remove(addresses_path.c_str());
-    if (!values_path.empty())
-        std::remove(values_path.c_str());
-}
-
-void MemScannerThread::create_output_files()
-{
-    /* Create the files with names from the thread tid */
-    std::ostringstream ossa;
-    ossa << memscanner.memscan_path << "/addresses-" << std::this_thread::get_id() << ".tmp";    
-    addresses_path = ossa.str();
-
-    std::ostringstream ossv;
-    ossv << memscanner.memscan_path << "/memory-" << std::this_thread::get_id() << ".tmp";
-    values_path = ossv.str();
-}
-
 void MemScannerThread::first_region_scan()
 {
-    create_output_files();    
-    std::ofstream vfs(values_path, std::ofstream::binary);
+    std::vector<uint8_t> chunk;
+    chunk.resize(MEMORY_CHUNK_SIZE);
     
-    new_memory_size = 0;
-    processed_memory_size = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
+    /* Start searching from beg_address to end_address, which is the range of
+     * this task. Read memory by chunks */
     uintptr_t cur_beg_addr = beg_address;
     uintptr_t cur_end_addr;
     for (int r = beg_region; r <= end_region; r++) {
@@ -90,23 +66,21 @@ void MemScannerThread::first_region_scan()
             cur_end_addr = ms.endaddr;
         }
         
-        /* Write data */
-        uint8_t chunk[4096];
-        
-        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096);
+        /* Store data */
+        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += MEMORY_CHUNK_SIZE) {
+            uint64_t chunk_size = std::min<uint64_t>(MEMORY_CHUNK_SIZE, cur_end_addr - ca);
+            processed_memory_size += chunk_size;
+
+            int readValues = memscanner.read(chunk.data(), ca, chunk_size);
             if (readValues < 0) {
                 std::cerr << "Cound not read game process at address " << std::hex << ca << std::endl;
                 ms.print();
+                readValues = 0;
             }
-            vfs.write((char*)chunk, 4096);
-            if (!vfs) {
-                finished = true;
-                error = EOUTPUT;
-                return;
-            }
-            new_memory_size += 4096;
-            processed_memory_size += 4096;
+            
+            /* Memory that could not be read is stored as zeros */
+            memset(chunk.data() + readValues, 0, chunk_size - readValues);
+            results.add_region(ca, chunk.data(), chunk_size);
             
             if (memscanner.is_stopped) {
                 finished = true;
@@ -120,20 +94,8 @@ void MemScannerThread::first_region_scan()
 
 void MemScannerThread::first_address_scan()
 {
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
+    /* Start searching from beg_address to end_address, which is the range of
+     * this task. Read memory by chunks */
     uintptr_t cur_beg_addr = beg_address;
     uintptr_t cur_end_addr;
     for (int r = beg_region; r <= end_region; r++) {
@@ -157,84 +119,61 @@ void MemScannerThread::first_address_scan()
         
         /* Write data */
         uint8_t chunk[4096+MAX_TYPE_SIZE]; // extra size for unaligned search
+        uint64_t mask[4096/64];
         
         for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
             processed_memory_size += 4096;
 
             /* Compute how much extra data we need to read to account for unaligned
-             * search, which does not apply for the end of the region */
-            int extra_read = (4096+ca)<cur_end_addr ? memscanner.value_type_size-memscanner.alignment : 0;
+             * search, which does not apply for the end of the section */
+            int extra_read = (4096+ca)<ms.endaddr ? memscanner.value_type_size-memscanner.alignment : 0;
             
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096+extra_read);
+            int readValues = memscanner.read(chunk, ca, 4096+extra_read);
             if (readValues < 0)
                 continue;
-            for (int v = 0; v < readValues-(memscanner.value_type_size-memscanner.alignment); v += memscanner.alignment) {
-                if (CompareOperations::check_value(chunk+v)) {
-                    batch_addresses[batch_index] = ca + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), chunk+v, memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
-                        }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
 
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
+            /* Compare all values of the chunk at once, and get a bit mask of
+             * the matching values */
+            int limit = readValues-(memscanner.value_type_size-memscanner.alignment);
+            if (limit <= 0)
+                continue;
+            int count = (limit + memscanner.alignment - 1) / memscanner.alignment;
+            CompareOperations::check_values(chunk, count, memscanner.alignment, mask);
+
+            for (int w = 0; w < (count+63)/64; w++) {
+                for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+                    int v = (w*64 + __builtin_ctzll(bits)) * memscanner.alignment;
+                    results.add(ca + v, chunk+v);
                 }
             }
+
+            if (memscanner.is_stopped) {
+                error = ESTOPPED;
+                finished = true;
+                return;
+            }
         }
     }
     
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
-    }
-    new_memory_size += batch_index*memscanner.value_type_size;
+    results.flush();
     finished = true;
 }
 
 void MemScannerThread::next_scan_from_region()
 {
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
     std::vector<uint8_t> new_memory;
     new_memory.resize(MEMORY_CHUNK_SIZE+memscanner.value_type_size-memscanner.alignment);
 
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    std::vector<char> old_memory;
-    std::ifstream ivfs;
+    /* Bit mask of matching values in a chunk */
+    std::vector<uint64_t> mask(MEMORY_CHUNK_SIZE/64);
+
+    /* If we compare from previous memory, get the stored memory of the same
+     * chunk */
+    std::vector<uint8_t> old_memory;
     if (memscanner.compare_type == CompareType::Previous) {
         old_memory.resize(MEMORY_CHUNK_SIZE+memscanner.value_type_size-memscanner.alignment);
-        
-        ivfs.open(memscanner.values_path, std::ofstream::binary);
-        ivfs.seekg(memory_offset);
     }
     
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-
     uintptr_t cur_beg_addr = beg_address;
     uintptr_t cur_end_addr;
     for (int r = beg_region; r <= end_region; r++) {
@@ -258,24 +197,18 @@ void MemScannerThread::next_scan_from_region()
         
         /* Read chunks of memory */
         while (cur_beg_addr < cur_end_addr) {
-            uint64_t chunk_size = MEMORY_CHUNK_SIZE;
-            uint64_t chunk_size_with_extra = chunk_size + memscanner.value_type_size-memscanner.alignment;
-            if ((cur_end_addr - cur_beg_addr) < chunk_size_with_extra) {
-                chunk_size = cur_end_addr - cur_beg_addr;
-                chunk_size_with_extra = chunk_size;
-            }
+            /* Values starting at the end of the range are read past it, which
+             * does not apply for the end of the section */
+            uint64_t chunk_size = std::min<uint64_t>(MEMORY_CHUNK_SIZE, cur_end_addr - cur_beg_addr);
+            uint64_t chunk_size_with_extra = std::min<uint64_t>(chunk_size + memscanner.value_type_size-memscanner.alignment, ms.endaddr - cur_beg_addr);
             
             processed_memory_size += chunk_size;
 
             if (memscanner.compare_type == CompareType::Previous) {
-                /* We need to seek each time, because we may need to read data
-                 * multiple times due to unaligned search */ 
-                ivfs.seekg(memory_offset);
-                ivfs.read(old_memory.data(), chunk_size_with_extra);
-                memory_offset += chunk_size;
+                memscanner.results.read_region(cur_beg_addr, old_memory.data(), chunk_size_with_extra);
             }
             
-            int readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(cur_beg_addr), chunk_size_with_extra);
+            int readValues = memscanner.read(new_memory.data(), cur_beg_addr, chunk_size_with_extra);
             if (readValues < 0) {
                 std::cerr << "Cound not read game process at address " << cur_beg_addr << std::endl;
                 ms.print();
@@ -287,143 +220,69 @@ void MemScannerThread::next_scan_from_region()
                 ms.print();
             }
             
-            for (unsigned int v = 0; v < readValues-(memscanner.value_type_size-memscanner.alignment); v += memscanner.alignment) {
-                if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[v], &old_memory[v])) ||
-                    ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[v]))) {
-                    batch_addresses[batch_index] = cur_beg_addr + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[v], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
-                        }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-                
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
+            int limit = readValues-(memscanner.value_type_size-memscanner.alignment);
+            int count = (limit > 0) ? (limit + memscanner.alignment - 1) / memscanner.alignment : 0;
+            if (memscanner.compare_type == CompareType::Previous)
+                CompareOperations::check_previous_values(new_memory.data(), old_memory.data(), count, memscanner.alignment, mask.data());
+            else
+                CompareOperations::check_values(new_memory.data(), count, memscanner.alignment, mask.data());
+
+            for (int w = 0; w < (count+63)/64; w++) {
+                for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+                    int v = (w*64 + __builtin_ctzll(bits)) * memscanner.alignment;
+                    results.add(cur_beg_addr + v, &new_memory[v]);
                 }
             }
+
+            if (memscanner.is_stopped) {
+                error = ESTOPPED;
+                finished = true;
+                return;
+            }
             
             cur_beg_addr += chunk_size;
         }
     }
     
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
-    }
-    new_memory_size += batch_index*memscanner.value_type_size;
+    results.flush();
     finished = true;
 }
 
 void MemScannerThread::next_scan_from_address()
 {
-    create_output_files();
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    int size_ratio = sizeof(uintptr_t)/memscanner.value_type_size;
-
-    std::vector<uint8_t> new_memory;
-    new_memory.resize(4096+memscanner.value_type_size-memscanner.alignment);
-
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    uint64_t max_chunk_size = MEMORY_CHUNK_SIZE;
-    if (memory_size < max_chunk_size)
-        max_chunk_size = memory_size;
-
-    std::vector<char> old_memory;
-
-    std::ifstream ivfs;
-    if (memscanner.compare_type == CompareType::Previous) {
-        old_memory.resize(max_chunk_size+memscanner.value_type_size-memscanner.alignment);
-        
-        ivfs.open(memscanner.values_path, std::ifstream::binary);
-    }
-
     std::vector<uintptr_t> old_addresses;
-    old_addresses.resize(max_chunk_size/memscanner.value_type_size);
+    std::vector<uint8_t> old_values;
 
-    std::ifstream iafs(memscanner.addresses_path, std::ifstream::binary);
-    if (!iafs)
-        std::cerr << "error: could not open file " << memscanner.addresses_path << std::endl;
-    
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-
-    /* Read chunks of memory */
-    uint64_t remaining_memory_size = memory_size;
-    while (remaining_memory_size > 0) {
-        uint64_t chunk_size = MEMORY_CHUNK_SIZE;
-        uint64_t chunk_size_with_extra = chunk_size + memscanner.value_type_size-memscanner.alignment;
-        if (remaining_memory_size < chunk_size_with_extra) {
-            chunk_size = remaining_memory_size;
-            chunk_size_with_extra = chunk_size;
-        }
-        
-        if (memscanner.compare_type == CompareType::Previous) {
-            /* We need to seek each time, because we may need to read data
-             * multiple times due to unaligned search */ 
-            ivfs.seekg(memory_offset);
-            if (!ivfs)
-                std::cerr << "error: could not seek to offset " << memory_offset << std::endl;
-            ivfs.read(old_memory.data(), chunk_size_with_extra);
-            if (!ivfs) {
-                std::cerr << "error: only " << ivfs.gcount() << " could be read from " << chunk_size << std::endl;
-                error = EINPUT;
-                finished = true;
-                return;
-            }
-        }
-        iafs.seekg(memory_offset*size_ratio);
-        if (!iafs)
-            std::cerr << "error: could not seek to offset " << memory_offset*size_ratio << std::endl;
+    /* Memory read for each group of addresses, and their location */
+    std::vector<uint8_t> new_memory;
+    std::vector<MemAccess::ReadRequest> requests;
+    std::vector<int> group_indices;
 
-        iafs.read((char*)old_addresses.data(), chunk_size_with_extra*size_ratio);
-        if (!iafs) {
-            std::cerr << "error: only " << iafs.gcount() << " could be read from " << chunk_size << std::endl;
+    /* Process the previous results by blocks */
+    for (size_t b = beg_block; b < end_block; b++) {
+        if (!memscanner.results.read_block(b, old_addresses, old_values)) {
+            std::cerr << "error: could not read results block " << b << std::endl;
             error = EINPUT;
             finished = true;
             return;
         }
-        
-        memory_offset += chunk_size;
-        
-        int addr_beg_index = 0;
-        int addr_end_index = chunk_size / memscanner.value_type_size;
 
-        // std::cout << "Index " << addr_beg_index << " to " << addr_end_index << " for thread " << std::this_thread::get_id() << std::endl;
-        // std::cout << "Chunk " << old_addresses[addr_beg_index] << " to " << old_addresses[addr_end_index-1] << " for thread " << std::this_thread::get_id() << std::endl;
+        /* Values are compared as whole MemValueType objects */
+        old_values.resize(old_values.size() + sizeof(MemValueType));
         
+        int addr_beg_index = 0;
+        int addr_end_index = old_addresses.size();
+
+        /* Look at all old addresses that are inside the same memory page.
+         * From cheatengine source code comments, it is faster to load an 
+         * entire memory page and look at the specific addresses than loading
+         * each individual addresses (because caching), except if you only
+         * need one address in the memory page. All pages of the block are
+         * then read at once. */
+        requests.clear();
+        group_indices.clear();
+        size_t memory_size = 0;
         while (addr_beg_index < addr_end_index) {
-            
-            /* Look at all old addresses that are inside the same memory page.
-             * From cheatengine source code comments, it is faster to load an 
-             * entire memory page and look at the specific addresses than loading
-             * each individual addresses (because caching), except if you only
-             * need one address in the memory page.
-             */
             uintptr_t beg_addr = old_addresses[addr_beg_index];
             uintptr_t beg_page = beg_addr & 0xfffffffffffff000;
             
@@ -432,69 +291,58 @@ void MemScannerThread::next_scan_from_address()
                 if ((old_addresses[addr_cur_index] & 0xfffffffffffff000) != beg_page)
                     break;
             }
-            
-            processed_memory_size += (addr_cur_index-addr_beg_index)*memscanner.value_type_size;
 
-            int readValues;
+            /* Load all values from first to last address */
+            uintptr_t last_addr = old_addresses[addr_cur_index-1];
+            MemAccess::ReadRequest request;
+            request.local_addr = reinterpret_cast<void*>(memory_size);
+            request.remote_addr = reinterpret_cast<void*>(beg_addr);
+            request.size = (last_addr-beg_addr)+memscanner.value_type_size;
+            requests.push_back(request);
+            group_indices.push_back(addr_beg_index);
+            memory_size += request.size;
 
-            /* If only one address in page, load that address */
-            if ((addr_cur_index-addr_beg_index) == 1) {
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), memscanner.value_type_size);
-            }
-            else {
-                /* Load all values from first to last address */
-                uintptr_t last_addr = old_addresses[addr_cur_index-1];
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), (last_addr-beg_addr)+memscanner.value_type_size);
-            }
-            if (readValues < 0) {
-                addr_beg_index = addr_cur_index;
-                continue;
-            }
-            
-            for (int i = addr_beg_index; i < addr_cur_index; i++) {
+            addr_beg_index = addr_cur_index;
+        }
+        group_indices.push_back(addr_end_index);
+
+        /* Local addresses were stored as offsets until the buffer is sized.
+         * Values are compared as whole MemValueType objects. */
+        new_memory.resize(memory_size + sizeof(MemValueType));
+        for (auto& request : requests)
+            request.local_addr = new_memory.data() + reinterpret_cast<uintptr_t>(request.local_addr);
+
+        memscanner.read_batch(requests);
+        processed_memory_size += old_addresses.size()*memscanner.value_type_size;
+
+        for (size_t g = 0; g < requests.size(); g++) {
+            const uint8_t* memory = static_cast<const uint8_t*>(requests[g].local_addr);
+            uintptr_t beg_addr = reinterpret_cast<uintptr_t>(requests[g].remote_addr);
+
+            for (int i = group_indices[g]; i < group_indices[g+1]; i++) {
                 uintptr_t addr = old_addresses[i];
-                int mem_index = addr-beg_addr;
+                size_t mem_index = addr-beg_addr;
+
+                /* Skip values that could not be read */
+                if ((mem_index + memscanner.value_type_size) > requests[g].result)
+                    break;
                 
                 if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[mem_index], &old_memory[i*memscanner.value_type_size])) ||
+                    CompareOperations::check_previous(&memory[mem_index], &old_values[i*memscanner.value_type_size])) ||
                     ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[mem_index]))) {
-                    batch_addresses[batch_index] = addr;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[mem_index], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
-                        }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-                
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
+                    CompareOperations::check_value(&memory[mem_index]))) {
+                    results.add(addr, &memory[mem_index]);
                 }
             }
-            
-            addr_beg_index = addr_cur_index;
         }
-        remaining_memory_size -= chunk_size;
+
+        if (memscanner.is_stopped) {
+            error = ESTOPPED;
+            finished = true;
+            return;
+        }
     }
     
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
-    }
-    new_memory_size += batch_index*memscanner.value_type_size;
+    results.flush();
     finished = true;
 }
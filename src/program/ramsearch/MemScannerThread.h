@@ -21,11 +21,12 @@
 #define LIBTAS_MEMSCANNERTHREAD_H_INCLUDED
 
 #include "MemScanner.h"
+#include "MemScanResults.h"
 
-#include <string>
 #include <cstdint>
 
-/* Store a section of the game memory */
+/* Scan task of a range of memory inside a section, or of a range of blocks
+ * of the previous results, run by one of the scanning threads */
 class MemScannerThread {
     public:
         
@@ -34,15 +35,12 @@ class MemScannerThread {
             ESTOPPED = -1,
             EOUTPUT = -2,
             EINPUT = -3,
-            EPROCESS = -4
+            EPROCESS = -4,
+            ESNAPSHOT = -5
         };
         
-        MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem);
-        ~MemScannerThread();
+        MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, size_t bb, size_t eb);
 
-        /* Create the output files that are named based on the scanning thread id */
-        void create_output_files();
-        
         /* First scan that will store the full memory when user set 'unknown value' */
         void first_region_scan();
 
@@ -60,15 +58,11 @@ class MemScannerThread {
         int beg_region, end_region; // Range of memory regions to search into
         uintptr_t beg_address, end_address; // Range of memory addresses to search into
         
-        off_t memory_offset; // Offset in the memory file pointed by the starting address
-        uint64_t memory_size; // Size of the memory file portion to process (in bytes)
+        size_t beg_block, end_block; // Range of previous result blocks to search into
         
-        uint64_t new_memory_size; // New size after the scan (in bytes)
+        MemScanResults results; // Results of the scan
         volatile uint64_t processed_memory_size; // Current processed size (in bytes), used for progress bar
         
-        std::string addresses_path; // Output file of addresses
-        std::string values_path; // Output file of values
-        
         volatile bool finished; // indicate if scan is finished, used for progress bar
         int error;
 };
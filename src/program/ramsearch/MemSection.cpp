@@ -89,6 +89,12 @@ void MemSection::readMap(std::string& line)
         return;
     }
 
+    /* Memory reserved by libTAS to store savestates in RAM */
+    if (filename.compare("[anon:libTAS savestates]") == 0) {
+        type = MemSpecial;
+        return;
+    }
+
     if (filename.find("[stack") == 0) {
         type = MemStack;
         return;
@@ -0,0 +1,228 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PointerIndex.h"
+#include "MemAccess.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+/* Number of memory pages read by each task */
+#define TASK_PAGES 1024
+
+/* Number of bits sorted by each radix sort pass */
+#define RADIX_BITS 16
+
+namespace {
+
+struct Range {
+    uintptr_t addr;
+    uintptr_t endaddr;
+};
+
+struct Task {
+    uintptr_t addr;
+    uintptr_t endaddr;
+    std::vector<PointerIndex::Entry> entries;
+};
+
+}
+
+void PointerIndex::build(const std::vector<MemSection>& sections, const std::vector<MemSection>& targets, std::function<void(uint64_t)> progress)
+{
+    entries.clear();
+
+    /* Build a sorted table of the target ranges, merging contiguous
+     * sections */
+    std::vector<Range> sorted_targets;
+    for (const MemSection& ms : targets)
+        sorted_targets.push_back({ms.addr, ms.endaddr});
+    std::sort(sorted_targets.begin(), sorted_targets.end(), [](const Range& a, const Range& b) {return a.addr < b.addr;});
+
+    std::vector<Range> ranges;
+    for (const Range& r : sorted_targets) {
+        if (!ranges.empty() && (ranges.back().endaddr >= r.addr))
+            ranges.back().endaddr = std::max(ranges.back().endaddr, r.endaddr);
+        else
+            ranges.push_back(r);
+    }
+    if (ranges.empty())
+        return;
+
+    uintptr_t min_target = ranges.front().addr;
+    uintptr_t max_target = ranges.back().endaddr;
+
+    /* Split sections into tasks */
+    std::vector<Task> tasks;
+    for (const MemSection& ms : sections) {
+        for (uintptr_t addr = ms.addr; addr < ms.endaddr; addr += TASK_PAGES*4096) {
+            Task task;
+            task.addr = addr;
+            task.endaddr = std::min<uintptr_t>(addr + TASK_PAGES*4096, ms.endaddr);
+            tasks.push_back(std::move(task));
+        }
+    }
+
+    int addr_size = MemAccess::getAddrSize();
+    std::atomic<size_t> next_task(0);
+    std::atomic<uint64_t> processed_size(0);
+    std::atomic<int> running_threads(0);
+
+    auto worker = [&]() {
+        std::vector<uint8_t> chunk(TASK_PAGES*4096);
+        std::vector<MemAccess::ReadRequest> requests;
+
+        size_t t;
+        while ((t = next_task++) < tasks.size()) {
+            Task& task = tasks[t];
+
+            /* Read pages of the task at once */
+            requests.clear();
+            for (uintptr_t addr = task.addr; addr < task.endaddr; addr += 4096) {
+                MemAccess::ReadRequest request;
+                request.local_addr = chunk.data() + (addr - task.addr);
+                request.remote_addr = reinterpret_cast<void*>(addr);
+                request.size = std::min<uintptr_t>(4096, task.endaddr - addr);
+                requests.push_back(request);
+            }
+            MemAccess::readBatch(requests);
+
+            for (const MemAccess::ReadRequest& request : requests) {
+                uintptr_t addr = reinterpret_cast<uintptr_t>(request.remote_addr);
+                const uint8_t* page = static_cast<const uint8_t*>(request.local_addr);
+                size_t count = request.result / addr_size;
+
+                for (size_t i = 0; i < count; i++) {
+                    /* Support both 32-bit and 64-bit pointers while conforming
+                     * aliasing rules */
+                    uintptr_t value;
+                    if (addr_size == 4) {
+                        uint32_t value32;
+                        memcpy(&value32, page + i*4, 4);
+                        value = static_cast<uintptr_t>(value32);
+                    }
+                    else {
+                        uint64_t value64;
+                        memcpy(&value64, page + i*8, 8);
+                        value = static_cast<uintptr_t>(value64);
+                    }
+
+                    if ((value < min_target) || (value >= max_target))
+                        continue;
+
+                    /* Find the last range starting before the value */
+                    auto it = std::upper_bound(ranges.begin(), ranges.end(), value,
+                        [](uintptr_t v, const Range& r) {return v < r.addr;});
+                    if ((it == ranges.begin()) || (value >= (it-1)->endaddr))
+                        continue;
+
+                    task.entries.push_back({value, addr + i*addr_size});
+                }
+            }
+
+            processed_size += task.endaddr - task.addr;
+        }
+        running_threads--;
+    };
+
+    int thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 4;
+    if (static_cast<size_t>(thread_count) > tasks.size())
+        thread_count = tasks.size();
+
+    std::vector<std::thread> threads;
+    running_threads = thread_count;
+    for (int i = 0; i < thread_count; i++)
+        threads.emplace_back(worker);
+
+    /* Report progress until all tasks are done */
+    while (running_threads > 0) {
+        progress(processed_size);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    progress(processed_size);
+
+    for (auto& thread : threads)
+        thread.join();
+
+    /* Gather entries in address order */
+    size_t total = 0;
+    for (const Task& task : tasks)
+        total += task.entries.size();
+    entries.reserve(total);
+    for (Task& task : tasks) {
+        entries.insert(entries.end(), task.entries.begin(), task.entries.end());
+        std::vector<Entry>().swap(task.entries);
+    }
+
+    sort();
+}
+
+void PointerIndex::sort()
+{
+    /* LSD radix sort on the values, which is stable so that pointers to the
+     * same value stay sorted by location */
+    std::vector<Entry> buffer(entries.size());
+    std::vector<size_t> counts(1 << RADIX_BITS);
+
+    for (int shift = 0; shift < static_cast<int>(8*sizeof(uintptr_t)); shift += RADIX_BITS) {
+        std::fill(counts.begin(), counts.end(), 0);
+        for (const Entry& e : entries)
+            counts[(e.value >> shift) & ((1 << RADIX_BITS) - 1)]++;
+
+        /* Skip the pass if all values share the same digit */
+        if (std::find(counts.begin(), counts.end(), entries.size()) != counts.end())
+            continue;
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t c = count;
+            count = offset;
+            offset += c;
+        }
+
+        for (const Entry& e : entries)
+            buffer[counts[(e.value >> shift) & ((1 << RADIX_BITS) - 1)]++] = e;
+
+        entries.swap(buffer);
+    }
+}
+
+const PointerIndex::Entry* PointerIndex::lower_bound(uintptr_t beg) const
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), beg,
+        [](const Entry& e, uintptr_t v) {return e.value < v;});
+    return entries.data() + (it - entries.begin());
+}
+
+const PointerIndex::Entry* PointerIndex::upper_bound(uintptr_t end) const
+{
+    auto it = std::upper_bound(entries.begin(), entries.end(), end,
+        [](uintptr_t v, const Entry& e) {return v < e.value;});
+    return entries.data() + (it - entries.begin());
+}
+
+void PointerIndex::clear()
+{
+    std::vector<Entry>().swap(entries);
+}
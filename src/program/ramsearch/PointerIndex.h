@@ -0,0 +1,60 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_POINTERINDEX_H_INCLUDED
+#define LIBTAS_POINTERINDEX_H_INCLUDED
+
+#include "MemSection.h"
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/* Index of the values stored in game memory that could be pointers, sorted
+ * by value, so that all pointers to a range of addresses are found with a
+ * binary search */
+class PointerIndex {
+    public:
+        struct Entry {
+            uintptr_t value; // pointer value
+            uintptr_t location; // address where the pointer is stored
+        };
+
+        /* Read all `sections` with multiple threads, and store all values
+         * that point inside one of the `targets` sections. `progress` is
+         * called periodically with the size of memory read so far. */
+        void build(const std::vector<MemSection>& sections, const std::vector<MemSection>& targets, std::function<void(uint64_t)> progress);
+
+        /* Get the entries whose value is between `beg` and `end` included */
+        const Entry* lower_bound(uintptr_t beg) const;
+        const Entry* upper_bound(uintptr_t end) const;
+
+        /* Number of pointers */
+        size_t size() const {return entries.size();}
+
+        void clear();
+
+    private:
+        /* Sort entries by value, keeping the order of equal values */
+        void sort();
+
+        std::vector<Entry> entries;
+};
+
+#endif
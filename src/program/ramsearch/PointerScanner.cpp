@@ -0,0 +1,194 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PointerScanner.h"
+
+#include <algorithm>
+#include <thread>
+
+/* Number of nodes or ranges processed by each task */
+#define TASK_NODES 256
+
+/* Number of chains sent at once to the output */
+#define OUTPUT_BATCH 4096
+
+namespace {
+
+/* Run tasks from `0` to `task_count-1` on one thread per core */
+void runTasks(size_t task_count, const std::function<void(size_t)>& task)
+{
+    std::atomic<size_t> next_task(0);
+    auto worker = [&]() {
+        size_t t;
+        while ((t = next_task++) < task_count)
+            task(t);
+    };
+
+    int thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 4;
+    if (static_cast<size_t>(thread_count) > task_count)
+        thread_count = task_count;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++)
+        threads.emplace_back(worker);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+}
+
+bool PointerChain::operator<(const PointerChain& other) const
+{
+    if (base_address != other.base_address)
+        return base_address < other.base_address;
+    return std::lexicographical_compare(offsets, offsets + level_count,
+        other.offsets, other.offsets + other.level_count);
+}
+
+bool PointerChain::operator==(const PointerChain& other) const
+{
+    return (base_address == other.base_address) &&
+        std::equal(offsets, offsets + level_count, other.offsets, other.offsets + other.level_count);
+}
+
+int PointerScanner::find_chains(uintptr_t addr, int max_level, int max_offset, std::function<void(std::vector<PointerChain>&)> output)
+{
+    max_level = std::min(max_level, static_cast<int>(PointerChain::MAX_LEVEL));
+
+    /* Instead of exploring every chain separately, which visits the same
+     * addresses many times, build the set of reachable addresses level by
+     * level. Each address is then expanded only once per level. */
+    levels.clear();
+    levels.emplace_back(1, Node{addr, 0});
+    for (int level = 0; level < (max_level-1); level++) {
+        expand_level(level, max_offset);
+        if (is_stopped) {
+            levels.clear();
+            return ESTOPPED;
+        }
+        if (levels.back().empty())
+            break;
+    }
+
+    /* Build chains from all static pointers to any reachable address */
+    struct Task {
+        int level;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Task> tasks;
+    for (int level = 0; level < static_cast<int>(levels.size()); level++)
+        for (size_t n = 0; n < levels[level].size(); n += TASK_NODES)
+            tasks.push_back({level, n, std::min(n + TASK_NODES, levels[level].size())});
+
+    runTasks(tasks.size(), [&](size_t t) {
+        std::vector<PointerChain> batch;
+        PointerChain chain;
+        const Task& task = tasks[t];
+
+        for (size_t n = task.begin; (n < task.end) && !is_stopped; n++) {
+            const Node& node = levels[task.level][n];
+            uintptr_t beg = (node.addr < static_cast<uintptr_t>(max_offset)) ? 0 : (node.addr - max_offset);
+            const PointerIndex::Entry* end = static_pointers.upper_bound(node.addr);
+            for (const PointerIndex::Entry* e = static_pointers.lower_bound(beg); e < end; e++) {
+                chain.base_address = e->location;
+                chain.level_count = task.level + 1;
+                chain.offsets[task.level] = node.addr - e->value;
+                descend(task.level, node, chain, max_offset, batch, output);
+            }
+        }
+
+        if (!batch.empty() && !is_stopped)
+            output(batch);
+    });
+
+    levels.clear();
+    return is_stopped ? ESTOPPED : ENOERROR;
+}
+
+void PointerScanner::expand_level(int level, int max_offset)
+{
+    /* Merge the overlapping ranges of values that point to this level, so
+     * that each pointer is found only once */
+    struct Range {
+        uintptr_t beg;
+        uintptr_t end;
+    };
+    std::vector<Range> ranges;
+    for (const Node& node : levels[level]) {
+        uintptr_t beg = (node.addr < static_cast<uintptr_t>(max_offset)) ? 0 : (node.addr - max_offset);
+        if (!ranges.empty() && (beg <= ranges.back().end + 1))
+            ranges.back().end = node.addr;
+        else
+            ranges.push_back({beg, node.addr});
+    }
+
+    size_t task_count = (ranges.size() + TASK_NODES - 1) / TASK_NODES;
+    std::vector<std::vector<Node>> results(task_count);
+
+    runTasks(task_count, [&](size_t t) {
+        size_t last = std::min((t+1) * TASK_NODES, ranges.size());
+        for (size_t r = t * TASK_NODES; (r < last) && !is_stopped; r++) {
+            const PointerIndex::Entry* end = pointers.upper_bound(ranges[r].end);
+            for (const PointerIndex::Entry* e = pointers.lower_bound(ranges[r].beg); e < end; e++)
+                results[t].push_back({e->location, e->value});
+        }
+    });
+
+    /* Pointers have distinct locations, so they only need to be sorted */
+    size_t total = 0;
+    for (const auto& result : results)
+        total += result.size();
+
+    std::vector<Node> next_level;
+    next_level.reserve(total);
+    for (auto& result : results) {
+        next_level.insert(next_level.end(), result.begin(), result.end());
+        std::vector<Node>().swap(result);
+    }
+    std::sort(next_level.begin(), next_level.end(), [](const Node& a, const Node& b) {return a.addr < b.addr;});
+
+    levels.push_back(std::move(next_level));
+}
+
+void PointerScanner::descend(int level, const Node& node, PointerChain& chain, int max_offset, std::vector<PointerChain>& batch, const std::function<void(std::vector<PointerChain>&)>& output)
+{
+    if (level == 0) {
+        batch.push_back(chain);
+        if (batch.size() >= OUTPUT_BATCH) {
+            if (!is_stopped)
+                output(batch);
+            batch.clear();
+        }
+        return;
+    }
+
+    /* Nodes of the previous level that this node points to */
+    const std::vector<Node>& previous = levels[level-1];
+    auto it = std::lower_bound(previous.begin(), previous.end(), node.value,
+        [](const Node& n, uintptr_t v) {return n.addr < v;});
+    for (; (it != previous.end()) && ((it->addr - node.value) <= static_cast<uintptr_t>(max_offset)); it++) {
+        if (is_stopped)
+            return;
+        chain.offsets[level-1] = it->addr - node.value;
+        descend(level-1, *it, chain, max_offset, batch, output);
+    }
+}
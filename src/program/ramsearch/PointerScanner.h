@@ -0,0 +1,85 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_POINTERSCANNER_H_INCLUDED
+#define LIBTAS_POINTERSCANNER_H_INCLUDED
+
+#include "PointerIndex.h"
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+/* Chain of pointers from a static address to a target address */
+struct PointerChain {
+    static const int MAX_LEVEL = 10;
+
+    uintptr_t base_address;
+
+    /* Offsets are stored in reverse order: the first one is added to the
+     * last pointer of the chain to get the target address */
+    int level_count;
+    int offsets[MAX_LEVEL];
+
+    bool operator<(const PointerChain& other) const;
+    bool operator==(const PointerChain& other) const;
+};
+
+class PointerScanner {
+    public:
+        enum {
+            ENOERROR = 0,
+            ESTOPPED = -1, // search was interrupted by the user
+        };
+
+        /* Index of pointers located in dynamic sections */
+        PointerIndex pointers;
+
+        /* Index of pointers located in static sections */
+        PointerIndex static_pointers;
+
+        /* Interrupt the search. Must be reset by the caller before
+         * starting a new search. */
+        std::atomic<bool> is_stopped{false};
+
+        /* Find all chains of pointers that start from a static address and
+         * end with `addr`, in maximum `max_level` levels and with a maximum
+         * offset of `max_offset`. Chains are sent by batches to `output`,
+         * which is called from multiple threads, and are not sorted. */
+        int find_chains(uintptr_t addr, int max_level, int max_offset, std::function<void(std::vector<PointerChain>&)> output);
+
+    private:
+        struct Node {
+            uintptr_t addr; // address reached at this level
+            uintptr_t value; // pointer value stored at this address
+        };
+
+        /* Addresses reachable from the target address at each level,
+         * without duplicates and sorted by address */
+        std::vector<std::vector<Node>> levels;
+
+        /* Fill the next level with all pointers to the current level */
+        void expand_level(int level, int max_offset);
+
+        /* Build all chains from a node down to the target address */
+        void descend(int level, const Node& node, PointerChain& chain, int max_offset, std::vector<PointerChain>& batch, const std::function<void(std::vector<PointerChain>&)>& output);
+};
+
+#endif
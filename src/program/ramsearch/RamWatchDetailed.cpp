@@ -29,6 +29,7 @@
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
 MemValueType RamWatchDetailed::get_value(bool& is_valid)
 {
@@ -71,17 +72,120 @@ MemValueType RamWatchDetailed::get_value(bool& is_valid)
         }
     }
     
+    size_t read_size = MemAccess::read(&value, reinterpret_cast<void*>(address), value_size());
+    is_valid = finish_value(value, read_size);
+    return value;
+}
+
+size_t RamWatchDetailed::value_size() const
+{
+    if (value_type == RamType::RamArray)
+        return array_size;
+    if (value_type == RamType::RamCString)
+        return RAM_ARRAY_MAX_SIZE;
+    return MemValue::type_size(value_type);
+}
+
+bool RamWatchDetailed::finish_value(MemValueType& value, size_t read_size) const
+{
     if (value_type == RamType::RamArray) {
-        is_valid = (MemAccess::read(value.v_array, reinterpret_cast<void*>(address), array_size) == (size_t)array_size);
         value.v_array[RAM_ARRAY_MAX_SIZE] = array_size;
+        return read_size == (size_t)array_size;
     }
-    else if (value_type == RamType::RamCString) {
-        is_valid = (MemAccess::read(value.v_cstr, reinterpret_cast<void*>(address), RAM_ARRAY_MAX_SIZE) > 0); 
+    if (value_type == RamType::RamCString) {
         value.v_cstr[RAM_ARRAY_MAX_SIZE] = 0;
+        return (read_size > 0) && (read_size != (size_t)-1);
+    }
+    return read_size == (size_t)MemValue::type_size(value_type);
+}
+
+void RamWatchDetailed::update_values(const std::vector<std::unique_ptr<RamWatchDetailed>>& watches)
+{
+    if (!MemAccess::isInited())
+        return;
+
+    int addr_size = MemAccess::getAddrSize();
+
+    /* Start all pointer chains from their base address */
+    size_t max_depth = 0;
+    for (const auto& w : watches) {
+        w->cached_valid = true;
+        w->cached_value.v_uint64_t = 0;
+        w->has_cached_value = true;
+
+        if (!w->is_pointer)
+            continue;
+
+        if (!w->base_address) {
+            /* If file is empty, address is absolute */
+            if (w->base_file.empty())
+                w->base_address = w->base_file_offset;
+            else
+                w->base_address = BaseAddresses::getAddress(w->base_file, w->base_file_offset);
+        }
+
+        w->pointer_addresses.assign(w->pointer_offsets.size(), 0);
+        w->address = w->base_address;
+        max_depth = std::max(max_depth, w->pointer_offsets.size());
+    }
+
+    /* Dereference one level of all pointer chains at a time */
+    std::vector<MemAccess::ReadRequest> requests;
+    std::vector<RamWatchDetailed*> requested_watches;
+    std::vector<uint64_t> pointers(watches.size());
+    for (size_t depth = 0; depth < max_depth; depth++) {
+        requests.clear();
+        requested_watches.clear();
+        for (const auto& w : watches) {
+            if (!w->is_pointer || !w->cached_valid || (depth >= w->pointer_offsets.size()))
+                continue;
+
+            MemAccess::ReadRequest request;
+            pointers[requests.size()] = 0;
+            request.local_addr = &pointers[requests.size()];
+            request.remote_addr = reinterpret_cast<void*>(w->address);
+            request.size = addr_size;
+            requests.push_back(request);
+            requested_watches.push_back(w.get());
+        }
+
+        MemAccess::readBatch(requests);
+
+        for (size_t r = 0; r < requests.size(); r++) {
+            RamWatchDetailed* w = requested_watches[r];
+            if (requests[r].result != (size_t)addr_size) {
+                w->cached_valid = false;
+                continue;
+            }
+
+            /* Pointers are read in the lower bytes */
+            uintptr_t next_address = static_cast<uintptr_t>(pointers[r]);
+            w->pointer_addresses[depth] = next_address;
+            w->address = next_address + w->pointer_offsets[depth];
+        }
+    }
+
+    /* Read all values */
+    requests.clear();
+    requested_watches.clear();
+    for (const auto& w : watches) {
+        if (!w->cached_valid)
+            continue;
+
+        MemAccess::ReadRequest request;
+        request.local_addr = &w->cached_value;
+        request.remote_addr = reinterpret_cast<void*>(w->address);
+        request.size = w->value_size();
+        requests.push_back(request);
+        requested_watches.push_back(w.get());
+    }
+
+    MemAccess::readBatch(requests);
+
+    for (size_t r = 0; r < requests.size(); r++) {
+        RamWatchDetailed* w = requested_watches[r];
+        w->cached_valid = w->finish_value(w->cached_value, requests[r].result);
     }
-    else
-        is_valid = (MemAccess::read(&value, reinterpret_cast<void*>(address), MemValue::type_size(value_type)) == (size_t)MemValue::type_size(value_type));
-    return value;
 }
 
 const char* RamWatchDetailed::value_str()
@@ -91,7 +195,14 @@ const char* RamWatchDetailed::value_str()
     }
 
     bool is_valid = true;
-    MemValueType value = get_value(is_valid);
+    MemValueType value;
+    if (has_cached_value) {
+        is_valid = cached_valid;
+        value = cached_value;
+    }
+    else {
+        value = get_value(is_valid);
+    }
     if (!is_valid)
         return "??????";
 
@@ -110,6 +221,9 @@ int RamWatchDetailed::poke_value(MemValueType value)
         return 0;
     }
 
+    /* Read the new value on the next display */
+    has_cached_value = false;
+
     /* Write value into the game process address */
     if (value_type == RamType::RamArray)
         return MemAccess::write(value.v_array, reinterpret_cast<void*>(address), value.v_array[RAM_ARRAY_MAX_SIZE]);
@@ -22,6 +22,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 #include "MemValue.h"
@@ -33,6 +34,11 @@ public:
     /* Return the current value of the ram watch as a string */
     const char* value_str();
 
+    /* Read the values of all ram watches at once, using a few batched reads
+     * for each level of pointer chains. Values are then returned by
+     * value_str() until the next update. */
+    static void update_values(const std::vector<std::unique_ptr<RamWatchDetailed>>& watches);
+
     /* Poke a value (given as a string) into the ram watch address. Return
      * the result of process_vm_writev call */
     int poke_value(const char* str_value);
@@ -61,6 +67,17 @@ private:
     /* Return the current value of the ram watch as a MemValueType */
     MemValueType get_value(bool& is_valid);
 
+    /* Size of the value to read */
+    size_t value_size() const;
+
+    /* Check if the value was read and fill the remaining fields */
+    bool finish_value(MemValueType& value, size_t read_size) const;
+
+    /* Value read by update_values() */
+    bool has_cached_value = false;
+    bool cached_valid;
+    MemValueType cached_value;
+
     /* Poke a value (given as a MemValueType) into the ram watch address. Return
      * the result of process_vm_writev call */
     int poke_value(MemValueType value);
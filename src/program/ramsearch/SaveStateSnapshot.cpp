@@ -0,0 +1,347 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "SaveStateSnapshot.h"
+
+#include "../../library/checkpoint/MemArea.h"
+#include "../../library/checkpoint/StateHeader.h"
+#include "../../shared/SharedConfig.h"
+#include "../../external/lz4.h"
+
+#ifdef LIBTAS_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+/* Sequential reader of the areas of a savestate */
+class SaveStateFile {
+    public:
+        ~SaveStateFile()
+        {
+            if (pmfd >= 0) ::close(pmfd);
+            if (pfd >= 0) ::close(pfd);
+            unmapBaseArea();
+        }
+
+        bool open(const std::string& pagemap_path, const std::string& pages_path)
+        {
+            pmfd = ::open(pagemap_path.c_str(), O_RDONLY);
+            if (pmfd < 0)
+                return false;
+            pfd = ::open(pages_path.c_str(), O_RDONLY);
+            if (pfd < 0)
+                return false;
+
+            if (!readAll(&header.magic, sizeof(int)))
+                return false;
+
+            if (header.magic == libtas::StateHeader::MAGIC) {
+                if (!readAll(&header.version, sizeof(header) - sizeof(int)))
+                    return false;
+            }
+            else {
+                /* Legacy savestates only used LZ4, and their pages can be
+                 * decoded as a stream */
+                header.flags = 0;
+                header.codec = SharedConfig::SS_CODEC_LZ4;
+                if (lseek(pmfd, sizeof(libtas::LegacyStateHeader), SEEK_SET) < 0)
+                    return false;
+            }
+
+            /* The pagemap file is read sequentially from here */
+            return true;
+        }
+
+        /* Read the next area with its page flags. Returns false at the end
+         * or on error */
+        bool nextArea(libtas::Area& area, std::vector<char>& flags)
+        {
+            if (!readAll(&area, sizeof(area)) || !area)
+                return false;
+
+            /* Detect a savestate made by a game of a different architecture,
+             * which has a different area structure */
+            if ((static_cast<char*>(area.endAddr) - static_cast<char*>(area.addr)) != static_cast<ptrdiff_t>(area.size))
+                return false;
+
+            flags.clear();
+            if (area.skip || area.uncommitted)
+                return true;
+
+            flags.resize((area.size + 4095) / 4096);
+            return readAll(flags.data(), flags.size());
+        }
+
+        /* Decode the pages of an area into `memory`, which must be zero. */
+        void decodeArea(const libtas::Area& area, const std::vector<char>& flags, uint8_t* memory, SaveStateFile* base, uint64_t& missing_pages)
+        {
+            off_t offset = area.page_offset;
+            int file_fd = -1;
+            char compressed[4096 + 128];
+
+            /* Pages of full savestates are compressed as a stream */
+            LZ4_streamDecode_t lz4s;
+            LZ4_setStreamDecode(&lz4s, nullptr, 0);
+
+            for (size_t p = 0; p < flags.size(); p++) {
+                char* page = reinterpret_cast<char*>(memory + p*4096);
+                switch (flags[p]) {
+                    case libtas::Area::FULL_PAGE:
+                        if (pread(pfd, page, 4096, offset) != 4096)
+                            missing_pages++;
+                        offset += 4096;
+                        break;
+                    case libtas::Area::COMPRESSED_PAGE: {
+                        int length = 0;
+                        if ((pread(pfd, &length, sizeof(int), offset) != sizeof(int)) ||
+                            (length <= 0) || (length > static_cast<int>(sizeof(compressed))) ||
+                            (pread(pfd, compressed, length, offset + sizeof(int)) != length) ||
+                            !decompressPage(compressed, length, page, lz4s)) {
+                            memset(page, 0, 4096);
+                            missing_pages++;
+                        }
+                        offset += sizeof(int) + length;
+                        break;
+                    }
+                    case libtas::Area::STORED_PAGE:
+                        /* The page store lives inside the game process */
+                        offset += sizeof(uint32_t);
+                        missing_pages++;
+                        break;
+                    case libtas::Area::BASE_PAGE:
+                        if (!base || !base->readPage(reinterpret_cast<uintptr_t>(area.addr) + p*4096, page, missing_pages))
+                            missing_pages++;
+                        break;
+                    case libtas::Area::FILE_PAGE:
+                        if (file_fd < 0)
+                            file_fd = ::open(area.name, O_RDONLY);
+                        if ((file_fd < 0) || (pread(file_fd, page, 4096, area.offset + p*4096) < 0))
+                            missing_pages++;
+                        break;
+                    default:
+                        /* Zero, unmapped or guard page */
+                        break;
+                }
+            }
+
+            if (file_fd >= 0)
+                ::close(file_fd);
+        }
+
+    private:
+        bool readAll(void* buf, size_t size)
+        {
+            char* ptr = static_cast<char*>(buf);
+            while (size > 0) {
+                ssize_t ret = ::read(pmfd, ptr, size);
+                if (ret <= 0)
+                    return false;
+                ptr += ret;
+                size -= ret;
+            }
+            return true;
+        }
+
+        bool decompressPage(const char* src, int length, char* dst, LZ4_streamDecode_t& lz4s)
+        {
+            if (!(header.flags & libtas::StateHeader::INDEPENDENT_BLOCKS))
+                return LZ4_decompress_safe_continue(&lz4s, src, dst, length, 4096) == 4096;
+
+            switch (header.codec) {
+                case SharedConfig::SS_CODEC_LZ4:
+                    return LZ4_decompress_safe(src, dst, length, 4096) == 4096;
+#ifdef LIBTAS_HAS_ZSTD
+                case SharedConfig::SS_CODEC_ZSTD:
+                    return ZSTD_decompress(dst, 4096, src, length) == 4096;
+#endif
+                default:
+                    return false;
+            }
+        }
+
+        /* Copy a page of this savestate used as a base savestate. Pages must
+         * be requested in increasing addresses. */
+        bool readPage(uintptr_t addr, char* page, uint64_t& missing_pages)
+        {
+            while (!base_end && ((base_memory == nullptr) || (addr >= reinterpret_cast<uintptr_t>(base_area.endAddr)))) {
+                unmapBaseArea();
+                if (!nextArea(base_area, base_flags)) {
+                    base_end = true;
+                    break;
+                }
+                if (base_flags.empty())
+                    continue;
+
+                void* memory = mmap(nullptr, base_area.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (memory == MAP_FAILED)
+                    continue;
+                base_memory = static_cast<uint8_t*>(memory);
+                decodeArea(base_area, base_flags, base_memory, nullptr, missing_pages);
+            }
+
+            if (base_end || (addr < reinterpret_cast<uintptr_t>(base_area.addr)))
+                return false;
+
+            memcpy(page, base_memory + (addr - reinterpret_cast<uintptr_t>(base_area.addr)), 4096);
+            return true;
+        }
+
+        void unmapBaseArea()
+        {
+            if (base_memory)
+                munmap(base_memory, base_area.size);
+            base_memory = nullptr;
+        }
+
+        int pmfd = -1;
+        int pfd = -1;
+        libtas::StateHeader header;
+
+        /* Current area when used as a base savestate */
+        libtas::Area base_area;
+        std::vector<char> base_flags;
+        uint8_t* base_memory = nullptr;
+        bool base_end = false;
+};
+
+}
+
+SaveStateSnapshot::~SaveStateSnapshot()
+{
+    close();
+}
+
+void SaveStateSnapshot::close()
+{
+    for (const Section& section : sections)
+        munmap(section.memory, section.endaddr - section.addr);
+    sections.clear();
+    missing_pages = 0;
+}
+
+bool SaveStateSnapshot::open(const std::string& pagemap_path, const std::string& pages_path, const std::string& base_pagemap_path, const std::string& base_pages_path)
+{
+    close();
+
+    SaveStateFile state;
+    if (!state.open(pagemap_path, pages_path)) {
+        error = "Could not open savestate files " + pagemap_path + " and " + pages_path;
+        return false;
+    }
+
+    /* The base savestate is only needed by incremental savestates */
+    SaveStateFile base;
+    bool has_base = !base_pagemap_path.empty() && (base_pagemap_path != pagemap_path) && base.open(base_pagemap_path, base_pages_path);
+
+    libtas::Area area;
+    std::vector<char> flags;
+    while (state.nextArea(area, flags)) {
+        /* Skip areas without content, and the content of savefiles which are
+         * not part of the game memory */
+        if (flags.empty() || (area.flags & libtas::Area::AREA_SAVEFILE))
+            continue;
+
+        void* memory = mmap(nullptr, area.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED) {
+            error = "Could not allocate memory for the savestate";
+            close();
+            return false;
+        }
+
+        Section section;
+        section.addr = reinterpret_cast<uintptr_t>(area.addr);
+        section.endaddr = reinterpret_cast<uintptr_t>(area.endAddr);
+        section.prot = area.prot;
+        section.flags = area.flags;
+        section.offset = area.offset;
+        section.devmajor = area.devmajor;
+        section.devminor = area.devminor;
+        section.inode = area.inodenum;
+        section.name = area.name;
+        section.memory = static_cast<uint8_t*>(memory);
+        sections.push_back(section);
+
+        state.decodeArea(area, flags, section.memory, has_base ? &base : nullptr, missing_pages);
+    }
+
+    if (sections.empty()) {
+        error = "Could not read any memory area from savestate " + pagemap_path;
+        return false;
+    }
+
+    return true;
+}
+
+std::string SaveStateSnapshot::maps() const
+{
+    std::string maps;
+    char line[128];
+    for (const Section& section : sections) {
+        snprintf(line, sizeof(line), "%lx-%lx %c%c%c%c %08lx %02lx:%02lx %lu ",
+            section.addr, section.endaddr,
+            (section.prot & PROT_READ) ? 'r' : '-',
+            (section.prot & PROT_WRITE) ? 'w' : '-',
+            (section.prot & PROT_EXEC) ? 'x' : '-',
+            (section.flags & libtas::Area::AREA_SHARED) ? 's' : 'p',
+            static_cast<unsigned long>(section.offset),
+            section.devmajor, section.devminor,
+            static_cast<unsigned long>(section.inode));
+        maps += line;
+        maps += section.name;
+        maps += '\n';
+    }
+    return maps;
+}
+
+size_t SaveStateSnapshot::read(void* local_addr, uintptr_t remote_addr, size_t size) const
+{
+    /* Find the section containing the address */
+    size_t s;
+    for (s = 0; s < sections.size(); s++) {
+        if ((remote_addr >= sections[s].addr) && (remote_addr < sections[s].endaddr))
+            break;
+    }
+    if (s == sections.size())
+        return -1;
+
+    /* Like process_vm_readv(), continue reading into the following sections
+     * if they are contiguous */
+    size_t read_size = 0;
+    uint8_t* dst = static_cast<uint8_t*>(local_addr);
+    uintptr_t addr = remote_addr;
+    for (; (s < sections.size()) && (read_size < size); s++) {
+        if (sections[s].addr > addr)
+            break;
+        size_t len = std::min<size_t>(size - read_size, sections[s].endaddr - addr);
+        memcpy(dst + read_size, sections[s].memory + (addr - sections[s].addr), len);
+        read_size += len;
+        addr += len;
+    }
+
+    return read_size;
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATESNAPSHOT_H_INCLUDED
+#define LIBTAS_SAVESTATESNAPSHOT_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Game memory stored inside a savestate on disk, which can be scanned like
+ * the memory of the running game. The whole savestate is decoded when opened,
+ * into memory that is only committed for the pages that were written. */
+class SaveStateSnapshot {
+    public:
+        SaveStateSnapshot() = default;
+        SaveStateSnapshot(const SaveStateSnapshot&) = delete;
+        SaveStateSnapshot& operator=(const SaveStateSnapshot&) = delete;
+        ~SaveStateSnapshot();
+
+        /* Decode the savestate from its pagemap and pages files. The base
+         * savestate files are used by incremental savestates, and may be
+         * empty. Returns false if the savestate could not be read, with the
+         * reason stored in `error`. */
+        bool open(const std::string& pagemap_path, const std::string& pages_path, const std::string& base_pagemap_path, const std::string& base_pages_path);
+
+        /* Returns the memory layout of the savestate, in the same format as
+         * /proc/pid/maps */
+        std::string maps() const;
+
+        /* Read memory of the savestate, with the same behaviour as
+         * MemAccess::read(). Returns the number of bytes read, or -1 if the
+         * address is not inside the savestate */
+        size_t read(void* local_addr, uintptr_t remote_addr, size_t size) const;
+
+        /* Number of pages whose content could not be recovered and are
+         * read as zeros. This happens for pages kept in the page store of the
+         * game process, or for pages of mapped files that were modified. */
+        uint64_t missing_pages = 0;
+
+        /* Reason of the last opening failure */
+        std::string error;
+
+    private:
+        struct Section {
+            uintptr_t addr;
+            uintptr_t endaddr;
+            int prot;
+            int flags;
+            off_t offset;
+            unsigned long devmajor;
+            unsigned long devminor;
+            ino_t inode;
+            std::string name;
+            uint8_t* memory; // decoded memory of the section
+        };
+
+        /* Unmap the memory of all sections */
+        void close();
+
+        std::vector<Section> sections;
+};
+
+#endif
@@ -106,6 +106,28 @@ EncodeWindow::EncodeWindow(Context* c, QWidget *parent) : QDialog(parent), conte
     
     framerateGroupBox->setLayout(framerateLayout);
 
+    skipDuplicates = new QCheckBox(tr("Skip duplicate frames (variable framerate)"));
+    skipDuplicates->setToolTip(tr("Identical frames, such as lag frames or static screens, are not sent to ffmpeg, which encodes a video with a variable framerate when the container supports it."));
+
+    /* Encoder thread */
+    queueSize = new QSpinBox();
+    queueSize->setMaximum(1000);
+    queueSize->setSpecialValueText(tr("Disabled"));
+    queueSize->setToolTip(tr("Frames are sent to ffmpeg from a separate thread, so that the game does not wait for ffmpeg. Each queued frame uses the memory of a full screen image."));
+
+    queuePolicy = new QComboBox();
+    queuePolicy->addItem(tr("Wait for the encoder"), SharedConfig::ENCODE_QUEUE_BLOCK);
+    queuePolicy->addItem(tr("Queue more frames"), SharedConfig::ENCODE_QUEUE_GROW);
+
+    QGroupBox *queueGroupBox = new QGroupBox(tr("Encoder thread"));
+    QGridLayout *queueLayout = new QGridLayout;
+    queueLayout->addWidget(new QLabel(tr("Queued frames:")), 0, 0);
+    queueLayout->addWidget(queueSize, 0, 1);
+    queueLayout->addWidget(new QLabel(tr("When the queue is full:")), 1, 0);
+    queueLayout->addWidget(queuePolicy, 1, 1);
+    queueLayout->setColumnStretch(1, 1);
+    queueGroupBox->setLayout(queueLayout);
+
     QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
 
     QPushButton* saveDefaultButton = new QPushButton(tr("Save as default"));
@@ -121,6 +143,8 @@ EncodeWindow::EncodeWindow(Context* c, QWidget *parent) : QDialog(parent), conte
     mainLayout->addWidget(encodeFileGroupBox);
     mainLayout->addWidget(codecGroupBox);
     mainLayout->addWidget(framerateGroupBox);
+    mainLayout->addWidget(skipDuplicates);
+    mainLayout->addWidget(queueGroupBox);
     mainLayout->addStretch(1);
     mainLayout->addWidget(buttonBox);
 
@@ -156,6 +180,12 @@ void EncodeWindow::update_config()
     else
         videoFramerate->setValue(context->config.sc.initial_framerate_num / context->config.sc.initial_framerate_den);
 
+    skipDuplicates->setChecked(context->config.sc.encode_skip_duplicates);
+
+    /* Set encoder thread queue */
+    queueSize->setValue(context->config.sc.encode_queue_size);
+    queuePolicy->setCurrentIndex(queuePolicy->findData(context->config.sc.encode_queue_policy));
+
     if (context->config.ffmpegoptions.empty()) {
         slotUpdate();
     }
@@ -229,6 +259,11 @@ void EncodeWindow::slotOk()
     else
         context->config.sc.video_framerate = 0;
 
+    context->config.sc.encode_skip_duplicates = skipDuplicates->isChecked();
+
+    context->config.sc.encode_queue_size = queueSize->value();
+    context->config.sc.encode_queue_policy = queuePolicy->currentData().toInt();
+
     context->config.sc_modified = true;
 
     /* Close window */
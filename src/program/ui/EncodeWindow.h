@@ -26,6 +26,7 @@
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QGroupBox>
+#include <QtWidgets/QCheckBox>
 
 /* Forward declaration */
 struct Context;
@@ -51,6 +52,9 @@ private:
     QLineEdit *ffmpegOptions;
     QSpinBox *videoFramerate;
     QGroupBox *framerateGroupBox;
+    QCheckBox *skipDuplicates;
+    QSpinBox *queueSize;
+    QComboBox *queuePolicy;
 
 private slots:
     void slotBrowseEncodePath();
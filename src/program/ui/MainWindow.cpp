@@ -33,6 +33,7 @@
 #include "AnnotationsWindow.h"
 #include "TimeTraceWindow.h"
 #include "TimeTraceModel.h"
+#include "SaveStateMetricsWindow.h"
 #include "LuaConsoleWindow.h"
 #include "MovieSettingsWindow.h"
 #include "ErrorChecking.h"
@@ -175,6 +176,7 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
     inputEditorWindow = new InputEditorWindow(c, &gameLoop->movie, this);
     annotationsWindow = new AnnotationsWindow(c, this);
     timeTraceWindow = new TimeTraceWindow(c, this);
+    saveStateMetricsWindow = new SaveStateMetricsWindow(c, this);
     luaConsoleWindow = new LuaConsoleWindow(c, this);
     movieSettingsWindow = new MovieSettingsWindow(c, &gameLoop->movie, this);
 
@@ -346,6 +348,8 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
     statusIcon->setPixmap(pixmap);
     statusSoft = new QLabel(tr("Savestates will likely not work unless you check [Video > Force software rendering]"));
     statusMute = new QLabel(tr("Savestates will likely not work unless you check [Sound > Mute]"));
+    statusSavestate = new QLabel();
+    statusBar()->addPermanentWidget(statusSavestate);
 
     /* Layouts */
 
@@ -670,6 +674,9 @@ void MainWindow::createMenus()
     configEncodeAction = toolsMenu->addAction(tr("Configure encode..."), encodeWindow, &EncodeWindow::exec);
     toggleEncodeAction = toolsMenu->addAction(tr("Start encode"), this, &MainWindow::slotToggleEncode);
     screenshotAction = toolsMenu->addAction(tr("Screenshot..."), this, &MainWindow::slotScreenshot);
+    screenshotAsyncAction = toolsMenu->addAction(tr("Write screenshots in background"), this, LAMBDABOOLSLOT(context->config.sc.screenshot_async));
+    screenshotAsyncAction->setCheckable(true);
+    screenshotAsyncAction->setToolTip("When checked, png and qoi screenshots are written from a separate thread, and the file may not be complete right after the screenshot");
 
     toolsMenu->addSeparator();
 
@@ -713,6 +720,7 @@ void MainWindow::createMenus()
     disabledActionsOnStart.append(busyloopAction);
 
     toolsMenu->addAction(tr("Time Trace..."), timeTraceWindow, &TimeTraceWindow::show);
+    toolsMenu->addAction(tr("Savestate Metrics..."), saveStateMetricsWindow, &SaveStateMetricsWindow::show);
 
 
     /* Input Menu */
@@ -773,6 +781,8 @@ void MainWindow::updateStatus(int status)
             frameCount->setValue(0);
             currentLength->setText("Current Time: -");
             fpsValues->setText("Current FPS: - / -");
+            context->savestate_size_slot = -1;
+            statusSavestate->clear();
 
             stopButton->setText("Stop");
             stopButton->setEnabled(false);
@@ -935,6 +945,18 @@ void MainWindow::updateUIFrequent()
         fpsValues->setText("Current FPS: - / -");
     }
 
+    /* Update savestate size */
+    if (context->savestate_size_slot >= 0) {
+        QString size_str = QString("State %1: ").arg(context->savestate_size_slot);
+        if (context->savestate_size > 0)
+            size_str += QString("%1 MB (estimated %2 MB)").arg(context->savestate_size / (1024.0*1024.0), 0, 'f', 1).arg(context->savestate_size_estimate / (1024.0*1024.0), 0, 'f', 1);
+        else
+            size_str += QString("estimated %1 MB").arg(context->savestate_size_estimate / (1024.0*1024.0), 0, 'f', 1);
+        if (context->savestate_space > 0)
+            size_str += QString(", %1 MB available").arg(context->savestate_space / (1024.0*1024.0), 0, 'f', 1);
+        statusSavestate->setText(size_str);
+    }
+
     /* Update RAM watch/search */
     if (ramSearchWindow->isVisible()) {
         ramSearchWindow->update();
@@ -1062,6 +1084,8 @@ void MainWindow::updateUIFromConfig()
 
     busyloopAction->setChecked(context->config.sc.busyloop_detection);
 
+    screenshotAsyncAction->setChecked(context->config.sc.screenshot_async);
+
     setCheckboxesFromMask(fastforwardGroup, context->config.sc.fastforward_mode);
     setRadioFromList(fastforwardRenderGroup, context->config.sc.fastforward_render);
 
@@ -1256,7 +1280,7 @@ void MainWindow::slotGamePathChanged()
 
     updateRecentGamepaths();
 
-    if (!context->is_soft_dirty) {
+    if (!context->is_soft_dirty && (context->config.sc.savestate_dirty_tracking == SharedConfig::DIRTY_SOFT)) {
         context->config.sc.savestate_settings &= ~SharedConfig::SS_INCREMENTAL;
     }
 
@@ -1271,7 +1295,7 @@ void MainWindow::slotGamePathChanged()
 
 void MainWindow::slotBrowseMoviePath()
 {
-    QString filename = QFileDialog::getSaveFileName(this, tr("Choose a movie file"), context->config.moviefile.c_str(), tr("libTAS movie files (*.ltm)"), Q_NULLPTR, QFileDialog::DontConfirmOverwrite);
+    QString filename = QFileDialog::getSaveFileName(this, tr("Choose a movie file"), context->config.moviefile.c_str(), tr("libTAS movie files (*.ltm *.ltmb)"), Q_NULLPTR, QFileDialog::DontConfirmOverwrite);
     if (filename.isNull())
         return;
 
@@ -1300,7 +1324,7 @@ void MainWindow::slotSaveMovie()
 void MainWindow::slotExportMovie()
 {
     if (context->config.sc.recording != SharedConfig::NO_RECORDING) {
-        QString filename = QFileDialog::getSaveFileName(this, tr("Choose a movie file"), context->config.moviefile.c_str(), tr("libTAS movie files (*.ltm)"));
+        QString filename = QFileDialog::getSaveFileName(this, tr("Choose a movie file"), context->config.moviefile.c_str(), tr("libTAS movie files (*.ltm *.ltmb)"));
         if (!filename.isNull()) {
             int ret = gameLoop->movie.saveMovie(filename.toStdString());
             if (ret < 0) {
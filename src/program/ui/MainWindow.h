@@ -61,6 +61,7 @@ class OsdWindow;
 class AnnotationsWindow;
 class AutoSaveWindow;
 class TimeTraceWindow;
+class SaveStateMetricsWindow;
 class LuaConsoleWindow;
 class MovieSettingsWindow;
 class HexViewWindow;
@@ -94,6 +95,7 @@ public:
     AnnotationsWindow* annotationsWindow;
     AutoSaveWindow* autoSaveWindow;
     TimeTraceWindow* timeTraceWindow;
+    SaveStateMetricsWindow* saveStateMetricsWindow;
     LuaConsoleWindow* luaConsoleWindow;
     MovieSettingsWindow* movieSettingsWindow;
     HexViewWindow* hexViewWindow;
@@ -116,6 +118,7 @@ public:
     QAction *configEncodeAction;
     QAction *toggleEncodeAction;
     QAction *screenshotAction;
+    QAction *screenshotAsyncAction;
 
     QActionGroup *slowdownGroup;
     QActionGroup *fastforwardGroup;
@@ -170,6 +173,7 @@ public:
     QLabel *statusIcon;
     QLabel *statusSoft;
     QLabel *statusMute;
+    QLabel *statusSavestate;
 
 
     /* Event filter function to prevent menu close when a checkable option is clicked */
@@ -21,7 +21,6 @@
 
 #include "utils.h"
 #include "Context.h"
-#include "ramsearch/MemAccess.h"
 #include "ramsearch/MemLayout.h"
 #include "ramsearch/BaseAddresses.h"
 
@@ -29,17 +28,132 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+/* Pointer chain files start with this magic followed by the pointer size.
+ * Chains are then stored sorted, each with the difference between its base
+ * address and the previous one, the number of offsets and the offsets, all
+ * written as variable-length integers. Files of the older format start
+ * directly with the pointer size, and store all values with a fixed size. */
+static const char CHAIN_FILE_MAGIC[4] = {'L', 'P', 'T', 'R'};
+
+static void writeVarint(std::ostream& os, uint64_t value)
+{
+    while (value >= 0x80) {
+        os.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    os.put(static_cast<char>(value));
+}
+
+static bool readVarint(std::istream& is, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = is.get();
+        if (c == EOF)
+            return false;
+        value |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/* Sequential reader of a pointer chain file in any format */
+class ChainFileReader {
+public:
+    ChainFileReader(const std::string& file) : ifs(file, std::ios::binary) {}
+
+    bool open()
+    {
+        char magic[sizeof(CHAIN_FILE_MAGIC)];
+        ifs.read(magic, sizeof(magic));
+        if (!ifs)
+            return false;
+
+        int ptr_size;
+        if (memcmp(magic, CHAIN_FILE_MAGIC, sizeof(magic)) == 0) {
+            compact = true;
+            ifs.read(reinterpret_cast<char*>(&ptr_size), sizeof(ptr_size));
+        }
+        else {
+            memcpy(&ptr_size, magic, sizeof(ptr_size));
+        }
 
-PointerScanModel::PointerScanModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c) {}
+        /* Check pointer size, so that we don't read garbage data */
+        return ifs && (ptr_size == sizeof(uintptr_t));
+    }
 
-void PointerScanModel::locatePointers()
+    /* Read the next chain. Returns false at the end of the file, or on
+     * error with `error` set. */
+    bool next(PointerChain& chain)
+    {
+        if (compact) {
+            uint64_t delta, size;
+            if (!readVarint(ifs, delta))
+                return false;
+            if (!readVarint(ifs, size) || (size > PointerChain::MAX_LEVEL)) {
+                error = true;
+                return false;
+            }
+            base_address += delta;
+            chain.base_address = base_address;
+            chain.level_count = size;
+            for (int i = 0; i < chain.level_count; i++) {
+                uint64_t offset;
+                if (!readVarint(ifs, offset)) {
+                    error = true;
+                    return false;
+                }
+                chain.offsets[i] = static_cast<int>(offset);
+            }
+            return true;
+        }
+
+        ifs.read(reinterpret_cast<char*>(&chain.base_address), sizeof(chain.base_address));
+        if (!ifs)
+            return false;
+
+        int size;
+        ifs.read(reinterpret_cast<char*>(&size), sizeof(size));
+        if (!ifs || (size < 0) || (size > PointerChain::MAX_LEVEL)) {
+            error = true;
+            return false;
+        }
+        chain.level_count = size;
+        ifs.read(reinterpret_cast<char*>(chain.offsets), size*sizeof(int));
+        if (!ifs) {
+            error = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool error = false;
+
+private:
+    std::ifstream ifs;
+    bool compact = false;
+    uintptr_t base_address = 0;
+};
+
+PointerScanModel::PointerScanModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c)
 {
-    pointer_map.clear();
-    static_pointer_map.clear();
+    /* Results are sent from the search threads, and must be added to the
+     * model from the UI thread */
+    connect(this, &PointerScanModel::signalChainsFound, this, &PointerScanModel::slotFlushChains, Qt::QueuedConnection);
+    connect(this, &PointerScanModel::signalSearchFinished, this, &PointerScanModel::slotSortChains, Qt::QueuedConnection);
+}
 
+void PointerScanModel::locatePointers()
+{
     std::unique_ptr<MemLayout> memlayout (new MemLayout(context->game_pid));
     
-    std::vector<MemSection> memory_sections;
+    std::vector<MemSection> static_sections;
+    std::vector<MemSection> dynamic_sections;
     file_mapping_sections.clear();
 
     int type_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW | MemSection::MemStack);
@@ -47,88 +161,48 @@ void PointerScanModel::locatePointers()
     
     MemSection section;
     while (memlayout->nextSection(type_flag, 0, section)) {
-        /* Only store sections that could contain pointers */
-        memory_sections.push_back(section);
-        
+        /* Only store sections that could contain pointers, and separate
+         * static sections. Pointers to static sections are skipped */
+        if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack)) {
+            static_sections.push_back(section);
+        }
+        else {
+            dynamic_sections.push_back(section);
+        }
+
         /* Keep the file mapping to access to the file and offsets */
         if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemFileMappingRW | MemSection::MemStack)) {
             file_mapping_sections.push_back(section);
         }
     }
 
-    /* Read all memory and store all pointers */
-    int cur_size = 0;
-    int game_addr_size = MemAccess::getAddrSize();
-    for (const MemSection &section : memory_sections) {
-
-        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += 4096) {
-
-            /* Read values in chunks of 4096 bytes so we lower the number of calls. */
-            
-            /* The following code is a bit awkward to support both 32-bit and
-             * 64-bit pointers while conforming aliasing rules. A better coder
-             * than me may write more elegant code */
-            uint64_t chunk64[4096/sizeof(uint64_t)];
-            uint32_t chunk32[4096/sizeof(uint32_t)];
-            int readValues;
-
-            if (game_addr_size == 4) {
-                readValues = MemAccess::read(chunk32, reinterpret_cast<void*>(addr), 4096);
-            }
-            else {
-                readValues = MemAccess::read(chunk64, reinterpret_cast<void*>(addr), 4096);
-            }
-            
-            if (readValues < 0) {
-                continue;
-            }
-
-            /* Update progress bar */
-            emit signalProgress((int)(100 * ((float)cur_size / total_size)));
-
-            unsigned int chunk_data_size = readValues/game_addr_size;
-
-            for (unsigned int i = 0; i < chunk_data_size; i++, cur_size += game_addr_size) {
-                /* Check if the value could be a pointer */
-                bool is_pointer = false;
-                
-                uintptr_t value;
-                if (game_addr_size == 4)
-                    value = static_cast<uintptr_t>(chunk32[i]);
-                else
-                    value = static_cast<uintptr_t>(chunk64[i]);
-
-                for (const MemSection &ms : memory_sections) {
-                    /* If pointing to a static section, we can skip it */
-                    if (ms.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack)) {
-                        continue;
-                    }
-
-                    /* We take advantage of the fact that sections are ordered */
-                    if (value < ms.addr) {
-                        break;
-                    }
-                    if (value < ms.endaddr) {
-                        is_pointer = true;
-                        break;
-                    }
-                }
+    /* Read all memory and store all pointers to dynamic sections */
+    uint64_t static_size = 0;
+    for (const MemSection &ms : static_sections)
+        static_size += ms.size;
+
+    pointerscanner.static_pointers.build(static_sections, dynamic_sections, [&](uint64_t size) {
+        emit signalProgress((int)(100 * ((float)size / total_size)));
+    });
+    pointerscanner.pointers.build(dynamic_sections, dynamic_sections, [&](uint64_t size) {
+        emit signalProgress((int)(100 * ((float)(static_size + size) / total_size)));
+    });
+}
 
-                if (is_pointer) {
-                    uintptr_t stored_addr = addr + i*game_addr_size;
-                    if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack)) {
-                        static_pointer_map.insert(std::make_pair(value, stored_addr));
-                    }
-                    else {
-                        pointer_map.insert(std::make_pair(value, stored_addr));
-                    }
-                }
-            }
-        }
+void PointerScanModel::resetChains(int ml)
+{
+    beginResetModel();
+    max_level = ml;
+    std::vector<PointerChain>().swap(pointer_chains);
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending_chains.clear();
     }
+    pointerscanner.is_stopped = false;
+    endResetModel();
 }
 
-void PointerScanModel::findPointerChain(uintptr_t addr, int ml, int max_offset)
+void PointerScanModel::findPointerChain(uintptr_t addr, int max_offset)
 {
     static uint64_t last_scan_frame = 1 << 30;
     /* Don't locate pointers again if this is the same frame */
@@ -137,107 +211,106 @@ void PointerScanModel::findPointerChain(uintptr_t addr, int ml, int max_offset)
         last_scan_frame = context->framecount;
     }
 
-    beginResetModel();
-
-    max_level = ml;
-    pointer_chains.clear();
-    int offsets[10];
-
-    // std::cout << "max offset " << max_offset << std::endl;
-
-    recursiveFind(addr, 0, offsets, max_offset);
+    int err = PointerScanner::ESTOPPED;
+    if (!pointerscanner.is_stopped) {
+        err = pointerscanner.find_chains(addr, max_level, max_offset, [this](std::vector<PointerChain>& chains) {
+            bool notify;
+            {
+                std::lock_guard<std::mutex> lock(pending_mutex);
+                notify = pending_chains.empty();
+                pending_chains.insert(pending_chains.end(), chains.begin(), chains.end());
+            }
+            /* Only notify once for all results waiting to be added */
+            if (notify)
+                emit signalChainsFound();
+        });
+    }
 
-    /* Sort pointers so that we can intersect with saved pointers */
-    std::sort(pointer_chains.begin(), pointer_chains.end());
+    emit signalSearchFinished(err);
+}
 
-    endResetModel();
+void PointerScanModel::stopSearch()
+{
+    pointerscanner.is_stopped = true;
 }
 
-void PointerScanModel::recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset)
+void PointerScanModel::slotFlushChains()
 {
-    /* Search inside static data */
-    auto iter = static_pointer_map.lower_bound(addr - max_offset);
-    while ((iter != static_pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found static chain with last offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        std::vector<int> offset_vec(offsets, offsets + level + 1);
-        pointer_chains.emplace_back(base_address, std::move(offset_vec));
-        iter++;
+    std::vector<PointerChain> chains;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        chains.swap(pending_chains);
     }
 
-    /* Stop if we reached the last level */
-    if (level == (max_level-1))
+    if (chains.empty())
         return;
 
-    /* Search inside dynamic data */
-    iter = pointer_map.lower_bound(addr - max_offset);
-    while ((iter != pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found chain with offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        recursiveFind(base_address, level+1, offsets, max_offset);
-        iter++;
-    }
+    beginInsertRows(QModelIndex(), pointer_chains.size(), pointer_chains.size() + chains.size() - 1);
+    pointer_chains.insert(pointer_chains.end(), chains.begin(), chains.end());
+    endInsertRows();
+}
+
+void PointerScanModel::slotSortChains()
+{
+    slotFlushChains();
+
+    /* Sort pointers so that we can intersect with saved pointers */
+    beginResetModel();
+    std::sort(pointer_chains.begin(), pointer_chains.end());
+    endResetModel();
 }
 
 int PointerScanModel::saveChains(const std::string& file)
-{    
+{
     std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
-    
+
     if (!ofs) return -1;
-    
-    /* Save pointer size first, so that we don't read garbage data */
+
+    ofs.write(CHAIN_FILE_MAGIC, sizeof(CHAIN_FILE_MAGIC));
     int ptr_size = sizeof(uintptr_t);
     ofs.write(reinterpret_cast<char*>(&ptr_size), sizeof(ptr_size));
-    
-    for (const auto& chain : pointer_chains) {
-        ofs.write(reinterpret_cast<const char*>(&chain.first), sizeof(chain.first));
-        int size = static_cast<int>(chain.second.size());
-        ofs.write(reinterpret_cast<char*>(&size), sizeof(size));
-        ofs.write(reinterpret_cast<const char*>(chain.second.data()), size*sizeof(int));
+
+    uintptr_t base_address = 0;
+    for (const PointerChain& chain : pointer_chains) {
+        writeVarint(ofs, chain.base_address - base_address);
+        base_address = chain.base_address;
+        writeVarint(ofs, chain.level_count);
+        for (int i = 0; i < chain.level_count; i++)
+            writeVarint(ofs, static_cast<uint32_t>(chain.offsets[i]));
     }
-    
-    return 0;
+
+    return ofs ? 0 : -1;
 }
 
 int PointerScanModel::loadChains(const std::string& file)
 {
-    std::vector<std::pair<uintptr_t, std::vector<int>>> loaded_pointer_chains;
-    std::ifstream ifs(file, std::ios::binary);
-    
-    if (!ifs) {
+    ChainFileReader reader(file);
+    if (!reader.open())
         return -1;
-    }
-    
-    int ptr_size;
-    ifs.read(reinterpret_cast<char*>(&ptr_size), sizeof(ptr_size));
-    if (ptr_size != sizeof(uintptr_t)) {
-        return -1;
-    }
 
-    while (ifs) {
-        uintptr_t addr;
-        ifs.read(reinterpret_cast<char*>(&addr), sizeof(addr));
-        if (!ifs) break;
-        
-        int size;
-        ifs.read(reinterpret_cast<char*>(&size), sizeof(size));
-        if ((size < 0) || (size > 10)) {
-            return -1;
+    /* Both lists of chains are sorted, so we can intersect them while
+     * reading the file */
+    std::vector<PointerChain> intersected_pointer_chains;
+    PointerChain loaded;
+    bool has_loaded = reader.next(loaded);
+    auto it = pointer_chains.begin();
+    while (has_loaded && (it != pointer_chains.end())) {
+        if (*it < loaded) {
+            it++;
+        }
+        else if (loaded < *it) {
+            has_loaded = reader.next(loaded);
+        }
+        else {
+            intersected_pointer_chains.push_back(*it);
+            it++;
+            has_loaded = reader.next(loaded);
         }
-
-        std::vector<int> offsets(size);
-        ifs.read(reinterpret_cast<char*>(offsets.data()), size*sizeof(int));
-        loaded_pointer_chains.emplace_back(addr, std::move(offsets));
     }
-    
-    /* Merge both pointer chain vectors */
-    std::vector<std::pair<uintptr_t, std::vector<int>>> intersected_pointer_chains;
-    std::set_intersection(pointer_chains.begin(), pointer_chains.end(),
-        loaded_pointer_chains.begin(), loaded_pointer_chains.end(),
-        std::back_inserter(intersected_pointer_chains));
-        
+
+    if (reader.error)
+        return -1;
+
     beginResetModel();
     pointer_chains = std::move(intersected_pointer_chains);
     endResetModel();
@@ -271,21 +344,21 @@ QVariant PointerScanModel::headerData(int section, Qt::Orientation orientation,
 QVariant PointerScanModel::data(const QModelIndex &index, int role) const
 {
     if (role == Qt::DisplayRole) {
-        const std::pair<uintptr_t, std::vector<int>> &chain = pointer_chains.at(index.row());
+        const PointerChain &chain = pointer_chains.at(index.row());
         if (index.column() == 0) {
             /* Get file and offset */
             off_t offset;
-            std::string file = BaseAddresses::getFileAndOffset(chain.first, offset);
+            std::string file = BaseAddresses::getFileAndOffset(chain.base_address, offset);
             if (offset >= 0)
                 return QString("%1+0x%2").arg(file.c_str()).arg(offset, 0, 16);
             else
                 return QString("%1-0x%2").arg(file.c_str()).arg(-offset, 0, 16);
         }
-        if (index.column() > static_cast<int>(chain.second.size())) {
+        if (index.column() > chain.level_count) {
             return QString("");
         }
         /* Offsets are stored in reverse order */
-        return QString("%1").arg(*(chain.second.rbegin() + (index.column() - 1)), 0, 16);
+        return QString("%1").arg(chain.offsets[chain.level_count - index.column()], 0, 16);
     }
     return QVariant();
 }
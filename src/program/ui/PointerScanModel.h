@@ -21,10 +21,11 @@
 #define LIBTAS_POINTERSCANMODEL_H_INCLUDED
 
 #include "ramsearch/MemSection.h"
+#include "ramsearch/PointerScanner.h"
 
 #include <QtCore/QAbstractTableModel>
 #include <vector>
-#include <map>
+#include <mutex>
 #include <memory>
 #include <string>
 #include <sys/types.h>
@@ -39,29 +40,35 @@ class PointerScanModel : public QAbstractTableModel {
 public:
     PointerScanModel(Context* c, QObject *parent = Q_NULLPTR);
 
-    /* Map of pointers (key) and addresses (value) */
-    std::multimap<uintptr_t,uintptr_t> pointer_map;
+    /* Pointers of the game memory and chain search */
+    PointerScanner pointerscanner;
 
-    /* Map of pointers (key) and addresses (value) that are in a static area */
-    std::multimap<uintptr_t,uintptr_t> static_pointer_map;
-
-    /* Results of pointer scan */
-    std::vector<std::pair<uintptr_t, std::vector<int>>> pointer_chains;
+    /* Results of pointer scan, sorted when the search is finished */
+    std::vector<PointerChain> pointer_chains;
 
     /* Max size of pointer chain */
     int max_level = 5;
 
-    /* Store all pointers from the game memory into a map */
+    /* Store all pointers from the game memory into the indexes */
     void locatePointers();
 
+    /* Clear the results before starting a new search. Must be called from
+     * the UI thread. */
+    void resetChains(int ml);
+
     /* Find all chains of pointers that start from a static address and
-     * end with the specified address, in maximum `ml` levels and with a maximum
-     * offset of `max_offset`
-     */
-    void findPointerChain(uintptr_t addr, int ml, int max_offset);
+     * end with the specified address, in maximum `max_level` levels and with
+     * a maximum offset of `max_offset`. This is meant to be called from
+     * another thread: results are added to the model while the search is
+     * running, and `signalSearchFinished` is emitted at the end. */
+    void findPointerChain(uintptr_t addr, int max_offset);
+
+    /* Force stop the search */
+    void stopSearch();
 
     int saveChains(const std::string& file);
 
+    /* Only keep the results that are also present in the file */
     int loadChains(const std::string& file);
 
 private:
@@ -70,8 +77,9 @@ private:
     /* File mapping sections */
     std::vector<MemSection> file_mapping_sections;
 
-    /* Recursive call for the pointer chain search */
-    void recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset);
+    /* Results found by the search threads and not yet added to the model */
+    std::vector<PointerChain> pending_chains;
+    std::mutex pending_mutex;
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
@@ -83,6 +91,15 @@ private:
 
 signals:
     void signalProgress(int);
+    void signalChainsFound();
+    void signalSearchFinished(int);
+
+private slots:
+    /* Add the pending results to the model */
+    void slotFlushChains();
+
+    /* Add the remaining results and sort them */
+    void slotSortChains();
 
 };
 
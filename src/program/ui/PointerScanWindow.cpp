@@ -42,6 +42,8 @@
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
 
+#include <thread>
+
 PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(parent), context(c)
 {
     setWindowTitle("Pointer Scan");
@@ -69,6 +71,7 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(pare
     searchProgress = new QProgressBar();
     searchProgress->setRange(0, 100);
     connect(pointerScanModel, &PointerScanModel::signalProgress, searchProgress, &QProgressBar::setValue);
+    connect(pointerScanModel, &PointerScanModel::signalSearchFinished, this, &PointerScanWindow::slotSearchFinished);
 
     scanCount = new QLabel();
     searchProgress->hide();
@@ -94,20 +97,25 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(pare
     formLayout->addRow(new QLabel(tr("Max offset:")), maxOffsetInput);
 
     /* Buttons */
-    QPushButton *searchButton = new QPushButton(tr("Search"));
+    searchButton = new QPushButton(tr("Search"));
     connect(searchButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotSearch);
 
+    stopButton = new QPushButton(tr("Force Stop"));
+    connect(stopButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotStop);
+    stopButton->setDisabled(true);
+
     QPushButton *addButton = new QPushButton(tr("Add Watch"));
     connect(addButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotAdd);
 
-    QPushButton *saveButton = new QPushButton(tr("Save Scan"));
+    saveButton = new QPushButton(tr("Save Scan"));
     connect(saveButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotSave);
 
-    QPushButton *loadButton = new QPushButton(tr("Intersect with other Scan"));
+    loadButton = new QPushButton(tr("Intersect with other Scan"));
     connect(loadButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotLoad);
 
     QDialogButtonBox *buttonBox = new QDialogButtonBox();
     buttonBox->addButton(searchButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(stopButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(addButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(saveButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(loadButton, QDialogButtonBox::ActionRole);
@@ -128,6 +136,9 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(pare
 
 void PointerScanWindow::slotSearch()
 {
+    if (isSearching)
+        return;
+
     bool ok;
     uintptr_t addr = addressInput->text().toULong(&ok, 16);
 
@@ -137,20 +148,52 @@ void PointerScanWindow::slotSearch()
     int max_level = maxLevelInput->value();
     int max_offset = maxOffsetInput->value();
 
+    isSearching = true;
+
+    /* Disable buttons during the process */
+    searchButton->setDisabled(true);
+    saveButton->setDisabled(true);
+    loadButton->setDisabled(true);
+    stopButton->setDisabled(false);
+
     scanCount->hide();
+    searchProgress->reset();
     searchProgress->show();
 
-    pointerScanModel->findPointerChain(addr, max_level, max_offset);
+    /* Results are added to the table while the search is running */
+    pointerScanModel->resetChains(max_level);
+
+    /* Start the actual search on a thread */
+    std::thread t(&PointerScanModel::findPointerChain, pointerScanModel, addr, max_offset);
+    t.detach();
+}
 
+void PointerScanWindow::slotSearchFinished(int err)
+{
     /* Update address count */
     searchProgress->hide();
     scanCount->show();
-    scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
+    if (err == PointerScanner::ESTOPPED)
+        scanCount->setText(QString("%1 results (the search was interrupted by the user)").arg(pointerScanModel->pointer_chains.size()));
+    else
+        scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
 
     /* Sort results */
-    for (int c=max_level; c>=0; c--) {
+    for (int c=pointerScanModel->max_level; c>=0; c--) {
         pointerScanView->sortByColumn(c, Qt::AscendingOrder);
     }
+
+    searchButton->setDisabled(false);
+    saveButton->setDisabled(false);
+    loadButton->setDisabled(false);
+    stopButton->setDisabled(true);
+
+    isSearching = false;
+}
+
+void PointerScanWindow::slotStop()
+{
+    pointerScanModel->stopSearch();
 }
 
 void PointerScanWindow::slotAdd()
@@ -170,13 +213,13 @@ void PointerScanWindow::slotAdd()
         uintptr_t addr = addressInput->text().toULong(&ok, 16);
         for (int i = 0; i < indexes.count(); i++) {
             const QModelIndex sourceIndex = proxyModel->mapToSource(indexes[i]);
-            const std::pair<uintptr_t, std::vector<int>> &chain = pointerScanModel->pointer_chains.at(sourceIndex.row());
+            const PointerChain &chain = pointerScanModel->pointer_chains.at(sourceIndex.row());
             std::unique_ptr<RamWatchDetailed> watch(new RamWatchDetailed(addr, type_index));
 
             watch->is_pointer = true;
-            watch->base_address = chain.first;
-            watch->base_file = BaseAddresses::getFileAndOffset(chain.first, watch->base_file_offset);
-            watch->pointer_offsets = chain.second;
+            watch->base_address = chain.base_address;
+            watch->base_file = BaseAddresses::getFileAndOffset(chain.base_address, watch->base_file_offset);
+            watch->pointer_offsets.assign(chain.offsets, chain.offsets + chain.level_count);
             std::reverse(watch->pointer_offsets.begin(), watch->pointer_offsets.end());
             
             if (indexes.count() == 1) {
@@ -28,6 +28,7 @@
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QProgressBar>
 #include <QtWidgets/QLabel>
+#include <QtWidgets/QPushButton>
 #include <QtCore/QSortFilterProxyModel>
 #include <memory>
 
@@ -56,10 +57,19 @@ private:
     QSpinBox *maxLevelInput;
     QSpinBox *maxOffsetInput;
 
+    QPushButton *searchButton;
+    QPushButton *stopButton;
+    QPushButton *saveButton;
+    QPushButton *loadButton;
+
     QString defaultPath;
+
+    bool isSearching = false;
     
 private slots:
     void slotSearch();
+    void slotSearchFinished(int err);
+    void slotStop();
     void slotAdd();
     void slotSave();
     void slotLoad();
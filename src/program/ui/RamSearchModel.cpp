@@ -23,6 +23,7 @@
 #include "qtutils.h"
 #include "ramsearch/MemLayout.h"
 #include "ramsearch/MemSection.h"
+#include "ramsearch/MemScannerThread.h" // error codes
 
 #include <QtWidgets/QMessageBox>
 #include <memory>
@@ -99,10 +100,40 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
 
 int RamSearchModel::predictScanCount(int mem_flags)
 {
-    std::unique_ptr<MemLayout> memlayout (new MemLayout(context->game_pid));
+    std::unique_ptr<MemLayout> memlayout (snapshot ? new MemLayout(snapshot->maps()) : new MemLayout(context->game_pid));
     return memlayout->totalSize(MemSection::MemAll, mem_flags);
 }
 
+int RamSearchModel::setSource(int slot)
+{
+    if (slot < 0) {
+        snapshot.reset();
+        memscanner.set_snapshot(nullptr);
+        return MemScannerThread::ENOERROR;
+    }
+
+    /* Savestates are read again before each search, because they may have
+     * been overwritten since the last one */
+    std::string prefix = context->config.savestatedir + '/';
+    prefix += context->gamename;
+    prefix += ".state";
+    std::string path = prefix + std::to_string(slot);
+    std::string basepath = prefix + "0";
+
+    std::shared_ptr<SaveStateSnapshot> new_snapshot = std::make_shared<SaveStateSnapshot>();
+    if (!new_snapshot->open(path + ".pm", path + ".p", basepath + ".pm", basepath + ".p")) {
+        std::cerr << new_snapshot->error << std::endl;
+        return MemScannerThread::ESNAPSHOT;
+    }
+
+    if (new_snapshot->missing_pages > 0)
+        std::cerr << "Savestate " << slot << ": " << new_snapshot->missing_pages << " pages could not be read and are searched as zeros" << std::endl;
+
+    snapshot = new_snapshot;
+    memscanner.set_snapshot(snapshot);
+    return MemScannerThread::ENOERROR;
+}
+
 uint64_t RamSearchModel::scanCount()
 {
     return memscanner.scan_count();
@@ -140,6 +171,8 @@ int RamSearchModel::searchWatches(CompareType ct, CompareOperator co, MemValueTy
 
 void RamSearchModel::update()
 {
+    memscanner.update_current_values();
+
     if (rowCount() > 0)
         emit dataChanged(index(0,1), index(rowCount()-1,1), QVector<int>(Qt::DisplayRole));
 }
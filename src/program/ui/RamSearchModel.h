@@ -57,6 +57,10 @@ public:
      * removed by the search */
     CompareType compare_type;
 
+    /* Search inside the savestate of the given slot for the next searches,
+     * or inside the game memory if slot is negative. Returns the error code */
+    int setSource(int slot);
+
     /* Perform a new search and returns the error code */
     int newWatches(int mem_flags, int type, int alignment, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t ba, uintptr_t ea);
 
@@ -86,6 +90,9 @@ public:
 private:
     Context *context;
 
+    /* Savestate being searched, if any */
+    std::shared_ptr<SaveStateSnapshot> snapshot;
+
     QColor unmatchedColor;
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
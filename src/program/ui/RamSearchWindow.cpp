@@ -99,6 +99,18 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
     watchLayout->addWidget(watchCount);
     watchLayout->addWidget(buttonBox);
 
+    /* Memory source, which can be changed between searches to compare values
+     * of different savestates */
+    sourceBox = new QComboBox();
+    sourceBox->addItem("Game memory", -1);
+    for (int i = 1; i <= 10; i++)
+        sourceBox->addItem(QString("Savestate %1").arg(i), i);
+
+    QGroupBox *sourceGroupBox = new QGroupBox(tr("Search In"));
+    QVBoxLayout *sourceLayout = new QVBoxLayout;
+    sourceLayout->addWidget(sourceBox);
+    sourceGroupBox->setLayout(sourceLayout);
+
     /* Memory regions */
     memSpecialBox = new QCheckBox("Exclude special regions");
     memSpecialBox->setChecked(true);
@@ -205,6 +217,7 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
 
     /* Create the options layout */
     QVBoxLayout *optionLayout = new QVBoxLayout;
+    optionLayout->addWidget(sourceGroupBox);
     optionLayout->addWidget(memGroupBox);
     optionLayout->addWidget(compareGroupBox);
     optionLayout->addWidget(operatorGroupBox);
@@ -275,7 +288,8 @@ void RamSearchWindow::slotNew()
     if (isSearching)
         return;
         
-    if (context->status != Context::ACTIVE)
+    /* Savestates can be searched without the game running */
+    if ((context->status != Context::ACTIVE) && (sourceBox->currentData().toInt() < 0))
         return;
     
     /* If there are results, then clear the current scan and enable all boxes */
@@ -307,7 +321,6 @@ void RamSearchWindow::slotNew()
         memflags |= MemSection::MemNoExec;
 
     searchProgress->reset();
-    searchProgress->setMaximum(ramSearchModel->predictScanCount(memflags));
 
     /* Start the actual scan search on a thread */
     std::thread t(&RamSearchWindow::threadedNew, this, memflags);
@@ -329,8 +342,13 @@ void RamSearchWindow::threadedNew(int memflags)
     uintptr_t begin_address = std::strtoul(qPrintable(memBeginLine->text()), nullptr, 16);
     uintptr_t end_address = std::strtoul(qPrintable(memEndLine->text()), nullptr, 16);
 
-    /* Call the RamSearch new function using the right type */
-    int err = ramSearchModel->newWatches(memflags, typeBox->currentIndex(), alignment, compare_type, compare_operator, compare_value, different_value, begin_address, end_address);
+    /* Select the memory to search into, which may need to decode a
+     * savestate, then call the RamSearch new function using the right type */
+    int err = ramSearchModel->setSource(sourceBox->currentData().toInt());
+    if (err == MemScannerThread::ENOERROR) {
+        searchProgress->setMaximum(ramSearchModel->predictScanCount(memflags));
+        err = ramSearchModel->newWatches(memflags, typeBox->currentIndex(), alignment, compare_type, compare_operator, compare_value, different_value, begin_address, end_address);
+    }
 
     if (err < 0)
         searchProgress->reset();
@@ -348,6 +366,9 @@ void RamSearchWindow::threadedNew(int memflags)
         case MemScannerThread::EPROCESS:
             watchCount->setText(tr("There was an error in the search process"));
             break;
+        case MemScannerThread::ESNAPSHOT:
+            watchCount->setText(tr("The savestate could not be read"));
+            break;
         default:
             /* Don't display values if too many results */
             if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
@@ -404,7 +425,9 @@ void RamSearchWindow::threadedSearch()
     MemValueType different_value;
     getCompareParameters(compare_type, compare_operator, compare_value, different_value);
 
-    int err = ramSearchModel->searchWatches(compare_type, compare_operator, compare_value, different_value);
+    int err = ramSearchModel->setSource(sourceBox->currentData().toInt());
+    if (err == MemScannerThread::ENOERROR)
+        err = ramSearchModel->searchWatches(compare_type, compare_operator, compare_value, different_value);
 
     if (err < 0)
         searchProgress->reset();
@@ -422,6 +445,9 @@ void RamSearchWindow::threadedSearch()
         case MemScannerThread::EPROCESS:
             watchCount->setText(tr("There was an error in the search process"));
             break;
+        case MemScannerThread::ESNAPSHOT:
+            watchCount->setText(tr("The savestate could not be read"));
+            break;
         default:
             /* Don't display values if too many results */
             if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
@@ -431,8 +457,9 @@ void RamSearchWindow::threadedSearch()
             break;
     }
 
-    /* Change the button to "New" if no results */
-    if (ramSearchModel->scanCount() == 0 || err < 0) {
+    /* Change the button to "New" if no results. Results are kept when the
+     * savestate could not be read. */
+    if (ramSearchModel->scanCount() == 0 || (err < 0 && err != MemScannerThread::ESNAPSHOT)) {
         newButton->setText(tr("New"));
         memGroupBox->setDisabled(false);
         formatGroupBox->setDisabled(false);
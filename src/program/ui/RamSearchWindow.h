@@ -62,6 +62,8 @@ private:
     QProgressBar *searchProgress;
     QLabel *watchCount;
 
+    QComboBox *sourceBox;
+
     QGroupBox *memGroupBox;
     QCheckBox *memSpecialBox;
     QCheckBox *memROBox;
@@ -20,6 +20,7 @@
 #include "RamWatchView.h"
 #include "RamWatchModel.h"
 #include "RamWatchEditWindow.h"
+#include "ramsearch/RamWatchDetailed.h"
 
 #include "Context.h"
 
@@ -110,6 +111,10 @@ void RamWatchView::slotGet(std::string &watch)
         return;
     }
 
+    /* Read all watches of this frame at once */
+    if (index == 0)
+        RamWatchDetailed::update_values(ramWatchModel->ramwatches);
+
     watch = ramWatchModel->ramwatches[index]->label;
     watch += ": ";
     watch += ramWatchModel->ramwatches[index]->value_str();
@@ -0,0 +1,183 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateMetricsWindow.h"
+#include "MainWindow.h"
+#include "GameEvents.h"
+
+#include "Context.h"
+
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QHeaderView>
+#include <fstream>
+#include <ctime>
+#include <unistd.h> // access()
+
+static const char* const phase_names[SaveStateMetrics::PHASE_COUNT] = {
+    "Suspend threads",
+    "Parse memory mapping",
+    "Read pagemap",
+    "Compress",
+    "Decompress",
+    "Read/write streams",
+    "Savefiles",
+    "Remap areas",
+    "Resume threads",
+    "Total",
+};
+
+static const char* const page_names[SaveStateMetrics::PAGE_TYPE_COUNT] = {
+    "Full",
+    "Compressed",
+    "Stored",
+    "Zero",
+    "File",
+    "Base",
+    "None",
+};
+
+SaveStateMetricsWindow::SaveStateMetricsWindow(Context* c, QWidget *parent) : QDialog(parent), context(c)
+{
+    setWindowTitle("Savestate Metrics");
+
+    summaryLabel = new QLabel(tr("No savestate was performed yet"));
+
+    /* Phase durations */
+    phaseTable = new QTableWidget(SaveStateMetrics::PHASE_COUNT, 1, this);
+    phaseTable->setHorizontalHeaderLabels(QStringList() << tr("Time (ms)"));
+    for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++) {
+        phaseTable->setVerticalHeaderItem(p, new QTableWidgetItem(phase_names[p]));
+        phaseTable->setItem(p, 0, new QTableWidgetItem());
+    }
+    phaseTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    phaseTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    phaseTable->verticalHeader()->setDefaultSectionSize(phaseTable->verticalHeader()->minimumSectionSize());
+
+    /* Page counts of each area */
+    QStringList areaLabels;
+    areaLabels << tr("Address") << tr("Size") << tr("Name");
+    for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++)
+        areaLabels << page_names[t];
+
+    areaTable = new QTableWidget(0, areaLabels.size(), this);
+    areaTable->setHorizontalHeaderLabels(areaLabels);
+    areaTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    areaTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    areaTable->setShowGrid(false);
+    areaTable->setAlternatingRowColors(true);
+    areaTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    areaTable->horizontalHeader()->setSectionResizeMode(2, QHeaderView::Stretch);
+    areaTable->verticalHeader()->setDefaultSectionSize(areaTable->verticalHeader()->minimumSectionSize());
+    areaTable->verticalHeader()->hide();
+
+    csvBox = new QCheckBox(tr("Append metrics to %1").arg(csvPath().c_str()));
+
+    /* Layout */
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+    mainLayout->addWidget(summaryLabel);
+    mainLayout->addWidget(phaseTable);
+    mainLayout->addWidget(areaTable, 1);
+    mainLayout->addWidget(csvBox);
+    setLayout(mainLayout);
+
+    qRegisterMetaType<SaveStateMetrics>("SaveStateMetrics");
+
+    /* We need connections to the game loop, so we access it through our parent */
+    MainWindow *mw = qobject_cast<MainWindow*>(parent);
+    if (mw) {
+        connect(mw->gameLoop->gameEvents, &GameEvents::savestateMetricsChanged, this, &SaveStateMetricsWindow::update);
+    }
+}
+
+std::string SaveStateMetricsWindow::csvPath() const
+{
+    return context->config.datadir + "/savestate_metrics.csv";
+}
+
+void SaveStateMetricsWindow::update(SaveStateMetrics metrics)
+{
+    if (csvBox->isChecked())
+        appendCsv(metrics);
+
+    uint64_t page_count = 0;
+    for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++)
+        page_count += metrics.pages[t];
+
+    QString summary = QString(metrics.loading ? tr("Loaded state %1") : tr("Saved state %1")).arg(metrics.slot);
+    if (metrics.size > 0)
+        summary += QString(tr(" of %1 MB")).arg(metrics.size / (1024.0*1024.0), 0, 'f', 1);
+    summary += QString(tr(" in %1 ms, %2 pages:")).arg(metrics.phase_ns[SaveStateMetrics::PHASE_TOTAL] / 1000000.0, 0, 'f', 1).arg(page_count);
+    for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++)
+        summary += QString(" %1 %2").arg(metrics.pages[t]).arg(QString(page_names[t]).toLower());
+    summaryLabel->setText(summary);
+
+    for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+        phaseTable->item(p, 0)->setText(QString::number(metrics.phase_ns[p] / 1000000.0, 'f', 2));
+
+    areaTable->setSortingEnabled(false);
+    areaTable->setRowCount(metrics.area_count);
+    for (int a = 0; a < metrics.area_count; a++) {
+        const SaveStateMetrics::AreaMetrics& area = metrics.areas[a];
+        areaTable->setItem(a, 0, new QTableWidgetItem(QString("%1").arg(area.addr, 0, 16)));
+
+        QTableWidgetItem *sizeItem = new QTableWidgetItem();
+        sizeItem->setData(Qt::DisplayRole, static_cast<qulonglong>(area.size));
+        areaTable->setItem(a, 1, sizeItem);
+
+        areaTable->setItem(a, 2, new QTableWidgetItem(area.name));
+
+        for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++) {
+            QTableWidgetItem *item = new QTableWidgetItem();
+            item->setData(Qt::DisplayRole, area.pages[t]);
+            areaTable->setItem(a, 3 + t, item);
+        }
+    }
+    areaTable->setSortingEnabled(true);
+}
+
+void SaveStateMetricsWindow::appendCsv(const SaveStateMetrics& metrics)
+{
+    std::string path = csvPath();
+    bool new_file = access(path.c_str(), F_OK) != 0;
+
+    std::ofstream ofs(path, std::ios::app);
+    if (!ofs)
+        return;
+
+    if (new_file) {
+        ofs << "time,operation,slot,size";
+        for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+            ofs << "," << phase_names[p] << " (ns)";
+        for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++)
+            ofs << "," << page_names[t] << " pages";
+        ofs << std::endl;
+    }
+
+    ofs << time(nullptr) << "," << (metrics.loading ? "load" : "save") << "," << metrics.slot << "," << metrics.size;
+    for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+        ofs << "," << metrics.phase_ns[p];
+    for (int t = 0; t < SaveStateMetrics::PAGE_TYPE_COUNT; t++)
+        ofs << "," << metrics.pages[t];
+    ofs << std::endl;
+}
+
+QSize SaveStateMetricsWindow::sizeHint() const
+{
+    return QSize(800, 700);
+}
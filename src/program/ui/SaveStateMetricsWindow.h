@@ -0,0 +1,61 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEMETRICSWINDOW_H_INCLUDED
+#define LIBTAS_SAVESTATEMETRICSWINDOW_H_INCLUDED
+
+#include "../shared/SaveStateMetrics.h"
+
+#include <QtWidgets/QDialog>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QTableWidget>
+#include <QtWidgets/QCheckBox>
+#include <string>
+
+/* Forward declaration */
+struct Context;
+
+class SaveStateMetricsWindow : public QDialog {
+    Q_OBJECT
+public:
+    SaveStateMetricsWindow(Context *c, QWidget *parent = Q_NULLPTR);
+
+    QSize sizeHint() const override;
+
+private:
+    Context *context;
+
+    QLabel *summaryLabel;
+    QTableWidget *phaseTable;
+    QTableWidget *areaTable;
+    QCheckBox *csvBox;
+
+    /* Path of the CSV log */
+    std::string csvPath() const;
+
+    /* Append a line to the CSV log */
+    void appendCsv(const SaveStateMetrics& metrics);
+
+public slots:
+    /* Update UI elements */
+    void update(SaveStateMetrics metrics);
+
+};
+
+#endif
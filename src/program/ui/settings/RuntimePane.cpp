@@ -17,6 +17,7 @@
     along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
 #include "RuntimePane.h"
 #include "tooltip/ToolTipComboBox.h"
 #include "tooltip/ToolTipCheckBox.h"
@@ -31,6 +32,11 @@
 #include <QtWidgets/QFormLayout>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QCheckBox>
+#include <QtWidgets/QSpinBox>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QHBoxLayout>
+#include <QtCore/QRegularExpression>
+#include <QtGui/QRegularExpressionValidator>
 
 RuntimePane::RuntimePane(Context* c) : context(c)
 {
@@ -67,29 +73,86 @@ void RuntimePane::initLayout()
     writingBox = new ToolTipCheckBox(tr("Prevent writing to disk"));
     steamBox = new ToolTipCheckBox(tr("Virtual Steam client"));
     downloadsBox = new ToolTipCheckBox(tr("Allow downloading missing libraries"));
+    sharedMemoryBox = new ToolTipCheckBox(tr("Communicate through shared memory"));
 
     generalLayout->addLayout(localeLayout);
     generalLayout->addWidget(writingBox);
     generalLayout->addWidget(steamBox);
     generalLayout->addWidget(downloadsBox);
+    generalLayout->addWidget(sharedMemoryBox);
     
     savestateBox = new QGroupBox(tr("Savestates"));
     QGridLayout* savestateLayout = new QGridLayout;
     savestateBox->setLayout(savestateLayout);
 
     stateIncrementalBox = new ToolTipCheckBox(tr("Incremental savestates"));
-    if (!context->is_soft_dirty) {
+    if (!context->is_soft_dirty && (context->config.sc.savestate_dirty_tracking == SharedConfig::DIRTY_SOFT)) {
         stateIncrementalBox->setEnabled(false);
         context->config.sc.savestate_settings &= ~SharedConfig::SS_INCREMENTAL;
     }
     stateCompressedBox = new ToolTipCheckBox(tr("Compressed savestates"));
     stateUnmappedBox = new ToolTipCheckBox(tr("Skip unmapped pages"));
     stateForkBox = new ToolTipCheckBox(tr("Fork to save states"));
+    stateRamBox = new ToolTipCheckBox(tr("Store savestates in RAM"));
+    stateRamSpillBox = new ToolTipCheckBox(tr("Move evicted states to disk"));
+    stateDedupBox = new ToolTipCheckBox(tr("Deduplicate pages across states"));
+    stateLazyBox = new ToolTipCheckBox(tr("Load savestates lazily"));
+
+    stateRamSize = new QSpinBox();
+    stateRamSize->setRange(64, 1024*1024);
+    stateRamSize->setSingleStep(256);
+    stateRamSize->setSuffix(tr(" MB"));
+
+    QFormLayout* stateRamLayout = new QFormLayout;
+    stateRamLayout->setFormAlignment(Qt::AlignLeft | Qt::AlignTop);
+    stateRamLayout->setFieldGrowthPolicy(QFormLayout::AllNonFixedFieldsGrow);
+    stateRamLayout->addRow(new QLabel(tr("Savestates RAM budget:")), stateRamSize);
+
+    stateCodecChoice = new ToolTipComboBox();
+    stateAltCodecChoice = new ToolTipComboBox();
+    for (ToolTipComboBox* choice : {stateCodecChoice, stateAltCodecChoice}) {
+        choice->addItem(tr("LZ4"), SharedConfig::SS_CODEC_LZ4);
+#ifdef LIBTAS_HAS_ZSTD
+        choice->addItem(tr("Zstandard"), SharedConfig::SS_CODEC_ZSTD);
+#endif
+    }
+
+    stateCodecLevel = new QSpinBox();
+    stateAltCodecLevel = new QSpinBox();
+    for (QSpinBox* level : {stateCodecLevel, stateAltCodecLevel}) {
+        level->setRange(1, 22);
+        level->setPrefix(tr("Level "));
+    }
+
+    QHBoxLayout* stateCodecLayout = new QHBoxLayout;
+    stateCodecLayout->addWidget(stateCodecChoice);
+    stateCodecLayout->addWidget(stateCodecLevel);
+    stateRamLayout->addRow(new QLabel(tr("Compression codec:")), stateCodecLayout);
+
+    QHBoxLayout* stateAltCodecLayout = new QHBoxLayout;
+    stateAltCodecLayout->addWidget(stateAltCodecChoice);
+    stateAltCodecLayout->addWidget(stateAltCodecLevel);
+    stateRamLayout->addRow(new QLabel(tr("Alternative codec:")), stateAltCodecLayout);
+
+    stateDirtyChoice = new ToolTipComboBox();
+    stateDirtyChoice->addItem(tr("Soft-dirty bit"), SharedConfig::DIRTY_SOFT);
+    stateDirtyChoice->addItem(tr("Userfaultfd write-protect"), SharedConfig::DIRTY_UFFD_WP);
+    stateRamLayout->addRow(new QLabel(tr("Memory write tracking:")), stateDirtyChoice);
+
+    stateAltCodecSlots = new QLineEdit();
+    stateAltCodecSlots->setPlaceholderText(tr("e.g. 8,9,10"));
+    stateAltCodecSlots->setValidator(new QRegularExpressionValidator(QRegularExpression("^[0-9, ]*$"), this));
+    stateRamLayout->addRow(new QLabel(tr("Slots using alternative codec:")), stateAltCodecSlots);
 
     savestateLayout->addWidget(stateIncrementalBox, 0, 0);
     savestateLayout->addWidget(stateCompressedBox, 0, 1);
     savestateLayout->addWidget(stateUnmappedBox, 1, 0);
     savestateLayout->addWidget(stateForkBox, 1, 1);
+    savestateLayout->addWidget(stateRamBox, 2, 0);
+    savestateLayout->addWidget(stateRamSpillBox, 2, 1);
+    savestateLayout->addWidget(stateDedupBox, 3, 0);
+    savestateLayout->addWidget(stateLazyBox, 3, 1);
+    savestateLayout->addLayout(stateRamLayout, 4, 0, 1, 2);
 
     timingBox = new QGroupBox(tr("Timing"));
     QVBoxLayout* timingMainLayout = new QVBoxLayout;
@@ -178,11 +241,23 @@ void RuntimePane::initSignals()
     connect(writingBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(steamBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(downloadsBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(sharedMemoryBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
 
     connect(stateIncrementalBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(stateCompressedBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(stateUnmappedBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(stateForkBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateRamBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateRamSpillBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateDedupBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateLazyBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateRamSize, QOverload<int>::of(&QSpinBox::valueChanged), this, &RuntimePane::saveConfig);
+    connect(stateCodecChoice, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated), this, &RuntimePane::saveConfig);
+    connect(stateCodecLevel, QOverload<int>::of(&QSpinBox::valueChanged), this, &RuntimePane::saveConfig);
+    connect(stateAltCodecChoice, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated), this, &RuntimePane::saveConfig);
+    connect(stateAltCodecLevel, QOverload<int>::of(&QSpinBox::valueChanged), this, &RuntimePane::saveConfig);
+    connect(stateAltCodecSlots, &QLineEdit::editingFinished, this, &RuntimePane::saveConfig);
+    connect(stateDirtyChoice, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated), this, &RuntimePane::saveConfig);
 
     connect(trackingTimeBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(trackingGettimeofdayBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
@@ -224,6 +299,11 @@ void RuntimePane::initToolTips()
     "will detect the missing libraries, download the registered ones and load "
     "them when running the game");
 
+    sharedMemoryBox->setDescription("Exchange data between libTAS and the game "
+    "through ring buffers in shared memory instead of the socket, which saves "
+    "many system calls each frame and speeds up fast-forward. Applied at the "
+    "next game launch.");
+
     stateIncrementalBox->setDescription("Optimize savestate size by only storing "
     "the memory pages that have been modified, at the cost of slightly more processing. "
     "This requires running on a native Linux installation (won't work on WSL2).<br><br>"
@@ -247,6 +327,53 @@ void RuntimePane::initToolTips()
     "Linux copy-on-write magic. Useful for games that take a long time to save."
     "<br><br><em>If unsure, leave this unchecked</em>");
 
+    stateRamBox->setDescription("Store savestates inside the game memory instead "
+    "of savestate files, which avoids the file system when saving and loading states. "
+    "Memory is allocated for each state when saving, up to the RAM budget below. "
+    "This is not compatible with forked savestates."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateRamSpillBox->setDescription("When the savestates stored in RAM exceed "
+    "the RAM budget, the least recently used states are removed from memory. "
+    "If checked, they are written to the savestate files instead of being lost."
+    "<br><br><em>If unsure, leave this checked</em>");
+
+    stateDedupBox->setDescription("Store each distinct memory page only once "
+    "for all savestate files, inside a shared page store next to the savestates. "
+    "This saves a lot of disk space for games with large memory that rarely "
+    "changes between states. The setting is read when the game starts, and "
+    "is not compatible with forked savestates."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateLazyBox->setDescription("When loading a state, only load memory pages "
+    "when the game accesses them, and load the other pages in the background. "
+    "This makes loading states much faster when seeking. "
+    "It requires userfaultfd, which may need to be allowed with "
+    "<code>sysctl vm.unprivileged_userfaultfd=1</code>, otherwise states are "
+    "loaded normally. The setting is read when the game starts."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateCodecChoice->setTitle("Compression codec");
+    stateCodecChoice->setDescription("Codec used for compressed savestates. "
+    "LZ4 is very fast, and the level is its acceleration factor, so higher "
+    "levels are faster but make bigger states. Zstandard (if libTAS was built "
+    "with it, and only for 64-bit games) makes smaller states but is slower, "
+    "and higher levels make smaller states. Other games use LZ4 instead."
+    "<br><br><em>If unsure, use LZ4 with level 1</em>");
+
+    stateAltCodecChoice->setTitle("Alternative codec");
+    stateAltCodecChoice->setDescription("Codec used instead of the one above "
+    "for the slots listed below, for example to make smaller states for the "
+    "slots that are kept on disk for a long time."
+    "<br><br><em>If unsure, leave the slot list empty</em>");
+
+    stateDirtyChoice->setDescription("Method used by incremental savestates "
+    "to know which memory pages were written since the last savestate. "
+    "Userfaultfd write-protect does not need the soft-dirty bit, and is not "
+    "affected by other programs clearing it, but requires Linux 6.7 or later. "
+    "Lazy loading is not available with this method."
+    "<br><br><em>If unsure, leave this to Soft-dirty bit</em>");
+
     trackingBox->setDescription("By checking a specific function, time will advance "
     "a bit when too many calls of that function have been made from the main thread. "
     "This prevents softlocks when a game wait in a loop for time to advance.<br><br>"
@@ -341,11 +468,57 @@ void RuntimePane::loadConfig()
     writingBox->setChecked(context->config.sc.prevent_savefiles);
     steamBox->setChecked(context->config.sc.virtual_steam);
     downloadsBox->setChecked(context->config.allow_downloads);
+    sharedMemoryBox->setChecked(context->config.shared_memory_socket);
 
     stateIncrementalBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_INCREMENTAL);
     stateCompressedBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_COMPRESSED);
     stateUnmappedBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_PRESENT);
     stateForkBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_FORK);
+    stateRamBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_RAM);
+    stateRamSpillBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_RAM_SPILL);
+    stateDedupBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_DEDUP);
+    stateLazyBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_LAZY);
+    stateForkBox->setEnabled(!stateRamBox->isChecked() && !stateDedupBox->isChecked());
+
+    /* We don't want to trigger the signals */
+    stateRamSize->blockSignals(true);
+    stateRamSize->setValue(context->config.sc.savestate_ram_size);
+    stateRamSize->blockSignals(false);
+
+    index = stateCodecChoice->findData(context->config.sc.savestate_codec);
+    if (index >= 0)
+        stateCodecChoice->setCurrentIndex(index);
+
+    index = stateAltCodecChoice->findData(context->config.sc.savestate_alt_codec);
+    if (index >= 0)
+        stateAltCodecChoice->setCurrentIndex(index);
+
+    stateCodecLevel->blockSignals(true);
+    stateCodecLevel->setValue(context->config.sc.savestate_codec_level);
+    stateCodecLevel->blockSignals(false);
+
+    stateAltCodecLevel->blockSignals(true);
+    stateAltCodecLevel->setValue(context->config.sc.savestate_alt_codec_level);
+    stateAltCodecLevel->blockSignals(false);
+
+    QStringList slotList;
+    for (int slot = 0; slot <= 10; slot++) {
+        if (context->config.sc.savestate_alt_codec_slots & (1 << slot))
+            slotList << QString::number(slot);
+    }
+    stateAltCodecSlots->setText(slotList.join(","));
+
+    index = stateDirtyChoice->findData(context->config.sc.savestate_dirty_tracking);
+    if (index >= 0)
+        stateDirtyChoice->setCurrentIndex(index);
+
+    stateIncrementalBox->setEnabled(context->is_soft_dirty || (context->config.sc.savestate_dirty_tracking != SharedConfig::DIRTY_SOFT));
+
+    stateCodecChoice->setEnabled(stateCompressedBox->isChecked());
+    stateCodecLevel->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecChoice->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecLevel->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecSlots->setEnabled(stateCompressedBox->isChecked());
 
     trackingTimeBox->setChecked(context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_TIME] != -1);
     trackingGettimeofdayBox->setChecked(context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_GETTIMEOFDAY] != -1);
@@ -382,12 +555,47 @@ void RuntimePane::saveConfig()
     context->config.sc.prevent_savefiles = writingBox->isChecked();
     context->config.sc.virtual_steam = steamBox->isChecked();
     context->config.allow_downloads = downloadsBox->isChecked();
+    context->config.shared_memory_socket = sharedMemoryBox->isChecked();
 
     context->config.sc.savestate_settings = 0;
     context->config.sc.savestate_settings |= stateIncrementalBox->isChecked() ? SharedConfig::SS_INCREMENTAL : 0;
     context->config.sc.savestate_settings |= stateCompressedBox->isChecked() ? SharedConfig::SS_COMPRESSED : 0;
     context->config.sc.savestate_settings |= stateUnmappedBox->isChecked() ? SharedConfig::SS_PRESENT : 0;
-    context->config.sc.savestate_settings |= stateForkBox->isChecked() ? SharedConfig::SS_FORK : 0;
+    context->config.sc.savestate_settings |= stateRamBox->isChecked() ? SharedConfig::SS_RAM : 0;
+    context->config.sc.savestate_settings |= stateRamSpillBox->isChecked() ? SharedConfig::SS_RAM_SPILL : 0;
+    context->config.sc.savestate_settings |= stateDedupBox->isChecked() ? SharedConfig::SS_DEDUP : 0;
+    context->config.sc.savestate_settings |= stateLazyBox->isChecked() ? SharedConfig::SS_LAZY : 0;
+    /* States stored in RAM would be lost inside the forked process, and the
+     * page store index cannot be updated from it */
+    if (!stateRamBox->isChecked() && !stateDedupBox->isChecked())
+        context->config.sc.savestate_settings |= stateForkBox->isChecked() ? SharedConfig::SS_FORK : 0;
+    stateForkBox->setEnabled(!stateRamBox->isChecked() && !stateDedupBox->isChecked());
+    context->config.sc.savestate_ram_size = stateRamSize->value();
+
+    context->config.sc.savestate_codec = stateCodecChoice->currentData().toInt();
+    context->config.sc.savestate_codec_level = stateCodecLevel->value();
+    context->config.sc.savestate_alt_codec = stateAltCodecChoice->currentData().toInt();
+    context->config.sc.savestate_alt_codec_level = stateAltCodecLevel->value();
+
+    context->config.sc.savestate_alt_codec_slots = 0;
+    for (const QString& slotStr : stateAltCodecSlots->text().split(QRegularExpression("[, ]"))) {
+        bool ok;
+        int slot = slotStr.toInt(&ok);
+        if (ok && (slot >= 0) && (slot <= 10))
+            context->config.sc.savestate_alt_codec_slots |= (1 << slot);
+    }
+
+    /* Incremental savestates need a way to track memory writes */
+    context->config.sc.savestate_dirty_tracking = stateDirtyChoice->currentData().toInt();
+    stateIncrementalBox->setEnabled(context->is_soft_dirty || (context->config.sc.savestate_dirty_tracking != SharedConfig::DIRTY_SOFT));
+    if (!stateIncrementalBox->isEnabled())
+        context->config.sc.savestate_settings &= ~SharedConfig::SS_INCREMENTAL;
+
+    stateCodecChoice->setEnabled(stateCompressedBox->isChecked());
+    stateCodecLevel->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecChoice->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecLevel->setEnabled(stateCompressedBox->isChecked());
+    stateAltCodecSlots->setEnabled(stateCompressedBox->isChecked());
 
     context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_TIME] = trackingTimeBox->isChecked() ? 100 : -1;
     context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_GETTIMEOFDAY] = trackingGettimeofdayBox->isChecked() ? 100 : -1;
@@ -419,9 +627,16 @@ void RuntimePane::update(int status)
     switch (status) {
     case Context::INACTIVE:
         timingBox->setEnabled(true);
+        stateRamSize->setEnabled(true);
+        stateDedupBox->setEnabled(true);
+        stateLazyBox->setEnabled(true);
         break;
     case Context::STARTING:
         timingBox->setEnabled(false);
+        /* The memory for savestates is reserved at game startup */
+        stateRamSize->setEnabled(false);
+        stateDedupBox->setEnabled(false);
+        stateLazyBox->setEnabled(false);
         break;
     }
 }
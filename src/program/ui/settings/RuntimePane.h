@@ -25,6 +25,8 @@
 class Context;
 class QComboBox;
 class QCheckBox;
+class QSpinBox;
+class QLineEdit;
 class ToolTipComboBox;
 class ToolTipCheckBox;
 class ToolTipGroupBox;
@@ -55,11 +57,23 @@ private:
     ToolTipCheckBox* writingBox;
     ToolTipCheckBox* steamBox;
     ToolTipCheckBox* downloadsBox;
+    ToolTipCheckBox* sharedMemoryBox;
 
     ToolTipCheckBox* stateIncrementalBox;
     ToolTipCheckBox* stateCompressedBox;
     ToolTipCheckBox* stateUnmappedBox;
     ToolTipCheckBox* stateForkBox;
+    ToolTipCheckBox* stateRamBox;
+    ToolTipCheckBox* stateDedupBox;
+    ToolTipCheckBox* stateLazyBox;
+    ToolTipComboBox* stateDirtyChoice;
+    ToolTipCheckBox* stateRamSpillBox;
+    QSpinBox* stateRamSize;
+    ToolTipComboBox* stateCodecChoice;
+    QSpinBox* stateCodecLevel;
+    ToolTipComboBox* stateAltCodecChoice;
+    QSpinBox* stateAltCodecLevel;
+    QLineEdit* stateAltCodecSlots;
 
     ToolTipGroupBox* trackingBox;
 
@@ -136,6 +136,8 @@ void remove_savestates(Context* context)
         std::string savestatepspath = savestateprefix + ".state" + std::to_string(i) + ".p";
         unlink(savestatepspath.c_str());
     }
+    std::string pagestorepath = savestateprefix + ".pagestore";
+    unlink(pagestorepath.c_str());
 }
 
 int extractBinaryType(std::string path)
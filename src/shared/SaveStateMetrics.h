@@ -0,0 +1,96 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEMETRICS_H_INCLUDED
+#define LIBTAS_SAVESTATEMETRICS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h> // offsetof
+
+/*
+ * Timings and page counts of the last savestate saving or loading, which are
+ * sent to the program to be displayed in the UI. The struct is sent as is by
+ * 32-bit and 64-bit games, so it only has fixed-size fields with explicit
+ * padding, to have the same layout in both ABIs.
+ */
+struct SaveStateMetrics {
+
+    enum Phase {
+        PHASE_SUSPEND, // Suspending game threads
+        PHASE_MAPS, // Parsing the memory mapping
+        PHASE_PAGEMAP, // Reading /proc/self/pagemap
+        PHASE_COMPRESS, // Compressing pages, including waiting for workers
+        PHASE_DECOMPRESS, // Decompressing pages, including waiting for workers
+        PHASE_IO, // Writing or reading the savestate streams
+        PHASE_SAVEFILES, // Saving or restoring savefiles
+        PHASE_REMAP, // mmap, munmap and mprotect of memory areas
+        PHASE_RESUME, // Resuming game threads
+        PHASE_TOTAL, // Whole operation
+        PHASE_COUNT
+    };
+
+    enum PageType {
+        PAGE_FULL,
+        PAGE_COMPRESSED,
+        PAGE_STORED,
+        PAGE_ZERO,
+        PAGE_FILE,
+        PAGE_BASE,
+        PAGE_NONE, // Unmapped or guard page
+        PAGE_TYPE_COUNT
+    };
+
+    enum {
+        AREA_COUNT = 256,
+        AREA_NAME_SIZE = 64,
+    };
+
+    struct AreaMetrics {
+        uint64_t addr;
+        uint64_t size;
+        char name[AREA_NAME_SIZE];
+        uint32_t pages[PAGE_TYPE_COUNT];
+        uint32_t padding;
+    };
+
+    int32_t slot;
+    int32_t loading;
+
+    /* Size of the savestate in bytes, or 0 if unknown */
+    uint64_t size;
+
+    /* Duration of each phase in nanoseconds */
+    uint64_t phase_ns[PHASE_COUNT];
+
+    /* Page count of each type for the whole savestate */
+    uint64_t pages[PAGE_TYPE_COUNT];
+
+    /* Page counts of each area. Only the first AREA_COUNT areas that contain
+     * pages are recorded. Only the first `area_count` elements are sent. */
+    int32_t area_count;
+    int32_t padding;
+    AreaMetrics areas[AREA_COUNT];
+};
+
+static_assert(sizeof(SaveStateMetrics::AreaMetrics) == 112, "AreaMetrics layout differs between ABIs");
+static_assert(offsetof(SaveStateMetrics, size) == 8, "SaveStateMetrics layout differs between ABIs");
+static_assert(offsetof(SaveStateMetrics, area_count) == 152, "SaveStateMetrics layout differs between ABIs");
+static_assert(offsetof(SaveStateMetrics, areas) == 160, "SaveStateMetrics layout differs between ABIs");
+
+#endif
@@ -115,6 +115,18 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
     int audio_codec = ACODEC_AAC;
     int audio_bitrate = 128;
 
+    /* What to do when the queue of frames waiting to be sent to ffmpeg
+     * is full */
+    enum EncodeQueuePolicy {
+        ENCODE_QUEUE_BLOCK, /* Wait for the encoder thread to send a frame */
+        ENCODE_QUEUE_GROW, /* Allocate more frames, using more memory */
+    };
+
+    /* Maximum number of frames waiting to be sent to ffmpeg by the encoder
+     * thread, or 0 to send frames from the game thread */
+    int encode_queue_size = 8;
+    int encode_queue_policy = ENCODE_QUEUE_BLOCK;
+
     /* An enum indicating which time-getting function query the time */
     enum TimeCallType
     {
@@ -252,11 +264,44 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
         SS_COMPRESSED = 0x08, /* Compress savestates */
         SS_PRESENT = 0x10, /* Skip unmapped pages */
         SS_FORK = 0x20, /* Use a forked process to save the state */
+        SS_DEDUP = 0x40, /* Store identical pages once for all savestates */
+        SS_LAZY = 0x80, /* Load savestate pages when they are first accessed */
+        SS_RAM = 0x100, /* Store savestates in RAM */
+        SS_RAM_SPILL = 0x200, /* Move evicted RAM savestates to disk instead of dropping them */
     };
 
     /* Savestate settings */
     int savestate_settings = SS_COMPRESSED;
 
+    /* Maximum size in MB of all savestates stored in RAM */
+    int savestate_ram_size = 4096;
+
+    /* Codec used to compress savestates */
+    enum SaveStateCodec
+    {
+        SS_CODEC_LZ4 = 0, /* LZ4, with level being the acceleration factor */
+        SS_CODEC_ZSTD = 1, /* Zstandard, if libTAS was built with it */
+    };
+
+    /* Compression codec and level of savestates */
+    int savestate_codec = SS_CODEC_LZ4;
+    int savestate_codec_level = 1;
+
+    /* Bitmask of savestate slots that use the alternative codec and level
+     * below, for example to make smaller states that are kept for a long time */
+    int savestate_alt_codec_slots = 0;
+    int savestate_alt_codec = SS_CODEC_ZSTD;
+    int savestate_alt_codec_level = 9;
+
+    /* Method used by incremental savestates to track written memory pages */
+    enum DirtyTracking
+    {
+        DIRTY_SOFT = 0, /* Soft-dirty bit of /proc/self/pagemap */
+        DIRTY_UFFD_WP = 1, /* Userfaultfd write-protect and PAGEMAP_SCAN */
+    };
+
+    int savestate_dirty_tracking = DIRTY_SOFT;
+
     /* Stacktrace hash to advance time */
     uint64_t busy_loop_hash = 0;
 
@@ -284,6 +329,15 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
     /* Display OSD in the video encode */
     bool osd_encode = false;
 
+    /* Don't send identical video frames to ffmpeg, and encode with a
+     * variable framerate instead */
+    bool encode_skip_duplicates = false;
+
+    /* Write png and qoi screenshots from a separate thread, so the game does
+     * not wait for the image to be encoded. The file may then not be complete
+     * yet when the screenshot returns. */
+    bool screenshot_async = false;
+
     /* Use a backup of savefiles in memory, which leaves the original
      * savefiles unmodified and save the content in savestates */
     bool prevent_savefiles = true;
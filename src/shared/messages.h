@@ -181,13 +181,13 @@ enum {
 
     /*
      * Tells the program that the saving succeeded
-     * Argument: none
+     * Argument: SaveStateMetrics up to `areas`, then `area_count` AreaMetrics
      */
     MSGB_SAVING_SUCCEEDED,
 
     /*
      * Tells the program that the loading succeeded
-     * Argument: none
+     * Argument: SaveStateMetrics up to `areas`, then `area_count` AreaMetrics
      */
     MSGB_LOADING_SUCCEEDED,
 
@@ -387,6 +387,12 @@ enum {
      * Arguments: int, uint64_t addr
      */
     MSGN_UNITY_ADDR,
+
+    /* Send the size of the last savestate, before the saving status.
+     * Arguments: int slot, uint64_t estimated size, uint64_t actual size
+     *            (0 if unknown), uint64_t available space (0 if unknown)
+     */
+    MSGB_SAVESTATE_SIZE,
 };
 
 #endif
@@ -18,6 +18,7 @@
  */
 
 #include "sockethelpers.h"
+#include "messages.h"
 
 #ifdef LIBTAS_LIBRARY
 #include "lcf.h"
@@ -36,11 +37,24 @@
 #include <iostream>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <cstring>
+#include <climits>
 #include <errno.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <poll.h>
+#endif
 
 
 #define SOCKET_FILENAME "/tmp/libTAS.socket"
 
+/* Version of the protocol, exchanged when connecting. Must be increased when
+ * the connection sequence or the way data is exchanged changes. */
+#define SOCKET_PROTOCOL_VERSION 2
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
@@ -54,6 +68,82 @@ static int socket_fd = 0;
 
 static std::mutex mutex;
 
+/* Transport used after the connection, sent by the program as the first data */
+enum {
+    TRANSPORT_SOCKET = 0,
+    TRANSPORT_SHARED_MEMORY = 1,
+};
+
+/* Size in bytes of the buffer of each ring, must be a power of two */
+#define RING_SIZE (1 << 20)
+
+/* Number of times a ring is checked before sleeping on the futex */
+#define RING_SPIN_COUNT 1024
+
+/* Single-producer single-consumer ring buffer, stored in memory shared by
+ * the program and the game. Positions are the total number of bytes written
+ * and read, and sequence numbers are used as futex words to sleep on. */
+struct SocketRing {
+    alignas(64) std::atomic<uint64_t> write_pos;
+    std::atomic<uint32_t> write_seq;
+    std::atomic<uint32_t> reader_waiting;
+
+    alignas(64) std::atomic<uint64_t> read_pos;
+    std::atomic<uint32_t> read_seq;
+    std::atomic<uint32_t> writer_waiting;
+
+    alignas(64) std::atomic<uint32_t> closed;
+
+    alignas(64) char data[RING_SIZE];
+};
+
+/* Shared memory holding one ring for each direction, the first one being
+ * from the program to the game */
+static SocketRing* rings = nullptr;
+static SocketRing* send_ring = nullptr;
+static SocketRing* recv_ring = nullptr;
+
+/* Size in bytes of the buffers used to batch socket data */
+#define BUFFER_SIZE (64 * 1024)
+
+/* Data sent is stored until a flush point, and data is received in chunks as
+ * large as possible, so that each frame only needs a few system calls. This
+ * is stored in its own memory segment, which is not saved in savestates, so
+ * that it always matches the state of the connection. */
+struct SocketBuffers {
+    unsigned int write_len;
+    bool write_error;
+    unsigned int read_pos;
+    unsigned int read_len;
+    char write_buf[BUFFER_SIZE];
+    char read_buf[BUFFER_SIZE];
+};
+
+static SocketBuffers* buffers = nullptr;
+static std::mutex buffer_mutex;
+
+/* Size of the buffers segment, rounded to pages */
+static const size_t buffers_size = (sizeof(SocketBuffers) + 4095) & ~static_cast<size_t>(4095);
+
+static void allocateBuffers()
+{
+    /* Add a guard page at each end, so that the segment is never merged
+     * with a neighbour mapping */
+    void* addr = mmap(nullptr, buffers_size + (2 * 4096), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((addr == MAP_FAILED) ||
+        (mprotect(static_cast<char*>(addr) + 4096, buffers_size, PROT_READ | PROT_WRITE) != 0)) {
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_WARN, LCF_SOCKET, "Couldn't allocate socket buffers, sending data unbuffered");
+#else
+        std::cerr << "Couldn't allocate socket buffers, sending data unbuffered" << std::endl;
+#endif
+        if (addr != MAP_FAILED)
+            munmap(addr, buffers_size + (2 * 4096));
+        return;
+    }
+    buffers = reinterpret_cast<SocketBuffers*>(static_cast<char*>(addr) + 4096);
+}
+
 int removeSocket(void) {
     int ret = unlink(SOCKET_FILENAME);
     if ((ret == -1) && (errno != ENOENT))
@@ -62,7 +152,67 @@ int removeSocket(void) {
 }
 
 #ifndef LIBTAS_LIBRARY
-bool initSocketProgram(pid_t fork_pid)
+#ifdef __linux__
+/* Create the shared memory of rings and send it to the game. Returns if the
+ * game accepted it. */
+static bool initSharedMemoryProgram()
+{
+    int transport = TRANSPORT_SHARED_MEMORY;
+    send(socket_fd, &transport, sizeof(int), MSG_NOSIGNAL);
+
+    int fd = memfd_create("libTAS_socket", MFD_CLOEXEC);
+    if ((fd < 0) || (ftruncate(fd, 2 * sizeof(SocketRing)) < 0)) {
+        std::cerr << "Could not create shared memory for the socket: " << strerror(errno) << std::endl;
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    void* addr = MAP_FAILED;
+    if (fd >= 0) {
+        addr = mmap(nullptr, 2 * sizeof(SocketRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    /* Send the file descriptor, or nothing if it failed */
+    char payload = (addr != MAP_FAILED) ? 1 : 0;
+    struct iovec iov = { &payload, 1 };
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (payload) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+    if (fd >= 0)
+        close(fd);
+
+    if (!payload)
+        return false;
+
+    /* Wait for the game to acknowledge */
+    int ack = 0;
+    recv(socket_fd, &ack, sizeof(int), MSG_WAITALL);
+    if (!ack) {
+        std::cerr << "Game could not map the shared memory of the socket" << std::endl;
+        munmap(addr, 2 * sizeof(SocketRing));
+        return false;
+    }
+
+    rings = static_cast<SocketRing*>(addr);
+    send_ring = &rings[0];
+    recv_ring = &rings[1];
+    return true;
+}
+#endif
+
+bool initSocketProgram(pid_t fork_pid, bool shared_memory)
 {
 #ifdef __unix__
     const struct sockaddr_un addr = { AF_UNIX, SOCKET_FILENAME };
@@ -102,11 +252,78 @@ bool initSocketProgram(pid_t fork_pid)
     }
     std::cout << "Attempt " << retry + 1 << ": Connected." << std::endl;
 
+    /* Check that the game uses the same protocol */
+    int version = SOCKET_PROTOCOL_VERSION;
+    send(socket_fd, &version, sizeof(int), MSG_NOSIGNAL);
+    int game_version = 0;
+    recv(socket_fd, &game_version, sizeof(int), MSG_WAITALL);
+    if (game_version != version) {
+        std::cerr << "Socket protocol version of the game (" << game_version << ") does not match the program (" << version << ")" << std::endl;
+        close(socket_fd);
+        return false;
+    }
+
+    allocateBuffers();
+
+    /* Tell the game which transport is used */
+#ifdef __linux__
+    if (shared_memory) {
+        if (initSharedMemoryProgram())
+            std::cout << "Using shared memory transport" << std::endl;
+        return true;
+    }
+#endif
+    int transport = TRANSPORT_SOCKET;
+    send(socket_fd, &transport, sizeof(int), MSG_NOSIGNAL);
+
     return true;
 }
 
 #else
 
+#ifdef __linux__
+/* Receive and map the shared memory of rings from the program, and
+ * acknowledge it. */
+static void initSharedMemoryGame()
+{
+    char payload = 0;
+    struct iovec iov = { &payload, 1 };
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if ((recvmsg(socket_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != 1) || !payload)
+        return;
+
+    int fd = -1;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    void* addr = MAP_FAILED;
+    if (fd >= 0) {
+        addr = mmap(nullptr, 2 * sizeof(SocketRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+
+    int ack = (addr != MAP_FAILED);
+    send(socket_fd, &ack, sizeof(int), MSG_NOSIGNAL);
+
+    if (!ack) {
+        LOG(LL_ERROR, LCF_SOCKET, "Couldn't map the shared memory of the socket %s", strerror(errno));
+        return;
+    }
+
+    rings = static_cast<SocketRing*>(addr);
+    send_ring = &rings[1];
+    recv_ring = &rings[0];
+    LOG(LL_DEBUG, LCF_SOCKET, "Using shared memory transport");
+}
+#endif
+
 bool initSocketGame(void)
 {
     GlobalNative gn;
@@ -155,6 +372,27 @@ bool initSocketGame(void)
 #endif
     
     close(tmp_fd);
+
+    /* Check that the program uses the same protocol */
+    int program_version = 0;
+    recv(socket_fd, &program_version, sizeof(int), MSG_WAITALL);
+    int version = SOCKET_PROTOCOL_VERSION;
+    send(socket_fd, &version, sizeof(int), MSG_NOSIGNAL);
+    if (program_version != version) {
+        LOG(LL_ERROR, LCF_SOCKET, "Socket protocol version of the program (%d) does not match the game (%d)", program_version, version);
+        exit(-1);
+    }
+
+    allocateBuffers();
+
+    /* Get the transport used by the program */
+    int transport = TRANSPORT_SOCKET;
+    recv(socket_fd, &transport, sizeof(int), MSG_WAITALL);
+#ifdef __linux__
+    if (transport == TRANSPORT_SHARED_MEMORY)
+        initSharedMemoryGame();
+#endif
+
     return true;
 }
 
@@ -164,10 +402,163 @@ void closeSocket(void)
 {
 #ifdef LIBTAS_LIBRARY
     GlobalNative gn;
+#endif
+    if (buffers) {
+        flushSocket();
+        munmap(reinterpret_cast<char*>(buffers) - 4096, buffers_size + (2 * 4096));
+        buffers = nullptr;
+    }
+#ifdef __linux__
+    if (rings) {
+        /* Wake up the other side if it is waiting on us */
+        for (int r = 0; r < 2; r++) {
+            rings[r].closed.store(1);
+            rings[r].write_seq.fetch_add(1);
+            rings[r].read_seq.fetch_add(1);
+            syscall(SYS_futex, &rings[r].write_seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+            syscall(SYS_futex, &rings[r].read_seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+        munmap(rings, 2 * sizeof(SocketRing));
+        rings = send_ring = recv_ring = nullptr;
+    }
 #endif
     close(socket_fd);
 }
 
+bool isSocketMemory(const void* addr, size_t size)
+{
+    if (buffers && (addr == buffers) && (size == buffers_size))
+        return true;
+    return rings && (addr == rings) && (size == 2 * sizeof(SocketRing));
+}
+
+#ifdef __linux__
+/* Returns if the other side closed the connection */
+static bool ringClosed()
+{
+#ifdef LIBTAS_LIBRARY
+    GlobalNative gn;
+#endif
+
+    if (recv_ring->closed.load())
+        return true;
+
+    /* The socket is still connected and tells us if the other process died */
+    struct pollfd pfd = { socket_fd, POLLRDHUP, 0 };
+    int ret = poll(&pfd, 1, 0);
+    return (ret > 0) && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+/* Wait until the sequence number `seq` is different from `val`, by first
+ * spinning then sleeping on the futex. `ready` checks if the wait is over.
+ * Returns false if the other side closed the connection. */
+template<typename F>
+static bool ringWait(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting, F ready)
+{
+    for (int i = 0; i < RING_SPIN_COUNT; i++) {
+        if (ready())
+            return true;
+    }
+
+    while (true) {
+        uint32_t val = seq.load();
+        waiting.store(1);
+        if (ready()) {
+            waiting.store(0);
+            return true;
+        }
+
+        /* Wake up regularly to check if the other side is still there */
+        struct timespec timeout = {0, 100L*1000L*1000L};
+        syscall(SYS_futex, &seq, FUTEX_WAIT, val, &timeout, nullptr, 0);
+        waiting.store(0);
+
+        if (ready())
+            return true;
+        if (ringClosed())
+            return false;
+    }
+}
+
+static int ringSend(const void* elem, unsigned int size)
+{
+    const char* src = static_cast<const char*>(elem);
+    unsigned int remaining = size;
+    uint64_t w = send_ring->write_pos.load(std::memory_order_relaxed);
+
+    while (remaining > 0) {
+        uint64_t r = send_ring->read_pos.load(std::memory_order_acquire);
+        uint64_t space = RING_SIZE - (w - r);
+        if (space == 0) {
+            if (!ringWait(send_ring->read_seq, send_ring->writer_waiting, [w]() {
+                return send_ring->read_pos.load(std::memory_order_acquire) != (w - RING_SIZE);
+            }))
+                return -1;
+            continue;
+        }
+
+        uint64_t offset = w & (RING_SIZE - 1);
+        unsigned int chunk = remaining;
+        if (chunk > space)
+            chunk = space;
+        if (chunk > (RING_SIZE - offset))
+            chunk = RING_SIZE - offset;
+
+        memcpy(&send_ring->data[offset], src, chunk);
+        w += chunk;
+        src += chunk;
+        remaining -= chunk;
+
+        /* Publish the data and wake up the reader if it is sleeping */
+        send_ring->write_pos.store(w, std::memory_order_release);
+        send_ring->write_seq.fetch_add(1);
+        if (send_ring->reader_waiting.load())
+            syscall(SYS_futex, &send_ring->write_seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    return size;
+}
+
+static int ringReceive(void* elem, unsigned int size)
+{
+    char* dst = static_cast<char*>(elem);
+    unsigned int remaining = size;
+    uint64_t r = recv_ring->read_pos.load(std::memory_order_relaxed);
+
+    while (remaining > 0) {
+        uint64_t w = recv_ring->write_pos.load(std::memory_order_acquire);
+        uint64_t available = w - r;
+        if (available == 0) {
+            if (!ringWait(recv_ring->write_seq, recv_ring->reader_waiting, [r]() {
+                return recv_ring->write_pos.load(std::memory_order_acquire) != r;
+            }))
+                return 0;
+            continue;
+        }
+
+        uint64_t offset = r & (RING_SIZE - 1);
+        unsigned int chunk = remaining;
+        if (chunk > available)
+            chunk = available;
+        if (chunk > (RING_SIZE - offset))
+            chunk = RING_SIZE - offset;
+
+        memcpy(dst, &recv_ring->data[offset], chunk);
+        r += chunk;
+        dst += chunk;
+        remaining -= chunk;
+
+        /* Release the space and wake up the writer if it is sleeping */
+        recv_ring->read_pos.store(r, std::memory_order_release);
+        recv_ring->read_seq.fetch_add(1);
+        if (recv_ring->writer_waiting.load())
+            syscall(SYS_futex, &recv_ring->read_seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    return size;
+}
+#endif
+
 void lockSocket(void)
 {
     mutex.lock();
@@ -178,10 +569,21 @@ void unlockSocket(void)
     mutex.unlock();
 }
 
-int sendData(const void* elem, unsigned int size)
+/* Send data directly over the transport */
+static int rawSend(const void* elem, unsigned int size)
 {
+#ifdef __linux__
+    if (send_ring) {
+        int ret = ringSend(elem, size);
+        if (ret == -1) {
 #ifdef LIBTAS_LIBRARY
-    LOG(LL_DEBUG, LCF_SOCKET, "Send socket data of size %u", size);
+            LOG(LL_ERROR, LCF_SOCKET, "Could not send data, connection closed");
+#else
+            std::cerr << "Could not send data, connection closed" << std::endl;
+#endif
+        }
+        return ret;
+    }
 #endif
 
     ssize_t ret = 0;
@@ -207,12 +609,115 @@ int sendData(const void* elem, unsigned int size)
     return ret;
 }
 
+/* Receive data directly from the socket, with the given recv() flags */
+static int rawReceive(void* elem, unsigned int size, int flags)
+{
+    ssize_t ret = 0;
+    do {
+        ret = recv(socket_fd, elem, size, flags);
+    } while ((ret == -1) && (errno == EINTR));
+
+    if (ret == -1) {
+        if (errno == EAGAIN)
+            return ret;
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_ERROR, LCF_SOCKET, "recv() returns -1 with error %s", strerror(errno));
+#else
+        std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
+#endif
+    }
+    else if (ret == 0 && size > 0) { // socket has been closed
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_WARN, LCF_SOCKET, "recv() returns 0 -> socket closed");
+#else
+        std::cerr << "recv() returns 0 -> socket closed" << std::endl;
+#endif
+    }
+    else if ((flags & MSG_WAITALL) && (ret != static_cast<ssize_t>(size))) {
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_ERROR, LCF_SOCKET, "recv() %u bytes instead of %u", ret, size);
+#else
+        std::cerr << "recv() " << ret << " bytes instead of " << size << std::endl;
+#endif
+    }
+    return ret;
+}
+
+/* Send the pending data. Must be called with `buffer_mutex` locked. */
+static int flushBuffer()
+{
+    if (buffers->write_len == 0)
+        return 0;
+
+    int ret = rawSend(buffers->write_buf, buffers->write_len);
+    buffers->write_len = 0;
+    if (ret == -1)
+        buffers->write_error = true;
+    return ret;
+}
+
+int flushSocket(void)
+{
+    if (!buffers)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    return flushBuffer();
+}
+
+int sendData(const void* elem, unsigned int size)
+{
+#ifdef LIBTAS_LIBRARY
+    LOG(LL_DEBUG, LCF_SOCKET, "Send socket data of size %u", size);
+#endif
+
+    if (!buffers)
+        return rawSend(elem, size);
+
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+
+    /* Report a failed flush, so that a closed connection is still detected */
+    if (buffers->write_error)
+        return -1;
+
+    if ((buffers->write_len + size) > BUFFER_SIZE) {
+        if (flushBuffer() == -1)
+            return -1;
+    }
+
+    /* Large data is sent directly */
+    if (size >= BUFFER_SIZE)
+        return rawSend(elem, size);
+
+    memcpy(&buffers->write_buf[buffers->write_len], elem, size);
+    buffers->write_len += size;
+    return size;
+}
+
 int sendMessage(int message)
 {
 #ifdef LIBTAS_LIBRARY
     LOG(LL_DEBUG, LCF_SOCKET, "Send socket message %d", message);
 #endif
-    return sendData(&message, sizeof(int));
+    int ret = sendData(&message, sizeof(int));
+    if (ret == -1)
+        return ret;
+
+    /* These messages end a group of messages, after which the other side
+     * starts processing them, so we send everything */
+    switch (message) {
+        case MSGN_START_FRAMEBOUNDARY:
+        case MSGN_END_FRAMEBOUNDARY:
+        case MSGN_EXPOSE:
+        case MSGB_START_FRAMEBOUNDARY:
+        case MSGB_QUIT:
+            if (flushSocket() == -1)
+                return -1;
+            break;
+        default:
+            break;
+    }
+    return ret;
 }
 
 void sendString(const std::string& str)
@@ -232,33 +737,60 @@ int receiveData(void* elem, unsigned int size)
     LOG(LL_DEBUG, LCF_SOCKET, "Receive socket data of size %u", size);
 #endif
 
-    ssize_t ret = 0;
-    do {
-        ret = recv(socket_fd, elem, size, MSG_WAITALL);
-    } while ((ret == -1) && (errno == EINTR));
+    /* The other side may be waiting for our pending data before sending
+     * anything, so we must send it before blocking */
+    flushSocket();
 
-    if (ret == -1) {
+#ifdef __linux__
+    if (recv_ring) {
+        int ret = ringReceive(elem, size);
+        if (ret == 0 && size > 0) {
 #ifdef LIBTAS_LIBRARY
-        LOG(LL_ERROR, LCF_SOCKET, "recv() returns -1 with error %s", strerror(errno));
+            LOG(LL_WARN, LCF_SOCKET, "Shared memory closed");
 #else
-        std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
+            std::cerr << "Shared memory closed" << std::endl;
 #endif
+        }
+        return ret;
     }
-    else if (ret == 0 && size > 0) { // socket has been closed
-#ifdef LIBTAS_LIBRARY
-        LOG(LL_WARN, LCF_SOCKET, "recv() returns 0 -> socket closed");
-#else
-        std::cerr << "recv() returns 0 -> socket closed" << std::endl;
 #endif
+
+    if (!buffers)
+        return rawReceive(elem, size, MSG_WAITALL);
+
+    /* Take what is available in the buffer first */
+    char* dst = static_cast<char*>(elem);
+    unsigned int available = buffers->read_len - buffers->read_pos;
+    unsigned int chunk = (available < size) ? available : size;
+    memcpy(dst, &buffers->read_buf[buffers->read_pos], chunk);
+    buffers->read_pos += chunk;
+    if (chunk == size)
+        return size;
+
+    dst += chunk;
+    unsigned int remaining = size - chunk;
+
+    /* Large data is received directly */
+    if (remaining >= BUFFER_SIZE) {
+        int ret = rawReceive(dst, remaining, MSG_WAITALL);
+        if (ret <= 0)
+            return ret;
+        return chunk + ret;
     }
-    else if (ret != static_cast<ssize_t>(size)) {
-#ifdef LIBTAS_LIBRARY
-        LOG(LL_ERROR, LCF_SOCKET, "recv() %u bytes instead of %u", ret, size);
-#else
-        std::cerr << "recv() " << ret << " bytes instead of " << size << std::endl;
-#endif
+
+    /* Fill the buffer with everything available, until we have enough */
+    buffers->read_pos = 0;
+    buffers->read_len = 0;
+    while (buffers->read_len < remaining) {
+        int ret = rawReceive(&buffers->read_buf[buffers->read_len], BUFFER_SIZE - buffers->read_len, 0);
+        if (ret <= 0)
+            return ret;
+        buffers->read_len += ret;
     }
-    return ret;
+
+    memcpy(dst, buffers->read_buf, remaining);
+    buffers->read_pos = remaining;
+    return size;
 }
 
 int receiveMessage()
@@ -280,6 +812,48 @@ int receiveMessage()
 int receiveMessageNonBlocking()
 {
     int msg;
+
+    flushSocket();
+
+#ifdef __linux__
+    if (recv_ring) {
+        uint64_t available = recv_ring->write_pos.load(std::memory_order_acquire) -
+            recv_ring->read_pos.load(std::memory_order_relaxed);
+        if (available < sizeof(int))
+            return ringClosed() ? -2 : -1;
+        ringReceive(&msg, sizeof(int));
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_DEBUG, LCF_SOCKET, "Receive non-blocking socket message %d", msg);
+#endif
+        return msg;
+    }
+#endif
+
+    if (buffers) {
+        if ((buffers->read_len - buffers->read_pos) < sizeof(int)) {
+            /* Move the partial data at the beginning and get what is available */
+            unsigned int available = buffers->read_len - buffers->read_pos;
+            memmove(buffers->read_buf, &buffers->read_buf[buffers->read_pos], available);
+            buffers->read_pos = 0;
+            buffers->read_len = available;
+
+            int ret = rawReceive(&buffers->read_buf[available], BUFFER_SIZE - available, MSG_DONTWAIT);
+            if (ret == 0)
+                return -2;
+            if (ret > 0)
+                buffers->read_len += ret;
+            if (buffers->read_len < sizeof(int))
+                return -1;
+        }
+
+        memcpy(&msg, &buffers->read_buf[buffers->read_pos], sizeof(int));
+        buffers->read_pos += sizeof(int);
+#ifdef LIBTAS_LIBRARY
+        LOG(LL_DEBUG, LCF_SOCKET, "Receive non-blocking socket message %d", msg);
+#endif
+        return msg;
+    }
+
     int ret = recv(socket_fd, &msg, sizeof(int), MSG_WAITALL | MSG_DONTWAIT);
     if (ret < 0)
         return ret;
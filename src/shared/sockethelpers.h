@@ -28,8 +28,10 @@
 int removeSocket();
 
 #ifndef LIBTAS_LIBRARY
-/* Initiate a socket connection with the game */
-bool initSocketProgram(pid_t fork_pid);
+/* Initiate a socket connection with the game. If `shared_memory` is set,
+ * data is then exchanged through ring buffers in shared memory instead of the
+ * socket, when available. */
+bool initSocketProgram(pid_t fork_pid, bool shared_memory = false);
 #else
 /* Initiate a socket connection with libTAS */
 bool initSocketGame(void);
@@ -38,6 +40,13 @@ bool initSocketGame(void);
 /* Close the socket connection */
 void closeSocket(void);
 
+/* Returns if the memory segment holds the buffers or the shared memory of
+ * the socket */
+bool isSocketMemory(const void* addr, size_t size);
+
+/* Send all data that was batched */
+int flushSocket(void);
+
 /* Lock access to socket */
 void lockSocket(void);
 
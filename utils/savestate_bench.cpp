@@ -0,0 +1,513 @@
+/* This code benchmarks savestates outside of a real game. It launches a game
+ * (typically `savestate_workload`) with libtas.so preloaded, speaks the same
+ * socket protocol as the libTAS program, and performs repeated save/load
+ * cycles on a single slot. It then reports latency percentiles and sizes of
+ * savestates, as well as the average duration of each phase.
+ *
+ * Usage: savestate_bench [options] /path/to/libtas.so /path/to/game [game args...]
+ *   -n cycles     Number of measured save/load cycles (default 20)
+ *   -w frames     Number of frames to advance before the first cycle (default 10)
+ *   -a frames     Number of frames to advance between a save and a load (default 1)
+ *   -s settings   Comma-separated savestate settings among incremental, ram,
+ *                 compressed, present, fork, dedup and lazy (default compressed,present)
+ *   -c codec      Compression codec, lz4 or zstd (default lz4)
+ *   -l level      Compression level (default 1)
+ *   -t tracking   Memory write tracking of incremental savestates, soft or uffd (default soft)
+ *   -d dir        Directory of savestate files (default /tmp/savestate_bench)
+ *   -o file       Write all samples in a CSV file
+ *   -m            Communicate with the game through shared memory
+ *
+ * Example:
+ *   savestate_bench -n 50 -s incremental,compressed,present ../build64/libtas.so \
+ *       ./savestate_workload dense:512 sparse:2048 file:64 reserve:262144
+ *
+ * Compile with `g++ -std=c++17 -I../src savestate_bench.cpp ../src/shared/sockethelpers.cpp -o savestate_bench`
+ */
+
+#include "shared/sockethelpers.h"
+#include "shared/messages.h"
+#include "shared/SharedConfig.h"
+#include "shared/SaveStateMetrics.h"
+#include "shared/GameInfo.h"
+#include "shared/inputs/MiscInputs.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static const char* phase_names[SaveStateMetrics::PHASE_COUNT] = {
+    "suspend", "maps", "pagemap", "compress", "decompress", "io",
+    "savefiles", "remap", "resume", "total"};
+
+struct Sample {
+    double latency_ms;
+    uint64_t size;
+    SaveStateMetrics metrics;
+};
+
+static SharedConfig config;
+static std::string savestate_prefix;
+static pid_t game_pid = 0;
+static uint64_t framecount = 0;
+static bool shared_memory = false;
+
+static void usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [-n cycles] [-w frames] [-a frames] [-s settings] [-c codec] [-l level] [-t tracking] [-d dir] [-o file] [-m] /path/to/libtas.so /path/to/game [game args...]" << std::endl;
+    exit(1);
+}
+
+static int parseSettings(const std::string& str)
+{
+    int settings = 0;
+    std::istringstream iss(str);
+    std::string setting;
+    while (std::getline(iss, setting, ',')) {
+        if (setting == "incremental") settings |= SharedConfig::SS_INCREMENTAL;
+        else if (setting == "ram") settings |= SharedConfig::SS_RAM;
+        else if (setting == "compressed") settings |= SharedConfig::SS_COMPRESSED;
+        else if (setting == "present") settings |= SharedConfig::SS_PRESENT;
+        else if (setting == "fork") settings |= SharedConfig::SS_FORK;
+        else if (setting == "dedup") settings |= SharedConfig::SS_DEDUP;
+        else if (setting == "lazy") settings |= SharedConfig::SS_LAZY;
+        else {
+            std::cerr << "Unknown savestate setting " << setting << std::endl;
+            exit(1);
+        }
+    }
+    return settings;
+}
+
+static void receiveFrameCountTime()
+{
+    uint64_t values[4];
+    receiveData(&framecount, sizeof(uint64_t));
+    receiveData(values, sizeof(values));
+}
+
+static bool initMessages()
+{
+    if (!initSocketProgram(game_pid, shared_memory))
+        return false;
+
+    int message = receiveMessage();
+    while (message != MSGB_END_INIT) {
+        switch (message) {
+            case MSGB_PID_ARCH: {
+                pid_t pid;
+                int addr_size;
+                receiveData(&pid, sizeof(pid_t));
+                receiveData(&addr_size, sizeof(int));
+                break;
+            }
+            case MSGB_GIT_COMMIT:
+                receiveString();
+                break;
+            default:
+                std::cerr << "Unknown init message " << message << std::endl;
+                return false;
+        }
+        message = receiveMessage();
+    }
+
+    sendMessage(MSGN_CONFIG_SIZE);
+    int config_size = sizeof(SharedConfig);
+    sendData(&config_size, sizeof(int));
+
+    sendMessage(MSGN_CONFIG);
+    sendData(&config, sizeof(SharedConfig));
+
+    sendMessage(MSGN_INITIAL_FRAMECOUNT_TIME);
+    int64_t zero = 0;
+    sendData(&framecount, sizeof(uint64_t));
+    sendData(&zero, sizeof(int64_t));
+    sendData(&zero, sizeof(int64_t));
+
+    if (config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
+        sendMessage(MSGN_BASE_SAVESTATE_INDEX);
+        int index = 0;
+        sendData(&index, sizeof(int));
+        sendMessage(MSGN_BASE_SAVESTATE_PATH);
+        sendString(savestate_prefix + "0");
+    }
+
+    sendMessage(MSGN_ENCODING_SEGMENT);
+    int encoding_segment = 0;
+    sendData(&encoding_segment, sizeof(int));
+
+    sendMessage(MSGN_END_INIT);
+    return true;
+}
+
+/* Process messages until the game reaches a frame boundary. Returns false if
+ * the game has quit. */
+static bool startFrame()
+{
+    int message = receiveMessage();
+    while (message != MSGB_START_FRAMEBOUNDARY) {
+        switch (message) {
+            case MSGB_WINDOW_ID: {
+                uint32_t window;
+                receiveData(&window, sizeof(uint32_t));
+                break;
+            }
+            case MSGB_ALERT_MSG:
+                std::cerr << "Alert: " << receiveString() << std::endl;
+                break;
+            case MSGB_ENCODE_FAILED:
+                break;
+            case MSGB_FRAMECOUNT_TIME:
+                receiveFrameCountTime();
+                break;
+            case MSGB_GAMEINFO: {
+                GameInfo game_info;
+                receiveData(&game_info, sizeof(GameInfo));
+                break;
+            }
+            case MSGB_FPS: {
+                float fps[2];
+                receiveData(fps, sizeof(fps));
+                break;
+            }
+            case MSGB_ENCODING_SEGMENT: {
+                int segment;
+                receiveData(&segment, sizeof(int));
+                break;
+            }
+            case MSGB_GETTIME_BACKTRACE: {
+                int type;
+                uint64_t hash;
+                receiveData(&type, sizeof(int));
+                receiveData(&hash, sizeof(uint64_t));
+                receiveString();
+                break;
+            }
+            case MSGB_NONDRAW_FRAME:
+            case MSGB_SKIPDRAW_FRAME:
+                break;
+            case MSGB_SYMBOL_ADDRESS: {
+                receiveString();
+                uint64_t addr = 0;
+                sendData(&addr, sizeof(uint64_t));
+                break;
+            }
+            case MSGB_QUIT:
+                return false;
+            default:
+                std::cerr << "Got unknown message " << message << std::endl;
+                return false;
+        }
+        message = receiveMessage();
+    }
+
+    sendMessage(MSGN_START_FRAMEBOUNDARY);
+    return true;
+}
+
+static void endFrame(bool quit)
+{
+    /* Send empty inputs */
+    sendMessage(MSGN_ALL_INPUTS);
+    uint32_t keyboard[16] = {};
+    sendData(keyboard, sizeof(keyboard));
+
+    MiscInputs misc;
+    misc.flags = 0;
+    misc.framerate_num = 0;
+    misc.framerate_den = 0;
+    misc.realtime_sec = 0;
+    misc.realtime_nsec = 0;
+    sendMessage(MSGN_MISC_INPUTS);
+    sendData(&misc, sizeof(MiscInputs));
+    sendMessage(MSGN_END_INPUTS);
+
+    if (quit)
+        sendMessage(MSGN_USERQUIT);
+
+    sendMessage(MSGN_END_FRAMEBOUNDARY);
+}
+
+static void receiveMetrics(SaveStateMetrics& metrics)
+{
+    receiveData(&metrics, offsetof(SaveStateMetrics, areas));
+    receiveData(metrics.areas, metrics.area_count * sizeof(SaveStateMetrics::AreaMetrics));
+}
+
+static void sendSlot(int slot)
+{
+    sendMessage(MSGN_SAVESTATE_INDEX);
+    sendData(&slot, sizeof(int));
+    sendMessage(MSGN_SAVESTATE_PATH);
+    sendString(savestate_prefix + std::to_string(slot));
+}
+
+static bool save(int slot, Sample& sample)
+{
+    sendSlot(slot);
+
+    auto start = std::chrono::steady_clock::now();
+    sendMessage(MSGN_SAVESTATE);
+
+    int message = receiveMessage();
+    if (message == MSGB_SAVESTATE_SIZE) {
+        int size_slot;
+        uint64_t sizes[3];
+        receiveData(&size_slot, sizeof(int));
+        receiveData(sizes, sizeof(sizes));
+        message = receiveMessage();
+    }
+
+    if (message != MSGB_SAVING_SUCCEEDED) {
+        std::cerr << "Saving state " << slot << " failed" << std::endl;
+        return false;
+    }
+
+    receiveMetrics(sample.metrics);
+    auto end = std::chrono::steady_clock::now();
+
+    sample.latency_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    sample.size = sample.metrics.size;
+    return true;
+}
+
+static bool load(int slot, Sample& sample)
+{
+    sendSlot(slot);
+
+    auto start = std::chrono::steady_clock::now();
+    sendMessage(MSGN_LOADSTATE);
+
+    int message = receiveMessage();
+    bool didLoad = (message == MSGB_LOADING_SUCCEEDED);
+    if (didLoad) {
+        receiveMetrics(sample.metrics);
+
+        /* The game shared config was overwritten by the loading */
+        sendMessage(MSGN_CONFIG);
+        sendData(&config, sizeof(SharedConfig));
+        message = receiveMessage();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (message != MSGB_FRAMECOUNT_TIME) {
+        std::cerr << "Got wrong message after state loading" << std::endl;
+        return false;
+    }
+    receiveFrameCountTime();
+
+    if (!didLoad) {
+        std::cerr << "Loading state " << slot << " failed" << std::endl;
+        return false;
+    }
+
+    sample.latency_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    sample.size = sample.metrics.size;
+    return true;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+static void report(const char* name, const std::vector<Sample>& samples)
+{
+    if (samples.empty())
+        return;
+
+    std::vector<double> latencies;
+    uint64_t total_size = 0;
+    double phases[SaveStateMetrics::PHASE_COUNT] = {};
+    for (const Sample& s : samples) {
+        latencies.push_back(s.latency_ms);
+        total_size += s.size;
+        for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+            phases[p] += s.metrics.phase_ns[p] / 1000000.0;
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << name << ": " << samples.size() << " samples" << std::endl;
+    std::cout << "  latency (ms): min " << percentile(latencies, 0) <<
+        ", p50 " << percentile(latencies, 0.5) <<
+        ", p90 " << percentile(latencies, 0.9) <<
+        ", p99 " << percentile(latencies, 0.99) <<
+        ", max " << percentile(latencies, 1) << std::endl;
+    std::cout << "  size: " << (total_size / samples.size()) / 1024 << " KB on average, " <<
+        total_size / (1024 * 1024) << " MB in total" << std::endl;
+    std::cout << "  average phase (ms):";
+    for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+        std::cout << " " << phase_names[p] << " " << phases[p] / samples.size();
+    std::cout << std::endl;
+}
+
+static void writeCSV(const std::string& file, const std::vector<Sample>& saves, const std::vector<Sample>& loads)
+{
+    std::ofstream csv(file);
+    csv << "operation,cycle,latency_ms,size";
+    for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+        csv << "," << phase_names[p] << "_ns";
+    csv << std::endl;
+
+    for (int l = 0; l < 2; l++) {
+        const std::vector<Sample>& samples = l ? loads : saves;
+        for (size_t i = 0; i < samples.size(); i++) {
+            csv << (l ? "load" : "save") << "," << i << "," << samples[i].latency_ms << "," << samples[i].size;
+            for (int p = 0; p < SaveStateMetrics::PHASE_COUNT; p++)
+                csv << "," << samples[i].metrics.phase_ns[p];
+            csv << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int cycles = 20;
+    int warmup = 10;
+    int advance = 1;
+    std::string dir = "/tmp/savestate_bench";
+    std::string csvfile;
+
+    config.savestate_settings = SharedConfig::SS_COMPRESSED | SharedConfig::SS_PRESENT;
+    config.logging_level = LL_WARN;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:w:a:s:c:l:t:d:o:m")) != -1) {
+        switch (opt) {
+            case 'n':
+                cycles = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'a':
+                advance = atoi(optarg);
+                break;
+            case 's':
+                config.savestate_settings = parseSettings(optarg);
+                break;
+            case 'c':
+                config.savestate_codec = (strcmp(optarg, "zstd") == 0) ? SharedConfig::SS_CODEC_ZSTD : SharedConfig::SS_CODEC_LZ4;
+                break;
+            case 'l':
+                config.savestate_codec_level = atoi(optarg);
+                break;
+            case 't':
+                config.savestate_dirty_tracking = (strcmp(optarg, "uffd") == 0) ? SharedConfig::DIRTY_UFFD_WP : SharedConfig::DIRTY_SOFT;
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'o':
+                csvfile = optarg;
+                break;
+            case 'm':
+                shared_memory = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if ((argc - optind < 2) || (cycles < 1) || (advance < 1))
+        usage(argv[0]);
+
+    std::string libtaspath = argv[optind];
+    char** game_argv = &argv[optind+1];
+
+    mkdir(dir.c_str(), 0700);
+    savestate_prefix = dir + "/bench.state";
+
+    removeSocket();
+
+    game_pid = fork();
+    if (game_pid == 0) {
+        setenv("LD_PRELOAD", libtaspath.c_str(), 1);
+        setenv("LIBTAS_LIBRARY_PATH", libtaspath.c_str(), 1);
+        setenv("TZ", "UTC0", 1);
+        execv(game_argv[0], game_argv);
+        std::cerr << "Could not execute " << game_argv[0] << std::endl;
+        _exit(1);
+    }
+
+    if (!initMessages()) {
+        kill(game_pid, SIGKILL);
+        return 1;
+    }
+
+    std::vector<Sample> saves, loads;
+    const int slot = 1;
+
+    /* Each cycle saves the state, advances `advance` frames and loads it back.
+     * The first cycle is not measured, because it also saves the base state
+     * for incremental savestates and initializes memory pools. */
+    bool ok = true;
+    for (int frame = 0; ok; frame++) {
+        if (!startFrame()) {
+            ok = false;
+            break;
+        }
+
+        int cycle_frame = frame - warmup;
+        int cycle = (cycle_frame >= 0) ? (cycle_frame / (advance + 1)) : -1;
+        if (cycle > cycles)
+            break;
+
+        if (cycle >= 0) {
+            int step = cycle_frame % (advance + 1);
+            Sample sample;
+            if (step == 0) {
+                ok = save(slot, sample);
+                if (ok && cycle > 0)
+                    saves.push_back(sample);
+            }
+            else if (step == advance) {
+                ok = load(slot, sample);
+                if (ok && cycle > 0)
+                    loads.push_back(sample);
+            }
+        }
+
+        if (ok)
+            endFrame(false);
+    }
+
+    if (ok)
+        endFrame(true);
+    closeSocket();
+
+    /* Give some time to the game to quit */
+    for (int i = 0; i < 50; i++) {
+        if (waitpid(game_pid, nullptr, WNOHANG) == game_pid) {
+            game_pid = 0;
+            break;
+        }
+        usleep(100000);
+    }
+    if (game_pid)
+        kill(game_pid, SIGKILL);
+
+    report("Save", saves);
+    report("Load", loads);
+
+    if (!csvfile.empty())
+        writeCSV(csvfile, saves, loads);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/* This code allocates configurable memory layouts and writes into them every
+ * frame, so that savestates can be benchmarked on a known workload. It is
+ * meant to be driven by `savestate_bench`, but it can also be run inside
+ * libTAS directly.
+ *
+ * Each argument describes one mapping as `type:size_in_MB`, with type being:
+ * - dense:   private anonymous mapping, fully filled with random data
+ * - sparse:  private anonymous mapping, with one page out of 16 filled
+ * - zero:    private anonymous mapping, fully touched but left with zeros
+ * - file:    private mapping of a temporary file, with one page out of 4 modified
+ * - shared:  shared anonymous mapping, fully filled with random data
+ * - memfd:   shared mapping of a memfd file, fully filled with random data
+ * - reserve: huge private anonymous mapping that is never touched, like
+ *            the 274 GB reservation that Celeste64 does
+ * and optionally `write:pages` to set how many pages are written on each
+ * frame in the dense and sparse mappings (default 64), e.g.:
+ *
+ *     savestate_workload dense:512 sparse:2048 file:64 reserve:262144 write:256
+ *
+ * Compile with `gcc savestate_workload.c -lSDL2 -o savestate_workload`
+ */
+
+#define _GNU_SOURCE
+#include <SDL2/SDL.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define PAGE_SIZE 4096
+#define MAX_MAPPINGS 64
+
+struct mapping {
+    char* addr;
+    size_t size;
+    size_t stride; /* Pages written every frame are taken one every `stride` pages */
+    size_t next;
+};
+
+static struct mapping mappings[MAX_MAPPINGS];
+static int mapping_nb = 0;
+
+static void fill_random(char* addr, size_t size, size_t stride)
+{
+    for (size_t p = 0; p < size; p += stride * PAGE_SIZE) {
+        int* array = (int*)(addr + p);
+        for (size_t j = 0; j < PAGE_SIZE / sizeof(int); j += 2)
+            array[j] = rand();
+    }
+}
+
+static char* map_file(size_t size, int shared, int memfd)
+{
+    int fd;
+    if (memfd) {
+        fd = memfd_create("savestate_workload", 0);
+    }
+    else {
+        char path[] = "/tmp/savestate_workloadXXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0)
+            unlink(path);
+    }
+
+    if (fd < 0) {
+        perror("Could not create file");
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        perror("Could not resize file");
+        close(fd);
+        return NULL;
+    }
+
+    /* Give some content to the file, so that its pages are backed */
+    if (!memfd) {
+        char* page = malloc(PAGE_SIZE);
+        for (size_t p = 0; p < size; p += PAGE_SIZE) {
+            memset(page, (int)(p / PAGE_SIZE), PAGE_SIZE);
+            if (write(fd, page, PAGE_SIZE) != PAGE_SIZE)
+                break;
+        }
+        free(page);
+    }
+
+    char* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+    return addr;
+}
+
+static int add_mapping(const char* type, size_t size_mb)
+{
+    if (mapping_nb >= MAX_MAPPINGS) {
+        fprintf(stderr, "Too many mappings\n");
+        return -1;
+    }
+
+    size_t size = size_mb * 1024 * 1024;
+    char* addr = NULL;
+    size_t stride = 0;
+
+    if (strcmp(type, "dense") == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+            fill_random(addr, size, 1);
+        stride = 1;
+    }
+    else if (strcmp(type, "sparse") == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+            fill_random(addr, size, 16);
+        stride = 16;
+    }
+    else if (strcmp(type, "zero") == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+            memset(addr, 0, size);
+    }
+    else if (strcmp(type, "file") == 0) {
+        addr = map_file(size, 0, 0);
+        if (addr)
+            fill_random(addr, size, 4);
+    }
+    else if (strcmp(type, "shared") == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+            fill_random(addr, size, 1);
+    }
+    else if (strcmp(type, "memfd") == 0) {
+        addr = map_file(size, 1, 1);
+        if (addr)
+            fill_random(addr, size, 1);
+    }
+    else if (strcmp(type, "reserve") == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    else {
+        fprintf(stderr, "Unknown mapping type %s\n", type);
+        return -1;
+    }
+
+    if (!addr || (addr == MAP_FAILED)) {
+        fprintf(stderr, "Could not map %zu MB of type %s\n", size_mb, type);
+        return -1;
+    }
+
+    printf("Mapped %zu MB of type %s at %p\n", size_mb, type, addr);
+
+    mappings[mapping_nb].addr = addr;
+    mappings[mapping_nb].size = size;
+    mappings[mapping_nb].stride = stride;
+    mappings[mapping_nb].next = 0;
+    mapping_nb++;
+    return 0;
+}
+
+/* Write `pages` pages into each dense or sparse mapping, continuing from the
+ * last written page, so that incremental savestates have new dirty pages */
+static void write_pages(size_t pages)
+{
+    for (int i = 0; i < mapping_nb; i++) {
+        struct mapping* m = &mappings[i];
+        if (!m->stride)
+            continue;
+
+        for (size_t p = 0; p < pages; p++) {
+            int* array = (int*)(m->addr + m->next);
+            array[rand() % (PAGE_SIZE / sizeof(int))] = rand();
+            m->next += m->stride * PAGE_SIZE;
+            if (m->next >= m->size)
+                m->next = 0;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t write_nb = 64;
+
+    srand(0);
+    for (int i = 1; i < argc; i++) {
+        char type[16];
+        size_t value;
+        if (sscanf(argv[i], "%15[a-z]:%zu", type, &value) != 2) {
+            fprintf(stderr, "Could not parse argument %s\n", argv[i]);
+            return 1;
+        }
+
+        if (strcmp(type, "write") == 0)
+            write_nb = value;
+        else if (add_mapping(type, value) < 0)
+            return 1;
+    }
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_Window* window = SDL_CreateWindow("Title",SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED,
+            640,
+            480,
+            SDL_WINDOW_SHOWN);
+
+    SDL_Renderer *renderer = SDL_CreateRenderer(window,-1,SDL_RENDERER_SOFTWARE | SDL_RENDERER_PRESENTVSYNC);
+
+    int run = 1;
+    while (run) {
+        write_pages(write_nb);
+
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        SDL_RenderPresent(renderer);
+
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT)
+                run = 0;
+        }
+    }
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+
+    SDL_Quit();
+    return 0;
+}